@@ -0,0 +1,350 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+  gcc -Wall hello_tree_bench.c -o hello_tree_bench -lpthread
+*/
+
+/*
+ * Measures how many lookups, getattrs, directory listings and open-close
+ * pairs a second a file system can do, over a tree shaped like the one
+ * hello_tree_ll makes: directories in the root, and files in those.
+ *
+ *   hello_tree_bench [-t threads,...] [-r rounds] [-T timeouts,... -s cmd]
+ *                    mountpoint
+ *
+ * Each phase goes over the whole tree rounds times, shared out among the
+ * threads; a round after the first shows what the kernel's caches save.
+ * With -s, the file system is mounted once for every timeout in -T, by
+ * running "cmd -o entry_timeout=T,attr_timeout=T mountpoint", which must
+ * put itself in the background; otherwise it's expected to be mounted
+ * already, with whatever timeouts it has, and can be anything laid out the
+ * same way (unixfs or loopback over a copy of the tree, say).
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define MAX_THREADS 256
+
+static const char *mountpoint;
+static unsigned ndirs, nfiles;
+static unsigned rounds = 3;
+static unsigned nthreads;
+
+struct phase {
+	const char *name;
+	unsigned long (*run)(unsigned self);	/* returns operations done */
+};
+
+static unsigned long lookup_phase(unsigned self);
+static unsigned long getattr_phase(unsigned self);
+static unsigned long readdir_phase(unsigned self);
+static unsigned long open_phase(unsigned self);
+
+static const struct phase phases[] = {
+	{ "lookup",	lookup_phase },
+	{ "getattr",	getattr_phase },
+	{ "readdir",	readdir_phase },
+	{ "open",	open_phase },
+};
+
+#define NPHASES (sizeof(phases) / sizeof(phases[0]))
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void file_path(char *path, size_t size, unsigned long i)
+{
+	snprintf(path, size, "%s/d%lu/f%lu", mountpoint, i / nfiles,
+		 i % nfiles);
+}
+
+/* stat() of every file: a lookup each, unless the entry is cached. */
+static unsigned long lookup_phase(unsigned self)
+{
+	unsigned long i, total = (unsigned long)ndirs * nfiles, ops = 0;
+	char path[1024];
+	struct stat st;
+	unsigned r;
+
+	for (r = 0; r < rounds; r++)
+		for (i = self; i < total; i += nthreads, ops++) {
+			file_path(path, sizeof(path), i);
+			if (stat(path, &st) == -1) {
+				perror(path);
+				exit(1);
+			}
+		}
+	return ops;
+}
+
+/* fstat() of an open file, as many times as there are files. */
+static unsigned long getattr_phase(unsigned self)
+{
+	unsigned long i, total = (unsigned long)ndirs * nfiles, ops = 0;
+	char path[1024];
+	struct stat st;
+	unsigned r;
+	int fd;
+
+	file_path(path, sizeof(path), self % total);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		exit(1);
+	}
+	for (r = 0; r < rounds; r++)
+		for (i = self; i < total; i += nthreads, ops++)
+			if (fstat(fd, &st) == -1) {
+				perror(path);
+				exit(1);
+			}
+	close(fd);
+	return ops;
+}
+
+static unsigned long list(const char *path)
+{
+	unsigned long entries = 0;
+	DIR *dir = opendir(path);
+
+	if (!dir) {
+		perror(path);
+		exit(1);
+	}
+	while (readdir(dir))
+		entries++;
+	closedir(dir);
+	return entries;
+}
+
+/* A complete listing of every directory. */
+static unsigned long readdir_phase(unsigned self)
+{
+	unsigned long ops = 0;
+	char path[1024];
+	unsigned d, r;
+
+	for (r = 0; r < rounds; r++)
+		for (d = self; d < ndirs; d += nthreads, ops++) {
+			snprintf(path, sizeof(path), "%s/d%u", mountpoint, d);
+			list(path);
+		}
+	return ops;
+}
+
+/* open() and close() of every file. */
+static unsigned long open_phase(unsigned self)
+{
+	unsigned long i, total = (unsigned long)ndirs * nfiles, ops = 0;
+	char path[1024];
+	unsigned r;
+	int fd;
+
+	for (r = 0; r < rounds; r++)
+		for (i = self; i < total; i += nthreads, ops++) {
+			file_path(path, sizeof(path), i);
+			fd = open(path, O_RDONLY);
+			if (fd == -1) {
+				perror(path);
+				exit(1);
+			}
+			close(fd);
+		}
+	return ops;
+}
+
+struct worker {
+	pthread_t thread;
+	unsigned self;
+	const struct phase *phase;
+	unsigned long ops;
+};
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+
+	w->ops = w->phase->run(w->self);
+	return NULL;
+}
+
+static double run_phase(const struct phase *phase)
+{
+	struct worker workers[MAX_THREADS];
+	unsigned long ops = 0;
+	double start;
+	unsigned i;
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].self = i;
+		workers[i].phase = phase;
+		errno = pthread_create(&workers[i].thread, NULL, worker_main,
+				       &workers[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+	}
+	return ops / (now() - start);
+}
+
+/* Counts the d<n> in the root, and the f<n> in d0. */
+static int measure_tree(void)
+{
+	char path[1024];
+
+	snprintf(path, sizeof(path), "%s/d0", mountpoint);
+	ndirs = list(mountpoint) - 2;
+	nfiles = list(path) - 2;
+	if (ndirs == 0 || nfiles == 0) {
+		fprintf(stderr, "%s: nothing to measure\n", mountpoint);
+		return -1;
+	}
+	return 0;
+}
+
+static int is_mounted(void)
+{
+	char parent[1024];
+	struct stat a, b;
+
+	snprintf(parent, sizeof(parent), "%s/..", mountpoint);
+	return stat(mountpoint, &a) == 0 && stat(parent, &b) == 0 &&
+	       a.st_dev != b.st_dev;
+}
+
+static int mount_with(const char *cmd, const char *timeout)
+{
+	char line[2048];
+	int i;
+
+	snprintf(line, sizeof(line),
+		 "%s -o entry_timeout=%s,attr_timeout=%s '%s'", cmd, timeout,
+		 timeout, mountpoint);
+	if (system(line) != 0) {
+		fprintf(stderr, "failed: %s\n", line);
+		return -1;
+	}
+	for (i = 0; i < 500 && !is_mounted(); i++)
+		usleep(10000);
+	return is_mounted() ? 0 : -1;
+}
+
+static void unmount(void)
+{
+	char line[1100];
+
+	snprintf(line, sizeof(line), "umount '%s' 2>/dev/null || "
+		 "fusermount -u '%s'", mountpoint, mountpoint);
+	if (system(line) != 0)
+		fprintf(stderr, "%s: could not unmount\n", mountpoint);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: hello_tree_bench [-t threads,...] "
+		"[-r rounds] [-T timeouts,... -s cmd]\n"
+		"                        mountpoint\n");
+	exit(2);
+}
+
+static int bench(const char *threads, const char *timeout)
+{
+	char *list = strdup(threads), *s, *next;
+	unsigned i;
+
+	if (measure_tree() == -1)
+		return -1;
+	printf("%u x %u%s%s\n", ndirs, nfiles, timeout ? ", timeout " : "",
+	       timeout ? timeout : "");
+	printf("%8s", "threads");
+	for (i = 0; i < NPHASES; i++)
+		printf("  %10s/s", phases[i].name);
+	printf("\n");
+
+	for (s = list; s; s = next) {
+		next = strchr(s, ',');
+		if (next)
+			*next++ = '\0';
+		nthreads = strtoul(s, NULL, 0);
+		if (nthreads == 0 || nthreads > MAX_THREADS)
+			usage();
+		printf("%8u", nthreads);
+		for (i = 0; i < NPHASES; i++) {
+			printf("  %12.0f", run_phase(&phases[i]));
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	free(list);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *threads = "1,2,4,8";
+	const char *cmd = NULL;
+	char *timeouts = NULL, *s, *next;
+	int ch, err = 0;
+
+	while ((ch = getopt(argc, argv, "t:r:T:s:")) != -1) {
+		switch (ch) {
+		case 't':
+			threads = optarg;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			timeouts = optarg;
+			break;
+		case 's':
+			cmd = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || rounds == 0 || (!timeouts != !cmd))
+		usage();
+	mountpoint = argv[optind];
+
+	if (!cmd)
+		return bench(threads, NULL) ? 1 : 0;
+
+	for (s = timeouts; s && !err; s = next) {
+		next = strchr(s, ',');
+		if (next)
+			*next++ = '\0';
+		if (mount_with(cmd, s) == -1)
+			return 1;
+		err = bench(threads, s);
+		unmount();
+		if (next)
+			printf("\n");
+	}
+	return err ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+  gcc -Wall `pkg-config fuse --cflags --libs` hello_tree_ll.c -o hello_tree_ll
+*/
+
+/*
+ * hello_ll with a bigger tree: dirs directories, d0 ... dN-1, each with
+ * files files, f0 ... fM-1, that all say hello. Nothing is stored; a name
+ * becomes an inode number, and an inode number its attributes, by a little
+ * arithmetic, so the time spent on a request is very nearly all FUSE's.
+ * That makes it the floor to measure other file systems' overheads against,
+ * with hello_tree_bench. Options:
+ *
+ *   -o dirs=N, -o files=M        the shape of the tree (default 16 x 256)
+ *   -o entry_timeout=T, -o attr_timeout=T  in seconds (default 1.0)
+ *
+ * The inode numbers are 1 for the root, 2 + d for directory d, and
+ * 2 + N + d * M + f for file f in it.
+ */
+
+#define FUSE_USE_VERSION 26
+
+#include <fuse_lowlevel.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+static const char *hello_str = "Hello World!\n";
+
+static struct hello_tree {
+	unsigned dirs;
+	unsigned files;
+	double entry_timeout;
+	double attr_timeout;
+} tree = { 16, 256, 1.0, 1.0 };
+
+#define HELLO_TREE_OPT(t, p) { t, offsetof(struct hello_tree, p), 1 }
+
+static const struct fuse_opt hello_tree_opts[] = {
+	HELLO_TREE_OPT("dirs=%u",		dirs),
+	HELLO_TREE_OPT("files=%u",		files),
+	HELLO_TREE_OPT("entry_timeout=%lf",	entry_timeout),
+	HELLO_TREE_OPT("attr_timeout=%lf",	attr_timeout),
+	FUSE_OPT_END
+};
+
+#define DIR_INO(d)	((fuse_ino_t)2 + (d))
+#define FILE_INO(d, f)	((fuse_ino_t)2 + tree.dirs + \
+			 (fuse_ino_t)(d) * tree.files + (f))
+
+static int is_dir(fuse_ino_t ino)
+{
+	return ino >= 2 && ino < DIR_INO(tree.dirs);
+}
+
+static int is_file(fuse_ino_t ino)
+{
+	return ino >= FILE_INO(0, 0) && ino < FILE_INO(tree.dirs, 0);
+}
+
+static int hello_stat(fuse_ino_t ino, struct stat *stbuf)
+{
+	stbuf->st_ino = ino;
+	if (ino == 1) {
+		stbuf->st_mode = S_IFDIR | 0755;
+		stbuf->st_nlink = 2 + tree.dirs;
+	} else if (is_dir(ino)) {
+		stbuf->st_mode = S_IFDIR | 0755;
+		stbuf->st_nlink = 2;
+	} else if (is_file(ino)) {
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = strlen(hello_str);
+	} else
+		return -1;
+	return 0;
+}
+
+/* "<prefix><n>", with n below limit and written the way readdir does. */
+static int parse_name(const char *name, char prefix, unsigned limit,
+		      unsigned *np)
+{
+	unsigned long n;
+	char *end;
+
+	if (name[0] != prefix || name[1] < '0' || name[1] > '9' ||
+	    (name[1] == '0' && name[2] != '\0'))
+		return -1;
+	errno = 0;
+	n = strtoul(name + 1, &end, 10);
+	if (errno || *end != '\0' || n >= limit)
+		return -1;
+	*np = n;
+	return 0;
+}
+
+static void hello_ll_getattr(fuse_req_t req, fuse_ino_t ino,
+			     struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+
+	(void) fi;
+
+	memset(&stbuf, 0, sizeof(stbuf));
+	if (hello_stat(ino, &stbuf) == -1)
+		fuse_reply_err(req, ENOENT);
+	else
+		fuse_reply_attr(req, &stbuf, tree.attr_timeout);
+}
+
+static void hello_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct fuse_entry_param e;
+	unsigned n;
+
+	memset(&e, 0, sizeof(e));
+	if (parent == 1 && parse_name(name, 'd', tree.dirs, &n) == 0)
+		e.ino = DIR_INO(n);
+	else if (is_dir(parent) &&
+		 parse_name(name, 'f', tree.files, &n) == 0)
+		e.ino = FILE_INO(parent - DIR_INO(0), n);
+	else {
+		fuse_reply_err(req, parent == 1 || is_dir(parent) ?
+			       ENOENT : ENOTDIR);
+		return;
+	}
+
+	e.attr_timeout = tree.attr_timeout;
+	e.entry_timeout = tree.entry_timeout;
+	hello_stat(e.ino, &e.attr);
+
+	fuse_reply_entry(req, &e);
+}
+
+/*
+ * Entry i of a directory has offset i + 1, so that a listing can be picked
+ * up anywhere without anything having been kept from the last request.
+ */
+static void hello_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+			     off_t off, struct fuse_file_info *fi)
+{
+	unsigned long count;
+	size_t used = 0;
+	char *buf;
+
+	(void) fi;
+
+	if (ino == 1)
+		count = 2 + tree.dirs;
+	else if (is_dir(ino))
+		count = 2 + tree.files;
+	else {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	buf = malloc(size);
+	if (!buf) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	for (; off >= 0 && (unsigned long)off < count; off++) {
+		struct stat stbuf;
+		char name[16];
+		size_t len;
+
+		memset(&stbuf, 0, sizeof(stbuf));
+		if (off < 2) {
+			strcpy(name, off ? ".." : ".");
+			stbuf.st_ino = off ? 1 : ino;
+			stbuf.st_mode = S_IFDIR;
+		} else if (ino == 1) {
+			snprintf(name, sizeof(name), "d%lu",
+				 (unsigned long)off - 2);
+			stbuf.st_ino = DIR_INO(off - 2);
+			stbuf.st_mode = S_IFDIR;
+		} else {
+			snprintf(name, sizeof(name), "f%lu",
+				 (unsigned long)off - 2);
+			stbuf.st_ino = FILE_INO(ino - DIR_INO(0), off - 2);
+			stbuf.st_mode = S_IFREG;
+		}
+
+		len = fuse_add_direntry(req, buf + used, size - used, name,
+					&stbuf, off + 1);
+		if (len > size - used)
+			break;
+		used += len;
+	}
+
+	fuse_reply_buf(req, buf, used);
+	free(buf);
+}
+
+static void hello_ll_open(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
+{
+	if (!is_file(ino))
+		fuse_reply_err(req, EISDIR);
+	else if ((fi->flags & 3) != O_RDONLY)
+		fuse_reply_err(req, EACCES);
+	else
+		fuse_reply_open(req, fi);
+}
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+static void hello_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+			  off_t off, struct fuse_file_info *fi)
+{
+	size_t len = strlen(hello_str);
+
+	(void) fi;
+
+	assert(is_file(ino));
+	if (off < len)
+		fuse_reply_buf(req, hello_str + off, min(len - off, size));
+	else
+		fuse_reply_buf(req, NULL, 0);
+}
+
+static struct fuse_lowlevel_ops hello_ll_oper = {
+	.lookup		= hello_ll_lookup,
+	.getattr	= hello_ll_getattr,
+	.readdir	= hello_ll_readdir,
+	.open		= hello_ll_open,
+	.read		= hello_ll_read,
+};
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_chan *ch;
+	char *mountpoint;
+	int multithreaded, foreground;
+	int err = -1;
+
+	if (fuse_opt_parse(&args, &tree, hello_tree_opts, NULL) == -1)
+		return 1;
+
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+			       &foreground) != -1 &&
+	    (ch = fuse_mount(mountpoint, &args)) != NULL) {
+		struct fuse_session *se;
+
+		se = fuse_lowlevel_new(&args, &hello_ll_oper,
+				       sizeof(hello_ll_oper), NULL);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) != -1) {
+				fuse_session_add_chan(se, ch);
+				if (fuse_daemonize(foreground) != -1) {
+					if (multithreaded)
+						err = fuse_session_loop_mt(se);
+					else
+						err = fuse_session_loop(se);
+				}
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+		free(mountpoint);
+	}
+	fuse_opt_free_args(&args);
+
+	return err ? 1 : 0;
+}
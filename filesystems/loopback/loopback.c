@@ -35,6 +35,9 @@
 #include <sys/xattr.h>
 #include <sys/attr.h>
 #include <sys/param.h>
+#include <stddef.h>
+
+#include "loopback_wb.h"
 
 #if defined(_POSIX_C_SOURCE)
 typedef unsigned char  u_char;
@@ -59,6 +62,15 @@ loopback_getattr(const char *path, struct stat *stbuf)
         return -errno;
     }
 
+    /* Writes still in memory may yet change the size and times. */
+    res = loopback_wb_sync(stbuf->st_dev, stbuf->st_ino);
+    if (res > 0) {
+        res = lstat(path, stbuf);
+    }
+    if (res == -1) {
+        return -errno;
+    }
+
     return 0;
 }
 
@@ -70,7 +82,10 @@ loopback_fgetattr(const char *path, struct stat *stbuf,
 
     (void)path;
 
-    res = fstat(fi->fh, stbuf);
+    res = loopback_wb_flush(fi->fh);
+    if (res == 0) {
+        res = fstat(fi->fh, stbuf);
+    }
     if (res == -1) {
         return -errno;
     }
@@ -271,6 +286,11 @@ loopback_exchange(const char *path1, const char *path2, unsigned long options)
 {
     int res;
 
+    if ((loopback_wb_sync_path(path1) == -1) ||
+        (loopback_wb_sync_path(path2) == -1)) {
+        return -errno;
+    }
+
     res = exchangedata(path1, path2, options);
     if (res == -1) {
         return -errno;
@@ -323,6 +343,15 @@ loopback_fsetattr_x(const char *path, struct setattr_x *attr,
     }
 
     if (SETATTR_WANTS_SIZE(attr)) {
+        /* Or pending writes would put back what's cut off. */
+        if (fi) {
+            res = loopback_wb_flush(fi->fh);
+        } else {
+            res = loopback_wb_sync_path(path);
+        }
+        if (res == -1) {
+            return -errno;
+        }
         if (fi) {
             res = ftruncate(fi->fh, attr->size);
         } else {
@@ -476,6 +505,12 @@ loopback_create(const char *path, mode_t mode, struct fuse_file_info *fi)
         return -errno;
     }
 
+    if (loopback_wb_open(fd) == -1) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
     fi->fh = fd;
     return 0;
 }
@@ -485,11 +520,21 @@ loopback_open(const char *path, struct fuse_file_info *fi)
 {
     int fd;
 
+    if ((fi->flags & O_TRUNC) && (loopback_wb_sync_path(path) == -1)) {
+        return -errno;
+    }
+
     fd = open(path, fi->flags);
     if (fd == -1) {
         return -errno;
     }
 
+    if (loopback_wb_open(fd) == -1) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
     fi->fh = fd;
     return 0;
 }
@@ -501,7 +546,7 @@ loopback_read(const char *path, char *buf, size_t size, off_t offset,
     int res;
 
     (void)path;
-    res = pread(fi->fh, buf, size, offset);
+    res = loopback_wb_pread(fi->fh, buf, size, offset);
     if (res == -1) {
         res = -errno;
     }
@@ -517,7 +562,7 @@ loopback_write(const char *path, const char *buf, size_t size,
 
     (void)path;
 
-    res = pwrite(fi->fh, buf, size, offset);
+    res = loopback_wb_pwrite(fi->fh, buf, size, offset);
     if (res == -1) {
         res = -errno;
     }
@@ -525,6 +570,77 @@ loopback_write(const char *path, const char *buf, size_t size,
     return res;
 }
 
+#if FUSE_VERSION >= 29
+
+/*
+ * With read_buf and write_buf, data doesn't have to pass through a buffer
+ * of ours: the library is handed the descriptor and offset, and copies, or
+ * where it can, splices, between the device and the backing file itself.
+ */
+
+static int
+loopback_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                  off_t offset, struct fuse_file_info *fi)
+{
+    struct fuse_bufvec *src;
+
+    (void)path;
+
+    if (loopback_wb_flush(fi->fh) == -1) {
+        return -errno;
+    }
+
+    src = malloc(sizeof(struct fuse_bufvec));
+    if (src == NULL) {
+        return -ENOMEM;
+    }
+
+    *src = FUSE_BUFVEC_INIT(size);
+
+    src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    src->buf[0].fd = fi->fh;
+    src->buf[0].pos = offset;
+
+    *bufp = src;
+
+    return 0;
+}
+
+static int
+loopback_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                   struct fuse_file_info *fi)
+{
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+    ssize_t res;
+
+    (void)path;
+
+    if (loopback_wb_enabled()) {
+        /* The write-back cache wants the data in memory. */
+        dst.buf[0].mem = malloc(dst.buf[0].size);
+        if (dst.buf[0].mem == NULL) {
+            return -ENOMEM;
+        }
+        res = fuse_buf_copy(&dst, buf, 0);
+        if (res >= 0) {
+            res = loopback_wb_pwrite(fi->fh, dst.buf[0].mem, res, offset);
+            if (res == -1) {
+                res = -errno;
+            }
+        }
+        free(dst.buf[0].mem);
+        return res;
+    }
+
+    dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    dst.buf[0].fd = fi->fh;
+    dst.buf[0].pos = offset;
+
+    return fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+}
+
+#endif /* FUSE_VERSION >= 29 */
+
 static int
 loopback_statfs(const char *path, struct statvfs *stbuf)
 {
@@ -545,7 +661,10 @@ loopback_flush(const char *path, struct fuse_file_info *fi)
 
     (void)path;
 
-    res = close(dup(fi->fh));
+    res = loopback_wb_flush(fi->fh);
+    if (res == 0) {
+        res = close(dup(fi->fh));
+    }
     if (res == -1) {
         return -errno;
     }
@@ -558,6 +677,7 @@ loopback_release(const char *path, struct fuse_file_info *fi)
 {
     (void)path;
 
+    loopback_wb_release(fi->fh);
     close(fi->fh);
 
     return 0;
@@ -572,7 +692,10 @@ loopback_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
 
     (void)isdatasync;
 
-    res = fsync(fi->fh);
+    res = loopback_wb_flush(fi->fh);
+    if (res == 0) {
+        res = fsync(fi->fh);
+    }
     if (res == -1) {
         return -errno;
     }
@@ -733,6 +856,10 @@ static struct fuse_operations loopback_oper = {
     .open        = loopback_open,
     .read        = loopback_read,
     .write       = loopback_write,
+#if FUSE_VERSION >= 29
+    .read_buf    = loopback_read_buf,
+    .write_buf   = loopback_write_buf,
+#endif
     .statfs      = loopback_statfs,
     .flush       = loopback_flush,
     .release     = loopback_release,
@@ -747,10 +874,41 @@ static struct fuse_operations loopback_oper = {
     .fsetattr_x  = loopback_fsetattr_x,
 };
 
+/*
+ * -o writeback_size=BYTES turns on write-back caching of up to that much
+ * per file, for at most -o writeback_age=MS; see loopback_wb.h.
+ */
+struct loopback_config {
+    unsigned long writeback_size;
+    unsigned      writeback_age;
+};
+
+#define LOOPBACK_OPT(t, p) { t, offsetof(struct loopback_config, p), 1 }
+
+static const struct fuse_opt loopback_opts[] = {
+    LOOPBACK_OPT("writeback_size=%lu", writeback_size),
+    LOOPBACK_OPT("writeback_age=%u",   writeback_age),
+    FUSE_OPT_END
+};
+
 int
 main(int argc, char *argv[])
 {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct loopback_config config = { 0, 1000 };
+    int res;
+
+    if (fuse_opt_parse(&args, &config, loopback_opts, NULL) == -1) {
+        exit(1);
+    }
+
+    loopback_wb_init(config.writeback_size, config.writeback_age);
+
     umask(0);
 
-    return fuse_main(argc, argv, &loopback_oper, NULL);
+    res = fuse_main(args.argc, args.argv, &loopback_oper, NULL);
+
+    fuse_opt_free_args(&args);
+
+    return res;
 }
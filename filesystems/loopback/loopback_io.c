@@ -0,0 +1,544 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "loopback_io.h"
+
+#ifdef HAVE_IO_URING
+
+struct loopback_io_uring {
+    int                  fd;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    void                *cq_ptr;
+    size_t               sq_len;
+    size_t               cq_len;
+    size_t               sqes_len;
+    unsigned char        read_op;
+    unsigned char        write_op;
+};
+
+#endif /* HAVE_IO_URING */
+
+struct loopback_io_engine {
+    const char         *name;
+    pthread_mutex_t     lock;
+    pthread_cond_t      space;      /* inflight went down */
+    unsigned            depth;
+    unsigned            inflight;
+
+    /* threads */
+    pthread_cond_t      work;
+    struct loopback_io *head;
+    struct loopback_io *tail;
+    int                 stopping;
+    unsigned            nthreads;
+    pthread_t          *threads;
+
+#ifdef HAVE_IO_URING
+    struct loopback_io_uring ring;
+    pthread_t           reaper;
+#endif
+};
+
+static ssize_t
+loopback_io_run(struct loopback_io *io)
+{
+    ssize_t res;
+
+    switch (io->op) {
+    case LOOPBACK_IO_READ:
+        res = pread(io->fd, io->buf, io->size, io->offset);
+        break;
+    case LOOPBACK_IO_WRITE:
+        res = pwrite(io->fd, io->buf, io->size, io->offset);
+        break;
+    case LOOPBACK_IO_FSYNC:
+        res = fsync(io->fd);
+        break;
+    case LOOPBACK_IO_FDATASYNC:
+        res = fdatasync(io->fd);
+        break;
+    default:
+        errno = EINVAL;
+        res = -1;
+        break;
+    }
+
+    return (res == -1) ? -errno : res;
+}
+
+static void
+loopback_io_complete(loopback_io_engine_t *e, struct loopback_io *io,
+                     ssize_t res)
+{
+    io->done(io, res);
+
+    pthread_mutex_lock(&e->lock);
+    e->inflight--;
+    pthread_cond_broadcast(&e->space);
+    pthread_mutex_unlock(&e->lock);
+}
+
+/* Must be called with e->lock held; returns with it held. */
+static void
+loopback_io_reserve(loopback_io_engine_t *e)
+{
+    while (e->inflight == e->depth) {
+        pthread_cond_wait(&e->space, &e->lock);
+    }
+    e->inflight++;
+}
+
+/* Threads */
+
+static void *
+loopback_io_worker(void *arg)
+{
+    loopback_io_engine_t *e = (loopback_io_engine_t *)arg;
+    struct loopback_io *io;
+
+    pthread_mutex_lock(&e->lock);
+    for (;;) {
+        while ((e->head == NULL) && !e->stopping) {
+            pthread_cond_wait(&e->work, &e->lock);
+        }
+        io = e->head;
+        if (io == NULL) {
+            break; /* stopping, and nothing left */
+        }
+        e->head = io->next;
+        if (e->head == NULL) {
+            e->tail = NULL;
+        }
+        pthread_mutex_unlock(&e->lock);
+
+        loopback_io_complete(e, io, loopback_io_run(io));
+
+        pthread_mutex_lock(&e->lock);
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    return NULL;
+}
+
+static int
+loopback_io_threads_start(loopback_io_engine_t *e, unsigned nthreads)
+{
+    unsigned i;
+
+    e->threads = calloc(nthreads, sizeof(pthread_t));
+    if (e->threads == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&e->threads[i], NULL, loopback_io_worker, e)) {
+            break;
+        }
+    }
+    e->nthreads = i;
+
+    if (i == 0) {
+        free(e->threads);
+        return -1;
+    }
+
+    e->name = "threads";
+
+    return 0;
+}
+
+static void
+loopback_io_threads_submit(loopback_io_engine_t *e, struct loopback_io *io)
+{
+    io->next = NULL;
+
+    pthread_mutex_lock(&e->lock);
+    loopback_io_reserve(e);
+    if (e->tail) {
+        e->tail->next = io;
+    } else {
+        e->head = io;
+    }
+    e->tail = io;
+    pthread_cond_signal(&e->work);
+    pthread_mutex_unlock(&e->lock);
+}
+
+static void
+loopback_io_threads_stop(loopback_io_engine_t *e)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&e->lock);
+    e->stopping = 1;
+    pthread_cond_broadcast(&e->work);
+    pthread_mutex_unlock(&e->lock);
+
+    for (i = 0; i < e->nthreads; i++) {
+        pthread_join(e->threads[i], NULL);
+    }
+
+    free(e->threads);
+}
+
+#ifdef HAVE_IO_URING
+
+/* io_uring, through the system calls; there's no liburing to depend on. */
+
+static int
+loopback_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static void *
+loopback_io_reaper(void *arg)
+{
+    loopback_io_engine_t *e = (loopback_io_engine_t *)arg;
+    struct loopback_io_uring *r = &e->ring;
+
+    for (;;) {
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            loopback_io_uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            struct loopback_io *io =
+                (struct loopback_io *)(uintptr_t)cqe->user_data;
+            ssize_t res = cqe->res;
+
+            __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (io == NULL) {
+                return NULL; /* the stop marker, submitted last */
+            }
+
+            loopback_io_complete(e, io, res);
+        }
+    }
+}
+
+/* Must be called with e->lock held, and a slot reserved. */
+static void
+loopback_io_uring_push(loopback_io_engine_t *e, struct loopback_io *io)
+{
+    struct loopback_io_uring *r = &e->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    if (io == NULL) {
+        sqe->opcode = IORING_OP_NOP;
+    } else {
+        sqe->fd = io->fd;
+        sqe->user_data = (uintptr_t)io;
+        switch (io->op) {
+        case LOOPBACK_IO_READ:
+        case LOOPBACK_IO_WRITE:
+            sqe->opcode = (io->op == LOOPBACK_IO_READ) ?
+                              r->read_op : r->write_op;
+            if ((sqe->opcode == IORING_OP_READV) ||
+                (sqe->opcode == IORING_OP_WRITEV)) {
+                io->iov.iov_base = io->buf;
+                io->iov.iov_len = io->size;
+                sqe->addr = (uintptr_t)&io->iov;
+                sqe->len = 1;
+            } else {
+                sqe->addr = (uintptr_t)io->buf;
+                sqe->len = (unsigned)io->size;
+            }
+            sqe->off = io->offset;
+            break;
+        case LOOPBACK_IO_FDATASYNC:
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            /* FALLTHROUGH */
+        default:
+            sqe->opcode = IORING_OP_FSYNC;
+            break;
+        }
+    }
+
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while ((loopback_io_uring_enter(r->fd, 1, 0, 0) == -1) &&
+           ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY))) {
+        /* retry */
+    }
+}
+
+static void
+loopback_io_uring_submit(loopback_io_engine_t *e, struct loopback_io *io)
+{
+    pthread_mutex_lock(&e->lock);
+    loopback_io_reserve(e);
+    loopback_io_uring_push(e, io);
+    pthread_mutex_unlock(&e->lock);
+}
+
+static void
+loopback_io_uring_unmap(struct loopback_io_uring *r)
+{
+    if (r->sqes && (r->sqes != MAP_FAILED)) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ptr && (r->cq_ptr != MAP_FAILED) && (r->cq_ptr != r->sq_ptr)) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    if (r->sq_ptr && (r->sq_ptr != MAP_FAILED)) {
+        munmap(r->sq_ptr, r->sq_len);
+    }
+    close(r->fd);
+}
+
+/*
+ * IORING_OP_READ and IORING_OP_WRITE came in with Linux 5.6, as did the
+ * probe; before that, there are only the vectored ones, with one vector.
+ */
+static void
+loopback_io_uring_probe(struct loopback_io_uring *r)
+{
+    r->read_op = IORING_OP_READV;
+    r->write_op = IORING_OP_WRITEV;
+
+#ifdef IO_URING_OP_SUPPORTED
+    {
+        unsigned nops = 256;
+        struct io_uring_probe *probe;
+
+        probe = calloc(1, sizeof(*probe) +
+                          nops * sizeof(struct io_uring_probe_op));
+        if (probe == NULL) {
+            return;
+        }
+
+        if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE,
+                    probe, nops) == 0) {
+            if ((IORING_OP_READ < probe->ops_len) &&
+                (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+                r->read_op = IORING_OP_READ;
+            }
+            if ((IORING_OP_WRITE < probe->ops_len) &&
+                (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+                r->write_op = IORING_OP_WRITE;
+            }
+        }
+
+        free(probe);
+    }
+#endif
+}
+
+static int
+loopback_io_uring_start(loopback_io_engine_t *e)
+{
+    struct loopback_io_uring *r = &e->ring;
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, e->depth, &p);
+    if (r->fd == -1) {
+        return -1; /* not in this kernel, or not allowed */
+    }
+
+    loopback_io_uring_probe(r);
+
+    /* Never more in flight than there's room for in either ring. */
+    if (e->depth > p.sq_entries) {
+        e->depth = p.sq_entries;
+    }
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) {
+            r->sq_len = r->cq_len;
+        }
+        r->cq_len = r->sq_len;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        loopback_io_uring_unmap(r);
+        return -1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            loopback_io_uring_unmap(r);
+            return -1;
+        }
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        loopback_io_uring_unmap(r);
+        return -1;
+    }
+
+    sq = r->sq_ptr;
+    cq = r->cq_ptr;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (pthread_create(&e->reaper, NULL, loopback_io_reaper, e)) {
+        loopback_io_uring_unmap(r);
+        return -1;
+    }
+
+    e->name = "uring";
+
+    return 0;
+}
+
+static void
+loopback_io_uring_stop(loopback_io_engine_t *e)
+{
+    /* Completions come in any order; the marker has to be the last. */
+    pthread_mutex_lock(&e->lock);
+    while (e->inflight) {
+        pthread_cond_wait(&e->space, &e->lock);
+    }
+    loopback_io_reserve(e);
+    loopback_io_uring_push(e, NULL);
+    pthread_mutex_unlock(&e->lock);
+
+    pthread_join(e->reaper, NULL);
+
+    loopback_io_uring_unmap(&e->ring);
+}
+
+#endif /* HAVE_IO_URING */
+
+loopback_io_engine_t *
+loopback_io_create(const char *kind, unsigned threads, unsigned depth)
+{
+    loopback_io_engine_t *e;
+    int res = -1;
+
+    if (strcmp(kind, "threads") && strcmp(kind, "uring")) {
+        return NULL;
+    }
+
+    e = calloc(1, sizeof(loopback_io_engine_t));
+    if (e == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->space, NULL);
+    pthread_cond_init(&e->work, NULL);
+    e->depth = depth ? depth : 1;
+
+#ifdef HAVE_IO_URING
+    if (strcmp(kind, "uring") == 0) {
+        res = loopback_io_uring_start(e);
+    }
+#endif
+
+    if (res == -1) {
+        res = loopback_io_threads_start(e, threads ? threads : 1);
+    }
+
+    if (res == -1) {
+        pthread_cond_destroy(&e->work);
+        pthread_cond_destroy(&e->space);
+        pthread_mutex_destroy(&e->lock);
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+void
+loopback_io_destroy(loopback_io_engine_t *e)
+{
+    if (e == NULL) {
+        return;
+    }
+
+#ifdef HAVE_IO_URING
+    if (e->nthreads == 0) {
+        loopback_io_uring_stop(e);
+    }
+#endif
+
+    if (e->nthreads) {
+        loopback_io_threads_stop(e);
+    }
+
+    pthread_cond_destroy(&e->work);
+    pthread_cond_destroy(&e->space);
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+const char *
+loopback_io_name(loopback_io_engine_t *e)
+{
+    return e->name;
+}
+
+void
+loopback_io_submit(loopback_io_engine_t *e, struct loopback_io *io)
+{
+#ifdef HAVE_IO_URING
+    if (e->nthreads == 0) {
+        loopback_io_uring_submit(e, io);
+        return;
+    }
+#endif
+
+    loopback_io_threads_submit(e, io);
+}
@@ -0,0 +1,69 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+#ifndef _LOOPBACK_IO_H
+#define _LOOPBACK_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Asynchronous I/O on the backing files, for loopback_ll.
+ *
+ * A request handler that submits its read, write or sync here returns at
+ * once, and replies from the completion callback. The number of backing
+ * operations in flight is then bounded by the engine's depth, and not by
+ * how many threads libfuse has waiting in pread().
+ *
+ * There are two engines: io_uring, where the kernel has it, and a pool of
+ * threads doing plain system calls, which is also what "uring" falls back
+ * to where it doesn't.
+ */
+
+typedef struct loopback_io_engine loopback_io_engine_t;
+
+enum {
+    LOOPBACK_IO_READ,
+    LOOPBACK_IO_WRITE,
+    LOOPBACK_IO_FSYNC,
+    LOOPBACK_IO_FDATASYNC,
+};
+
+/*
+ * Owned by the caller, and left alone until done is called, with the
+ * number of bytes transferred, 0 for the syncs, or -errno. done may be
+ * called on any thread, including the submitting one.
+ */
+struct loopback_io {
+    int                  op;
+    int                  fd;
+    void                *buf;
+    size_t               size;
+    off_t                offset;
+    void               (*done)(struct loopback_io *io, ssize_t res);
+    struct loopback_io  *next;      /* the engine's */
+    struct iovec         iov;       /* ditto */
+};
+
+/* kind is "threads" or "uring"; returns NULL if it's neither. */
+extern loopback_io_engine_t *loopback_io_create(const char *kind,
+                                                unsigned threads,
+                                                unsigned depth);
+
+/* Waits for everything submitted to be done. */
+extern void        loopback_io_destroy(loopback_io_engine_t *engine);
+
+/* The engine actually in use. */
+extern const char *loopback_io_name(loopback_io_engine_t *engine);
+
+/* Blocks while depth operations are already in flight. */
+extern void        loopback_io_submit(loopback_io_engine_t *engine,
+                                      struct loopback_io   *io);
+
+#endif /* _LOOPBACK_IO_H */
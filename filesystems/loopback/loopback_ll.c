@@ -0,0 +1,1453 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+/*
+ * Loopback file system in C. Uses the low-level FUSE API.
+ *
+ * The path-based loopback hands every request a full path, which the host
+ * kernel has to walk again for each lstat(), open(), getxattr() and so on.
+ * Here, every inode the kernel knows about holds an O_PATH descriptor for
+ * the underlying file, and requests are served relative to it with the
+ * *at() calls: a lookup walks one component, and a getattr walks none.
+ *
+ * O_PATH and AT_EMPTY_PATH make this Linux-only; the Mac OS X specific
+ * operations of loopback.c (exchange, xtimes, setattr_x) are not here.
+ *
+ *   loopback_ll /mnt/loop -o source=/tmp/dir[,timeout=SECONDS]
+ *
+ * timeout sets both entry_timeout and attr_timeout, which can also be
+ * given on their own; they're how long the kernel may trust our answers.
+ *
+ * writeback_size=BYTES turns on write-back caching of up to that much per
+ * file, for at most writeback_age=MS (1000 by default); see loopback_wb.h.
+ *
+ * io=uring or io=threads hands reads, writes and syncs to an asynchronous
+ * engine, with up to io_depth=N (64) in flight, and io_threads=N (8) for
+ * the threads; see loopback_io.h. Writes that go to the write-back cache
+ * stay synchronous, and so do the reads that go with them.
+ */
+
+#define FUSE_USE_VERSION 26
+
+#define _GNU_SOURCE
+
+#include <fuse_lowlevel.h>
+#include <fuse_opt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+
+#include "loopback_io.h"
+#include "loopback_wb.h"
+
+#if !defined(O_PATH) || !defined(AT_EMPTY_PATH)
+#error "This file system requires O_PATH and AT_EMPTY_PATH (Linux 2.6.39+)."
+#endif
+
+struct loopback_inode {
+    struct loopback_inode *next;       /* hash chain */
+    int                    fd;         /* O_PATH, O_NOFOLLOW */
+    int                    is_symlink;
+    dev_t                  dev;
+    ino_t                  ino;
+    uint64_t               nlookup;    /* protected by the table lock */
+    int                    wb_error;   /* ditto; see loopback_ll_release */
+};
+
+struct loopback_data {
+    pthread_mutex_t         lock;
+    struct loopback_inode **buckets;
+    size_t                  nbuckets;
+    size_t                  count;
+    struct loopback_inode   root;
+    char                   *source;
+    double                  entry_timeout;
+    double                  attr_timeout;
+    unsigned long           writeback_size;
+    unsigned                writeback_age;
+    char                   *io;
+    unsigned                io_threads;
+    unsigned                io_depth;
+    loopback_io_engine_t   *engine;
+};
+
+#define LOOPBACK_INITIAL_BUCKETS 1024
+
+static inline struct loopback_data *
+loopback_data(fuse_req_t req)
+{
+    return (struct loopback_data *)fuse_req_userdata(req);
+}
+
+static inline struct loopback_inode *
+loopback_inode(fuse_req_t req, fuse_ino_t ino)
+{
+    if (ino == FUSE_ROOT_ID) {
+        return &loopback_data(req)->root;
+    }
+
+    return (struct loopback_inode *)(uintptr_t)ino;
+}
+
+static inline int
+loopback_fd(fuse_req_t req, fuse_ino_t ino)
+{
+    return loopback_inode(req, ino)->fd;
+}
+
+/*
+ * An O_PATH descriptor can't be read from, written to, or asked for its
+ * extended attributes, but the /proc name for it can be opened like the
+ * file itself, without walking the original path.
+ */
+#define LOOPBACK_PROCNAME_MAX 64
+
+static inline void
+loopback_procname(int fd, char procname[LOOPBACK_PROCNAME_MAX])
+{
+    snprintf(procname, LOOPBACK_PROCNAME_MAX, "/proc/self/fd/%d", fd);
+}
+
+/* Inode table */
+
+static inline size_t
+loopback_hash(struct loopback_data *lo, dev_t dev, ino_t ino)
+{
+    uint64_t h = ((uint64_t)ino * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)dev;
+
+    return (size_t)(h >> 16) & (lo->nbuckets - 1);
+}
+
+/* Must be called with lo->lock held. */
+static void
+loopback_table_grow(struct loopback_data *lo)
+{
+    struct loopback_inode **old = lo->buckets;
+    size_t oldn = lo->nbuckets, i;
+    struct loopback_inode **new;
+
+    new = calloc(oldn * 2, sizeof(struct loopback_inode *));
+    if (new == NULL) {
+        return; /* longer chains, that's all */
+    }
+
+    lo->buckets = new;
+    lo->nbuckets = oldn * 2;
+
+    for (i = 0; i < oldn; i++) {
+        struct loopback_inode *inode, *next;
+        for (inode = old[i]; inode; inode = next) {
+            size_t h = loopback_hash(lo, inode->dev, inode->ino);
+            next = inode->next;
+            inode->next = new[h];
+            new[h] = inode;
+        }
+    }
+
+    free(old);
+}
+
+/* Must be called with lo->lock held. */
+static struct loopback_inode *
+loopback_table_find(struct loopback_data *lo, dev_t dev, ino_t ino)
+{
+    struct loopback_inode *inode;
+
+    for (inode = lo->buckets[loopback_hash(lo, dev, ino)]; inode;
+         inode = inode->next) {
+        if ((inode->ino == ino) && (inode->dev == dev)) {
+            return inode;
+        }
+    }
+
+    return NULL;
+}
+
+/* Must be called with lo->lock held. */
+static void
+loopback_table_insert(struct loopback_data *lo, struct loopback_inode *inode)
+{
+    size_t h;
+
+    if (lo->count >= lo->nbuckets * 2) {
+        loopback_table_grow(lo);
+    }
+
+    h = loopback_hash(lo, inode->dev, inode->ino);
+    inode->next = lo->buckets[h];
+    lo->buckets[h] = inode;
+    lo->count++;
+}
+
+/* Must be called with lo->lock held. */
+static void
+loopback_table_remove(struct loopback_data *lo, struct loopback_inode *inode)
+{
+    struct loopback_inode **pp;
+
+    for (pp = &lo->buckets[loopback_hash(lo, inode->dev, inode->ino)]; *pp;
+         pp = &(*pp)->next) {
+        if (*pp == inode) {
+            *pp = inode->next;
+            lo->count--;
+            return;
+        }
+    }
+}
+
+static void
+loopback_unref(struct loopback_data *lo, struct loopback_inode *inode,
+               uint64_t n)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&lo->lock);
+    inode->nlookup -= n;
+    if ((inode->nlookup == 0) && (inode != &lo->root)) {
+        loopback_table_remove(lo, inode);
+        fd = inode->fd;
+    }
+    pthread_mutex_unlock(&lo->lock);
+
+    if (fd != -1) {
+        close(fd);
+        free(inode);
+    }
+}
+
+/*
+ * Looks name up in parent, and returns the inode for it with one more
+ * lookup reference, as the kernel will expect of a successful reply.
+ */
+static int
+loopback_do_lookup(fuse_req_t req, fuse_ino_t parent, const char *name,
+                   struct fuse_entry_param *e)
+{
+    struct loopback_data *lo = loopback_data(req);
+    struct loopback_inode *inode, *new;
+    int fd, err;
+
+    memset(e, 0, sizeof(*e));
+    e->attr_timeout = lo->attr_timeout;
+    e->entry_timeout = lo->entry_timeout;
+
+    /*
+     * Listing a directory has the kernel look up every entry in it, and
+     * most of those we'll already hold, from the listing before. Those
+     * only need a stat of the name to be answered.
+     */
+    if (fstatat(loopback_fd(req, parent), name, &e->attr,
+                AT_SYMLINK_NOFOLLOW) == -1) {
+        return errno;
+    }
+
+    /* Held back writes would leave the size and times stale. */
+    switch (loopback_wb_sync(e->attr.st_dev, e->attr.st_ino)) {
+    case -1:
+        return errno;
+    case 1:
+        if (fstatat(loopback_fd(req, parent), name, &e->attr,
+                    AT_SYMLINK_NOFOLLOW) == -1) {
+            return errno;
+        }
+        break;
+    }
+
+    pthread_mutex_lock(&lo->lock);
+    inode = loopback_table_find(lo, e->attr.st_dev, e->attr.st_ino);
+    if (inode) {
+        inode->nlookup++;
+    }
+    pthread_mutex_unlock(&lo->lock);
+
+    if (inode) {
+        e->ino = (inode == &lo->root) ? FUSE_ROOT_ID : (uintptr_t)inode;
+        return 0;
+    }
+
+    /* A new one: open it, and stat what we opened, not what we named. */
+    fd = openat(loopback_fd(req, parent), name, O_PATH | O_NOFOLLOW);
+    if (fd == -1) {
+        return errno;
+    }
+
+    if (fstatat(fd, "", &e->attr, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == -1) {
+        err = errno;
+        close(fd);
+        return err;
+    }
+
+    new = calloc(1, sizeof(struct loopback_inode));
+    if (new == NULL) {
+        close(fd);
+        return ENOMEM;
+    }
+
+    pthread_mutex_lock(&lo->lock);
+    inode = loopback_table_find(lo, e->attr.st_dev, e->attr.st_ino);
+    if (inode) {
+        inode->nlookup++;
+    } else {
+        inode = new;
+        inode->fd = fd;
+        inode->is_symlink = S_ISLNK(e->attr.st_mode);
+        inode->dev = e->attr.st_dev;
+        inode->ino = e->attr.st_ino;
+        inode->nlookup = 1;
+        loopback_table_insert(lo, inode);
+        new = NULL;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&lo->lock);
+
+    if (new) {
+        /* Already known; keep the descriptor we have. */
+        free(new);
+        close(fd);
+    }
+
+    e->ino = (inode == &lo->root) ? FUSE_ROOT_ID : (uintptr_t)inode;
+
+    return 0;
+}
+
+/* Operations */
+
+#ifdef FUSE_CAP_SPLICE_WRITE
+
+/*
+ * Splicing is opt-in: ask for it both ways, so that read replies and
+ * write requests can move between /dev/fuse and the backing file through
+ * a pipe instead of through our memory.
+ */
+static void
+loopback_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void)userdata;
+
+    conn->want |= conn->capable &
+        (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE | FUSE_CAP_SPLICE_READ);
+}
+
+#endif /* FUSE_CAP_SPLICE_WRITE */
+
+static void
+loopback_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param e;
+    int err;
+
+    err = loopback_do_lookup(req, parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void
+loopback_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    loopback_unref(loopback_data(req), loopback_inode(req, ino), nlookup);
+
+    fuse_reply_none(req);
+}
+
+static void
+loopback_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_inode *inode = loopback_inode(req, ino);
+    struct stat st;
+
+    (void)fi;
+
+    if (loopback_wb_sync(inode->dev, inode->ino) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (fstatat(inode->fd, "", &st,
+                AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fuse_reply_attr(req, &st, loopback_data(req)->attr_timeout);
+}
+
+static void
+loopback_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                    int valid, struct fuse_file_info *fi)
+{
+    struct loopback_inode *inode = loopback_inode(req, ino);
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int res;
+
+    loopback_procname(inode->fd, procname);
+
+    if (valid & FUSE_SET_ATTR_MODE) {
+        if (fi) {
+            res = fchmod(fi->fh, attr->st_mode);
+        } else {
+            res = chmod(procname, attr->st_mode);
+        }
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        uid_t uid = (valid & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
+        gid_t gid = (valid & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
+
+        res = fchownat(inode->fd, "", uid, gid,
+                       AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & FUSE_SET_ATTR_SIZE) {
+        /* Or pending writes would put back what's cut off. */
+        if (loopback_wb_sync(inode->dev, inode->ino) == -1) {
+            goto out_err;
+        }
+        if (fi) {
+            res = ftruncate(fi->fh, attr->st_size);
+        } else {
+            res = truncate(procname, attr->st_size);
+        }
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    if (valid & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) {
+        struct timespec tv[2];
+
+        tv[0].tv_sec = 0;
+        tv[0].tv_nsec = UTIME_OMIT;
+        tv[1].tv_sec = 0;
+        tv[1].tv_nsec = UTIME_OMIT;
+
+        if (valid & FUSE_SET_ATTR_ATIME) {
+            tv[0] = attr->st_atim;
+        }
+        if (valid & FUSE_SET_ATTR_MTIME) {
+            tv[1] = attr->st_mtim;
+        }
+
+        if (fi) {
+            res = futimens(fi->fh, tv);
+        } else {
+            res = utimensat(AT_FDCWD, procname, tv, 0);
+        }
+        if (res == -1) {
+            goto out_err;
+        }
+    }
+
+    loopback_ll_getattr(req, ino, fi);
+    return;
+
+out_err:
+    fuse_reply_err(req, errno);
+}
+
+static void
+loopback_ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    char buf[PATH_MAX + 1];
+    ssize_t res;
+
+    res = readlinkat(loopback_fd(req, ino), "", buf, sizeof(buf));
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (res == sizeof(buf)) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    buf[res] = '\0';
+
+    fuse_reply_readlink(req, buf);
+}
+
+static void
+loopback_make_node(fuse_req_t req, fuse_ino_t parent, const char *name,
+                   mode_t mode, dev_t rdev, const char *link)
+{
+    struct fuse_entry_param e;
+    int dirfd = loopback_fd(req, parent);
+    int res, err;
+
+    if (S_ISDIR(mode)) {
+        res = mkdirat(dirfd, name, mode);
+    } else if (S_ISLNK(mode)) {
+        res = symlinkat(link, dirfd, name);
+    } else {
+        res = mknodat(dirfd, name, mode, rdev);
+    }
+
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    err = loopback_do_lookup(req, parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void
+loopback_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  mode_t mode, dev_t rdev)
+{
+    loopback_make_node(req, parent, name, mode, rdev, NULL);
+}
+
+static void
+loopback_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  mode_t mode)
+{
+    loopback_make_node(req, parent, name, S_IFDIR | mode, 0, NULL);
+}
+
+static void
+loopback_ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
+                    const char *name)
+{
+    loopback_make_node(req, parent, name, S_IFLNK, 0, link);
+}
+
+static void
+loopback_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+                 const char *newname)
+{
+    struct loopback_data *lo = loopback_data(req);
+    struct loopback_inode *inode = loopback_inode(req, ino);
+    char procname[LOOPBACK_PROCNAME_MAX];
+    struct fuse_entry_param e;
+
+    loopback_procname(inode->fd, procname);
+
+    if (linkat(AT_FDCWD, procname, loopback_fd(req, newparent), newname,
+               AT_SYMLINK_FOLLOW) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = lo->attr_timeout;
+    e.entry_timeout = lo->entry_timeout;
+
+    if (loopback_wb_sync(inode->dev, inode->ino) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (fstatat(inode->fd, "", &e.attr,
+                AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    pthread_mutex_lock(&lo->lock);
+    inode->nlookup++;
+    pthread_mutex_unlock(&lo->lock);
+
+    e.ino = ino;
+
+    fuse_reply_entry(req, &e);
+}
+
+static void
+loopback_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int res;
+
+    res = unlinkat(loopback_fd(req, parent), name, 0);
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static void
+loopback_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int res;
+
+    res = unlinkat(loopback_fd(req, parent), name, AT_REMOVEDIR);
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static void
+loopback_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                   fuse_ino_t newparent, const char *newname)
+{
+    int res;
+
+    res = renameat(loopback_fd(req, parent), name,
+                   loopback_fd(req, newparent), newname);
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+struct loopback_dirp {
+    DIR *dp;
+    struct dirent *entry;
+    off_t offset;
+};
+
+static inline struct loopback_dirp *
+get_dirp(struct fuse_file_info *fi)
+{
+    return (struct loopback_dirp *)(uintptr_t)fi->fh;
+}
+
+static void
+loopback_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_dirp *d;
+    int fd, err;
+
+    d = malloc(sizeof(struct loopback_dirp));
+    if (d == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    fd = openat(loopback_fd(req, ino), ".", O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        err = errno;
+        free(d);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    d->dp = fdopendir(fd);
+    if (d->dp == NULL) {
+        err = errno;
+        close(fd);
+        free(d);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    d->offset = 0;
+    d->entry = NULL;
+
+    fi->fh = (uintptr_t)d;
+
+    fuse_reply_open(req, fi);
+}
+
+static void
+loopback_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    struct loopback_dirp *d = get_dirp(fi);
+    char *buf, *p;
+    size_t rem;
+
+    (void)ino;
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    if (offset != d->offset) {
+        seekdir(d->dp, offset);
+        d->entry = NULL;
+        d->offset = offset;
+    }
+
+    p = buf;
+    rem = size;
+
+    while (1) {
+        struct stat st;
+        off_t nextoff;
+        size_t entsize;
+
+        if (!d->entry) {
+            errno = 0;
+            d->entry = readdir(d->dp);
+            if (!d->entry) {
+                if (errno && (rem == size)) {
+                    int err = errno;
+                    free(buf);
+                    fuse_reply_err(req, err);
+                    return;
+                }
+                break;
+            }
+        }
+
+        memset(&st, 0, sizeof(st));
+        st.st_ino = d->entry->d_ino;
+        st.st_mode = d->entry->d_type << 12;
+        nextoff = telldir(d->dp);
+
+        entsize = fuse_add_direntry(req, p, rem, d->entry->d_name, &st,
+                                    nextoff);
+        if (entsize > rem) {
+            break; /* keep the entry for the next call */
+        }
+
+        p += entsize;
+        rem -= entsize;
+
+        d->entry = NULL;
+        d->offset = nextoff;
+    }
+
+    fuse_reply_buf(req, buf, size - rem);
+    free(buf);
+}
+
+static void
+loopback_ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+                       struct fuse_file_info *fi)
+{
+    struct loopback_dirp *d = get_dirp(fi);
+
+    (void)ino;
+
+    closedir(d->dp);
+    free(d);
+
+    fuse_reply_err(req, 0);
+}
+
+static void
+loopback_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                   mode_t mode, struct fuse_file_info *fi)
+{
+    struct fuse_entry_param e;
+    int fd, err;
+
+    fd = openat(loopback_fd(req, parent), name,
+                (fi->flags | O_CREAT) & ~O_NOFOLLOW, mode);
+    if (fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback_wb_open(fd) == -1) {
+        err = errno;
+        close(fd);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    fi->fh = fd;
+
+    err = loopback_do_lookup(req, parent, name, &e);
+    if (err) {
+        loopback_wb_release(fd);
+        close(fd);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    fuse_reply_create(req, &e, fi);
+}
+
+static void
+loopback_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_inode *inode = loopback_inode(req, ino);
+    char procname[LOOPBACK_PROCNAME_MAX];
+    int fd, err;
+
+    loopback_procname(inode->fd, procname);
+
+    if ((fi->flags & O_TRUNC) &&
+        (loopback_wb_sync(inode->dev, inode->ino) == -1)) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fd = open(procname, fi->flags & ~O_NOFOLLOW);
+    if (fd == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    if (loopback_wb_open(fd) == -1) {
+        err = errno;
+        close(fd);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    fi->fh = fd;
+
+    fuse_reply_open(req, fi);
+}
+
+/* Asynchronous I/O */
+
+struct loopback_ll_io {
+    struct loopback_io io;      /* must be first */
+    fuse_req_t         req;
+    char               data[];
+};
+
+static void
+loopback_ll_read_done(struct loopback_io *io, ssize_t res)
+{
+    struct loopback_ll_io *x = (struct loopback_ll_io *)io;
+
+    if (res < 0) {
+        fuse_reply_err(x->req, -res);
+    } else {
+        fuse_reply_buf(x->req, x->data, res);
+    }
+
+    free(x);
+}
+
+static void
+loopback_ll_write_done(struct loopback_io *io, ssize_t res)
+{
+    struct loopback_ll_io *x = (struct loopback_ll_io *)io;
+
+    if (res < 0) {
+        fuse_reply_err(x->req, -res);
+    } else {
+        fuse_reply_write(x->req, res);
+    }
+
+    free(x);
+}
+
+static void
+loopback_ll_sync_done(struct loopback_io *io, ssize_t res)
+{
+    struct loopback_ll_io *x = (struct loopback_ll_io *)io;
+
+    fuse_reply_err(x->req, (res < 0) ? -res : 0);
+
+    free(x);
+}
+
+/*
+ * Hands the request over to the engine, which replies to it; the write
+ * data, if any, is copied, as it lives in libfuse's buffer for the request.
+ */
+static void
+loopback_ll_submit(fuse_req_t req, int op, int fd, const char *buf,
+                   size_t size, off_t offset,
+                   void (*done)(struct loopback_io *, ssize_t))
+{
+    size_t datasize = (op == LOOPBACK_IO_READ || op == LOOPBACK_IO_WRITE) ?
+                          size : 0;
+    struct loopback_ll_io *x;
+
+    x = malloc(sizeof(struct loopback_ll_io) + datasize);
+    if (x == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    if (op == LOOPBACK_IO_WRITE) {
+        memcpy(x->data, buf, size);
+    }
+
+    x->io.op = op;
+    x->io.fd = fd;
+    x->io.buf = x->data;
+    x->io.size = size;
+    x->io.offset = offset;
+    x->io.done = done;
+    x->req = req;
+
+    loopback_io_submit(loopback_data(req)->engine, &x->io);
+}
+
+static inline int
+loopback_ll_async(fuse_req_t req)
+{
+    return loopback_data(req)->engine && !loopback_wb_enabled();
+}
+
+static void
+loopback_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                 struct fuse_file_info *fi)
+{
+#if FUSE_VERSION >= 29
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
+
+    (void)ino;
+
+    if (loopback_ll_async(req)) {
+        loopback_ll_submit(req, LOOPBACK_IO_READ, fi->fh, NULL, size, offset,
+                           loopback_ll_read_done);
+        return;
+    }
+
+    if (loopback_wb_flush(fi->fh) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    /* Let the library splice from the file, rather than copy through us. */
+    buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    buf.buf[0].fd = fi->fh;
+    buf.buf[0].pos = offset;
+
+    fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+#else
+    char *buf;
+    ssize_t res;
+
+    (void)ino;
+
+    if (loopback_ll_async(req)) {
+        loopback_ll_submit(req, LOOPBACK_IO_READ, fi->fh, NULL, size, offset,
+                           loopback_ll_read_done);
+        return;
+    }
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    res = loopback_wb_pread(fi->fh, buf, size, offset);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_buf(req, buf, res);
+    }
+
+    free(buf);
+#endif
+}
+
+static void
+loopback_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                  off_t offset, struct fuse_file_info *fi)
+{
+    ssize_t res;
+
+    (void)ino;
+
+    if (loopback_ll_async(req)) {
+        loopback_ll_submit(req, LOOPBACK_IO_WRITE, fi->fh, buf, size, offset,
+                           loopback_ll_write_done);
+        return;
+    }
+
+    res = loopback_wb_pwrite(fi->fh, buf, size, offset);
+    if (res == -1) {
+        fuse_reply_err(req, errno);
+    } else {
+        fuse_reply_write(req, res);
+    }
+}
+
+#if FUSE_VERSION >= 29
+
+static void
+loopback_ll_write_buf(fuse_req_t req, fuse_ino_t ino,
+                      struct fuse_bufvec *in_buf, off_t offset,
+                      struct fuse_file_info *fi)
+{
+    struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(fuse_buf_size(in_buf));
+    ssize_t res;
+
+    (void)ino;
+
+    if (loopback_wb_enabled() || loopback_data(req)->engine) {
+        /* The write-back cache and the engines want the data in memory. */
+        out_buf.buf[0].mem = malloc(out_buf.buf[0].size);
+        if (out_buf.buf[0].mem == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        res = fuse_buf_copy(&out_buf, in_buf, 0);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+        } else {
+            loopback_ll_write(req, ino, out_buf.buf[0].mem, res, offset, fi);
+        }
+        free(out_buf.buf[0].mem);
+        return;
+    }
+
+    out_buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    out_buf.buf[0].fd = fi->fh;
+    out_buf.buf[0].pos = offset;
+
+    res = fuse_buf_copy(&out_buf, in_buf, 0);
+    if (res < 0) {
+        fuse_reply_err(req, -res);
+    } else {
+        fuse_reply_write(req, (size_t)res);
+    }
+}
+
+#endif /* FUSE_VERSION >= 29 */
+
+/*
+ * Returns, and forgets, the error a release of ino couldn't report: the
+ * next flush or fsync of the file reports it instead.
+ */
+static int
+loopback_release_error(fuse_req_t req, fuse_ino_t ino)
+{
+    struct loopback_data *lo = loopback_data(req);
+    struct loopback_inode *inode = loopback_inode(req, ino);
+    int err;
+
+    pthread_mutex_lock(&lo->lock);
+    err = inode->wb_error;
+    inode->wb_error = 0;
+    pthread_mutex_unlock(&lo->lock);
+
+    return err;
+}
+
+static void
+loopback_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int res, err;
+
+    res = loopback_wb_flush(fi->fh);
+    if (res == 0) {
+        res = close(dup(fi->fh));
+    }
+    err = (res == -1) ? errno : 0;
+
+    if (err == 0) {
+        err = loopback_release_error(req, ino);
+    }
+
+    fuse_reply_err(req, err);
+}
+
+static void
+loopback_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct loopback_data *lo = loopback_data(req);
+    struct loopback_inode *inode = loopback_inode(req, ino);
+
+    /*
+     * Release can't fail as far as the caller is concerned, so the held
+     * back writes that didn't make it out are kept against the inode.
+     */
+    if (loopback_wb_release(fi->fh) == -1) {
+        int err = errno;
+
+        fprintf(stderr, "loopback_ll: write-back of inode %llu: %s\n",
+                (unsigned long long)inode->ino, strerror(err));
+
+        pthread_mutex_lock(&lo->lock);
+        inode->wb_error = err;
+        pthread_mutex_unlock(&lo->lock);
+    }
+    close(fi->fh);
+
+    fuse_reply_err(req, 0);
+}
+
+static void
+loopback_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                  struct fuse_file_info *fi)
+{
+    int res, err;
+
+    res = loopback_wb_flush(fi->fh);
+    if ((res == 0) && (err = loopback_release_error(req, ino))) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if ((res == 0) && loopback_data(req)->engine) {
+        loopback_ll_submit(req, datasync ? LOOPBACK_IO_FDATASYNC :
+                                           LOOPBACK_IO_FSYNC,
+                           fi->fh, NULL, 0, 0, loopback_ll_sync_done);
+        return;
+    }
+    if (res == 0) {
+        res = datasync ? fdatasync(fi->fh) : fsync(fi->fh);
+    }
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static void
+loopback_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                     struct fuse_file_info *fi)
+{
+    int fd = dirfd(get_dirp(fi)->dp);
+    int res;
+
+    (void)ino;
+
+    if (datasync) {
+        res = fdatasync(fd);
+    } else {
+        res = fsync(fd);
+    }
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static void
+loopback_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs stbuf;
+
+    if (fstatvfs(loopback_fd(req, ino), &stbuf) == -1) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fuse_reply_statfs(req, &stbuf);
+}
+
+/*
+ * There is no way to get at the extended attributes of a symbolic link
+ * through its O_PATH descriptor without walking a path again, so symbolic
+ * links don't have any.
+ */
+#define LOOPBACK_XATTR_PROLOGUE()                               \
+    struct loopback_inode *inode = loopback_inode(req, ino);    \
+    char procname[LOOPBACK_PROCNAME_MAX];                       \
+                                                                \
+    if (inode->is_symlink) {                                    \
+        fuse_reply_err(req, ENOTSUP);                           \
+        return;                                                 \
+    }                                                           \
+                                                                \
+    loopback_procname(inode->fd, procname);
+
+static void
+loopback_ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                     const char *value, size_t size, int flags)
+{
+    int res;
+
+    LOOPBACK_XATTR_PROLOGUE();
+
+    res = setxattr(procname, name, value, size, flags);
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static void
+loopback_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                     size_t size)
+{
+    char *value = NULL;
+    ssize_t res;
+
+    LOOPBACK_XATTR_PROLOGUE();
+
+    if (size) {
+        value = malloc(size);
+        if (value == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        res = getxattr(procname, name, value, size);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_buf(req, value, res);
+        }
+        free(value);
+    } else {
+        res = getxattr(procname, name, NULL, 0);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_xattr(req, res);
+        }
+    }
+}
+
+static void
+loopback_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    char *list = NULL;
+    ssize_t res;
+
+    LOOPBACK_XATTR_PROLOGUE();
+
+    if (size) {
+        list = malloc(size);
+        if (list == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        res = listxattr(procname, list, size);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_buf(req, list, res);
+        }
+        free(list);
+    } else {
+        res = listxattr(procname, NULL, 0);
+        if (res == -1) {
+            fuse_reply_err(req, errno);
+        } else {
+            fuse_reply_xattr(req, res);
+        }
+    }
+}
+
+static void
+loopback_ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+    int res;
+
+    LOOPBACK_XATTR_PROLOGUE();
+
+    res = removexattr(procname, name);
+
+    fuse_reply_err(req, (res == -1) ? errno : 0);
+}
+
+static struct fuse_lowlevel_ops loopback_ll_oper = {
+#ifdef FUSE_CAP_SPLICE_WRITE
+    .init        = loopback_ll_init,
+#endif
+    .lookup      = loopback_ll_lookup,
+    .forget      = loopback_ll_forget,
+    .getattr     = loopback_ll_getattr,
+    .setattr     = loopback_ll_setattr,
+    .readlink    = loopback_ll_readlink,
+    .mknod       = loopback_ll_mknod,
+    .mkdir       = loopback_ll_mkdir,
+    .unlink      = loopback_ll_unlink,
+    .rmdir       = loopback_ll_rmdir,
+    .symlink     = loopback_ll_symlink,
+    .rename      = loopback_ll_rename,
+    .link        = loopback_ll_link,
+    .open        = loopback_ll_open,
+    .read        = loopback_ll_read,
+    .write       = loopback_ll_write,
+#if FUSE_VERSION >= 29
+    .write_buf   = loopback_ll_write_buf,
+#endif
+    .flush       = loopback_ll_flush,
+    .release     = loopback_ll_release,
+    .fsync       = loopback_ll_fsync,
+    .opendir     = loopback_ll_opendir,
+    .readdir     = loopback_ll_readdir,
+    .releasedir  = loopback_ll_releasedir,
+    .fsyncdir    = loopback_ll_fsyncdir,
+    .statfs      = loopback_ll_statfs,
+    .setxattr    = loopback_ll_setxattr,
+    .getxattr    = loopback_ll_getxattr,
+    .listxattr   = loopback_ll_listxattr,
+    .removexattr = loopback_ll_removexattr,
+    .create      = loopback_ll_create,
+};
+
+#define LOOPBACK_OPT(t, p) { t, offsetof(struct loopback_data, p), 1 }
+
+static const struct fuse_opt loopback_opts[] = {
+    LOOPBACK_OPT("source=%s",          source),
+    LOOPBACK_OPT("timeout=%lf",        entry_timeout),
+    LOOPBACK_OPT("timeout=%lf",        attr_timeout),
+    LOOPBACK_OPT("entry_timeout=%lf",  entry_timeout),
+    LOOPBACK_OPT("attr_timeout=%lf",   attr_timeout),
+    LOOPBACK_OPT("writeback_size=%lu", writeback_size),
+    LOOPBACK_OPT("writeback_age=%u",   writeback_age),
+    LOOPBACK_OPT("io=%s",              io),
+    LOOPBACK_OPT("io_threads=%u",      io_threads),
+    LOOPBACK_OPT("io_depth=%u",        io_depth),
+    FUSE_OPT_END
+};
+
+static int
+loopback_init_root(struct loopback_data *lo)
+{
+    struct stat st;
+
+    lo->root.fd = open(lo->source, O_PATH | O_DIRECTORY);
+    if (lo->root.fd == -1) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", lo->source, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(lo->root.fd, &st) == -1) {
+        fprintf(stderr, "loopback_ll: %s: %s\n", lo->source, strerror(errno));
+        close(lo->root.fd);
+        return -1;
+    }
+
+    lo->root.dev = st.st_dev;
+    lo->root.ino = st.st_ino;
+    lo->root.nlookup = 2; /* never forgotten */
+
+    lo->nbuckets = LOOPBACK_INITIAL_BUCKETS;
+    lo->buckets = calloc(lo->nbuckets, sizeof(struct loopback_inode *));
+    if (lo->buckets == NULL) {
+        close(lo->root.fd);
+        return -1;
+    }
+
+    /* So that a lookup of ".." that lands on the root finds it. */
+    loopback_table_insert(lo, &lo->root);
+
+    return 0;
+}
+
+static void
+loopback_fini_root(struct loopback_data *lo)
+{
+    size_t i;
+
+    for (i = 0; i < lo->nbuckets; i++) {
+        struct loopback_inode *inode, *next;
+        for (inode = lo->buckets[i]; inode; inode = next) {
+            next = inode->next;
+            close(inode->fd);
+            if (inode != &lo->root) {
+                free(inode);
+            }
+        }
+    }
+
+    free(lo->buckets);
+}
+
+/* Every inode the kernel holds on to costs us a descriptor. */
+static void
+loopback_raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static int
+loopback_start_io(struct loopback_data *lo)
+{
+    if (lo->io == NULL) {
+        return 0;
+    }
+
+    lo->engine = loopback_io_create(lo->io, lo->io_threads, lo->io_depth);
+    if (lo->engine == NULL) {
+        fprintf(stderr, "loopback_ll: io=%s: no such engine\n", lo->io);
+        return -1;
+    }
+
+    if (strcmp(lo->io, loopback_io_name(lo->engine))) {
+        fprintf(stderr, "loopback_ll: io=%s not available, using %s\n",
+                lo->io, loopback_io_name(lo->engine));
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct loopback_data lo;
+    struct fuse_chan *ch;
+    char *mountpoint;
+    int multithreaded, foreground;
+    int err = -1;
+
+    memset(&lo, 0, sizeof(lo));
+    pthread_mutex_init(&lo.lock, NULL);
+    lo.entry_timeout = 1.0;
+    lo.attr_timeout = 1.0;
+    lo.writeback_age = 1000;
+    lo.io_threads = 8;
+    lo.io_depth = 64;
+
+    if (fuse_opt_parse(&args, &lo, loopback_opts, NULL) == -1) {
+        return 1;
+    }
+
+    if (lo.source == NULL) {
+        lo.source = strdup("/");
+    }
+
+    loopback_wb_init(lo.writeback_size, lo.writeback_age);
+
+    if (loopback_init_root(&lo) == -1) {
+        return 1;
+    }
+
+    loopback_raise_fd_limit();
+
+    umask(0);
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+                           &foreground) != -1 &&
+        (ch = fuse_mount(mountpoint, &args)) != NULL) {
+        struct fuse_session *se;
+
+        se = fuse_lowlevel_new(&args, &loopback_ll_oper,
+                               sizeof(loopback_ll_oper), &lo);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                /* After daemonizing, which leaves threads behind. */
+                if ((fuse_daemonize(foreground) != -1) &&
+                    (loopback_start_io(&lo) != -1)) {
+                    if (multithreaded) {
+                        err = fuse_session_loop_mt(se);
+                    } else {
+                        err = fuse_session_loop(se);
+                    }
+                    /* Waits for what's in flight to be replied to. */
+                    loopback_io_destroy(lo.engine);
+                }
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+        free(mountpoint);
+    }
+
+    fuse_opt_free_args(&args);
+    loopback_fini_root(&lo);
+    free(lo.source);
+    free(lo.io);
+
+    return err ? 1 : 0;
+}
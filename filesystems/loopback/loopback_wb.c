@@ -0,0 +1,574 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "loopback_wb.h"
+
+struct loopback_wb_extent {
+    off_t   off;
+    size_t  len;
+    size_t  cap;
+    char   *data;
+};
+
+/*
+ * One per file with write-back descriptors open. The extents are sorted,
+ * and neither overlap nor touch: a write that reaches one is merged in.
+ */
+struct loopback_wb_file {
+    struct loopback_wb_file  *next;       /* hash chain */
+    dev_t                     dev;
+    ino_t                     ino;
+    unsigned                  handles;    /* registered descriptors */
+    unsigned                  refs;       /* handles, and calls in flight */
+    pthread_mutex_t           lock;
+    int                       fd;         /* to write out through */
+    int                       nextents;
+    struct loopback_wb_extent extents[LOOPBACK_WB_MAX_EXTENTS];
+    size_t                    bytes;
+    uint64_t                  dirty_since;
+};
+
+#define LOOPBACK_WB_BUCKETS 256
+
+/* The lock covers the tables and the handles, refs and fd fields. */
+static struct {
+    pthread_mutex_t           lock;
+    size_t                    max_bytes;
+    uint64_t                  max_age;    /* in microseconds */
+    volatile unsigned         nfiles;
+    struct loopback_wb_file  *buckets[LOOPBACK_WB_BUCKETS];
+    struct loopback_wb_file **by_fd;
+    int                       nfds;
+} loopback_wb;
+
+static uint64_t
+loopback_wb_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t)tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+static inline unsigned
+loopback_wb_hash(dev_t dev, ino_t ino)
+{
+    return ((unsigned)ino ^ ((unsigned)dev * 31)) % LOOPBACK_WB_BUCKETS;
+}
+
+void
+loopback_wb_init(size_t max_bytes, unsigned max_age_ms)
+{
+    pthread_mutex_init(&loopback_wb.lock, NULL);
+    loopback_wb.max_bytes = max_bytes;
+    loopback_wb.max_age = (uint64_t)max_age_ms * 1000;
+}
+
+int
+loopback_wb_enabled(void)
+{
+    return loopback_wb.max_bytes != 0;
+}
+
+/* Must be called with loopback_wb.lock held. */
+static struct loopback_wb_file *
+loopback_wb_find(dev_t dev, ino_t ino)
+{
+    struct loopback_wb_file *f;
+
+    for (f = loopback_wb.buckets[loopback_wb_hash(dev, ino)]; f; f = f->next) {
+        if ((f->ino == ino) && (f->dev == dev)) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+/* Must be called with loopback_wb.lock held. */
+static void
+loopback_wb_unref_locked(struct loopback_wb_file *f)
+{
+    if (--f->refs == 0) {
+        pthread_mutex_destroy(&f->lock);
+        free(f);
+    }
+}
+
+static void
+loopback_wb_put(struct loopback_wb_file *f)
+{
+    pthread_mutex_lock(&loopback_wb.lock);
+    loopback_wb_unref_locked(f);
+    pthread_mutex_unlock(&loopback_wb.lock);
+}
+
+static struct loopback_wb_file *
+loopback_wb_get_ino(dev_t dev, ino_t ino)
+{
+    struct loopback_wb_file *f;
+
+    if (loopback_wb.nfiles == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&loopback_wb.lock);
+    f = loopback_wb_find(dev, ino);
+    if (f) {
+        f->refs++;
+    }
+    pthread_mutex_unlock(&loopback_wb.lock);
+
+    return f;
+}
+
+/*
+ * Returns the file fd refers to, if anything at all is being written back;
+ * fd itself needn't be registered, and registered says whether it is.
+ */
+static struct loopback_wb_file *
+loopback_wb_get_fd(int fd, int *registered)
+{
+    struct loopback_wb_file *f = NULL;
+    struct stat st;
+
+    *registered = 0;
+
+    if (loopback_wb.nfiles == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&loopback_wb.lock);
+    if ((fd >= 0) && (fd < loopback_wb.nfds)) {
+        f = loopback_wb.by_fd[fd];
+        if (f) {
+            f->refs++;
+            *registered = 1;
+        }
+    }
+    pthread_mutex_unlock(&loopback_wb.lock);
+
+    if ((f == NULL) && (fstat(fd, &st) == 0)) {
+        f = loopback_wb_get_ino(st.st_dev, st.st_ino);
+    }
+
+    return f;
+}
+
+/*
+ * Writes out every extent, in order. Those that fail stay, for the next
+ * attempt. Must be called with f->lock held.
+ */
+static int
+loopback_wb_flush_locked(struct loopback_wb_file *f)
+{
+    int i, res = 0;
+
+    for (i = 0; i < f->nextents; i++) {
+        struct loopback_wb_extent *x = &f->extents[i];
+
+        while (x->len) {
+            ssize_t n = pwrite(f->fd, x->data, x->len, x->off);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                res = -1;
+                goto out;
+            }
+            if ((size_t)n < x->len) {
+                memmove(x->data, x->data + n, x->len - n);
+            }
+            x->off += n;
+            x->len -= n;
+            f->bytes -= n;
+        }
+
+        free(x->data);
+    }
+
+out:
+    memmove(&f->extents[0], &f->extents[i],
+            (f->nextents - i) * sizeof(struct loopback_wb_extent));
+    f->nextents -= i;
+
+    if (f->nextents == 0) {
+        f->dirty_since = 0;
+    }
+
+    return res;
+}
+
+/*
+ * Merges a write into the extents. Fails with ENOSPC if it needs an extent
+ * of its own and they're all taken. Must be called with f->lock held.
+ */
+static int
+loopback_wb_insert_locked(struct loopback_wb_file *f, const char *buf,
+                          size_t size, off_t offset)
+{
+    struct loopback_wb_extent *x = f->extents, *first, *last;
+    off_t end = offset + size, noff, nend;
+    size_t nlen, old;
+    char *data;
+    int i, j, k;
+
+    /* [i, j) are the extents this write overlaps or touches. */
+    for (i = 0; (i < f->nextents) && (x[i].off + (off_t)x[i].len < offset);
+         i++) {
+        /* nothing */
+    }
+    for (j = i; (j < f->nextents) && (x[j].off <= end); j++) {
+        /* nothing */
+    }
+
+    if (i == j) {
+        if (f->nextents == LOOPBACK_WB_MAX_EXTENTS) {
+            errno = ENOSPC;
+            return -1;
+        }
+        data = malloc(size);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(data, buf, size);
+        memmove(&x[i + 1], &x[i],
+                (f->nextents - i) * sizeof(struct loopback_wb_extent));
+        x[i].off = offset;
+        x[i].len = size;
+        x[i].cap = size;
+        x[i].data = data;
+        f->nextents++;
+        f->bytes += size;
+        return 0;
+    }
+
+    first = &x[i];
+    last = &x[j - 1];
+    noff = (offset < first->off) ? offset : first->off;
+    nend = (end > last->off + (off_t)last->len) ?
+               end : last->off + (off_t)last->len;
+    nlen = nend - noff;
+
+    if ((noff == first->off) && (nlen <= first->cap)) {
+        data = first->data;
+    } else if (noff == first->off) {
+        /* Growing at the end, as appends do: leave room for more. */
+        size_t cap = (nlen > 2 * first->cap) ? nlen : 2 * first->cap;
+        data = realloc(first->data, cap);
+        if (data == NULL) {
+            return -1;
+        }
+        first->cap = cap;
+    } else {
+        data = malloc(nlen);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(data + (first->off - noff), first->data, first->len);
+        free(first->data);
+        first->cap = nlen;
+    }
+
+    old = first->len;
+    for (k = i + 1; k < j; k++) {
+        memcpy(data + (x[k].off - noff), x[k].data, x[k].len);
+        old += x[k].len;
+        free(x[k].data);
+    }
+    memcpy(data + (offset - noff), buf, size);
+
+    first->off = noff;
+    first->len = nlen;
+    first->data = data;
+
+    memmove(&x[i + 1], &x[j],
+            (f->nextents - j) * sizeof(struct loopback_wb_extent));
+    f->nextents -= j - i - 1;
+    f->bytes += nlen - old;
+
+    return 0;
+}
+
+int
+loopback_wb_open(int fd)
+{
+    struct loopback_wb_file *f;
+    struct stat st;
+    int flags;
+
+    if (!loopback_wb_enabled()) {
+        return 0;
+    }
+
+    /*
+     * Appends go wherever the end of the file is at the time, not where
+     * the kernel thought it was; they're written through.
+     */
+    flags = fcntl(fd, F_GETFL);
+    if ((flags == -1) || ((flags & O_ACCMODE) == O_RDONLY) ||
+        (flags & O_APPEND)) {
+        return 0;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&loopback_wb.lock);
+
+    if (fd >= loopback_wb.nfds) {
+        int nfds = (fd < 64) ? 128 : 2 * fd;
+        struct loopback_wb_file **by_fd;
+
+        by_fd = realloc(loopback_wb.by_fd,
+                        nfds * sizeof(struct loopback_wb_file *));
+        if (by_fd == NULL) {
+            pthread_mutex_unlock(&loopback_wb.lock);
+            return -1;
+        }
+        memset(by_fd + loopback_wb.nfds, 0,
+               (nfds - loopback_wb.nfds) * sizeof(struct loopback_wb_file *));
+        loopback_wb.by_fd = by_fd;
+        loopback_wb.nfds = nfds;
+    }
+
+    f = loopback_wb_find(st.st_dev, st.st_ino);
+    if (f == NULL) {
+        unsigned h = loopback_wb_hash(st.st_dev, st.st_ino);
+
+        f = calloc(1, sizeof(struct loopback_wb_file));
+        if (f == NULL) {
+            pthread_mutex_unlock(&loopback_wb.lock);
+            return -1;
+        }
+        pthread_mutex_init(&f->lock, NULL);
+        f->dev = st.st_dev;
+        f->ino = st.st_ino;
+        f->fd = fd;
+        f->next = loopback_wb.buckets[h];
+        loopback_wb.buckets[h] = f;
+        loopback_wb.nfiles++;
+    }
+
+    f->handles++;
+    f->refs++;
+    loopback_wb.by_fd[fd] = f;
+
+    pthread_mutex_unlock(&loopback_wb.lock);
+
+    return 0;
+}
+
+int
+loopback_wb_release(int fd)
+{
+    struct loopback_wb_file *f, **pp;
+    int i, res;
+
+    if (loopback_wb.nfiles == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&loopback_wb.lock);
+
+    f = ((fd >= 0) && (fd < loopback_wb.nfds)) ? loopback_wb.by_fd[fd] : NULL;
+    if (f == NULL) {
+        pthread_mutex_unlock(&loopback_wb.lock);
+        return 0;
+    }
+
+    loopback_wb.by_fd[fd] = NULL;
+    f->handles--;
+
+    pthread_mutex_lock(&f->lock);
+
+    res = loopback_wb_flush_locked(f);
+
+    if (f->handles == 0) {
+        /* Whatever couldn't be written now never will be. */
+        for (i = 0; i < f->nextents; i++) {
+            free(f->extents[i].data);
+        }
+        f->nextents = 0;
+        f->bytes = 0;
+        f->fd = -1;
+
+        pp = &loopback_wb.buckets[loopback_wb_hash(f->dev, f->ino)];
+        while (*pp != f) {
+            pp = &(*pp)->next;
+        }
+        *pp = f->next;
+        loopback_wb.nfiles--;
+    } else if (f->fd == fd) {
+        for (i = 0; i < loopback_wb.nfds; i++) {
+            if (loopback_wb.by_fd[i] == f) {
+                f->fd = i;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&f->lock);
+
+    loopback_wb_unref_locked(f);
+
+    pthread_mutex_unlock(&loopback_wb.lock);
+
+    return res;
+}
+
+ssize_t
+loopback_wb_pread(int fd, char *buf, size_t size, off_t offset)
+{
+    struct loopback_wb_file *f;
+    int i, registered, res = 0;
+
+    f = loopback_wb_get_fd(fd, &registered);
+
+    if (f) {
+        /*
+         * Read your writes: those in range go out first, and so do those
+         * past it, which may make what's in range a hole, not the end.
+         */
+        pthread_mutex_lock(&f->lock);
+        for (i = 0; i < f->nextents; i++) {
+            struct loopback_wb_extent *x = &f->extents[i];
+            if (offset < x->off + (off_t)x->len) {
+                res = loopback_wb_flush_locked(f);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&f->lock);
+        loopback_wb_put(f);
+        if (res == -1) {
+            return -1;
+        }
+    }
+
+    return pread(fd, buf, size, offset);
+}
+
+ssize_t
+loopback_wb_pwrite(int fd, const char *buf, size_t size, off_t offset)
+{
+    struct loopback_wb_file *f;
+    int registered, res;
+    uint64_t now;
+
+    f = loopback_wb_get_fd(fd, &registered);
+
+    if (f == NULL) {
+        return pwrite(fd, buf, size, offset);
+    }
+
+    pthread_mutex_lock(&f->lock);
+
+    if (!registered || (size >= loopback_wb.max_bytes)) {
+        /* Not ours to buffer, or too big to: after what's pending. */
+        res = loopback_wb_flush_locked(f);
+        pthread_mutex_unlock(&f->lock);
+        loopback_wb_put(f);
+        return (res == -1) ? -1 : pwrite(fd, buf, size, offset);
+    }
+
+    now = loopback_wb_now();
+    res = 0;
+
+    if ((f->bytes + size > loopback_wb.max_bytes) ||
+        (f->dirty_since && (now - f->dirty_since >= loopback_wb.max_age))) {
+        res = loopback_wb_flush_locked(f);
+    }
+
+    if (res == 0) {
+        res = loopback_wb_insert_locked(f, buf, size, offset);
+        if ((res == -1) && (errno == ENOSPC)) {
+            res = loopback_wb_flush_locked(f);
+            if (res == 0) {
+                res = loopback_wb_insert_locked(f, buf, size, offset);
+            }
+        }
+    }
+
+    if ((res == 0) && (f->dirty_since == 0)) {
+        f->dirty_since = now;
+    }
+
+    pthread_mutex_unlock(&f->lock);
+    loopback_wb_put(f);
+
+    return (res == -1) ? -1 : (ssize_t)size;
+}
+
+int
+loopback_wb_flush(int fd)
+{
+    struct loopback_wb_file *f;
+    int registered, res;
+
+    f = loopback_wb_get_fd(fd, &registered);
+    if (f == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&f->lock);
+    res = loopback_wb_flush_locked(f);
+    pthread_mutex_unlock(&f->lock);
+    loopback_wb_put(f);
+
+    return res;
+}
+
+int
+loopback_wb_sync(dev_t dev, ino_t ino)
+{
+    struct loopback_wb_file *f = loopback_wb_get_ino(dev, ino);
+    int res = 0;
+
+    if (f == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&f->lock);
+    if (f->nextents) {
+        res = loopback_wb_flush_locked(f);
+        if (res == 0) {
+            res = 1;
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+    loopback_wb_put(f);
+
+    return res;
+}
+
+int
+loopback_wb_sync_path(const char *path)
+{
+    struct stat st;
+
+    if ((loopback_wb.nfiles == 0) || (lstat(path, &st) == -1)) {
+        return 0;
+    }
+
+    return loopback_wb_sync(st.st_dev, st.st_ino);
+}
@@ -0,0 +1,76 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+
+*/
+
+#ifndef _LOOPBACK_WB_H
+#define _LOOPBACK_WB_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Write-back caching for the loopback file systems.
+ *
+ * Without it, every write request becomes a pwrite() on the backing file
+ * right away, so a program writing a log a line at a time costs one host
+ * system call per line. With it, writes to a file are gathered in memory,
+ * with adjacent and overlapping ones merged into extents, and written out
+ * when the file is flushed, synced or released, or once there's
+ * writeback_size bytes of them, or the oldest is writeback_age ms old.
+ *
+ * Buffered data belongs to the file, not to the descriptor it came
+ * through, so that every open of a file sees the same contents: reads of
+ * a range that is still buffered, stats, truncations and opens write out
+ * what's pending first.
+ *
+ * Everything is keyed by the backing descriptor, which is what the
+ * loopbacks keep in fi->fh; descriptors that were never registered with
+ * loopback_wb_open() are written through.
+ *
+ * Nothing runs in the background: a file that is written to and then left
+ * open and idle keeps its last writes until something touches it.
+ *
+ * Like the system calls they stand in for, these return -1 and set errno
+ * on failure.
+ */
+
+#define LOOPBACK_WB_MAX_EXTENTS 64
+
+/*
+ * Must be called once, before anything else. Enables write-back caching;
+ * with max_bytes 0, it stays off, and all the calls below fall through to
+ * the host straight away.
+ */
+extern void    loopback_wb_init(size_t max_bytes, unsigned max_age_ms);
+extern int     loopback_wb_enabled(void);
+
+/* Registers a newly opened descriptor; read-only ones are left alone. */
+extern int     loopback_wb_open(int fd);
+
+/* Writes out, and forgets about, fd; call before closing it. */
+extern int     loopback_wb_release(int fd);
+
+extern ssize_t loopback_wb_pread(int fd, char *buf, size_t size,
+                                 off_t offset);
+extern ssize_t loopback_wb_pwrite(int fd, const char *buf, size_t size,
+                                  off_t offset);
+
+/* Writes out what's pending for the file fd refers to. */
+extern int     loopback_wb_flush(int fd);
+
+/*
+ * Writes out what's pending for the file with the given device and inode
+ * numbers. Returns 1 if there was anything, so that a stat taken before is
+ * now out of date, and 0 if there wasn't.
+ */
+extern int     loopback_wb_sync(dev_t dev, ino_t ino);
+
+/* As above, for a path, which is only stat'ed if anything is pending. */
+extern int     loopback_wb_sync_path(const char *path);
+
+#endif /* _LOOPBACK_WB_H */
@@ -35,12 +35,13 @@
 
 #include <cassert>
 #include <vector>
-#include <pcrecpp.h>
 
 #include <fuse.h>
 
 #include "procfs_displays.h"
 #include "procfs_proc_info.h"
+#include "procfs_router.h"
+#include "procfs_snapshot.h"
 #include "procfs_windows.h"
 #include "sequencegrab/procfs_sequencegrab.h"
 
@@ -76,7 +77,13 @@ static pthread_mutex_t  display_lock;
 static int              display_busy = 0;
 static CFMutableDataRef display_png = (CFMutableDataRef)0;
 
-static pcrecpp::RE *valid_process_pattern = new pcrecpp::RE("/(\\d+)");
+/* the dispatcher tables, compiled at startup */
+static procfs_router_t *procfs_file_router = (procfs_router_t *)0;
+static procfs_router_t *procfs_directory_router = (procfs_router_t *)0;
+static procfs_router_t *procfs_link_router = (procfs_router_t *)0;
+
+/* generated files, rendered at open */
+static procfs_snapshot_cache_t *procfs_snapshots = (procfs_snapshot_cache_t *)0;
 
 typedef struct {
     char x;
@@ -239,7 +246,6 @@ typedef int (*procfs_readlink_handler_t)(procfs_dispatcher_entry_t  e,
 typedef struct procfs_dispatcher_entry {
     int                         flag;
     char                       *pattern;
-    pcrecpp::RE                *compiled_pattern;
     int                         argc;
     procfs_open_handler_t       open;
     procfs_release_handler_t    release;
@@ -330,7 +336,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         0,                                   \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         argc,                                \
         procfs_open_##openp,                 \
         procfs_release_##releasep,           \
@@ -348,7 +353,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         flag,                                \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         argc,                                \
         procfs_open_##openp,                 \
         procfs_release_##releasep,           \
@@ -366,7 +370,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         0,                                   \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         argc,                                \
         procfs_open_eisdir,                  \
         procfs_release_eisdir,               \
@@ -384,7 +387,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         0,                                   \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         0,                                   \
         procfs_open_eisdir,                  \
         procfs_release_eisdir,               \
@@ -402,7 +404,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         0,                                   \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         argc,                                \
         procfs_open_##openp,                 \
         procfs_release_##releasep,           \
@@ -420,7 +421,6 @@ procfs_readlink_##handler(procfs_dispatcher_entry_t  e,      \
     {                                        \
         0,                                   \
         pattern,                             \
-        new pcrecpp::RE(pattern),            \
         argc,                                \
         procfs_open_default_file,            \
         procfs_release_default_file,         \
@@ -1109,7 +1109,7 @@ procfs_directory_table[] = {
     )
 
     DECL_DIRECTORY(
-        "/(\\d+)/task/threads/([a-f\\d])+",
+        "/(\\d+)/task/threads/([a-f\\d]+)",
         2,
         default_directory,
         default_directory,
@@ -4427,13 +4427,6 @@ procfs_init(struct fuse_conn_info *conn)
         }
     }
 
-    total_file_patterns =
-        sizeof(procfs_file_table)/sizeof(struct procfs_dispatcher_entry);
-    total_directory_patterns =
-        sizeof(procfs_directory_table)/sizeof(struct procfs_dispatcher_entry);
-    total_link_patterns =
-        sizeof(procfs_link_table)/sizeof(struct procfs_dispatcher_entry);
-   
     pthread_mutex_init(&camera_lock, NULL);
     pthread_mutex_init(&display_lock, NULL);
 
@@ -4454,120 +4447,136 @@ procfs_destroy(void *arg)
     CFRelease(camera_tiff);
 }
 
+/*
+ * Paths below a process directory go away with the process, whatever the
+ * table entry they match.
+ */
+static int
+procfs_process_exists(const char *path)
+{
+    char *ep;
+    pid_t check_pid;
+
+    if ((path[0] != '/') || (path[1] < '0') || (path[1] > '9')) {
+        return 1;
+    }
+
+    check_pid = strtol(path + 1, &ep, 10);
+    if ((*ep != '/') && (*ep != '\0')) {
+        return 1;
+    }
+
+    return (getpgid(check_pid) != -1);
+}
+
+static procfs_router_t *
+procfs_compile_table(struct procfs_dispatcher_entry *table, int count)
+{
+    int i;
+    procfs_router_t *router = procfs_router_create();
+
+    for (i = 0; i < count; i++) {
+        procfs_dispatcher_entry_t e = &table[i];
+        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {
+            continue;
+        }
+        if (procfs_router_add(router, e->pattern, i) != e->argc) {
+            fprintf(stderr, "procfs: cannot compile pattern %s\n",
+                    e->pattern);
+            exit(1);
+        }
+    }
+
+    return router;
+}
+
+static procfs_dispatcher_entry_t
+procfs_route(procfs_router_t                *router,
+             struct procfs_dispatcher_entry *table,
+             const char                     *path,
+             procfs_route_match_t           *match)
+{
+    if (procfs_router_match(router, path, match)) {
+        return &table[match->value];
+    }
+
+    return (procfs_dispatcher_entry_t)0;
+}
+
+/*
+ * Files with the default open handler are generated by their read handler
+ * in one go, so they are rendered once at open and then read from there.
+ * The others (screenshots, the window identifier) keep state of their own
+ * in fi->fh.
+ */
+#define PROCFS_ENTRY_SNAPSHOTS(e) \
+    (((e)->open == procfs_open_default_file) && \
+     ((e)->read != procfs_read_einval))
+
+struct procfs_render_args {
+    procfs_dispatcher_entry_t  e;
+    const char               **argv;
+    struct fuse_file_info     *fi;
+};
+
+static int
+procfs_render_entry(void *arg, char *buf, size_t size)
+{
+    struct procfs_render_args *args = (struct procfs_render_args *)arg;
+
+    return args->e->read(args->e, args->argv, buf, size, 0, args->fi);
+}
+
 #define PROCFS_OPEN_RELEASE_COMMON()                                          \
-    int i;                                                                    \
     procfs_dispatcher_entry_t e;                                              \
-    string arg1, arg2, arg3;                                                  \
-    const char *real_argv[PROCFS_MAX_ARGS];                                   \
+    procfs_route_match_t m;                                                   \
                                                                               \
-    if (valid_process_pattern->PartialMatch(path, &arg1)) {                   \
-        pid_t check_pid = atoi(arg1.c_str());                                 \
-        if (getpgid(check_pid) == -1) {                                       \
-            return -ENOENT;                                                   \
-        }                                                                     \
+    e = procfs_route(procfs_file_router, procfs_file_table, path, &m);        \
+    if (!e) {                                                                 \
+        e = procfs_route(procfs_link_router, procfs_link_table, path, &m);    \
     }                                                                         \
-                                                                              \
-    for (i = 0; i < PROCFS_MAX_ARGS; i++) {                                   \
-        real_argv[i] = (char *)0;                                             \
+    if (!e) {                                                                 \
+        return -ENOENT;                                                       \
     }                                                                         \
-                                                                              \
-    for (i = 0; i < total_file_patterns; i++) {                               \
-        e = &procfs_file_table[i];                                            \
-        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {                 \
-            continue;                                                         \
-        }                                                                     \
-        switch (e->argc) {                                                    \
-        case 0:                                                               \
-            if (e->compiled_pattern->FullMatch(path)) {                       \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 1:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {                \
-                real_argv[0] = arg1.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 2:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {         \
-                real_argv[0] = arg1.c_str();                                  \
-                real_argv[1] = arg2.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 3:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {  \
-                real_argv[0] = arg1.c_str();                                  \
-                real_argv[1] = arg2.c_str();                                  \
-                real_argv[2] = arg3.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        default:                                                              \
-            break;                                                            \
-        }                                                                     \
-    }                                                                         \
-                                                                              \
-    for (i = 0; i < total_link_patterns; i++) {                               \
-        e = &procfs_link_table[i];                                            \
-        switch (e->argc) {                                                    \
-        case 0:                                                               \
-            if (e->compiled_pattern->FullMatch(path)) {                       \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 1:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {                \
-                real_argv[0] = arg1.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 2:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {         \
-                real_argv[0] = arg1.c_str();                                  \
-                real_argv[1] = arg2.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        case 3:                                                               \
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {  \
-                real_argv[0] = arg1.c_str();                                  \
-                real_argv[1] = arg2.c_str();                                  \
-                real_argv[2] = arg3.c_str();                                  \
-                goto out;                                                     \
-            }                                                                 \
-            break;                                                            \
-                                                                              \
-        default:                                                              \
-            break;                                                            \
-        }                                                                     \
-    }                                                                         \
-                                                                              \
-    return -ENOENT;                                                           \
-                                                                              \
-out:                                                                          \
 
 static int
 procfs_open(const char *path, struct fuse_file_info *fi)
 {
+    int ret;
+
+    if (!procfs_process_exists(path)) {
+        return -ENOENT;
+    }
+
     PROCFS_OPEN_RELEASE_COMMON()
 
-    return e->open(e, real_argv, path, fi);
+    ret = e->open(e, m.argv, path, fi);
+
+    if ((ret == 0) && PROCFS_ENTRY_SNAPSHOTS(e)) {
+        procfs_snapshot_t *snap;
+        struct procfs_render_args args = { e, m.argv, fi };
+        /* If this fails, reads go to the read handler, and fail there. */
+        if (procfs_snapshot_open(procfs_snapshots, path, procfs_render_entry,
+                                 &args, &snap) == 0) {
+            fi->fh = (uint64_t)(uintptr_t)snap;
+        }
+    }
+
+    return ret;
 }
 
 static int
 procfs_release(const char *path, struct fuse_file_info *fi)
 {
+    /* No process check here: the snapshot must go even if the process has. */
     PROCFS_OPEN_RELEASE_COMMON()
 
-    return e->release(e, real_argv, path, fi);
+    if (PROCFS_ENTRY_SNAPSHOTS(e) && fi->fh) {
+        procfs_snapshot_release((procfs_snapshot_t *)(uintptr_t)fi->fh);
+        fi->fh = 0;
+    }
+
+    return e->release(e, m.argv, path, fi);
 }
 
 static int
@@ -4585,146 +4594,26 @@ procfs_releasedir(const char *path, struct fuse_file_info *fi)
 static int
 procfs_getattr(const char *path, struct stat *stbuf)
 {
-    int i;
     procfs_dispatcher_entry_t e;
-    string arg1, arg2, arg3;
-    const char *real_argv[PROCFS_MAX_ARGS];
-
-    if (valid_process_pattern->PartialMatch(path, &arg1)) {
-        pid_t check_pid = atoi(arg1.c_str());
-        if (getpgid(check_pid) == -1) {
-            return -ENOENT;
-        }
-    }
+    procfs_route_match_t m;
 
-    for (i = 0; i < PROCFS_MAX_ARGS; i++) {
-        real_argv[i] = (char *)0;
+    if (!procfs_process_exists(path)) {
+        return -ENOENT;
     }
 
-    for (i = 0; i < total_directory_patterns; i++) {
-        e = &procfs_directory_table[i];
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-
-        case 3:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                real_argv[2] = arg3.c_str();
-                goto out;
-            }
-            break;
-
-        default:
-            break;
-        }
+    e = procfs_route(procfs_directory_router, procfs_directory_table, path,
+                     &m);
+    if (!e) {
+        e = procfs_route(procfs_file_router, procfs_file_table, path, &m);
     }
-
-    for (i = 0; i < total_file_patterns; i++) {
-        e = &procfs_file_table[i];
-        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {
-            continue;
-        }
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-
-        case 3:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                real_argv[2] = arg3.c_str();
-                goto out;
-            }
-            break;
-
-        default:
-            break;
-        }
+    if (!e) {
+        e = procfs_route(procfs_link_router, procfs_link_table, path, &m);
     }
-
-    for (i = 0; i < total_link_patterns; i++) {
-        e = &procfs_link_table[i];
-        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {
-            continue;
-        }
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-
-        case 3:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                real_argv[2] = arg3.c_str();
-                goto out;
-            }
-            break;
-
-        default:
-            break;
-        }
+    if (!e) {
+        return -ENOENT;
     }
 
-    return -ENOENT;
-
-out:
-    return e->getattr(e, real_argv, stbuf);
+    return e->getattr(e, m.argv, stbuf);
 }
 
 
@@ -4735,66 +4624,20 @@ procfs_readdir(const char             *path,
                off_t                  offset,
                struct fuse_file_info *fi)
 {
-    int i;
     procfs_dispatcher_entry_t e;
-    string arg1, arg2, arg3;
-    const char *real_argv[PROCFS_MAX_ARGS];
-
-    if (valid_process_pattern->PartialMatch(path, &arg1)) {
-        pid_t check_pid = atoi(arg1.c_str());
-        if (getpgid(check_pid) == -1) {
-            return -ENOENT;
-        }
-    }
+    procfs_route_match_t m;
 
-    for (i = 0; i < PROCFS_MAX_ARGS; i++) {
-        real_argv[i] = (char *)0;
+    if (!procfs_process_exists(path)) {
+        return -ENOENT;
     }
 
-    for (i = 0; i < total_directory_patterns; i++) {
-
-        e = &procfs_directory_table[i];
-
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-
-        case 3:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                real_argv[2] = arg3.c_str();
-                goto out;
-            }
-            break;
-
-        default:
-            return -ENOENT;
-        }
+    e = procfs_route(procfs_directory_router, procfs_directory_table, path,
+                     &m);
+    if (!e) {
+        return -ENOENT;
     }
 
-    return -ENOENT;
-
-out:
-    (void)e->readdir(e, real_argv, buf, filler, offset, fi);
+    (void)e->readdir(e, m.argv, buf, filler, offset, fi);
 
     (void)procfs_populate_directory(e->content_files, e->content_directories,
                                     buf, filler, offset, fi);
@@ -4805,112 +4648,35 @@ out:
 static int
 procfs_readlink(const char *path, char *buf, size_t size)
 {
-    int i;
     procfs_dispatcher_entry_t e;
-    string arg1, arg2, arg3;
-    const char *real_argv[PROCFS_MAX_ARGS];
-
-    for (i = 0; i < PROCFS_MAX_ARGS; i++) {
-        real_argv[i] = (char *)0;
-    }
-
-    for (i = 0; i < total_link_patterns; i++) {
+    procfs_route_match_t m;
 
-        e = &procfs_link_table[i];
-
-        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {
-            continue;
-        }
-
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-        }
+    e = procfs_route(procfs_link_router, procfs_link_table, path, &m);
+    if (!e) {
+        return -ENOENT;
     }
 
-    return -ENOENT;
-
-out:
-    return e->readlink(e, real_argv, buf, size);
+    return e->readlink(e, m.argv, buf, size);
 }
 
 static int
 procfs_read(const char *path, char *buf, size_t size, off_t offset,
             struct fuse_file_info *fi)
 {
-    int i;
     procfs_dispatcher_entry_t e;
-    string arg1, arg2, arg3;
-    const char *real_argv[PROCFS_MAX_ARGS];
+    procfs_route_match_t m;
 
-    for (i = 0; i < PROCFS_MAX_ARGS; i++) {
-        real_argv[i] = (char *)0;
+    e = procfs_route(procfs_file_router, procfs_file_table, path, &m);
+    if (!e) {
+        return -EIO;
     }
 
-    for (i = 0; i < total_file_patterns; i++) {
-
-        e = &procfs_file_table[i];
-
-        if ((e->flag & PROCFS_FLAG_ISDOTFILE) & !procfs_ui) {
-            continue;
-        }
-
-        switch (e->argc) {
-        case 0:
-            if (e->compiled_pattern->FullMatch(path)) {
-                goto out;
-            }
-            break;
-
-        case 1:
-            if (e->compiled_pattern->FullMatch(path, &arg1)) {
-                real_argv[0] = arg1.c_str();
-                goto out;
-            }
-            break;
-
-        case 2:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                goto out;
-            }
-            break;
-
-        case 3:
-            if (e->compiled_pattern->FullMatch(path, &arg1, &arg2, &arg3)) {
-                real_argv[0] = arg1.c_str();
-                real_argv[1] = arg2.c_str();
-                real_argv[2] = arg3.c_str();
-                goto out;
-            }
-            break;
-    
-        default:
-            return -EIO;
-        }
-    }   
+    if (PROCFS_ENTRY_SNAPSHOTS(e) && fi->fh) {
+        return procfs_snapshot_read((procfs_snapshot_t *)(uintptr_t)fi->fh,
+                                    buf, size, offset);
+    }
 
-    return -EIO;
-    
-out:    
-    return e->read(e, real_argv, buf, size, offset, fi);
+    return e->read(e, m.argv, buf, size, offset, fi);
 }
 
 static int
@@ -4960,6 +4726,16 @@ main(int argc, char *argv[])
         extra_opts = def_opts_ui;
     }
 
+    /*
+     * By default, a snapshot belongs to the open file it was taken for. With
+     * a time to live (in milliseconds), opens of a file in quick succession
+     * share it.
+     */
+    char *ttl = getenv("MACFUSE_PROCFS_SNAPSHOT_TTL");
+    procfs_snapshots = procfs_snapshot_cache_create(ttl ? atoi(ttl) : 0);
+    if (!procfs_snapshots)
+        return -1;
+
     argc++;
     new_argv = (char **)malloc(sizeof(char *) * argc);
     if (!new_argv)
@@ -4969,7 +4745,28 @@ main(int argc, char *argv[])
     }
     argv[i] = extra_opts;
 
+    total_file_patterns =
+        sizeof(procfs_file_table)/sizeof(struct procfs_dispatcher_entry);
+    total_directory_patterns =
+        sizeof(procfs_directory_table)/sizeof(struct procfs_dispatcher_entry);
+    total_link_patterns =
+        sizeof(procfs_link_table)/sizeof(struct procfs_dispatcher_entry);
+
+    procfs_file_router =
+        procfs_compile_table(procfs_file_table, total_file_patterns);
+    procfs_directory_router =
+        procfs_compile_table(procfs_directory_table, total_directory_patterns);
+    procfs_link_router =
+        procfs_compile_table(procfs_link_table, total_link_patterns);
+
     procfs_oper_populate(&procfs_oper);
 
-    return fuse_main(argc, argv, &procfs_oper, NULL);
+    i = fuse_main(argc, argv, &procfs_oper, NULL);
+
+    procfs_router_destroy(procfs_file_router);
+    procfs_router_destroy(procfs_directory_router);
+    procfs_router_destroy(procfs_link_router);
+    procfs_snapshot_cache_destroy(procfs_snapshots);
+
+    return i;
 }
@@ -0,0 +1,869 @@
+/*
+ * procfs as a MacFUSE file system for Mac OS X
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "procfs_router.h"
+
+/*
+ * Patterns are only parsed when they are added, so the containers below are
+ * fine to use there. procfs_router_match() must not allocate.
+ */
+
+#define PROCFS_ROUTER_MAX_EXPANSION 4096
+
+enum {
+    EDGE_LITERAL, /* the whole segment, possibly with a captured part */
+    EDGE_CLASS,   /* prefix, a run of a character class, suffix */
+    EDGE_TAIL,    /* the rest of the path; always ends a route */
+};
+
+struct procfs_route_node;
+
+struct procfs_route_edge {
+    int                       kind;
+    std::string               text;    /* literal, class prefix, or glob */
+    std::string               suffix;  /* class suffix */
+    uint32_t                  set[8];  /* class members */
+    int                       capture;
+    size_t                    cap_off; /* captured part of a literal */
+    size_t                    cap_len;
+    int                       value;   /* tails only */
+    struct procfs_route_node *child;   /* literals and classes only */
+};
+
+struct procfs_route_node {
+    int                                   value;     /* -1 if none */
+    int                                   min_value; /* over the subtree */
+    std::vector<struct procfs_route_edge> literals;  /* by length, text */
+    std::vector<struct procfs_route_edge> others;    /* in order added */
+};
+
+struct procfs_router {
+    struct procfs_route_node *root;
+};
+
+/* Pattern parsing */
+
+enum {
+    TOKEN_CHAR,   /* a literal character */
+    TOKEN_CLASS,  /* one character out of a set */
+    TOKEN_RUN,    /* one or more characters out of a set */
+    TOKEN_GROUP,  /* a parenthesized alternation of char/class tokens */
+    TOKEN_ANY,    /* .* */
+    TOKEN_ANY1,   /* .+ */
+};
+
+struct procfs_token {
+    int                                     type;
+    char                                    c;
+    uint32_t                                set[8];
+    std::vector<std::vector<procfs_token> > alternatives;
+};
+
+static inline void
+set_add(uint32_t set[8], unsigned char c)
+{
+    set[c >> 5] |= (1U << (c & 31));
+}
+
+static inline int
+set_has(const uint32_t set[8], unsigned char c)
+{
+    return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static void
+set_add_digits(uint32_t set[8])
+{
+    for (unsigned char c = '0'; c <= '9'; c++) {
+        set_add(set, c);
+    }
+}
+
+/* Splits s on sep wherever sep is outside of parentheses and brackets. */
+static int
+split_toplevel(const std::string &s, char sep, std::vector<std::string> &out)
+{
+    int depth = 0, inclass = 0;
+    size_t start = 0;
+
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '\\') {
+            i++;
+        } else if (inclass) {
+            if (c == ']') {
+                inclass = 0;
+            }
+        } else if (c == '[') {
+            inclass = 1;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            if (--depth < 0) {
+                return -1;
+            }
+        } else if (c == sep && depth == 0) {
+            out.push_back(s.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+
+    if (depth || inclass) {
+        return -1;
+    }
+
+    out.push_back(s.substr(start));
+
+    return 0;
+}
+
+static int
+parse_tokens(const std::string &s, std::vector<procfs_token> &tokens,
+             int ingroup)
+{
+    for (size_t i = 0; i < s.size(); i++) {
+
+        procfs_token t;
+        t.type = TOKEN_CHAR;
+        t.c = s[i];
+        memset(t.set, 0, sizeof(t.set));
+
+        if (s[i] == '\\') {
+            if (++i == s.size()) {
+                return -1;
+            }
+            if (s[i] == 'd') {
+                t.type = TOKEN_CLASS;
+                set_add_digits(t.set);
+            } else {
+                t.c = s[i];
+            }
+        } else if (s[i] == '[') {
+            t.type = TOKEN_CLASS;
+            for (i++; i < s.size() && s[i] != ']'; i++) {
+                if (s[i] == '\\' && i + 1 < s.size() && s[i + 1] == 'd') {
+                    set_add_digits(t.set);
+                    i++;
+                } else if (i + 2 < s.size() && s[i + 1] == '-' &&
+                           s[i + 2] != ']') {
+                    for (int c = (unsigned char)s[i];
+                         c <= (unsigned char)s[i + 2]; c++) {
+                        set_add(t.set, (unsigned char)c);
+                    }
+                    i += 2;
+                } else {
+                    set_add(t.set, (unsigned char)s[i]);
+                }
+            }
+            if (i == s.size()) {
+                return -1;
+            }
+        } else if (s[i] == '(') {
+            if (ingroup) {
+                return -1;
+            }
+            size_t depth = 1, j;
+            for (j = i + 1; j < s.size() && depth; j++) {
+                if (s[j] == '\\') {
+                    j++;
+                } else if (s[j] == '(') {
+                    depth++;
+                } else if (s[j] == ')') {
+                    depth--;
+                }
+            }
+            if (depth) {
+                return -1;
+            }
+            std::vector<std::string> alts;
+            if (split_toplevel(s.substr(i + 1, j - i - 2), '|', alts) != 0) {
+                return -1;
+            }
+            t.type = TOKEN_GROUP;
+            for (size_t k = 0; k < alts.size(); k++) {
+                std::vector<procfs_token> sub;
+                if (parse_tokens(alts[k], sub, 1) != 0) {
+                    return -1;
+                }
+                t.alternatives.push_back(sub);
+            }
+            i = j - 1;
+        } else if (s[i] == '.' && i + 1 < s.size() &&
+                   (s[i + 1] == '*' || s[i + 1] == '+')) {
+            t.type = (s[i + 1] == '*') ? TOKEN_ANY : TOKEN_ANY1;
+            i++;
+        } else if (s[i] == '+' || s[i] == '*' || s[i] == '?' ||
+                   s[i] == '{' || s[i] == '^' || s[i] == '$') {
+            if (s[i] != '+' || tokens.empty()) {
+                return -1;
+            }
+            procfs_token &prev = tokens.back();
+            if (prev.type == TOKEN_CHAR) {
+                prev.type = TOKEN_RUN;
+                memset(prev.set, 0, sizeof(prev.set));
+                set_add(prev.set, (unsigned char)prev.c);
+            } else if (prev.type == TOKEN_CLASS) {
+                prev.type = TOKEN_RUN;
+            } else {
+                return -1;
+            }
+            continue;
+        }
+        /* A lone '.' is taken to mean itself, as in "screenshot.png". */
+
+        tokens.push_back(t);
+    }
+
+    return 0;
+}
+
+/* Expands fixed-width tokens into all the strings they can match. */
+static int
+expand_fixed(const std::vector<procfs_token> &tokens,
+             std::vector<std::string> &out)
+{
+    out.clear();
+    out.push_back("");
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const procfs_token &t = tokens[i];
+        std::vector<std::string> next;
+        if (t.type == TOKEN_CHAR) {
+            for (size_t k = 0; k < out.size(); k++) {
+                next.push_back(out[k] + t.c);
+            }
+        } else if (t.type == TOKEN_CLASS) {
+            for (size_t k = 0; k < out.size(); k++) {
+                for (int c = 1; c < 256; c++) {
+                    if (set_has(t.set, (unsigned char)c)) {
+                        next.push_back(out[k] + (char)c);
+                    }
+                }
+            }
+        } else {
+            return -1;
+        }
+        if (next.size() > PROCFS_ROUTER_MAX_EXPANSION) {
+            return -1;
+        }
+        out.swap(next);
+    }
+
+    return 0;
+}
+
+static int
+literal_of(const std::vector<procfs_token> &tokens, size_t from, size_t to,
+           std::string &out)
+{
+    out.clear();
+    for (size_t i = from; i < to; i++) {
+        if (tokens[i].type != TOKEN_CHAR) {
+            return -1;
+        }
+        out += tokens[i].c;
+    }
+    return 0;
+}
+
+/* Trie construction */
+
+static struct procfs_route_node *
+node_create(void)
+{
+    struct procfs_route_node *n = new procfs_route_node;
+    n->value = -1;
+    n->min_value = -1;
+    return n;
+}
+
+static void
+node_destroy(struct procfs_route_node *n)
+{
+    size_t i;
+    for (i = 0; i < n->literals.size(); i++) {
+        node_destroy(n->literals[i].child);
+    }
+    for (i = 0; i < n->others.size(); i++) {
+        if (n->others[i].child) {
+            node_destroy(n->others[i].child);
+        }
+    }
+    delete n;
+}
+
+static void
+node_note_value(struct procfs_route_node *n, int value)
+{
+    if (n->min_value < 0 || value < n->min_value) {
+        n->min_value = value;
+    }
+}
+
+static bool
+literal_less(const procfs_route_edge &a, const procfs_route_edge &b)
+{
+    if (a.text.size() != b.text.size()) {
+        return a.text.size() < b.text.size();
+    }
+    return a.text < b.text;
+}
+
+static struct procfs_route_node *
+node_add_literal(struct procfs_route_node *n, const std::string &text,
+                 int capture, size_t cap_off, size_t cap_len)
+{
+    std::vector<procfs_route_edge> &v = n->literals;
+
+    for (size_t i = 0; i < v.size(); i++) {
+        if (v[i].text == text && v[i].capture == capture &&
+            v[i].cap_off == cap_off && v[i].cap_len == cap_len) {
+            return v[i].child;
+        }
+    }
+
+    procfs_route_edge e;
+    e.kind = EDGE_LITERAL;
+    e.text = text;
+    memset(e.set, 0, sizeof(e.set));
+    e.capture = capture;
+    e.cap_off = cap_off;
+    e.cap_len = cap_len;
+    e.value = -1;
+    e.child = node_create();
+
+    v.insert(std::upper_bound(v.begin(), v.end(), e, literal_less), e);
+
+    return e.child;
+}
+
+static struct procfs_route_node *
+node_add_class(struct procfs_route_node *n, const std::string &prefix,
+               const uint32_t set[8], const std::string &suffix, int capture)
+{
+    std::vector<procfs_route_edge> &v = n->others;
+
+    for (size_t i = 0; i < v.size(); i++) {
+        if (v[i].kind == EDGE_CLASS && v[i].text == prefix &&
+            v[i].suffix == suffix && v[i].capture == capture &&
+            memcmp(v[i].set, set, sizeof(v[i].set)) == 0) {
+            return v[i].child;
+        }
+    }
+
+    procfs_route_edge e;
+    e.kind = EDGE_CLASS;
+    e.text = prefix;
+    e.suffix = suffix;
+    memcpy(e.set, set, sizeof(e.set));
+    e.capture = capture;
+    e.cap_off = e.cap_len = 0;
+    e.value = -1;
+    e.child = node_create();
+    v.push_back(e);
+
+    return e.child;
+}
+
+static void
+node_add_tail(struct procfs_route_node *n, const std::string &glob,
+              int capture, int value)
+{
+    procfs_route_edge e;
+    e.kind = EDGE_TAIL;
+    e.text = glob;
+    memset(e.set, 0, sizeof(e.set));
+    e.capture = capture;
+    e.cap_off = e.cap_len = 0;
+    e.value = value;
+    e.child = NULL;
+    n->others.push_back(e);
+}
+
+/*
+ * Adds one segment below each of the given nodes, replacing them with the
+ * nodes the segment leads to. Returns the number of captures, or -1.
+ */
+static int
+add_segment(std::vector<struct procfs_route_node *> &nodes,
+            const std::string &segment, int last, int value)
+{
+    std::vector<procfs_token> tokens;
+    std::vector<struct procfs_route_node *> next;
+    size_t i, k, ngroups = 0, nruns = 0, nany = 0, where = 0;
+
+    if (parse_tokens(segment, tokens, 0) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < tokens.size(); i++) {
+        const procfs_token &t = tokens[i];
+        if (t.type == TOKEN_GROUP) {
+            ngroups++;
+            where = i;
+            if (t.alternatives.size() == 1 &&
+                t.alternatives[0].size() == 1) {
+                int inner = t.alternatives[0][0].type;
+                if (inner == TOKEN_RUN) {
+                    nruns++;
+                } else if (inner == TOKEN_ANY || inner == TOKEN_ANY1) {
+                    nany++;
+                }
+            }
+        } else if (t.type == TOKEN_RUN) {
+            nruns++;
+            where = i;
+        } else if (t.type == TOKEN_ANY || t.type == TOKEN_ANY1) {
+            nany++;
+        }
+    }
+
+    if (ngroups > 1) {
+        return -1;
+    }
+
+    if (nany) {
+
+        /* The rest of the path. */
+
+        std::string glob;
+        int capture = 0;
+
+        if (!last || nruns) {
+            return -1;
+        }
+        if (ngroups) {
+            /* Only a lone (.+) or (.*) can be captured. */
+            if (tokens.size() != 1) {
+                return -1;
+            }
+            capture = 1;
+            glob = (tokens[0].alternatives[0][0].type == TOKEN_ANY1) ?
+                       "?*" : "*";
+        } else {
+            for (i = 0; i < tokens.size(); i++) {
+                switch (tokens[i].type) {
+                case TOKEN_CHAR:
+                    if (tokens[i].c == '*' || tokens[i].c == '?') {
+                        return -1;
+                    }
+                    glob += tokens[i].c;
+                    break;
+                case TOKEN_ANY:
+                    glob += "*";
+                    break;
+                case TOKEN_ANY1:
+                    glob += "?*";
+                    break;
+                default:
+                    return -1;
+                }
+            }
+        }
+
+        for (k = 0; k < nodes.size(); k++) {
+            node_note_value(nodes[k], value);
+            node_add_tail(nodes[k], glob, capture, value);
+        }
+        nodes.clear();
+
+        return capture;
+    }
+
+    if (nruns) {
+
+        /* A run of a class, with a literal prefix and suffix. */
+
+        std::string prefix, suffix;
+        const procfs_token *run = &tokens[where];
+        int capture = 0;
+
+        if (nruns > 1) {
+            return -1;
+        }
+        if (run->type == TOKEN_GROUP) {
+            run = &run->alternatives[0][0];
+            capture = 1;
+        } else if (ngroups) {
+            return -1;
+        }
+        if (literal_of(tokens, 0, where, prefix) != 0 ||
+            literal_of(tokens, where + 1, tokens.size(), suffix) != 0) {
+            return -1;
+        }
+
+        for (k = 0; k < nodes.size(); k++) {
+            node_note_value(nodes[k], value);
+            next.push_back(node_add_class(nodes[k], prefix, run->set, suffix,
+                                          capture));
+        }
+        nodes.swap(next);
+
+        return capture;
+    }
+
+    /* A literal, or a set of them if there are classes or a group. */
+
+    std::vector<procfs_token> before, after;
+    std::vector<std::string> heads, tails;
+    std::vector<std::string> middles;
+
+    if (ngroups) {
+        before.assign(tokens.begin(), tokens.begin() + where);
+        after.assign(tokens.begin() + where + 1, tokens.end());
+        const procfs_token &g = tokens[where];
+        for (i = 0; i < g.alternatives.size(); i++) {
+            std::vector<std::string> expanded;
+            if (expand_fixed(g.alternatives[i], expanded) != 0) {
+                return -1;
+            }
+            middles.insert(middles.end(), expanded.begin(), expanded.end());
+        }
+    } else {
+        before = tokens;
+        middles.push_back("");
+    }
+
+    if (expand_fixed(before, heads) != 0 || expand_fixed(after, tails) != 0) {
+        return -1;
+    }
+    if (heads.size() * middles.size() * tails.size() >
+        PROCFS_ROUTER_MAX_EXPANSION) {
+        return -1;
+    }
+
+    for (k = 0; k < nodes.size(); k++) {
+        node_note_value(nodes[k], value);
+        for (size_t h = 0; h < heads.size(); h++) {
+            for (size_t m = 0; m < middles.size(); m++) {
+                for (size_t t = 0; t < tails.size(); t++) {
+                    std::string text = heads[h] + middles[m] + tails[t];
+                    if (text.empty()) {
+                        return -1;
+                    }
+                    next.push_back(node_add_literal(nodes[k], text,
+                                                    ngroups ? 1 : 0,
+                                                    heads[h].size(),
+                                                    middles[m].size()));
+                }
+            }
+        }
+    }
+    std::sort(next.begin(), next.end());
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+    nodes.swap(next);
+
+    return ngroups ? 1 : 0;
+}
+
+static int
+add_alternative(struct procfs_router *router, const std::string &path,
+                int value)
+{
+    std::vector<struct procfs_route_node *> nodes;
+    std::vector<std::string> segments;
+    int captures = 0;
+
+    if (path.empty() || path[0] != '/') {
+        return -1;
+    }
+
+    nodes.push_back(router->root);
+
+    if (path.size() > 1) {
+        if (split_toplevel(path.substr(1), '/', segments) != 0) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < segments.size(); i++) {
+        int n;
+        if (nodes.empty()) {
+            return -1; /* something after the rest of the path */
+        }
+        n = add_segment(nodes, segments[i], i == segments.size() - 1, value);
+        if (n < 0) {
+            return -1;
+        }
+        captures += n;
+    }
+
+    if (captures > PROCFS_ROUTER_MAX_ARGS) {
+        return -1;
+    }
+
+    for (size_t k = 0; k < nodes.size(); k++) {
+        node_note_value(nodes[k], value);
+        if (nodes[k]->value < 0 || value < nodes[k]->value) {
+            nodes[k]->value = value;
+        }
+    }
+
+    return captures;
+}
+
+/* Matching */
+
+struct procfs_route_walk {
+    int         ncaps;
+    const char *caps[PROCFS_ROUTER_MAX_ARGS];
+    size_t      caplens[PROCFS_ROUTER_MAX_ARGS];
+    int         best;
+    int         best_ncaps;
+    const char *best_caps[PROCFS_ROUTER_MAX_ARGS];
+    size_t      best_caplens[PROCFS_ROUTER_MAX_ARGS];
+};
+
+static void
+walk_found(struct procfs_route_walk *w, int value)
+{
+    if (w->best < 0 || value < w->best) {
+        w->best = value;
+        w->best_ncaps = w->ncaps;
+        for (int i = 0; i < w->ncaps; i++) {
+            w->best_caps[i] = w->caps[i];
+            w->best_caplens[i] = w->caplens[i];
+        }
+    }
+}
+
+static inline int
+walk_worth(const struct procfs_route_walk *w, int value)
+{
+    return (value >= 0) && (w->best < 0 || value < w->best);
+}
+
+static int
+glob_match(const char *glob, const char *s, size_t len)
+{
+    const char *star = NULL;
+    size_t i = 0, mark = 0;
+
+    while (i < len) {
+        if (*glob == '?' || (*glob && *glob != '*' && *glob == s[i])) {
+            glob++;
+            i++;
+        } else if (*glob == '*') {
+            star = glob++;
+            mark = i;
+        } else if (star) {
+            glob = star + 1;
+            i = ++mark;
+        } else {
+            return 0;
+        }
+    }
+
+    while (*glob == '*') {
+        glob++;
+    }
+
+    return *glob == '\0';
+}
+
+struct literal_key {
+    const char *s;
+    size_t      len;
+};
+
+static bool
+literal_key_less(const procfs_route_edge &e, const literal_key &k)
+{
+    if (e.text.size() != k.len) {
+        return e.text.size() < k.len;
+    }
+    return memcmp(e.text.data(), k.s, k.len) < 0;
+}
+
+static void walk_node(const struct procfs_route_node *n, const char *p,
+                      struct procfs_route_walk *w);
+
+static void
+walk_edge(const procfs_route_edge &e, const char *p, const char *off,
+          size_t len, struct procfs_route_walk *w)
+{
+    if (e.capture) {
+        w->caps[w->ncaps] = off;
+        w->caplens[w->ncaps] = len;
+        w->ncaps++;
+    }
+    walk_node(e.child, p, w);
+    if (e.capture) {
+        w->ncaps--;
+    }
+}
+
+/* p points at the '/' before the next segment, or at the end of the path. */
+static void
+walk_node(const struct procfs_route_node *n, const char *p,
+          struct procfs_route_walk *w)
+{
+    const char *seg, *next;
+    size_t seglen, i;
+
+    if (*p == '\0') {
+        if (walk_worth(w, n->value)) {
+            walk_found(w, n->value);
+        }
+        return;
+    }
+
+    seg = p + 1;
+    next = strchr(seg, '/');
+    if (!next) {
+        next = seg + strlen(seg);
+    }
+    seglen = next - seg;
+
+    literal_key key = { seg, seglen };
+    std::vector<procfs_route_edge>::const_iterator it =
+        std::lower_bound(n->literals.begin(), n->literals.end(), key,
+                         literal_key_less);
+    for (; it != n->literals.end(); ++it) {
+        if (it->text.size() != seglen ||
+            memcmp(it->text.data(), seg, seglen) != 0) {
+            break;
+        }
+        if (walk_worth(w, it->child->min_value)) {
+            walk_edge(*it, next, seg + it->cap_off, it->cap_len, w);
+        }
+    }
+
+    for (i = 0; i < n->others.size(); i++) {
+
+        const procfs_route_edge &e = n->others[i];
+
+        if (e.kind == EDGE_TAIL) {
+            if (walk_worth(w, e.value) &&
+                glob_match(e.text.c_str(), seg, strlen(seg))) {
+                if (e.capture) {
+                    w->caps[w->ncaps] = seg;
+                    w->caplens[w->ncaps] = strlen(seg);
+                    w->ncaps++;
+                }
+                walk_found(w, e.value);
+                if (e.capture) {
+                    w->ncaps--;
+                }
+            }
+            continue;
+        }
+
+        size_t plen = e.text.size(), slen = e.suffix.size(), j;
+
+        if (!walk_worth(w, e.child->min_value) || seglen < plen + slen + 1 ||
+            memcmp(seg, e.text.data(), plen) != 0 ||
+            memcmp(next - slen, e.suffix.data(), slen) != 0) {
+            continue;
+        }
+        for (j = plen; j < seglen - slen; j++) {
+            if (!set_has(e.set, (unsigned char)seg[j])) {
+                break;
+            }
+        }
+        if (j == seglen - slen) {
+            walk_edge(e, next, seg + plen, seglen - plen - slen, w);
+        }
+    }
+}
+
+/* Interface */
+
+procfs_router_t *
+procfs_router_create(void)
+{
+    procfs_router_t *router = new procfs_router;
+    router->root = node_create();
+    return router;
+}
+
+void
+procfs_router_destroy(procfs_router_t *router)
+{
+    if (router) {
+        node_destroy(router->root);
+        delete router;
+    }
+}
+
+int
+procfs_router_add(procfs_router_t *router, const char *pattern, int value)
+{
+    std::vector<std::string> alternatives;
+    int captures = -1;
+
+    if (!router || !pattern || value < 0) {
+        return -1;
+    }
+
+    if (split_toplevel(pattern, '|', alternatives) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < alternatives.size(); i++) {
+        int n = add_alternative(router, alternatives[i], value);
+        if (n < 0 || (i > 0 && n != captures)) {
+            return -1;
+        }
+        captures = n;
+    }
+
+    return captures;
+}
+
+int
+procfs_router_match(const procfs_router_t *router, const char *path,
+                    procfs_route_match_t *match)
+{
+    struct procfs_route_walk w;
+    char *cp;
+    int i;
+
+    if (!path || path[0] != '/') {
+        return 0;
+    }
+
+    w.ncaps = 0;
+    w.best = -1;
+    w.best_ncaps = 0;
+
+    walk_node(router->root, (path[1] == '\0') ? path + 1 : path, &w);
+
+    if (w.best < 0) {
+        return 0;
+    }
+
+    match->value = w.best;
+    match->argc = w.best_ncaps;
+    cp = match->buf;
+    for (i = 0; i < PROCFS_ROUTER_MAX_ARGS; i++) {
+        match->argv[i] = (const char *)0;
+    }
+    for (i = 0; i < w.best_ncaps; i++) {
+        size_t len = w.best_caplens[i];
+        if ((size_t)(cp - match->buf) + len + 1 > sizeof(match->buf)) {
+            return 0;
+        }
+        memcpy(cp, w.best_caps[i], len);
+        cp[len] = '\0';
+        match->argv[i] = cp;
+        cp += len + 1;
+    }
+
+    return 1;
+}
@@ -0,0 +1,61 @@
+/*
+ * procfs as a MacFUSE file system for Mac OS X
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#ifndef _PROCFS_ROUTER_H
+#define _PROCFS_ROUTER_H
+
+/*
+ * A path router for the procfs dispatcher tables.
+ *
+ * The tables describe paths with a small subset of regular expressions. At
+ * startup, each pattern is compiled into a trie keyed by path segment, so
+ * that a lookup walks the path once and neither runs a regex nor allocates.
+ * A segment of a pattern can be
+ *
+ *     name                 a literal
+ *     (a|b|c[0-3])         a literal out of a set, captured
+ *     pre(\d+)suf          pre/suf around a run of a character class;
+ *     pre([a-f\d]+)suf     the run may be captured or not
+ *     (.+)                 the rest of the path, captured (last segment only)
+ *     .*\._.*              the rest of the path, matched as a glob
+ *
+ * and a pattern can be an alternation of such paths at the top level. When
+ * several patterns match a path, the one that was added with the lowest
+ * value wins, which gives the same answer as trying the patterns in table
+ * order.
+ */
+
+#define PROCFS_ROUTER_MAX_ARGS 3
+#define PROCFS_ROUTER_BUFSIZE  1024
+
+typedef struct procfs_router procfs_router_t;
+
+typedef struct procfs_route_match {
+    int         value;                        /* as passed to ..._add() */
+    int         argc;
+    const char *argv[PROCFS_ROUTER_MAX_ARGS]; /* point into buf */
+    char        buf[PROCFS_ROUTER_BUFSIZE];
+} procfs_route_match_t;
+
+extern procfs_router_t *procfs_router_create(void);
+extern void             procfs_router_destroy(procfs_router_t *router);
+
+/* Returns the number of captures in the pattern, or -1 if not supported. */
+extern int              procfs_router_add(procfs_router_t *router,
+                                          const char      *pattern,
+                                          int              value);
+
+/* Returns 1 and fills in match if the path matches, 0 otherwise. */
+extern int              procfs_router_match(const procfs_router_t *router,
+                                            const char            *path,
+                                            procfs_route_match_t  *match);
+
+#endif /* _PROCFS_ROUTER_H */
@@ -0,0 +1,285 @@
+/*
+ * procfs as a MacFUSE file system for Mac OS X
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "procfs_snapshot.h"
+
+struct procfs_snapshot {
+    procfs_snapshot_cache_t *cache;
+    unsigned int             refcount;  /* protected by cache->lock */
+    size_t                   len;
+    char                    *data;
+};
+
+struct procfs_snapshot_slot {
+    char              *key;
+    procfs_snapshot_t *snap;
+    uint64_t           expires;        /* in microseconds */
+};
+
+struct procfs_snapshot_cache {
+    pthread_mutex_t              lock;
+    uint64_t                     ttl;  /* in microseconds; 0 => no sharing */
+    int                          destroyed; /* the last release frees it */
+    struct procfs_snapshot_stats stats;
+    struct procfs_snapshot_slot  slots[PROCFS_SNAPSHOT_CACHE_SLOTS];
+};
+
+static uint64_t
+procfs_snapshot_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t)tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+static unsigned int
+procfs_snapshot_hash(const char *key)
+{
+    unsigned int h = 5381;
+
+    while (*key) {
+        h = (h * 33) ^ (unsigned char)*key++;
+    }
+
+    return h % PROCFS_SNAPSHOT_CACHE_SLOTS;
+}
+
+/* Must be called with cache->lock held. */
+static void
+procfs_snapshot_unref_locked(procfs_snapshot_t *snap)
+{
+    if (--snap->refcount == 0) {
+        snap->cache->stats.live--;
+        snap->cache->stats.bytes -= snap->len;
+        free(snap->data);
+        free(snap);
+    }
+}
+
+static int
+procfs_snapshot_render(procfs_snapshot_cache_t  *cache,
+                       procfs_snapshot_render_t  render,
+                       void                     *arg,
+                       procfs_snapshot_t       **snapp)
+{
+    size_t size = PROCFS_SNAPSHOT_INITIAL_SIZE;
+    char *data = NULL;
+    int len;
+
+    for (;;) {
+        char *newdata = (char *)realloc(data, size);
+        if (!newdata) {
+            free(data);
+            return -ENOMEM;
+        }
+        data = newdata;
+
+        pthread_mutex_lock(&cache->lock);
+        cache->stats.renders++;
+        pthread_mutex_unlock(&cache->lock);
+
+        len = render(arg, data, size);
+        if (len < 0) {
+            free(data);
+            return len;
+        }
+        if (((size_t)len < size) || (size >= PROCFS_SNAPSHOT_MAX_SIZE)) {
+            break;
+        }
+        size *= 2;
+    }
+
+    procfs_snapshot_t *snap =
+        (procfs_snapshot_t *)malloc(sizeof(procfs_snapshot_t));
+    if (!snap) {
+        free(data);
+        return -ENOMEM;
+    }
+
+    /* Don't hold on to the slack. */
+    if (len == 0) {
+        free(data);
+        data = NULL;
+    } else {
+        char *newdata = (char *)realloc(data, len);
+        if (newdata) {
+            data = newdata;
+        }
+    }
+
+    snap->cache = cache;
+    snap->refcount = 1;
+    snap->len = len;
+    snap->data = data;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stats.live++;
+    cache->stats.bytes += len;
+    pthread_mutex_unlock(&cache->lock);
+
+    *snapp = snap;
+
+    return 0;
+}
+
+procfs_snapshot_cache_t *
+procfs_snapshot_cache_create(unsigned ttl_ms)
+{
+    procfs_snapshot_cache_t *cache =
+        (procfs_snapshot_cache_t *)calloc(1, sizeof(procfs_snapshot_cache_t));
+
+    if (cache) {
+        pthread_mutex_init(&cache->lock, NULL);
+        cache->ttl = (uint64_t)ttl_ms * 1000;
+    }
+
+    return cache;
+}
+
+static void
+procfs_snapshot_cache_free(procfs_snapshot_cache_t *cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+void
+procfs_snapshot_cache_destroy(procfs_snapshot_cache_t *cache)
+{
+    int i, unused;
+
+    if (!cache) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < PROCFS_SNAPSHOT_CACHE_SLOTS; i++) {
+        struct procfs_snapshot_slot *slot = &cache->slots[i];
+        if (slot->snap) {
+            procfs_snapshot_unref_locked(slot->snap);
+            free(slot->key);
+            slot->snap = NULL;
+            slot->key = NULL;
+        }
+    }
+    /* Snapshots still held by open files keep pointing at the cache. */
+    cache->destroyed = 1;
+    unused = (cache->stats.live == 0);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (unused) {
+        procfs_snapshot_cache_free(cache);
+    }
+}
+
+void
+procfs_snapshot_cache_stats(procfs_snapshot_cache_t      *cache,
+                            struct procfs_snapshot_stats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int
+procfs_snapshot_open(procfs_snapshot_cache_t  *cache,
+                     const char               *key,
+                     procfs_snapshot_render_t  render,
+                     void                     *arg,
+                     procfs_snapshot_t       **snapp)
+{
+    struct procfs_snapshot_slot *slot = NULL;
+    procfs_snapshot_t *snap;
+    char *newkey = NULL;
+    uint64_t now = 0;
+    int ret;
+
+    if (cache->ttl) {
+        slot = &cache->slots[procfs_snapshot_hash(key)];
+        now = procfs_snapshot_now();
+        pthread_mutex_lock(&cache->lock);
+        if (slot->snap && (now < slot->expires) &&
+            (strcmp(slot->key, key) == 0)) {
+            snap = slot->snap;
+            snap->refcount++;
+            cache->stats.hits++;
+            pthread_mutex_unlock(&cache->lock);
+            *snapp = snap;
+            return 0;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    /* Render without the lock; it can take a while. */
+    ret = procfs_snapshot_render(cache, render, arg, &snap);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (slot && (newkey = strdup(key))) {
+        pthread_mutex_lock(&cache->lock);
+        if (slot->snap) {
+            procfs_snapshot_unref_locked(slot->snap);
+            free(slot->key);
+        }
+        slot->key = newkey;
+        slot->snap = snap;
+        slot->expires = now + cache->ttl;
+        snap->refcount++;
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    *snapp = snap;
+
+    return 0;
+}
+
+int
+procfs_snapshot_read(procfs_snapshot_t *snap, char *buf, size_t size,
+                     off_t offset)
+{
+    if ((offset < 0) || ((size_t)offset >= snap->len)) {
+        return 0;
+    }
+
+    if (size > snap->len - offset) {
+        size = snap->len - offset;
+    }
+
+    memcpy(buf, snap->data + offset, size);
+
+    return size;
+}
+
+void
+procfs_snapshot_release(procfs_snapshot_t *snap)
+{
+    procfs_snapshot_cache_t *cache = snap->cache;
+    int unused;
+
+    pthread_mutex_lock(&cache->lock);
+    procfs_snapshot_unref_locked(snap);
+    unused = cache->destroyed && (cache->stats.live == 0);
+    pthread_mutex_unlock(&cache->lock);
+
+    /* The last snapshot out of a destroyed cache takes the cache along. */
+    if (unused) {
+        procfs_snapshot_cache_free(cache);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * procfs as a MacFUSE file system for Mac OS X
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#ifndef _PROCFS_SNAPSHOT_H
+#define _PROCFS_SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Snapshots of generated files.
+ *
+ * The contents of a generated file are rendered once, when it is opened,
+ * and reads are then served from that copy, instead of every read
+ * rendering the whole file again only to return a slice of it. A reader
+ * thus also sees one consistent version of the file from start to end.
+ *
+ * If the cache is given a time to live, a snapshot is also shared with
+ * other opens of the same file until it is that old.
+ */
+
+typedef struct procfs_snapshot       procfs_snapshot_t;
+typedef struct procfs_snapshot_cache procfs_snapshot_cache_t;
+
+/*
+ * Renders a whole file into buf. Returns the length of the contents, or a
+ * negative errno. A return value of size means that the contents may not
+ * have fit; the renderer is called again with a larger buffer.
+ */
+typedef int (*procfs_snapshot_render_t)(void *arg, char *buf, size_t size);
+
+#define PROCFS_SNAPSHOT_INITIAL_SIZE 65536
+#define PROCFS_SNAPSHOT_MAX_SIZE     (16 * 1024 * 1024)
+#define PROCFS_SNAPSHOT_CACHE_SLOTS  64
+
+struct procfs_snapshot_stats {
+    uint64_t renders;   /* calls to a renderer */
+    uint64_t hits;      /* opens served by a cached snapshot */
+    uint64_t live;      /* snapshots in existence */
+    uint64_t bytes;     /* ... and their size */
+};
+
+extern procfs_snapshot_cache_t *procfs_snapshot_cache_create(unsigned ttl_ms);
+extern void procfs_snapshot_cache_destroy(procfs_snapshot_cache_t *cache);
+extern void procfs_snapshot_cache_stats(procfs_snapshot_cache_t      *cache,
+                                        struct procfs_snapshot_stats *stats);
+
+/* Returns 0 and a referenced snapshot, or the renderer's error. */
+extern int  procfs_snapshot_open(procfs_snapshot_cache_t  *cache,
+                                 const char               *key,
+                                 procfs_snapshot_render_t  render,
+                                 void                     *arg,
+                                 procfs_snapshot_t       **snapp);
+
+/* Returns the number of bytes copied; 0 at and past the end. */
+extern int  procfs_snapshot_read(procfs_snapshot_t *snap, char *buf,
+                                 size_t size, off_t offset);
+
+extern void procfs_snapshot_release(procfs_snapshot_t *snap);
+
+#endif /* _PROCFS_SNAPSHOT_H */
@@ -18,6 +18,54 @@
 
 DECL_UNIXFS("2.11BSD", 211bsd);
 
+static inline void
+__unixfs_internal_idecode(fs_endian_t e, struct inode* ip,
+                          const struct dinode* dip)
+{
+    /* ip->I_ic1 = dip->di_ic1 */
+
+    ip->I_mode  = fs16_to_host(e, dip->di_mode);
+    ip->I_nlink = fs16_to_host(e, dip->di_nlink);
+    ip->I_uid   = fs16_to_host(e, dip->di_uid);
+    ip->I_gid   = fs16_to_host(e, dip->di_gid);
+    ip->I_size  = fs32_to_host(e, dip->di_size);
+
+#ifndef EXTERNALTIMES
+
+    /* ip->I_ic2 = dip->di_ic2 */
+
+    ip->I_atime_sec = fs32_to_host(e, dip->di_atime);
+    ip->I_mtime_sec = fs32_to_host(e, dip->di_mtime);
+    ip->I_ctime_sec = fs32_to_host(e, dip->di_ctime);
+
+#endif
+
+    int i;
+
+    for (i = 0; i < NADDR; i++)
+        ip->I_daddr[i] = fs32_to_host(e, dip->di_addr[i]);
+}
+
+UNIXFS_ENDIAN_SPECIALIZE(__unixfs_internal_idecode,
+                         (struct inode* ip, const struct dinode* dip),
+                         (ip, dip));
+
+static inline void
+__unixfs_internal_ddecode(fs_endian_t e, struct direct* ep)
+{
+    ep->d_ino = fs16_to_host(e, ep->d_ino);
+    ep->d_reclen = fs16_to_host(e, ep->d_reclen);
+    ep->d_namlen = fs16_to_host(e, ep->d_namlen);
+}
+
+UNIXFS_ENDIAN_SPECIALIZE(__unixfs_internal_ddecode, (struct direct* ep), (ep));
+
+/* for the byte order of the file system this thread is attached to */
+#define unixfs_internal_idecode(ip, dip) \
+    __unixfs_internal_idecode_variants[unixfs->s_endian](ip, dip)
+#define unixfs_internal_ddecode(ep) \
+    __unixfs_internal_ddecode_variants[unixfs->s_endian](ep)
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -162,11 +210,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
     struct super_block* sb = (struct super_block*)filsys;
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -208,8 +259,13 @@ nospace:
     return (off_t)0; /* ENOSPC */
 }
 
+/*
+ * If ib is not NULL, the last level of indirection goes through it: see
+ * struct unixfs_indirblk.
+ */
 static off_t
-unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+__unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error,
+                       struct unixfs_indirblk* ib)
 {
     a_daddr_t bn = (a_daddr_t)lblkno;
 
@@ -270,16 +326,27 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
      */
 
     for (; j <= 3; j++) {
-        char ubuf[UNIXFS_IOSIZE(unixfs)];
-        int ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return (off_t)0;
-        }
-        a_daddr_t* bap = (a_daddr_t*)ubuf;
         sh -= NSHIFT;
         i = (bn >> sh) & NMASK;
-        nb = fs32_to_host(unixfs->s_endian, bap[i]);
+        if ((j == 3) && ib && (ib->ib_blkno == (off_t)nb)) {
+            nb = ib->ib_addr[i];
+        } else {
+            char ubuf[UNIXFS_IOSIZE(unixfs)];
+            int ret = unixfs_internal_bread((off_t)nb, ubuf);
+            if (ret) {
+                *error = ret;
+                return (off_t)0;
+            }
+            if ((j == 3) && ib) {
+                unixfs_fs32v_to_host(unixfs->s_endian, ib->ib_addr, ubuf,
+                                     NINDIR);
+                ib->ib_blkno = (off_t)nb;
+                nb = ib->ib_addr[i];
+            } else {
+                a_daddr_t* bap = (a_daddr_t*)ubuf;
+                nb = fs32_to_host(unixfs->s_endian, bap[i]);
+            }
+        }
         if (nb == 0)
             return (off_t)0; /* !writable; should be -1 rather */
     }
@@ -291,6 +358,12 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
     return (off_t)nb;
 }
 
+static off_t
+unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+{
+    return __unixfs_internal_bmap(ip, lblkno, error, NULL);
+}
+
 static int
 unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
@@ -306,11 +379,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)DEV_BSIZE) != UNIXFS_IOSIZE(unixfs))
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(unixfs->s_bdev, blkbuf,
+                                    UNIXFS_IOSIZE(unixfs),
+                                    blkno * (off_t)DEV_BSIZE);
 }
 
 static struct inode*
@@ -340,28 +411,7 @@ unixfs_internal_iget(ino_t ino)
 
     ip->I_number = ino;
 
-    /* ip->I_ic1 = dip->di_ic1 */
-
-    ip->I_mode  = fs16_to_host(unixfs->s_endian, dip->di_mode);
-    ip->I_nlink = fs16_to_host(unixfs->s_endian, dip->di_nlink);
-    ip->I_uid   = fs16_to_host(unixfs->s_endian, dip->di_uid);
-    ip->I_gid   = fs16_to_host(unixfs->s_endian, dip->di_gid);
-    ip->I_size  = fs32_to_host(unixfs->s_endian, dip->di_size);
-
-#ifndef EXTERNALTIMES
-
-    /* ip->I_ic2 = dip->di_ic2 */
-
-    ip->I_atime_sec = fs32_to_host(unixfs->s_endian, dip->di_atime);
-    ip->I_mtime_sec = fs32_to_host(unixfs->s_endian, dip->di_mtime);
-    ip->I_ctime_sec = fs32_to_host(unixfs->s_endian, dip->di_ctime);
-
-#endif
-
-    int i;
-
-    for (i = 0; i < NADDR; i++)
-        ip->I_daddr[i] = fs32_to_host(unixfs->s_endian, dip->di_addr[i]);
+    unixfs_internal_idecode(ip, dip);
 
     if (S_ISCHR(ip->I_mode) || S_ISBLK(ip->I_mode)) {
         uint32_t rdev = ip->I_daddr[0];
@@ -473,9 +523,7 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
             entryoffsetinblock = 0;
         }
         ep = (struct direct*)((char*)ubuf + entryoffsetinblock);
-        ep->d_ino = fs16_to_host(unixfs->s_endian, ep->d_ino);
-        ep->d_reclen = fs16_to_host(unixfs->s_endian, ep->d_reclen);
-        ep->d_namlen = fs16_to_host(unixfs->s_endian, ep->d_namlen);
+        unixfs_internal_ddecode(ep);
         if (ep->d_reclen == 0 ||
             __unixfs_internal_dirbadentry(ep, entryoffsetinblock)) {
             i = ANCIENTFS_211BSD_DIRBLKSIZ -
@@ -506,47 +554,53 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
     struct direct* ep;
     off_t ni_offset = *offset;
     off_t entryoffsetinblock = blkoff(ni_offset);
     int endsearch = roundup(dp->I_size, ANCIENTFS_211BSD_DIRBLKSIZ);
+    int n = 0;
 
     if (ni_offset >= endsearch)
-        return -1;
+        return 0;
 
     if (!dirbuf->flags.initialized || (blkoff(ni_offset) == 0)) {
         int ret = __unixfs_internal_blkatoff(dp, ni_offset, dirbuf->data);
         if (ret)
-            return ret;
+            return -1;
         entryoffsetinblock = 0;
         dirbuf->flags.initialized = 1;
     }
-    ep = (struct direct*)((char*)dirbuf->data + entryoffsetinblock);
-    ep->d_ino = fs16_to_host(unixfs->s_endian, ep->d_ino);
-    ep->d_reclen = fs16_to_host(unixfs->s_endian, ep->d_reclen);
-    ep->d_namlen = fs16_to_host(unixfs->s_endian, ep->d_namlen);
-    if (ep->d_reclen == 0 ||
-        __unixfs_internal_dirbadentry(ep, entryoffsetinblock)) {
-        int i =
-            ANCIENTFS_211BSD_DIRBLKSIZ - (entryoffsetinblock &
-                (ANCIENTFS_211BSD_DIRBLKSIZ - 1));
-        ni_offset += i;
-        entryoffsetinblock += i;
-        dent->ino = 0;
-    } else {
-        dent->ino = (ino_t)ep->d_ino;
-        memcpy(dent->name, ep->d_name, ep->d_namlen);
-        dent->name[ep->d_namlen] = '\0';
-        ni_offset += ep->d_reclen;
-        entryoffsetinblock += ep->d_reclen;
-    }
+
+    /* the rest of the block, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[n++];
+
+        ep = (struct direct*)((char*)dirbuf->data + entryoffsetinblock);
+        unixfs_internal_ddecode(ep);
+        if (ep->d_reclen == 0 ||
+            __unixfs_internal_dirbadentry(ep, entryoffsetinblock)) {
+            int i =
+                ANCIENTFS_211BSD_DIRBLKSIZ - (entryoffsetinblock &
+                    (ANCIENTFS_211BSD_DIRBLKSIZ - 1));
+            ni_offset += i;
+            entryoffsetinblock += i;
+            dent->ino = 0;
+        } else {
+            dent->ino = (ino_t)ep->d_ino;
+            memcpy(dent->name, ep->d_name, ep->d_namlen);
+            dent->name[ep->d_namlen] = '\0';
+            ni_offset += ep->d_reclen;
+            entryoffsetinblock += ep->d_reclen;
+        }
+    } while ((n < max) && (blkoff(ni_offset) != 0) && (ni_offset < endsearch));
 
     *offset = ni_offset;
 
-    return 0;
+    return n;
 }
 
 static ssize_t
@@ -559,10 +613,13 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
     ssize_t iosize = UNIXFS_IOSIZE(unixfs);
     char blkbuf[iosize];
     char* p = buf;
+    struct unixfs_indirblk ib;
+
+    ib.ib_blkno = 0;
 
     while (remaining > 0) {
         off_t lbn = offset / DEV_BSIZE;
-        off_t bn = unixfs_internal_bmap(ip, lbn, error);
+        off_t bn = __unixfs_internal_bmap(ip, lbn, error, &ib);
         if (UNIXFS_BADBLOCK(bn, *error))
             break;
         *error = unixfs_internal_bread(bn, blkbuf);
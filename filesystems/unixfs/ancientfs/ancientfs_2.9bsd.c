@@ -18,6 +18,44 @@
 
 DECL_UNIXFS("2.9BSD", 29bsd);
 
+static inline void
+__unixfs_internal_idecode(fs_endian_t e, struct inode* ip,
+                          const struct dinode* dip)
+{
+    ip->I_mode  = fs16_to_host(e, dip->di_mode);
+    ip->I_nlink = fs16_to_host(e, dip->di_nlink);
+    ip->I_uid   = fs16_to_host(e, dip->di_uid);
+    ip->I_gid   = fs16_to_host(e, dip->di_gid);
+    ip->I_size  = fs32_to_host(e, dip->di_size);
+
+    ip->I_atime_sec = fs32_to_host(e, dip->di_atime);
+    ip->I_mtime_sec = fs32_to_host(e, dip->di_mtime);
+    ip->I_ctime_sec = fs32_to_host(e, dip->di_ctime);
+
+    int i;
+
+    char* p1 = (char*)(ip->I_daddr);
+    const char* p2 = (const char*)(dip->di_addr);
+
+    for (i = 0; i < NADDR; i++) {
+        *p1++ = *p2++;
+        *p1++ = 0;
+        *p1++ = *p2++;
+        *p1++ = *p2++;
+    }
+
+    for (i = 0; i < NADDR; i++)
+        ip->I_daddr[i] = fs32_to_host(e, ip->I_daddr[i]);
+}
+
+UNIXFS_ENDIAN_SPECIALIZE(__unixfs_internal_idecode,
+                         (struct inode* ip, const struct dinode* dip),
+                         (ip, dip));
+
+/* for the byte order of the file system this thread is attached to */
+#define unixfs_internal_idecode(ip, dip) \
+    __unixfs_internal_idecode_variants[unixfs->s_endian](ip, dip)
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -162,11 +200,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
     struct super_block* sb = (struct super_block*)filsys;
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -208,8 +249,13 @@ nospace:
     return (off_t)0; /* ENOSPC */
 }
 
+/*
+ * If ib is not NULL, the last level of indirection goes through it: see
+ * struct unixfs_indirblk.
+ */
 static off_t
-unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+__unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error,
+                       struct unixfs_indirblk* ib)
 {
     a_daddr_t bn = (a_daddr_t)lblkno;
 
@@ -270,16 +316,27 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
      */
 
     for (; j <= 3; j++) {
-        char ubuf[UNIXFS_IOSIZE(unixfs)];
-        int ret = unixfs_internal_bread((off_t)nb, ubuf);
-        if (ret) {
-            *error = ret;
-            return (off_t)0;
-        }
-        a_daddr_t* bap = (a_daddr_t*)ubuf;
         sh -= NSHIFT;
         i = (bn >> sh) & NMASK;
-        nb = fs32_to_host(unixfs->s_endian, bap[i]);
+        if ((j == 3) && ib && (ib->ib_blkno == (off_t)nb)) {
+            nb = ib->ib_addr[i];
+        } else {
+            char ubuf[UNIXFS_IOSIZE(unixfs)];
+            int ret = unixfs_internal_bread((off_t)nb, ubuf);
+            if (ret) {
+                *error = ret;
+                return (off_t)0;
+            }
+            if ((j == 3) && ib) {
+                unixfs_fs32v_to_host(unixfs->s_endian, ib->ib_addr, ubuf,
+                                     NINDIR);
+                ib->ib_blkno = (off_t)nb;
+                nb = ib->ib_addr[i];
+            } else {
+                a_daddr_t* bap = (a_daddr_t*)ubuf;
+                nb = fs32_to_host(unixfs->s_endian, bap[i]);
+            }
+        }
         if (nb == 0)
             return (off_t)0; /* !writable; should be -1 rather */
     }
@@ -291,6 +348,12 @@ unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
     return (off_t)nb;
 }
 
+static off_t
+unixfs_internal_bmap(struct inode* ip, off_t lblkno, int* error)
+{
+    return __unixfs_internal_bmap(ip, lblkno, error, NULL);
+}
+
 static int
 unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
@@ -306,11 +369,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(unixfs->s_bdev, blkbuf,
+                                    UNIXFS_IOSIZE(unixfs),
+                                    blkno * (off_t)BSIZE);
 }
 
 static struct inode*
@@ -340,30 +401,7 @@ unixfs_internal_iget(ino_t ino)
 
     ip->I_number = ino;
 
-    ip->I_mode  = fs16_to_host(unixfs->s_endian, dip->di_mode);
-    ip->I_nlink = fs16_to_host(unixfs->s_endian, dip->di_nlink);
-    ip->I_uid   = fs16_to_host(unixfs->s_endian, dip->di_uid);
-    ip->I_gid   = fs16_to_host(unixfs->s_endian, dip->di_gid);
-    ip->I_size  = fs32_to_host(unixfs->s_endian, dip->di_size);
-
-    ip->I_atime_sec = fs32_to_host(unixfs->s_endian, dip->di_atime);
-    ip->I_mtime_sec = fs32_to_host(unixfs->s_endian, dip->di_mtime);
-    ip->I_ctime_sec = fs32_to_host(unixfs->s_endian, dip->di_ctime);
-
-    int i;
-
-    char* p1 = (char*)(ip->I_daddr);
-    char* p2 = (char*)(dip->di_addr);
-
-    for (i = 0; i < NADDR; i++) {
-        *p1++ = *p2++;
-        *p1++ = 0;
-        *p1++ = *p2++;
-        *p1++ = *p2++;
-    }
-
-    for (i = 0; i < NADDR; i++)
-        ip->I_daddr[i] = fs32_to_host(unixfs->s_endian, ip->I_daddr[i]);
+    unixfs_internal_idecode(ip, dip);
 
     if (S_ISCHR(ip->I_mode) || S_ISBLK(ip->I_mode)) {
         uint32_t rdev = ip->I_daddr[0];
@@ -443,11 +481,10 @@ eloop:
     memset(&udent, 0, sizeof(udent));
     memcpy(&udent, ubuf + (offset & BMASK), unixfs->s_dentsize);
 
-    udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
-
     offset += unixfs->s_dentsize;
     count--;
 
+    /* 0 is 0 in any byte order; only a match needs converting */
     if (udent.u_ino == 0) {
         if (eo == 0)
             eo = offset;
@@ -459,6 +496,8 @@ eloop:
 
     /* matched */
 
+    udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
+
     ret = unixfs_internal_igetattr((ino_t)(udent.u_ino), stbuf);
 
 out:
@@ -468,36 +507,44 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
     if ((*offset + unixfs->s_dentsize) > dp->I_size)
-        return -1;
+        return 0;
 
     if (!dirbuf->flags.initialized || ((*offset & BMASK) == 0)) {
         int ret;
         off_t blkno = unixfs_internal_bmap(dp, (off_t)(*offset / BSIZE), &ret);
         if (UNIXFS_BADBLOCK(blkno, ret))
-            return ret;
+            return -1;
         ret = unixfs_internal_bread(blkno, dirbuf->data);
         if (ret != 0)
-            return ret;
+            return -1;
         dirbuf->flags.initialized = 1;
     }
 
     struct dent udent;
     size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
+    int n = 0;
 
-    memset(&udent, 0, sizeof(udent));
-    memcpy(&udent, dirbuf->data + (*offset & BMASK), unixfs->s_dentsize);
-    udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
-    dent->ino = udent.u_ino;
-    memcpy(dent->name, udent.u_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    /* the rest of the block, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[n++];
 
-    *offset += unixfs->s_dentsize;
+        memset(&udent, 0, sizeof(udent));
+        memcpy(&udent, dirbuf->data + (*offset & BMASK), unixfs->s_dentsize);
+        udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
+        dent->ino = udent.u_ino;
+        memcpy(dent->name, udent.u_name, dirnamelen);
+        dent->name[dirnamelen] = '\0';
 
-    return 0;
+        *offset += unixfs->s_dentsize;
+    } while ((n < max) && ((*offset & BMASK) != 0) &&
+             ((*offset + unixfs->s_dentsize) <= dp->I_size));
+
+    return n;
 }
 
 static ssize_t
@@ -510,10 +557,13 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
     ssize_t iosize = UNIXFS_IOSIZE(unixfs);
     char blkbuf[iosize];
     char* p = buf;
+    struct unixfs_indirblk ib;
+
+    ib.ib_blkno = 0;
 
     while (remaining > 0) {
         off_t lbn = offset / BSIZE;
-        off_t bn = unixfs_internal_bmap(ip, lbn, error);
+        off_t bn = __unixfs_internal_bmap(ip, lbn, error, &ib);
         if (UNIXFS_BADBLOCK(bn, *error))
             break;
         *error = unixfs_internal_bread(bn, blkbuf);
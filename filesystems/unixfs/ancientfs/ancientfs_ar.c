@@ -5,6 +5,7 @@
  */
 
 #include "ancientfs_ar.h"
+#include "ancientfs_cksum.h"
 #include "unixfs_common.h"
 
 #include <errno.h>
@@ -60,9 +61,7 @@ DECL_UNIXFS("UNIX ar", ar);
 
 /* Convert ar header field to an integer. */
 #define AR_ATOI(from, to, len, base) { \
-        memmove(buf, from, len); \
-        buf[len] = '\0'; \
-        to = strtol(buf, (char **)NULL, base); \
+        to = ancientfs_atoi(from, len, base); \
 }
 
 struct chdr {
@@ -77,12 +76,13 @@ struct chdr {
 };
 
 static int ancientfs_ar_readheader(int fd, struct chdr* chdr);
+static int ancientfs_ar_scan(struct unixfs_scanner* us, void* arg);
 
 static int
 ancientfs_ar_readheader(int fd, struct chdr* chdr)
 {
     int len, nr;
-    char *p, buf[20];
+    char *p;
     char hb[sizeof(struct ar_hdr) + 1];
     struct ar_hdr* hdr;
 
@@ -142,6 +142,73 @@ ancientfs_ar_readheader(int fd, struct chdr* chdr)
     return 0;
 }
 
+static int
+ancientfs_ar_scan(struct unixfs_scanner* us, void* arg)
+{
+    unixfs_internal_attach(arg);
+
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_atree* at = &fs->s_tree;
+    int fd = unixfs->s_bdev;
+    int err = 0;
+
+    (void)lseek(fd, (off_t)SARMAG, SEEK_SET); /* past the magic */
+
+    struct chdr ar;
+
+    for (;;) {
+
+        unixfs_scanner_lock(us);
+        int cancelled = unixfs_scanner_cancelled(us);
+        unixfs_scanner_unlock(us);
+        if (cancelled) {
+            err = ECANCELED;
+            break;
+        }
+
+        if (ancientfs_ar_readheader(fd, &ar) != 0)
+            break;
+
+        if (S_ISDIR(ar.mode)) /* an archive has no business with these */
+            goto next;
+
+        /* the scanner is the only writer of the tree; no need to lock */
+        if (unixfs_atree_lookup(at, ROOTINO, ar.name, ar.lname, 0))
+            goto next; /* duplicate */
+
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode  = ar.mode;
+        st.st_uid   = ar.uid;
+        st.st_gid   = ar.gid;
+        st.st_nlink = 1;
+        st.st_size  = ar.size;
+        st.st_mtime = ar.date;
+
+        unixfs_scanner_lock(us);
+        ino_t ino = unixfs_atree_add(at, ROOTINO, ar.name, &st, ar.addr, NULL);
+        if (ino)
+            unixfs_scanner_publish(us);
+        unixfs_scanner_unlock(us);
+
+        if (!ino) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            abort();
+        }
+
+        fs->s_files++;
+        fs->s_lastino = (uint32_t)ino;
+next:
+        (void)lseek(fd, (off_t)(ar.size + (ar.size & 1)), SEEK_CUR);
+    }
+
+    unixfs_scanner_lock(us);
+    unixfs->s_statvfs.f_files = fs->s_files + fs->s_directories;
+    unixfs_scanner_unlock(us);
+
+    return err;
+}
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -204,97 +271,24 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_bdev = fd;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(sizeof(struct ar_node_info))) != 0)
+    if ((err = unixfs_inodelayer_init(0)) != 0)
         goto out;
 
-    struct inode* rootip = unixfs_inodelayer_iget((ino_t)ROOTINO);
-    if (!rootip) {
-        fprintf(stderr, "*** fatal error: no root inode\n");
-        abort();
+    if ((err = unixfs_atree_init(&fs->s_tree, (ino_t)ROOTINO)) != 0) {
+        unixfs_inodelayer_fini();
+        goto out;
     }
 
-    rootip->I_mode = S_IFDIR | 0755;
-    rootip->I_uid  = getuid();
-    rootip->I_gid  = getgid();
-    rootip->I_size = 2;
-    rootip->I_atime_sec = rootip->I_mtime_sec = rootip->I_ctime_sec =        time(0);
-
-    struct ar_node_info* rootai = (struct ar_node_info*)rootip->I_private;
-    rootai->ar_self = rootip;
-    rootai->ar_parent = NULL;
-    rootai->ar_children = NULL;
-    rootai->ar_next_sibling = NULL;
-
-    unixfs_inodelayer_isucceeded(rootip);
+    struct unixfs_anode* rootnp = unixfs_atree_node(&fs->s_tree, ROOTINO);
+    rootnp->an_uid = getuid();
+    rootnp->an_gid = getgid();
+    rootnp->an_mtime = time(0);
 
     fs->s_fsize = (stbuf.st_size / BSIZE) + 1;
     fs->s_files = 0;
     fs->s_directories = 1 + 1 + 1;
-    fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    struct chdr ar;
-    ino_t parent_ino = ROOTINO;
-
-    for (;;) {
-
-        if (ancientfs_ar_readheader(fd, &ar) != 0)
-            break;
-
-        int missing = unixfs_internal_namei(parent_ino, ar.name, &stbuf);
-        if (!missing) /* duplicate */
-            goto next;
-
-        struct inode* ip = unixfs_inodelayer_iget((ino_t)(fs->s_lastino + 1));
-        if (!ip) {
-            fprintf(stderr, "*** fatal error: no inode for %llu\n",
-                   (ino64_t)(fs->s_lastino + 1));
-            abort();
-        }
-        ip->I_mode  = ar.mode;
-        ip->I_uid   = ar.uid;
-        ip->I_gid   = ar.gid;
-        ip->I_nlink = 1;
-        ip->I_size  = ar.size;
-        ip->I_atime_sec = ip->I_mtime_sec = ip->I_ctime_sec = ar.date;
-        ip->I_daddr[0] = ar.addr;
-
-        struct ar_node_info* ai = (struct ar_node_info*)ip->I_private;
-        ai->ar_name = malloc(ar.lname + 1);
-        if (!ai->ar_name) {
-            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
-            abort();
-        }
-
-        memcpy(ai->ar_name, ar.name, ar.lname);
-        ai->ar_name[ar.lname] = '\0';
-        ai->ar_namelen = ar.lname;
-
-        ai->ar_self = ip;
-        ai->ar_children = NULL;
-        struct inode* parent_ip = unixfs_internal_iget(parent_ino);
-        parent_ip->I_size += 1;
-        ai->ar_parent = (struct ar_node_info*)(parent_ip->I_private);
-        ai->ar_next_sibling = ai->ar_parent->ar_children;
-        ai->ar_parent->ar_children = ai;
-        if (S_ISDIR(ip->I_mode)) {
-            fs->s_directories++;
-            parent_ino = fs->s_lastino + 1;
-            ip->I_size = 2;
-            ip->I_daddr[0] = 0;
-        } else {
-            fs->s_files++;
-            fs->s_lastino++;
-            unixfs_internal_iput(parent_ip);
-            unixfs_inodelayer_isucceeded(ip);
-           /* no put */
-        }
-
-        fs->s_lastino++;
-next:
-        (void)lseek(fd, (off_t)(ar.size + (ar.size & 1)), SEEK_CUR);
-    }
-
     unixfs->s_statvfs.f_bsize = BSIZE;
     unixfs->s_statvfs.f_frsize = BSIZE;
     unixfs->s_statvfs.f_ffree = 0;
@@ -305,6 +299,16 @@ next:
     unixfs->s_dentsize = 1;
     unixfs->s_statvfs.f_namemax = UNIXFS_MAXNAMLEN;
 
+    /* the rest of the tree comes in the background */
+    err = unixfs_scanner_start(&fs->s_scanner, ancientfs_ar_scan, sb);
+    if (err) {
+        fprintf(stderr, "*** fatal error: cannot set up the scanner\n");
+        unixfs_atree_fini(&fs->s_tree);
+        unixfs_inodelayer_fini();
+        err = ENOMEM;
+        goto out;
+    }
+
     snprintf(unixfs->s_fsname, UNIXFS_MNAMELEN, "UNIX ar");
 
     char* dmg_basename = basename((char*)dmg);
@@ -333,26 +337,21 @@ unixfs_internal_fini(void* filsys)
 {
     struct super_block* sb = (struct super_block*)filsys;
     struct filsys* fs = (struct filsys*)sb->s_fs_info;
-    ino_t i = fs->s_lastino;
-    for (; i >= ROOTINO; i--) {
-        struct inode* tmp = unixfs_internal_iget(i);
-        if (tmp) {
-            struct ar_node_info* ai = (struct ar_node_info*)tmp->I_private;
-            if (ai->ar_name)
-                free(ai->ar_name);
-            unixfs_internal_iput(tmp);
-            unixfs_internal_iput(tmp);
-        }
-    }
+
+    unixfs_scanner_stop(&fs->s_scanner);
 
     unixfs_inodelayer_fini();
+    unixfs_atree_fini(&fs->s_tree);
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -386,6 +385,19 @@ unixfs_internal_iget(ino_t ino)
     if (ip->I_initialized)
         return ip;
 
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    int found;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    if ((found = (unixfs_atree_node(&fs->s_tree, ino) != NULL)))
+        unixfs_atree_stat(&fs->s_tree, ino, &ip->I_stat);
+    unixfs_scanner_unlock(&fs->s_scanner);
+
+    if (found) {
+        unixfs_inodelayer_isucceeded(ip);
+        return ip;
+    }
+
     unixfs_inodelayer_ifailed(ip);
 
     return NULL; 
@@ -414,7 +426,11 @@ unixfs_internal_igetattr(ino_t ino, struct stat* stbuf)
 static void
 unixfs_internal_istat(struct inode* ip, struct stat* stbuf)
 {
-    memcpy(stbuf, &ip->I_stat, sizeof(struct stat));
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner); /* directories grow as we scan */
+    unixfs_atree_stat(&fs->s_tree, ip->I_ino, stbuf);
+    unixfs_scanner_unlock(&fs->s_scanner);
 }
 
 static int
@@ -436,28 +452,27 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
         goto out;
     }
 
-    struct ar_node_info* child =
-        ((struct ar_node_info*)dp->I_private)->ar_children;;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    ino_t seen = 0;
+    int done = 0;
+    ino_t ino = 0;
 
-    if (!child) {
-        ret = ENOENT;
-        goto out;
-    }
-
-    int found = 0;
-
-    do {
-        size_t target_namelen = strlen((const char*)child->ar_name);
-        if ((namelen == target_namelen) &&
-            (memcmp(name, child->ar_name, target_namelen) == 0)) {
-            found = 1;
+    /* until it's found, or the scanner is past the end of the archive */
+    unixfs_scanner_lock(us);
+    for (;;) {
+        ino_t head = unixfs_atree_node(&fs->s_tree, parentino)->an_children;
+        ino = unixfs_atree_lookup(&fs->s_tree, parentino, name, namelen,
+                                  seen);
+        if (ino || done)
             break;
-        }
-        child = child->ar_next_sibling;
-    } while (child);
+        seen = head;
+        done = unixfs_scanner_wait(us);
+    }
+    unixfs_scanner_unlock(us);
 
-    if (found)
-        ret = unixfs_internal_igetattr((ino_t)child->ar_self->I_ino, stbuf);
+    if (ino)
+        ret = unixfs_internal_igetattr(ino, stbuf);
 
 out:
     unixfs_internal_iput(dp);
@@ -466,58 +481,49 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    if (*offset >= dp->I_size)
-        return -1;
-
-    if (*offset < 2) {
-        int idx = 0;
-        dent->name[idx++] = '.';
-        dent->ino = ROOTINO;
-        if (*offset == 1) {
-            if (dp->I_ino != ROOTINO) {
-                struct inode* pdp = unixfs_internal_iget(dp->I_ino);
-                if (pdp) {
-                    dent->ino = pdp->I_ino;
-                    unixfs_internal_iput(pdp);
-                }
-            }
-            dent->name[idx++] = '.';
-        }
-        dent->name[idx++] = '\0';
-        goto out;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    struct unixfs_anode* dnp;
+    int done = 0, n;
+
+    /* only the end of the listing has to wait for the scanner */
+    unixfs_scanner_lock(us);
+    dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
+    while ((*offset >= dnp->an_size) && !done) {
+        done = unixfs_scanner_wait(us);
+        dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
     }
 
-    struct ar_node_info* child =
-        ((struct ar_node_info*)dp->I_private)->ar_children;;
-
-    off_t i;
-
-    for (i = 0; i < (*offset - 2); i++)
-        child = child->ar_next_sibling;
-
-    dent->ino = (ino_t)child->ar_self->I_ino;
-    size_t dirnamelen = min(child->ar_namelen, UNIXFS_MAXNAMLEN);
-    memcpy(dent->name, child->ar_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    n = unixfs_atree_readdir(&fs->s_tree, dp->I_ino, dirbuf, offset, dents,
+                             max);
 
-out:
-    *offset += 1;
+    unixfs_scanner_unlock(us);
 
-    return 0;
+    return n;
 }
 
 static ssize_t
 unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
                        int* error)
 {
-    off_t start = (off_t)ip->I_daddr[0];
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    off_t start =
+        (off_t)unixfs_atree_node(&fs->s_tree, ip->I_ino)->an_un.an_daddr;
+    unixfs_scanner_unlock(&fs->s_scanner);
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    ssize_t ret = pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    if (ret > 0)
+        UNIXFS_STATS_BIO(ret);
+
+    return ret;
 }
 
 static int
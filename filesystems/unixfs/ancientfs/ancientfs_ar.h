@@ -19,7 +19,8 @@ struct filsys
     uint32_t s_files;
     uint32_t s_directories;
     uint32_t s_lastino;
-    struct inode* s_rootip;
+    struct unixfs_atree s_tree;
+    struct unixfs_scanner s_scanner; /* builds s_tree after init */
 };
 
 #define ARMAG    "!<arch>\n" /* ar "magic number" */
@@ -39,14 +40,4 @@ struct ar_hdr
     char ar_fmag[2];         /* ASCII consistency check */
 };
 
-struct ar_node_info
-{ 
-    struct   inode*        ar_self;
-    struct   ar_node_info* ar_parent;
-    struct   ar_node_info* ar_children;
-    struct   ar_node_info* ar_next_sibling;
-    char*    ar_name;
-    uint32_t ar_namelen;
-};
-
 #endif /* _ANCIENTFS_AR_H_ */
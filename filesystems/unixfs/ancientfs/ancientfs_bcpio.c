@@ -5,6 +5,7 @@
  */
 
 #include "ancientfs_bcpio.h"
+#include "ancientfs_links.h"
 #include "unixfs_common.h"
 
 #include <errno.h>
@@ -26,6 +27,7 @@ struct bcpio_entry {
 };
 
 static int ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce);
+static int ancientfs_bcpio_scan(struct unixfs_scanner* us, void* arg);
 
 static int
 ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
@@ -49,7 +51,7 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
 
     memset(ce, 0, sizeof(*ce));
 
-    /* nothing to do with h_dev */
+    ce->stat.st_dev = fs16_to_host(unixfs->s_endian, hdr->h_dev);
     ce->stat.st_ino = fs16_to_host(unixfs->s_endian, hdr->h_ino);
     ce->stat.st_mode =
         ancientfs_bcpio_mode(fs16_to_host(unixfs->s_endian, hdr->h_mode),
@@ -143,6 +145,151 @@ ancientfs_bcpio_readheader(int fd, struct bcpio_entry* ce)
     return 0;
 }
 
+static int
+ancientfs_bcpio_scan(struct unixfs_scanner* us, void* arg)
+{
+    unixfs_internal_attach(arg);
+
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_atree* at = &fs->s_tree;
+    int fd = unixfs->s_bdev;
+    int err;
+
+    lseek(fd, (off_t)0, SEEK_SET); /* rewind archive */
+
+    struct bcpio_entry _ce, *ce = &_ce;
+    struct ancientfs_links links;
+
+    ancientfs_links_init(&links);
+
+    for (;;) {
+
+        unixfs_scanner_lock(us);
+        int cancelled = unixfs_scanner_cancelled(us);
+        unixfs_scanner_unlock(us);
+        if (cancelled) {
+            err = ECANCELED;
+            break;
+        }
+
+        if ((err = ancientfs_bcpio_readheader(fd, ce)) != 0) {
+            if (err == 1)
+                err = 0;
+            else {
+                fprintf(stderr,
+                        "*** warning: cannot read block (error %d); "
+                        "tree is incomplete\n", err);
+                err = EIO;
+            }
+            break;
+        }
+
+        char* path = ce->name;
+        ino_t parent_ino = ROOTINO;
+        size_t pathlen = strlen(ce->name);
+
+        if ((*path == '.') && ((pathlen == 1) ||
+            ((pathlen == 2) && (*(path + 1) == '/')))) {
+            /* root */
+            unixfs_scanner_lock(us);
+            struct unixfs_anode* rootnp = unixfs_atree_node(at, ROOTINO);
+            rootnp->an_mode = ce->stat.st_mode;
+            rootnp->an_mtime = ce->stat.st_mtime;
+            unixfs_scanner_unlock(us);
+            continue;
+        }
+                
+        /* we don't deal with many fancy paths here: just '/' and './' */
+        if (*path == '/')
+            path++;
+        else if (*path == '.' && *(path + 1) == '/')
+            path += 2;
+
+        char *cnp, *term;
+
+        for (cnp = strtok_r(path, "/", &term); cnp;
+            cnp = strtok_r(NULL, "/", &term)) {
+            /* BSD's strtok_r() leaves term NULL after the last component,
+               glibc's pointing to an empty string */
+            int last = !(term && *term);
+            /* we have { parent_ino, cnp }; as the tree's only writer, we
+               needn't lock to look */
+            ino_t ino = unixfs_atree_lookup(at, parent_ino, cnp, strlen(cnp),
+                                            0);
+            if (ino) {
+                parent_ino = ino;
+                if (last) { /* out of order */
+                    unixfs_scanner_lock(us);
+                    struct unixfs_anode* dnp = unixfs_atree_node(at, ino);
+                    dnp->an_mode = ce->stat.st_mode;
+                    dnp->an_uid = ce->stat.st_uid;
+                    dnp->an_gid = ce->stat.st_gid;
+                    unixfs_scanner_unlock(us);
+                }
+                continue;
+            }
+
+            struct stat st = ce->stat;
+            if (!last && !S_ISDIR(st.st_mode)) /* out of order */
+                st.st_mode = S_IFDIR | 0755;
+
+            /* another name for a file we have: a hard link to it */
+            int linked = last && !S_ISDIR(st.st_mode) && (st.st_nlink > 1);
+            ino_t target = linked ?
+                ancientfs_links_find(&links, st.st_dev, st.st_ino) : 0;
+
+            unixfs_scanner_lock(us);
+            if (target && (ino = unixfs_atree_link(at, parent_ino, cnp,
+                                                   target))) {
+                /* the data comes with every name, or with the last only */
+                if (S_ISREG(st.st_mode) && st.st_size) {
+                    struct unixfs_anode* np = unixfs_atree_node(at, target);
+                    np->an_size = st.st_size;
+                    np->an_un.an_daddr = ce->daddr;
+                }
+            } else {
+                target = 0;
+                if (linked)
+                    st.st_nlink = 1; /* and one more for each link */
+                ino = unixfs_atree_add(at, parent_ino, cnp, &st, ce->daddr,
+                                       ce->linktargetname);
+            }
+            if (ino)
+                unixfs_scanner_publish(us);
+            unixfs_scanner_unlock(us);
+
+            if (!ino || (linked && !target &&
+                ancientfs_links_add(&links, st.st_dev, st.st_ino, ino))) {
+                fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+                abort();
+            }
+
+            if (target) /* not a file of its own */
+                break;
+
+            if (S_ISDIR(st.st_mode))
+                fs->s_directories++;
+            else
+                fs->s_files++;
+
+            fs->s_lastino = (uint32_t)ino;
+
+            if (S_ISDIR(st.st_mode))
+                parent_ino = ino;
+
+        } /* for each component */
+
+    } /* for each block */
+
+    ancientfs_links_fini(&links);
+
+    unixfs_scanner_lock(us);
+    unixfs->s_statvfs.f_files = fs->s_files + fs->s_directories;
+    unixfs_scanner_unlock(us);
+
+    return err;
+}
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -230,174 +377,24 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_bdev = fd;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(sizeof(struct bcpio_node_info))) != 0)
+    if ((err = unixfs_inodelayer_init(0)) != 0)
         goto out;
 
-    struct inode* rootip = unixfs_inodelayer_iget((ino_t)ROOTINO);
-    if (!rootip) {
-        fprintf(stderr, "*** fatal error: no root inode\n");
-        abort();
+    if ((err = unixfs_atree_init(&fs->s_tree, (ino_t)ROOTINO)) != 0) {
+        unixfs_inodelayer_fini();
+        goto out;
     }
 
-    rootip->I_mode = S_IFDIR | 0755;
-    rootip->I_uid  = getuid();
-    rootip->I_gid  = getgid();
-    rootip->I_size = 2;
-    rootip->I_atime_sec = rootip->I_mtime_sec = rootip->I_ctime_sec =        time(0);
-
-    struct bcpio_node_info* rootci = (struct bcpio_node_info*)rootip->I_private;
-    rootci->ci_self = rootip;
-    rootci->ci_parent = NULL;
-    rootci->ci_children = NULL;
-    rootci->ci_next_sibling = NULL;
-
-    unixfs_inodelayer_isucceeded(rootip);
+    struct unixfs_anode* rootnp = unixfs_atree_node(&fs->s_tree, ROOTINO);
+    rootnp->an_uid = getuid();
+    rootnp->an_gid = getgid();
+    rootnp->an_mtime = time(0);
 
     fs->s_fsize = stbuf.st_size / BCBLOCK;
     fs->s_files = 0;
     fs->s_directories = 1 + 1 + 1;
-    fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    lseek(fd, (off_t)0, SEEK_SET); /* rewind archive */
-
-    struct bcpio_entry _ce, *ce = &_ce;
-
-    for (;;) {
-        if ((err = ancientfs_bcpio_readheader(fd, ce)) != 0) {
-            if (err == 1)
-                break;
-            else {
-                fprintf(stderr,
-                        "*** fatal error: cannot read block (error %d)\n", err);
-                err = EIO;
-                goto out;
-            }
-        }
-
-        char* path = ce->name;
-        ino_t parent_ino = ROOTINO;
-        size_t pathlen = strlen(ce->name);
-
-        if ((*path == '.') && ((pathlen == 1) ||
-            ((pathlen == 2) && (*(path + 1) == '/')))) {
-            /* root */
-            rootip->I_mode = ce->stat.st_mode;
-            rootip->I_atime_sec = \
-                rootip->I_mtime_sec = \
-                    rootip->I_ctime_sec = ce->stat.st_mtime;
-            continue;
-        }
-                
-        /* we don't deal with many fancy paths here: just '/' and './' */
-        if (*path == '/')
-            path++;
-        else if (*path == '.' && *(path + 1) == '/')
-            path += 2;
-
-        char *cnp, *term;
-
-        for (cnp = strtok_r(path, "/", &term); cnp;
-            cnp = strtok_r(NULL, "/", &term)) {
-            /* we have { parent_ino, cnp } */
-            struct stat stbuf;
-            int missing = unixfs_internal_namei(parent_ino, cnp, &stbuf);
-            if (!missing) {
-                parent_ino = stbuf.st_ino;
-                if (!term) { /* out of order */
-                    struct inode* dirp = unixfs_inodelayer_iget(parent_ino);
-                    if (!dirp || !dirp->I_initialized) {
-                        fprintf(stderr,
-                                "*** fatal error: inode %llu inconsistent\n",
-                                (ino64_t)parent_ino);
-                        abort();
-                    }
-                    dirp->I_mode = ce->stat.st_mode;
-                    dirp->I_uid = ce->stat.st_uid;
-                    dirp->I_gid = ce->stat.st_gid;
-                    unixfs_inodelayer_iput(dirp);
-                }
-                continue;
-            }
-            struct inode* ip =
-                unixfs_inodelayer_iget((ino_t)(fs->s_lastino + 1));
-            if (!ip) {
-                fprintf(stderr, "*** fatal error: no inode for %llu\n",
-                        (ino64_t)(fs->s_lastino + 1));
-                abort();
-            }
-
-            ip->I_mode  = ce->stat.st_mode;
-            ip->I_uid   = ce->stat.st_uid;
-            ip->I_gid   = ce->stat.st_gid;
-            ip->I_size  = ce->stat.st_size;
-            ip->I_nlink = ce->stat.st_nlink;
-            ip->I_rdev  = ce->stat.st_rdev;
-
-            ip->I_atime_sec = ip->I_mtime_sec = ip->I_ctime_sec =
-                ce->stat.st_mtime;
-
-            struct bcpio_node_info* ci = (struct bcpio_node_info*)ip->I_private;
-
-            size_t namelen = strlen(cnp);
-            ci->ci_name = malloc(namelen + 1);
-            if (!ci->ci_name) {
-                fprintf(stderr, "*** fatal error: cannot allocate memory\n");
-                abort();
-            }
-            memcpy(ci->ci_name, cnp, namelen);
-            ci->ci_name[namelen] = '\0';
-
-            ip->I_daddr[0] = 0;
-
-            if (S_ISLNK(ip->I_mode)) {
-                namelen = strlen(ce->linktargetname);
-                ci->ci_linktargetname = malloc(namelen + 1);
-                if (!ci->ci_name) {
-                    fprintf(stderr,
-                            "*** fatal error: cannot allocate memory\n");
-                    abort();
-                }
-                memcpy(ci->ci_linktargetname, ce->linktargetname, namelen);
-                ci->ci_linktargetname[namelen] = '\0';
-            } else if (S_ISREG(ip->I_mode)) {
-
-                ip->I_daddr[0] = ce->daddr;
-            }
-             
-            ci->ci_self = ip;
-            ci->ci_children = NULL;
-            struct inode* parent_ip = unixfs_internal_iget(parent_ino);
-            parent_ip->I_size += 1;
-            ci->ci_parent = (struct bcpio_node_info*)(parent_ip->I_private);
-            ci->ci_next_sibling = ci->ci_parent->ci_children;
-            ci->ci_parent->ci_children = ci;
-
-            if (term && !S_ISDIR(ip->I_mode)) /* out of order */
-                ip->I_mode = S_IFDIR | 0755;
-
-            if (S_ISDIR(ip->I_mode)) {
-                fs->s_directories++;
-                parent_ino = fs->s_lastino + 1;
-                ip->I_size = 2;
-            } else
-                fs->s_files++;
-
-            fs->s_lastino++;
-
-            //if (ip->I_ino > fs->s_lastino)
-                //fs->s_lastino = ip->I_ino;
-
-            unixfs_internal_iput(parent_ip);
-            unixfs_inodelayer_isucceeded(ip);
-            /* no put */
-
-        } /* for each component */
-
-    } /* for each block */
-
-    err = 0;
-
     unixfs->s_statvfs.f_bsize = BCBLOCK;
     unixfs->s_statvfs.f_frsize = BCBLOCK;
     unixfs->s_statvfs.f_ffree = 0;
@@ -408,6 +405,16 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_dentsize = 1;
     unixfs->s_statvfs.f_namemax = UNIXFS_MAXNAMLEN;
 
+    /* the rest of the tree comes in the background */
+    err = unixfs_scanner_start(&fs->s_scanner, ancientfs_bcpio_scan, sb);
+    if (err) {
+        fprintf(stderr, "*** fatal error: cannot set up the scanner\n");
+        unixfs_atree_fini(&fs->s_tree);
+        unixfs_inodelayer_fini();
+        err = ENOMEM;
+        goto out;
+    }
+
     snprintf(unixfs->s_fsname, UNIXFS_MNAMELEN, "Old (binary) bcpio");
 
     char* dmg_basename = basename((char*)dmg);
@@ -436,29 +443,21 @@ unixfs_internal_fini(void* filsys)
 {
     struct super_block* sb = (struct super_block*)filsys;
     struct filsys* fs = (struct filsys*)sb->s_fs_info;
-    ino_t i = fs->s_lastino;
-    for (; i >= ROOTINO; i--) {
-        struct inode* tmp = unixfs_internal_iget(i);
-        if (tmp) {
-            struct bcpio_node_info* ci = (struct bcpio_node_info*)tmp->I_private;
-            if (ci) {
-                free(ci->ci_name);
-                if (ci->ci_linktargetname)
-                    free(ci->ci_linktargetname);
-            }
-            unixfs_internal_iput(tmp);
-            unixfs_internal_iput(tmp);
-        }
-    }
+
+    unixfs_scanner_stop(&fs->s_scanner);
 
     unixfs_inodelayer_fini();
+    unixfs_atree_fini(&fs->s_tree);
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -492,6 +491,19 @@ unixfs_internal_iget(ino_t ino)
     if (ip->I_initialized)
         return ip;
 
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    int found;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    if ((found = (unixfs_atree_node(&fs->s_tree, ino) != NULL)))
+        unixfs_atree_stat(&fs->s_tree, ino, &ip->I_stat);
+    unixfs_scanner_unlock(&fs->s_scanner);
+
+    if (found) {
+        unixfs_inodelayer_isucceeded(ip);
+        return ip;
+    }
+
     unixfs_inodelayer_ifailed(ip);
 
     return NULL; 
@@ -520,7 +532,11 @@ unixfs_internal_igetattr(ino_t ino, struct stat* stbuf)
 static void
 unixfs_internal_istat(struct inode* ip, struct stat* stbuf)
 {
-    memcpy(stbuf, &ip->I_stat, sizeof(struct stat));
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner); /* directories grow as we scan */
+    unixfs_atree_stat(&fs->s_tree, ip->I_ino, stbuf);
+    unixfs_scanner_unlock(&fs->s_scanner);
 }
 
 static int
@@ -542,28 +558,27 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
         goto out;
     }
 
-    struct bcpio_node_info* child =
-        ((struct bcpio_node_info*)dp->I_private)->ci_children;;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    ino_t seen = 0;
+    int done = 0;
+    ino_t ino = 0;
 
-    if (!child) {
-        ret = ENOENT;
-        goto out;
-    }
-
-    int found = 0;
-
-    do {
-        size_t target_namelen = strlen((const char*)child->ci_name);
-        if ((namelen == target_namelen) &&
-            (memcmp(name, child->ci_name, target_namelen) == 0)) {
-            found = 1;
+    /* until it's found, or the scanner is past the end of the archive */
+    unixfs_scanner_lock(us);
+    for (;;) {
+        ino_t head = unixfs_atree_node(&fs->s_tree, parentino)->an_children;
+        ino = unixfs_atree_lookup(&fs->s_tree, parentino, name, namelen,
+                                  seen);
+        if (ino || done)
             break;
-        }
-        child = child->ci_next_sibling;
-    } while (child);
+        seen = head;
+        done = unixfs_scanner_wait(us);
+    }
+    unixfs_scanner_unlock(us);
 
-    if (found)
-        ret = unixfs_internal_igetattr((ino_t)child->ci_self->I_ino, stbuf);
+    if (ino)
+        ret = unixfs_internal_igetattr(ino, stbuf);
 
 out:
     unixfs_internal_iput(dp);
@@ -572,59 +587,49 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    if (*offset >= dp->I_size)
-        return -1;
-
-    if (*offset < 2) {
-        int idx = 0;
-        dent->name[idx++] = '.';
-        dent->ino = ROOTINO;
-        if (*offset == 1) {
-            if (dp->I_ino != ROOTINO) {
-                struct inode* pdp = unixfs_internal_iget(dp->I_ino);
-                if (pdp) {
-                    dent->ino = pdp->I_ino;
-                    unixfs_internal_iput(pdp);
-                }
-            }
-            dent->name[idx++] = '.';
-        }
-        dent->name[idx++] = '\0';
-        goto out;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    struct unixfs_anode* dnp;
+    int done = 0, n;
+
+    /* only the end of the listing has to wait for the scanner */
+    unixfs_scanner_lock(us);
+    dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
+    while ((*offset >= dnp->an_size) && !done) {
+        done = unixfs_scanner_wait(us);
+        dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
     }
 
-    struct bcpio_node_info* child =
-        ((struct bcpio_node_info*)dp->I_private)->ci_children;;
-
-    off_t i;
-
-    for (i = 0; i < (*offset - 2); i++)
-        child = child->ci_next_sibling;
+    n = unixfs_atree_readdir(&fs->s_tree, dp->I_ino, dirbuf, offset, dents,
+                             max);
 
-    dent->ino = (ino_t)child->ci_self->I_ino;
-    size_t dirnamelen = strlen(child->ci_name);
-    dirnamelen = min(dirnamelen, UNIXFS_MAXNAMLEN);
-    memcpy(dent->name, child->ci_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
-
-out:
-    *offset += 1;
+    unixfs_scanner_unlock(us);
 
-    return 0;
+    return n;
 }
 
 static ssize_t
 unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
                        int* error)
 {
-    off_t start = (off_t)ip->I_daddr[0];
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    off_t start =
+        (off_t)unixfs_atree_node(&fs->s_tree, ip->I_ino)->an_un.an_daddr;
+    unixfs_scanner_unlock(&fs->s_scanner);
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    ssize_t ret = pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    if (ret > 0)
+        UNIXFS_STATS_BIO(ret);
+
+    return ret;
 }
 
 static int
@@ -636,15 +641,20 @@ unixfs_internal_readlink(ino_t ino, char path[UNIXFS_MAXPATHLEN])
 
     int error;
 
-    struct bcpio_node_info* ci = (struct bcpio_node_info*)ip->I_private;
-    if (!ci->ci_linktargetname) {
+    if (!S_ISLNK(ip->I_mode)) {
         error = ENOENT;
         goto out;
     } 
 
-    size_t linklen = min(ip->I_size, BCBLOCK);
-    memcpy(path, ci->ci_linktargetname, linklen);
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    struct unixfs_anode* np = unixfs_atree_node(&fs->s_tree, ino);
+    const char* target = unixfs_atree_string(&fs->s_tree, np->an_un.an_link);
+    size_t linklen = min(strlen(target), UNIXFS_MAXPATHLEN - 1);
+    memcpy(path, target, linklen);
     path[linklen] = '\0';
+    unixfs_scanner_unlock(&fs->s_scanner);
 
     error = 0;
 
@@ -33,7 +33,8 @@ struct filsys
     uint32_t s_lastino;
     uint32_t s_dataoffset;
     uint32_t s_needsswap;
-    struct inode* s_rootip;
+    struct unixfs_atree s_tree;
+    struct unixfs_scanner s_scanner; /* builds s_tree after init */
 };
 
 #define BCBLOCK       512
@@ -59,15 +60,6 @@ struct bcpio_header {
  /* char    h_data[h_filesize rounded to word]; */
 } __attribute__((packed));
 
-struct bcpio_node_info {
-    struct inode*           ci_self;
-    struct bcpio_node_info* ci_parent;
-    struct bcpio_node_info* ci_children;
-    struct bcpio_node_info* ci_next_sibling;
-    char*                   ci_name;
-    char*                   ci_linktargetname;
-};
-
 /* modes */
 #define IALLOC  0100000 /* i-node is allocated */
 #define ILARG   010000  /* large file */
@@ -0,0 +1,387 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#include "ancientfs_cksum.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define ANCIENTFS_CKSUM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define ANCIENTFS_CKSUM_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ANCIENTFS_CKSUM_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* scalar: the reference the others have to agree with */
+
+static long
+bytesum_scalar(const void* p, size_t n, int signedbytes)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    long sum = 0;
+    size_t i;
+
+    if (signedbytes) {
+        for (i = 0; i < n; i++)
+            sum += (int8_t)b[i];
+    } else {
+        for (i = 0; i < n; i++)
+            sum += b[i];
+    }
+
+    return sum;
+}
+
+static uint16_t
+wordsum_scalar(const void* p, size_t n, int swap)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    uint16_t sum = 0;
+    size_t i;
+
+    /* bytes rather than words: p needn't be aligned */
+    for (i = 0; i < n; i++, b += 2) {
+        uint16_t w;
+        memcpy(&w, b, sizeof(w));
+        if (swap)
+            w = (uint16_t)((w << 8) | (w >> 8));
+        sum += w;
+    }
+
+    return sum;
+}
+
+static int
+usable_scalar(void)
+{
+    return 1;
+}
+
+/*
+ * The x86 versions add up bytes with PSADBW, which sums the absolute
+ * differences of 8 unsigned bytes from 0 into a 64-bit lane. Flipping the
+ * top bit of every byte first turns a signed byte b into b + 128, so a
+ * signed sum is that sum less 128 a byte.
+ */
+
+#if ANCIENTFS_CKSUM_SSE2
+
+static long
+bytesum_sse2(const void* p, size_t n, int signedbytes)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i flip = _mm_set1_epi8(signedbytes ? (char)0x80 : 0);
+    __m128i acc = zero;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(v, flip), zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    long sum = (long)(lanes[0] + lanes[1]);
+    if (signedbytes)
+        sum -= 128 * (long)i;
+
+    return sum + bytesum_scalar(b + i, n - i, signedbytes);
+}
+
+static uint16_t
+wordsum_sse2(const void* p, size_t n, int swap)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    if (swap) {
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(b + 2 * i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            acc = _mm_add_epi16(acc, v);
+        }
+    } else {
+        for (; i + 8 <= n; i += 8)
+            acc = _mm_add_epi16(acc,
+                      _mm_loadu_si128((const __m128i*)(b + 2 * i)));
+    }
+
+    uint16_t lanes[8], sum = 0;
+    int k;
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    for (k = 0; k < 8; k++)
+        sum += lanes[k];
+
+    return sum + wordsum_scalar(b + 2 * i, n - i, swap);
+}
+
+static int
+usable_sse2(void)
+{
+    return 1; /* compiled for it */
+}
+
+#endif /* ANCIENTFS_CKSUM_SSE2 */
+
+#if ANCIENTFS_CKSUM_AVX2
+
+__attribute__((target("avx2"))) static long
+bytesum_avx2(const void* p, size_t n, int signedbytes)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i flip = _mm256_set1_epi8(signedbytes ? (char)0x80 : 0);
+    __m256i acc = zero;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = _mm256_add_epi64(acc,
+                  _mm256_sad_epu8(_mm256_xor_si256(v, flip), zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    long sum = (long)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    if (signedbytes)
+        sum -= 128 * (long)i;
+
+    return sum + bytesum_scalar(b + i, n - i, signedbytes);
+}
+
+__attribute__((target("avx2"))) static uint16_t
+wordsum_avx2(const void* p, size_t n, int swap)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    if (swap) {
+        for (; i + 16 <= n; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(b + 2 * i));
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8),
+                                _mm256_srli_epi16(v, 8));
+            acc = _mm256_add_epi16(acc, v);
+        }
+    } else {
+        for (; i + 16 <= n; i += 16)
+            acc = _mm256_add_epi16(acc,
+                      _mm256_loadu_si256((const __m256i*)(b + 2 * i)));
+    }
+
+    uint16_t lanes[16], sum = 0;
+    int k;
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    for (k = 0; k < 16; k++)
+        sum += lanes[k];
+
+    return sum + wordsum_scalar(b + 2 * i, n - i, swap);
+}
+
+static int
+usable_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+#endif /* ANCIENTFS_CKSUM_AVX2 */
+
+#if ANCIENTFS_CKSUM_NEON
+
+static long
+bytesum_neon(const void* p, size_t n, int signedbytes)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    const uint8x16_t flip = vdupq_n_u8(signedbytes ? 0x80 : 0);
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = veorq_u8(vld1q_u8(b + i), flip);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+
+    long sum = (long)vgetq_lane_u32(acc, 0) + (long)vgetq_lane_u32(acc, 1) +
+               (long)vgetq_lane_u32(acc, 2) + (long)vgetq_lane_u32(acc, 3);
+    if (signedbytes)
+        sum -= 128 * (long)i;
+
+    return sum + bytesum_scalar(b + i, n - i, signedbytes);
+}
+
+static uint16_t
+wordsum_neon(const void* p, size_t n, int swap)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    uint16x8_t acc = vdupq_n_u16(0);
+    size_t i = 0;
+
+    if (swap) {
+        for (; i + 8 <= n; i += 8)
+            acc = vaddq_u16(acc,
+                      vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(b + 2 * i))));
+    } else {
+        for (; i + 8 <= n; i += 8)
+            acc = vaddq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(b + 2 * i)));
+    }
+
+    uint16_t lanes[8], sum = 0;
+    int k;
+    vst1q_u16(lanes, acc);
+    for (k = 0; k < 8; k++)
+        sum += lanes[k];
+
+    return sum + wordsum_scalar(b + 2 * i, n - i, swap);
+}
+
+static int
+usable_neon(void)
+{
+    return 1; /* compiled for it */
+}
+
+#endif /* ANCIENTFS_CKSUM_NEON */
+
+struct ancientfs_kernels {
+    const char* name;
+    long        (*bytesum)(const void* p, size_t n, int signedbytes);
+    uint16_t    (*wordsum)(const void* p, size_t n, int swap);
+    int         (*usable)(void);
+};
+
+/* best first */
+static const struct ancientfs_kernels ancientfs_kernels[] = {
+#if ANCIENTFS_CKSUM_AVX2
+    { "avx2",   bytesum_avx2,   wordsum_avx2,   usable_avx2   },
+#endif
+#if ANCIENTFS_CKSUM_SSE2
+    { "sse2",   bytesum_sse2,   wordsum_sse2,   usable_sse2   },
+#endif
+#if ANCIENTFS_CKSUM_NEON
+    { "neon",   bytesum_neon,   wordsum_neon,   usable_neon   },
+#endif
+    { "scalar", bytesum_scalar, wordsum_scalar, usable_scalar },
+};
+
+#define ANCIENTFS_NKERNELS \
+    (sizeof(ancientfs_kernels) / sizeof(ancientfs_kernels[0]))
+
+static const struct ancientfs_kernels* ancientfs_kernels_active =
+    &ancientfs_kernels[ANCIENTFS_NKERNELS - 1];
+
+/* before main(), and so before any scanner thread */
+static void ancientfs_cksum_init(void) __attribute__((constructor));
+
+static void
+ancientfs_cksum_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < ANCIENTFS_NKERNELS; i++) {
+        if (ancientfs_kernels[i].usable()) {
+            ancientfs_kernels_active = &ancientfs_kernels[i];
+            break;
+        }
+    }
+}
+
+const char*
+ancientfs_cksum_impl(void)
+{
+    return ancientfs_kernels_active->name;
+}
+
+int
+ancientfs_cksum_use(const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < ANCIENTFS_NKERNELS; i++) {
+        if (!strcmp(ancientfs_kernels[i].name, name)) {
+            if (!ancientfs_kernels[i].usable())
+                return -1;
+            ancientfs_kernels_active = &ancientfs_kernels[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+long
+ancientfs_bytesum(const void* p, size_t n, int signedbytes)
+{
+    return ancientfs_kernels_active->bytesum(p, n, signedbytes);
+}
+
+uint16_t
+ancientfs_wordsum(const void* p, size_t n, int swap)
+{
+    return ancientfs_kernels_active->wordsum(p, n, swap);
+}
+
+static inline int
+ancientfs_digit(unsigned char c)
+{
+    if ((unsigned)(c - '0') < 10)
+        return c - '0';
+    c |= 0x20;
+    if ((unsigned)(c - 'a') < 26)
+        return c - 'a' + 10;
+    return 36; /* no base has it */
+}
+
+/*
+ * Header fields are a dozen characters at most, too few for vector loads
+ * to pay for themselves; what this saves over the copy into a terminated
+ * buffer and strtol() is the copy, and strtol()'s generality. Signs and
+ * 0x prefixes, which no archive writes, still go to strtol().
+ */
+long
+ancientfs_atoi(const char* field, size_t len, int base)
+{
+    const unsigned char* p = (const unsigned char*)field;
+    const unsigned char* end = p + len;
+
+    while ((p < end) && ((*p == ' ') || ((*p >= '\t') && (*p <= '\r'))))
+        p++;
+
+    if ((p < end) && ((*p == '+') || (*p == '-') ||
+        ((base == 16) && (*p == '0') && (p + 1 < end) &&
+         ((p[1] | 0x20) == 'x')))) {
+        char buf[32];
+        len = (len < sizeof(buf)) ? len : sizeof(buf) - 1;
+        memcpy(buf, field, len);
+        buf[len] = '\0';
+        return strtol(buf, (char**)NULL, base);
+    }
+
+    unsigned long value = 0;
+    int d;
+
+    for (; (p < end) && ((d = ancientfs_digit(*p)) < base); p++) {
+        if (value > ((unsigned long)LONG_MAX - d) / base)
+            return LONG_MAX; /* as strtol() does */
+        value = value * base + d;
+    }
+
+    return (long)value;
+}
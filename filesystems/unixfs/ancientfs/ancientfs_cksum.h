@@ -0,0 +1,38 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#ifndef _ANCIENTFS_CKSUM_H_
+#define _ANCIENTFS_CKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The checksum kernels that scanning archive and tape headers spends its
+ * time in, with vector versions (SSE2, AVX2, NEON) picked at startup for
+ * what the processor can do, and a scalar one for everything else.
+ */
+
+/* Sum of n bytes, each taken as signed or as unsigned. */
+long     ancientfs_bytesum(const void* p, size_t n, int signedbytes);
+
+/* Sum, modulo 2^16, of n 16-bit words, each byte swapped first if swap. */
+uint16_t ancientfs_wordsum(const void* p, size_t n, int swap);
+
+/*
+ * What strtol(3) makes of a header field of len characters that need not
+ * be terminated, without copying it first.
+ */
+long     ancientfs_atoi(const char* field, size_t len, int base);
+
+/*
+ * The kernels in use ("scalar", "sse2", "avx2" or "neon"), and a way to
+ * pick others; ancientfs_cksum_use() returns -1 if name can't run here.
+ */
+const char* ancientfs_cksum_impl(void);
+int         ancientfs_cksum_use(const char* name);
+
+#endif /* _ANCIENTFS_CKSUM_H_ */
@@ -20,7 +20,8 @@ struct filsys
     uint32_t s_lastino;
     uint32_t s_dataoffset;
     uint32_t s_needsswap;
-    struct inode* s_rootip;
+    struct unixfs_atree s_tree;
+    struct unixfs_scanner s_scanner; /* builds s_tree after init */
 };
 
 #define CPIO_NEWC_BLOCK       512
@@ -49,15 +50,6 @@ struct cpio_newc_header {
 /*  char c_data[c_filesize rounded to 4 bytes]; */
 } __attribute__((packed));
 
-struct cpio_newc_node_info {
-    struct inode*               ci_self;
-    struct cpio_newc_node_info* ci_parent;
-    struct cpio_newc_node_info* ci_children;
-    struct cpio_newc_node_info* ci_next_sibling;
-    char*                       ci_name;
-    char*                       ci_linktargetname;
-};
-
 /* modes */
 #define IALLOC  0100000 /* i-node is allocated */
 #define ILARG   010000  /* large file */
@@ -366,11 +366,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (fs)
             free(fs);
+        free(sb);
     }
 }
 
@@ -410,11 +413,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(unixfs->s_bdev, blkbuf,
+                                    UNIXFS_IOSIZE(unixfs),
+                                    blkno * (off_t)BSIZE);
 }
 
 static struct inode*
@@ -570,47 +571,55 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
     struct direct* ep;
     off_t ni_offset = *offset;
     off_t entryoffsetinblock = blkoff(ni_offset);
     int endsearch = roundup(dp->I_size, ANCIENTFS_211BSD_DIRBLKSIZ);
+    int n = 0;
 
     if (ni_offset >= endsearch)
-        return -1;
+        return 0;
 
     if (!dirbuf->flags.initialized || (blkoff(ni_offset) == 0)) {
         int ret = __unixfs_internal_blkatoff(dp, ni_offset, dirbuf->data);
         if (ret)
-            return ret;
+            return -1;
         entryoffsetinblock = 0;
         dirbuf->flags.initialized = 1;
     }
-    ep = (struct direct*)((char*)dirbuf->data + entryoffsetinblock);
-    ep->d_ino = fs16_to_host(unixfs->s_endian, ep->d_ino);
-    ep->d_reclen = fs16_to_host(unixfs->s_endian, ep->d_reclen);
-    ep->d_namlen = fs16_to_host(unixfs->s_endian, ep->d_namlen);
-    if (ep->d_reclen == 0 ||
-        __unixfs_internal_dirbadentry(ep, entryoffsetinblock)) {
-        int i =
-            ANCIENTFS_211BSD_DIRBLKSIZ - (entryoffsetinblock &
-                (ANCIENTFS_211BSD_DIRBLKSIZ - 1));
-        ni_offset += i;
-        entryoffsetinblock += i;
-        dent->ino = 0;
-    } else {
-        dent->ino = (ino_t)ep->d_ino;
-        memcpy(dent->name, ep->d_name, ep->d_namlen);
-        dent->name[ep->d_namlen] = '\0';
-        ni_offset += ep->d_reclen;
-        entryoffsetinblock += ep->d_reclen;
-    }
+
+    /* the rest of the block, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[n++];
+
+        ep = (struct direct*)((char*)dirbuf->data + entryoffsetinblock);
+        ep->d_ino = fs16_to_host(unixfs->s_endian, ep->d_ino);
+        ep->d_reclen = fs16_to_host(unixfs->s_endian, ep->d_reclen);
+        ep->d_namlen = fs16_to_host(unixfs->s_endian, ep->d_namlen);
+        if (ep->d_reclen == 0 ||
+            __unixfs_internal_dirbadentry(ep, entryoffsetinblock)) {
+            int i =
+                ANCIENTFS_211BSD_DIRBLKSIZ - (entryoffsetinblock &
+                    (ANCIENTFS_211BSD_DIRBLKSIZ - 1));
+            ni_offset += i;
+            entryoffsetinblock += i;
+            dent->ino = 0;
+        } else {
+            dent->ino = (ino_t)ep->d_ino;
+            memcpy(dent->name, ep->d_name, ep->d_namlen);
+            dent->name[ep->d_namlen] = '\0';
+            ni_offset += ep->d_reclen;
+            entryoffsetinblock += ep->d_reclen;
+        }
+    } while ((n < max) && (blkoff(ni_offset) != 0) && (ni_offset < endsearch));
 
     *offset = ni_offset;
 
-    return 0;
+    return n;
 }
 
 static ssize_t
@@ -9,6 +9,7 @@
 
 #include "unixfs_internal.h"
 #include "ancientfs.h"
+#include "ancientfs_cksum.h"
 
 typedef int16_t  a_short;      /* ancient short */
 typedef uint16_t a_ushort;     /* ancient unsigned short */
@@ -134,16 +135,10 @@ struct spcl {
 static inline int
 ancientfs_dump_cksum(uint16_t* buf, fs_endian_t e, uint32_t flags)
 {
-    uint16_t sum;
-    uint16_t limit;
+    uint16_t probe = 0x0102;
+    int swap = (fs16_to_host(e, probe) != probe);
 
-    sum = 0;
-    limit = BSIZE / sizeof(uint16_t);
-
-    do {
-        sum += fs16_to_host(e, *buf);
-        buf++;
-    } while (--limit);
+    uint16_t sum = ancientfs_wordsum(buf, BSIZE / sizeof(uint16_t), swap);
 
     return (sum == CHECKSUM) ? 0 : 1;
 }
@@ -5,6 +5,7 @@
  */
 
 #include "ancientfs_itp.h"
+#include "ancientfs_tapedir.h"
 #include "unixfs_common.h"
 
 #include <errno.h>
@@ -118,12 +119,19 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    char tapeblock[BSIZE];
+    struct ancientfs_tapedir td;
+
+    ancientfs_tapedir_open(&td, fd, BSIZE, tapedir_begin_block,
+                           tapedir_end_block, INOPB,
+                           sizeof(struct dinode_itp), 32, unixfs->s_endian);
 
     for (i = tapedir_begin_block; i < tapedir_end_block; i++) {
-        if (pread(fd, tapeblock, BSIZE, (off_t)(i * BSIZE)) != BSIZE) {
+        uint16_t* sums;
+        char* tapeblock = ancientfs_tapedir_block(&td, i, &sums);
+        if (!tapeblock) {
             fprintf(stderr, "*** fatal error: cannot read tape block %llu\n",
                     (off_t)i);
+            ancientfs_tapedir_close(&td);
             err = EIO;
             goto out;
         }
@@ -132,8 +140,7 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         
         for (j = 0; j < INOPB; j++, di++) {
 
-            if (ancientfs_itp_cksum((uint8_t*)di,
-                                 unixfs->s_flags, unixfs->s_endian) != 0)
+            if (sums[j] != 0)
                 continue;
 
             if (!di->di_path[0]) {
@@ -217,6 +224,8 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
         }
     }
 
+    ancientfs_tapedir_close(&td);
+
     unixfs->s_statvfs.f_bsize = BSIZE;
     unixfs->s_statvfs.f_frsize = BSIZE;
     unixfs->s_statvfs.f_ffree = 0;
@@ -267,11 +276,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -304,11 +316,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         /* NOTREACHED */
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(unixfs->s_bdev, blkbuf,
+                                    UNIXFS_IOSIZE(unixfs),
+                                    blkno * (off_t)BSIZE);
 }
 
 static struct inode*
@@ -404,47 +414,64 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    if (*offset >= dp->I_size)
-        return -1;
+    struct unixfs_dircursor* dc = (struct unixfs_dircursor*)dirbuf->data;
+    struct tap_node_info* child = NULL;
+    int n;
+
+    if (!dirbuf->flags.initialized) {
+        dc->dc_offset = 0;
+        dc->dc_next = NULL;
+        dirbuf->flags.initialized = 1;
+    }
+
+    for (n = 0; (n < max) && (*offset < dp->I_size); n++, *offset += 1) {
+        struct unixfs_direntry* dent = &dents[n];
 
-    if (*offset < 2) {
-        int idx = 0;
-        dent->name[idx++] = '.';
-        dent->ino = ROOTINO;
-        if (*offset == 1) {
-            if (dp->I_ino != ROOTINO) {
-                struct inode* pdp = unixfs_internal_iget(dp->I_ino);
-                if (pdp) {
-                    dent->ino = pdp->I_ino;
-                    unixfs_internal_iput(pdp);
+        if (*offset < 2) {
+            int idx = 0;
+            dent->name[idx++] = '.';
+            dent->ino = ROOTINO;
+            if (*offset == 1) {
+                if (dp->I_ino != ROOTINO) {
+                    struct inode* pdp = unixfs_internal_iget(dp->I_ino);
+                    if (pdp) {
+                        dent->ino = pdp->I_ino;
+                        unixfs_internal_iput(pdp);
+                    }
                 }
+                dent->name[idx++] = '.';
             }
-            dent->name[idx++] = '.';
+            dent->name[idx++] = '\0';
+            continue;
         }
-        dent->name[idx++] = '\0';
-        goto out;
-    }
 
-    struct tap_node_info* child =
-        ((struct tap_node_info*)dp->I_private)->ti_children;;
+        if (!child) {
+            if ((dc->dc_offset == *offset) && dc->dc_next) {
+                child = (struct tap_node_info*)dc->dc_next;
+            } else {
+                off_t i;
+                child = ((struct tap_node_info*)dp->I_private)->ti_children;
+                for (i = 0; i < (*offset - 2); i++)
+                    child = child->ti_next_sibling;
+            }
+        }
 
-    off_t i;
+        dent->ino = (ino_t)child->ti_self->I_ino;
+        size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
+        memcpy(dent->name, child->ti_name, dirnamelen);
+        dent->name[dirnamelen] = '\0';
 
-    for (i = 0; i < (*offset - 2); i++)
         child = child->ti_next_sibling;
+    }
 
-    dent->ino = (ino_t)child->ti_self->I_ino;
-    size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
-    memcpy(dent->name, child->ti_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    dc->dc_offset = *offset;
+    dc->dc_next = child;
 
-out:
-    *offset += 1;
-
-    return 0;
+    return n;
 }
 
 static ssize_t
@@ -83,15 +83,4 @@ ancientfs_itp_mode(mode_t mode, uint32_t flags)
     return newmode;
 }
 
-static inline int
-ancientfs_itp_cksum(uint8_t* de, fs_endian_t e, uint32_t flags)
-{
-    uint16_t* p = (uint16_t*)de;
-    uint16_t cksum = 0;
-    int i = 0;
-    for (i = 0; i < 32; i++, p++)
-        cksum += fs16_to_host(e, *p);
-    return cksum;
-}
-
 #endif /* _ANCIENTFS_ITP_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#include "ancientfs_links.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+ancientfs_links_init(struct ancientfs_links* links)
+{
+    memset(links, 0, sizeof(*links));
+}
+
+void
+ancientfs_links_fini(struct ancientfs_links* links)
+{
+    if (links->al_table)
+        free(links->al_table);
+    memset(links, 0, sizeof(*links));
+}
+
+static size_t
+ancientfs_links_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = (ino ^ (dev << 32) ^ (dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+    return (size_t)(h ^ (h >> 32));
+}
+
+static struct ancientfs_link*
+ancientfs_links_slot(struct ancientfs_link* table, size_t size, uint64_t dev,
+                     uint64_t ino)
+{
+    size_t i = ancientfs_links_hash(dev, ino) & (size - 1);
+
+    /* linear probing; the table is never more than half full */
+    while (table[i].ln_node &&
+           ((table[i].ln_dev != dev) || (table[i].ln_ino != ino)))
+        i = (i + 1) & (size - 1);
+
+    return &table[i];
+}
+
+ino_t
+ancientfs_links_find(struct ancientfs_links* links, uint64_t dev,
+                     uint64_t ino)
+{
+    if (!links->al_count)
+        return 0;
+
+    return ancientfs_links_slot(links->al_table, links->al_size, dev,
+                                ino)->ln_node;
+}
+
+int
+ancientfs_links_add(struct ancientfs_links* links, uint64_t dev,
+                    uint64_t ino, ino_t node)
+{
+    if (2 * (links->al_count + 1) > links->al_size) {
+        size_t size = max(links->al_size * 2, 64);
+        struct ancientfs_link* table = calloc(size, sizeof(*table));
+        if (!table)
+            return ENOMEM;
+        size_t i;
+        for (i = 0; i < links->al_size; i++) {
+            struct ancientfs_link* lp = &links->al_table[i];
+            if (lp->ln_node)
+                *ancientfs_links_slot(table, size, lp->ln_dev,
+                                      lp->ln_ino) = *lp;
+        }
+        if (links->al_table)
+            free(links->al_table);
+        links->al_table = table;
+        links->al_size = size;
+    }
+
+    struct ancientfs_link* lp =
+        ancientfs_links_slot(links->al_table, links->al_size, dev, ino);
+    if (!lp->ln_node)
+        links->al_count++;
+    lp->ln_dev = dev;
+    lp->ln_ino = ino;
+    lp->ln_node = node;
+
+    return 0;
+}
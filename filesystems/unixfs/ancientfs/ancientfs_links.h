@@ -0,0 +1,42 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#ifndef _ANCIENTFS_LINKS_H_
+#define _ANCIENTFS_LINKS_H_
+
+#include "unixfs_internal.h"
+
+/*
+ * The files of an archive that have more than one name, by the device and
+ * inode number the archive gives them, each with the node that the first
+ * of its names got in the archive tree, so that the names after it can be
+ * made hard links to that node. A scanner keeps one while it scans.
+ */
+
+struct ancientfs_link {
+    uint64_t ln_dev;
+    uint64_t ln_ino;
+    ino_t    ln_node;        /* 0 for an empty slot */
+};
+
+struct ancientfs_links {
+    struct ancientfs_link* al_table;
+    size_t                 al_size;  /* a power of 2 */
+    size_t                 al_count;
+};
+
+void  ancientfs_links_init(struct ancientfs_links* links);
+void  ancientfs_links_fini(struct ancientfs_links* links);
+
+/* Returns the node for { dev, ino }, or 0 if there's none yet. */
+ino_t ancientfs_links_find(struct ancientfs_links* links, uint64_t dev,
+                           uint64_t ino);
+
+/* Returns 0, or ENOMEM. */
+int   ancientfs_links_add(struct ancientfs_links* links, uint64_t dev,
+                          uint64_t ino, ino_t node);
+
+#endif /* _ANCIENTFS_LINKS_H_ */
@@ -309,9 +309,11 @@ unixfs_usage(void)
 "AncientFS (%s): a MacFUSE file system to mount ancient Unix disks and tapes\n"
 "Amit Singh <http://osxbook.com>\n"
 "usage:\n"
-"      %s [--force] [--fsendian pdp|big|little] --dmg DMG --type TYPE MOUNTPOINT [MacFUSE args...]\n"
+"      %s [--control] [--force] [--fsendian pdp|big|little] [--idle SECONDS] --dmg DMG --type TYPE MOUNTPOINT [MacFUSE args...]\n"
 "where:\n"
-"     . DMG is an ancient Unix disk or tape image of a valid type\n"
+"     . DMG is an ancient Unix disk or tape image of a valid type, or a\n"
+"       directory of such images, each of which then shows up as a\n"
+"       subdirectory of the volume (TYPE may be left out if they have magic)\n"
 "     . TYPE is one of the following:\n\n",
 PROGVERS, PROGNAME);
 
@@ -324,7 +326,10 @@ PROGVERS, PROGNAME);
     fprintf(stderr, "\n");
 
     fprintf(stderr, "%s",
+    "     . --control mounts read-write so that the knobs in /.unixfs can be set\n"
     "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --idle closes images in a directory after SECONDS unused (default\n"
+    "       60; 0 keeps them open)\n"
     );
 }
 
@@ -248,11 +248,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -366,47 +369,64 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    if (*offset >= dp->I_size)
-        return -1;
+    struct unixfs_dircursor* dc = (struct unixfs_dircursor*)dirbuf->data;
+    struct ar_node_info* child = NULL;
+    int n;
+
+    if (!dirbuf->flags.initialized) {
+        dc->dc_offset = 0;
+        dc->dc_next = NULL;
+        dirbuf->flags.initialized = 1;
+    }
+
+    for (n = 0; (n < max) && (*offset < dp->I_size); n++, *offset += 1) {
+        struct unixfs_direntry* dent = &dents[n];
 
-    if (*offset < 2) {
-        int idx = 0;
-        dent->name[idx++] = '.';
-        dent->ino = ROOTINO;
-        if (*offset == 1) {
-            if (dp->I_ino != ROOTINO) {
-                struct inode* pdp = unixfs_internal_iget(dp->I_ino);
-                if (pdp) {
-                    dent->ino = pdp->I_ino;
-                    unixfs_internal_iput(pdp);
+        if (*offset < 2) {
+            int idx = 0;
+            dent->name[idx++] = '.';
+            dent->ino = ROOTINO;
+            if (*offset == 1) {
+                if (dp->I_ino != ROOTINO) {
+                    struct inode* pdp = unixfs_internal_iget(dp->I_ino);
+                    if (pdp) {
+                        dent->ino = pdp->I_ino;
+                        unixfs_internal_iput(pdp);
+                    }
                 }
+                dent->name[idx++] = '.';
             }
-            dent->name[idx++] = '.';
+            dent->name[idx++] = '\0';
+            continue;
         }
-        dent->name[idx++] = '\0';
-        goto out;
-    }
 
-    struct ar_node_info* child =
-        ((struct ar_node_info*)dp->I_private)->ar_children;;
+        if (!child) {
+            if ((dc->dc_offset == *offset) && dc->dc_next) {
+                child = (struct ar_node_info*)dc->dc_next;
+            } else {
+                off_t i;
+                child = ((struct ar_node_info*)dp->I_private)->ar_children;
+                for (i = 0; i < (*offset - 2); i++)
+                    child = child->ar_next_sibling;
+            }
+        }
 
-    off_t i;
+        dent->ino = (ino_t)child->ar_self->I_ino;
+        size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
+        memcpy(dent->name, child->ar_name, dirnamelen);
+        dent->name[dirnamelen] = '\0';
 
-    for (i = 0; i < (*offset - 2); i++)
         child = child->ar_next_sibling;
+    }
 
-    dent->ino = (ino_t)child->ar_self->I_ino;
-    size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
-    memcpy(dent->name, child->ar_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    dc->dc_offset = *offset;
+    dc->dc_next = child;
 
-out:
-    *offset += 1;
-
-    return 0;
+    return n;
 }
 
 static ssize_t
@@ -417,7 +437,11 @@ unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    ssize_t ret = pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    if (ret > 0)
+        UNIXFS_STATS_BIO(ret);
+
+    return ret;
 }
 
 static int
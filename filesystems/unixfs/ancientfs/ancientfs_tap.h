@@ -147,17 +147,6 @@ tap:
     return newmode;
 }
 
-static inline int
-ancientfs_tap_cksum(uint8_t* de, fs_endian_t e, uint32_t flags)
-{
-    uint16_t* p = (uint16_t*)de;
-    uint16_t cksum = 0;
-    int i = 0;
-    for (i = 0; i < 32; i++, p++)
-        cksum += fs16_to_host(e, *p);
-    return cksum;
-}
-
 /*
  * v1 00:00 Jan 1, 1971 /60
  * v2 00:00 Jan 1, 1971 /60
@@ -0,0 +1,135 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#include "ancientfs_tapedir.h"
+#include "ancientfs_cksum.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void
+ancientfs_tapedir_open(struct ancientfs_tapedir* td, int fd, uint32_t bsize,
+                       uint32_t begin, uint32_t end, uint32_t inopb,
+                       uint32_t entsize, uint32_t sumwords, fs_endian_t e)
+{
+    assert(!sumwords || ((inopb - 1) * entsize + sumwords * 2 <= bsize));
+
+    memset(td, 0, sizeof(*td));
+    td->td_fd = fd;
+    td->td_bsize = bsize;
+    td->td_end = end;
+    td->td_first = begin;
+    td->td_nblocks = 0;
+    td->td_chunk = TAPEDIR_CHUNK_MIN;
+    td->td_inopb = inopb;
+    td->td_entsize = entsize;
+    td->td_sumwords = sumwords;
+    td->td_endian = e;
+
+    /* a DECtape's or a magtape's whole directory is a single read */
+    if (end - begin <= TAPEDIR_CHUNK_MAX)
+        td->td_chunk = max(end - begin, 1);
+}
+
+void
+ancientfs_tapedir_close(struct ancientfs_tapedir* td)
+{
+    if (td->td_buf)
+        free(td->td_buf);
+    if (td->td_sums)
+        free(td->td_sums);
+    td->td_buf = NULL;
+    td->td_sums = NULL;
+    td->td_nblocks = 0;
+}
+
+static void
+ancientfs_tapedir_sum(struct ancientfs_tapedir* td)
+{
+    uint16_t* sums = td->td_sums;
+    uint32_t b, j;
+
+    /* does the data's byte order differ from ours? */
+    uint16_t probe = 0x0102;
+    int swap = (fs16_to_host(td->td_endian, probe) != probe);
+
+    for (b = 0; b < td->td_nblocks; b++) {
+        const char* blk = td->td_buf + (size_t)b * td->td_bsize;
+        for (j = 0; j < td->td_inopb; j++)
+            *sums++ = ancientfs_wordsum(blk + (size_t)j * td->td_entsize,
+                                        td->td_sumwords, swap);
+    }
+}
+
+static int
+ancientfs_tapedir_fill(struct ancientfs_tapedir* td, uint32_t blkno)
+{
+    uint32_t want = min(td->td_chunk, td->td_end - blkno);
+    size_t bytes = (size_t)want * td->td_bsize;
+
+    char* buf = realloc(td->td_buf, bytes);
+    if (!buf)
+        return ENOMEM;
+    td->td_buf = buf;
+
+    if (td->td_sumwords) {
+        uint16_t* sums = realloc(td->td_sums,
+                                 (size_t)want * td->td_inopb *
+                                 sizeof(uint16_t));
+        if (!sums)
+            return ENOMEM;
+        td->td_sums = sums;
+    }
+
+    td->td_first = blkno;
+    td->td_nblocks = 0;
+
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t ret = pread(td->td_fd, td->td_buf + done, bytes - done,
+                            (off_t)blkno * td->td_bsize + done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+
+    /* a short read only matters if the directory needs what's missing */
+    td->td_nblocks = done / td->td_bsize;
+    if (td->td_nblocks && td->td_sumwords)
+        ancientfs_tapedir_sum(td);
+
+    td->td_chunk = min(td->td_chunk * 2, TAPEDIR_CHUNK_MAX);
+
+    return td->td_nblocks ? 0 : EIO;
+}
+
+char*
+ancientfs_tapedir_block(struct ancientfs_tapedir* td, uint32_t blkno,
+                        uint16_t** sums)
+{
+    if (blkno >= td->td_end)
+        return NULL;
+
+    if ((blkno < td->td_first) || (blkno >= td->td_first + td->td_nblocks)) {
+        if (ancientfs_tapedir_fill(td, blkno) != 0)
+            return NULL;
+    }
+
+    uint32_t idx = blkno - td->td_first;
+
+    if (sums)
+        *sums = td->td_sumwords ? (td->td_sums + idx * td->td_inopb) : NULL;
+
+    return td->td_buf + (size_t)idx * td->td_bsize;
+}
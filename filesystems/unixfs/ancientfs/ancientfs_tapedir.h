@@ -0,0 +1,55 @@
+/*
+ * Ancient UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#ifndef _ANCIENTFS_TAPEDIR_H_
+#define _ANCIENTFS_TAPEDIR_H_
+
+#include "unixfs_internal.h"
+
+/*
+ * A tape's directory, read into memory many blocks at a time instead of
+ * one block at a time. A generic tape's directory can in principle run to
+ * TAPEDIR_END_BLOCK_GENERIC blocks, although it ends at its first empty
+ * entry, so the chunk that is read starts small and doubles each time.
+ *
+ * If the entries carry a checksum (the sum of their first td_sumwords
+ * 16-bit words being 0), it is computed for every entry of a chunk when
+ * the chunk comes in, and can then be looked up per entry.
+ */
+
+#define TAPEDIR_CHUNK_MIN 16   /* blocks */
+#define TAPEDIR_CHUNK_MAX 2048 /* blocks */
+
+struct ancientfs_tapedir {
+    int         td_fd;
+    uint32_t    td_bsize;    /* bytes per block */
+    uint32_t    td_end;      /* one past the directory's last block */
+    uint32_t    td_first;    /* first block in td_buf */
+    uint32_t    td_nblocks;  /* blocks in td_buf */
+    uint32_t    td_chunk;    /* blocks to read next time */
+    uint32_t    td_inopb;    /* entries per block */
+    uint32_t    td_entsize;  /* bytes per entry */
+    uint32_t    td_sumwords; /* 0 if the entries have no checksum */
+    fs_endian_t td_endian;
+    char*       td_buf;
+    uint16_t*   td_sums;     /* td_inopb per block in td_buf */
+};
+
+void ancientfs_tapedir_open(struct ancientfs_tapedir* td, int fd,
+                            uint32_t bsize, uint32_t begin, uint32_t end,
+                            uint32_t inopb, uint32_t entsize,
+                            uint32_t sumwords, fs_endian_t e);
+void ancientfs_tapedir_close(struct ancientfs_tapedir* td);
+
+/*
+ * Returns block blkno of the directory, or NULL if it cannot be read. The
+ * block stays valid until the next call. If sums is not NULL, it is set to
+ * the block's td_inopb checksums, each of which is 0 for a good entry.
+ */
+char* ancientfs_tapedir_block(struct ancientfs_tapedir* td, uint32_t blkno,
+                              uint16_t** sums);
+
+#endif /* _ANCIENTFS_TAPEDIR_H_ */
@@ -5,10 +5,12 @@
  */
 
 #include "ancientfs_tar.h"
+#include "ancientfs_cksum.h"
 #include "unixfs_common.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,43 +24,421 @@ DECL_UNIXFS("UNIX V7 tar/ustar", tar);
 #define OCTAL    8
 
 #define TAR_ATOI(from, to, len, base) { \
-        memmove(buf, from, len); \
-        buf[len] = '\0'; \
-        to = strtol(buf, (char **)NULL, base); \
+        to = ancientfs_atoi(from, len, base); \
 }
 
 struct tar_entry {
     char name[UNIXFS_MAXPATHLEN + 1];
     char linktargetname[UNIXFS_MAXPATHLEN + 1];
     struct stat stat;
+    off_t datasize; /* bytes after the header(s) that are the file's */
+    int sparse;     /* the file's runs of data are in the scan's map */
 };
 
-static int ancientfs_tar_readheader(int fd, struct tar_entry* te);
-static int ancientfs_tar_chksum(union hblock* hb);
+/*
+ * What POSIX.1-2001 extended headers (and GNU's long name headers) say about
+ * a file, overriding its header. Global ones hold for all files after them.
+ */
+
+#define TAR_PAX_PATH       0x001
+#define TAR_PAX_LINKPATH   0x002
+#define TAR_PAX_SIZE       0x004
+#define TAR_PAX_MTIME      0x008
+#define TAR_PAX_UID        0x010
+#define TAR_PAX_GID        0x020
+#define TAR_PAX_REALSIZE   0x040 /* GNU.sparse.size or GNU.sparse.realsize */
+#define TAR_PAX_SPARSENAME 0x080
+#define TAR_PAX_SPARSEMAP  0x100 /* sparse format 0.0 or 0.1: map is here */
+#define TAR_PAX_SPARSE1    0x200 /* sparse format 1.0: map is in the data */
+
+#define TAR_MAXEXTHDR (64 * 1024 * 1024)
+
+struct tar_pax {
+    uint32_t flags;
+    char     path[UNIXFS_MAXPATHLEN + 1];
+    char     linkpath[UNIXFS_MAXPATHLEN + 1];
+    char     sparsename[UNIXFS_MAXPATHLEN + 1];
+    off_t    size;
+    time_t   mtime;
+    long     mtimensec;
+    uid_t    uid;
+    gid_t    gid;
+    off_t    realsize;
+    uint64_t sparseoffset; /* format 0.0: waiting for its numbytes */
+};
+
+/* What the scanner carries from one header to the next. */
+struct tar_scan {
+    int fd;
+    struct tar_pax global;
+    struct tar_pax local;
+    struct unixfs_aextent* map; /* the current file's, if it's sparse */
+    size_t nmap;
+    size_t mapcapacity;
+};
+
+static int ancientfs_tar_readheader(struct tar_scan* ts,
+                                    struct tar_entry* te);
+static int ancientfs_tar_chksum(union hblock* hb, long chksum);
+static int ancientfs_tar_scan(struct unixfs_scanner* us, void* arg);
 
 int
-ancientfs_tar_chksum(union hblock* hb)
+ancientfs_tar_chksum(union hblock* hb, long chksum)
+{
+    memset(hb->dbuf.chksum, ' ', sizeof(hb->dbuf.chksum));
+
+    /*
+     * POSIX sums unsigned chars, but tar has also always summed chars, which
+     * are signed on some machines; only bytes past 0177 (GNU tar's base-256
+     * numbers, say) tell the two apart.
+     */
+    return (chksum == ancientfs_bytesum(hb->dummy, TBLOCK, 0)) ||
+           (chksum == ancientfs_bytesum(hb->dummy, TBLOCK, 1));
+}
+
+/* octal, or, for GNU tar's too-big values, base-256 if the top bit is set */
+static int64_t
+ancientfs_tar_number(const char* field, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)field;
+
+    if (!(p[0] & 0x80))
+        return (int64_t)ancientfs_atoi(field, len, OCTAL);
+
+    uint64_t v = p[0] & 0x7f;
+    if (p[0] & 0x40) /* negative */
+        v |= ~(uint64_t)0x7f;
+
+    size_t i;
+    for (i = 1; i < len; i++)
+        v = (v << 8) | p[i];
+
+    return (int64_t)v;
+}
+
+static ssize_t
+ancientfs_tar_readfull(int fd, void* buf, size_t nbyte)
+{
+    size_t done = 0;
+
+    while (done < nbyte) {
+        ssize_t ret = read(fd, (char*)buf + done, nbyte - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+
+    return (ssize_t)done;
+}
+
+static void
+ancientfs_tar_strcpy(char* to, const char* from, size_t len)
+{
+    len = min(len, UNIXFS_MAXPATHLEN);
+    memcpy(to, from, len);
+    to[len] = '\0';
+}
+
+static void
+ancientfs_tar_addextent(struct tar_scan* ts, uint64_t offset, uint64_t length)
+{
+    if (ts->nmap == ts->mapcapacity) {
+        size_t capacity = max(ts->mapcapacity * 2, 16);
+        struct unixfs_aextent* map =
+            realloc(ts->map, capacity * sizeof(struct unixfs_aextent));
+        if (!map) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            abort();
+        }
+        ts->map = map;
+        ts->mapcapacity = capacity;
+    }
+
+    ts->map[ts->nmap].ae_offset = offset;
+    ts->map[ts->nmap].ae_length = length;
+    ts->map[ts->nmap].ae_daddr = 0;
+    ts->nmap++;
+}
+
+/* "seconds[.fraction]", seconds possibly negative */
+static void
+ancientfs_tar_paxtime(const char* value, time_t* sec, long* nsec)
 {
-    char* cp;
-    for (cp = hb->dbuf.chksum; cp < &hb->dbuf.chksum[sizeof(hb->dbuf.chksum)];
-         cp++)
-        *cp = ' ';
+    char* end;
+    long scale = 100000000;
 
-    int i = 0;
-    for (cp = hb->dummy; cp < &hb->dummy[TBLOCK]; cp++)
-        i += *cp;
+    *sec = (time_t)strtoll(value, &end, 10);
+    *nsec = 0;
+
+    if (*end++ != '.')
+        return;
+
+    for (; (*end >= '0') && (*end <= '9') && scale; end++, scale /= 10)
+        *nsec += (*end - '0') * scale;
+
+    if ((*value == '-') && *nsec) { /* -1.25 is 2 seconds less 0.75 */
+        (*sec)--;
+        *nsec = 1000000000 - *nsec;
+    }
+}
+
+static void
+ancientfs_tar_paxkey(struct tar_scan* ts, struct tar_pax* pax,
+                     const char* key, const char* value, size_t valuelen)
+{
+    int local = (pax == &ts->local);
+
+    if (!strcmp(key, "path")) {
+        ancientfs_tar_strcpy(pax->path, value, valuelen);
+        pax->flags |= TAR_PAX_PATH;
+    } else if (!strcmp(key, "linkpath")) {
+        ancientfs_tar_strcpy(pax->linkpath, value, valuelen);
+        pax->flags |= TAR_PAX_LINKPATH;
+    } else if (!strcmp(key, "size")) {
+        pax->size = (off_t)strtoull(value, NULL, 10);
+        pax->flags |= TAR_PAX_SIZE;
+    } else if (!strcmp(key, "mtime")) {
+        ancientfs_tar_paxtime(value, &pax->mtime, &pax->mtimensec);
+        pax->flags |= TAR_PAX_MTIME;
+    } else if (!strcmp(key, "uid")) {
+        pax->uid = (uid_t)strtoul(value, NULL, 10);
+        pax->flags |= TAR_PAX_UID;
+    } else if (!strcmp(key, "gid")) {
+        pax->gid = (gid_t)strtoul(value, NULL, 10);
+        pax->flags |= TAR_PAX_GID;
+    } else if (!local || strncmp(key, "GNU.sparse.", 11)) {
+        return; /* sparse files come one at a time */
+    } else if (!strcmp(key + 11, "size") || !strcmp(key + 11, "realsize")) {
+        pax->realsize = (off_t)strtoull(value, NULL, 10);
+        pax->flags |= TAR_PAX_REALSIZE;
+    } else if (!strcmp(key + 11, "name")) {
+        ancientfs_tar_strcpy(pax->sparsename, value, valuelen);
+        pax->flags |= TAR_PAX_SPARSENAME;
+    } else if (!strcmp(key + 11, "major")) {
+        if (strtoul(value, NULL, 10) == 1)
+            pax->flags |= TAR_PAX_SPARSE1;
+    } else if (!strcmp(key + 11, "offset")) { /* 0.0: pairs of keywords */
+        pax->sparseoffset = strtoull(value, NULL, 10);
+        pax->flags |= TAR_PAX_SPARSEMAP;
+    } else if (!strcmp(key + 11, "numbytes")) {
+        ancientfs_tar_addextent(ts, pax->sparseoffset,
+                                strtoull(value, NULL, 10));
+    } else if (!strcmp(key + 11, "map")) {    /* 0.1: "offset,size,..." */
+        const char* p = value;
+        char* end;
+        ts->nmap = 0;
+        pax->flags |= TAR_PAX_SPARSEMAP;
+        while (*p) {
+            uint64_t offset = strtoull(p, &end, 10);
+            if ((*end != ',') || (end == p))
+                break;
+            p = end + 1;
+            uint64_t length = strtoull(p, &end, 10);
+            if (((*end != ',') && *end) || (end == p))
+                break;
+            ancientfs_tar_addextent(ts, offset, length);
+            p = *end ? end + 1 : end;
+        }
+    }
+}
+
+/* records are "length key=value\n", length counting all of it */
+static void
+ancientfs_tar_paxparse(struct tar_scan* ts, struct tar_pax* pax, char* data,
+                       size_t size)
+{
+    char* p = data;
+    char* end = data + size;
+
+    while (p < end) {
+        char* key;
+        unsigned long len = strtoul(p, &key, 10);
+        if ((key == p) || (*key != ' ') || (len > (size_t)(end - p)) ||
+            (len < (size_t)(key - p) + 3))
+            break;
+        char* record_end = p + len;
+        if (record_end[-1] != '\n')
+            break;
+        key++;
+        char* value = memchr(key, '=', record_end - key);
+        if (!value)
+            break;
+        *value++ = '\0';
+        record_end[-1] = '\0';
+        ancientfs_tar_paxkey(ts, pax, key, value, record_end - 1 - value);
+        p = record_end;
+    }
+}
+
+/*
+ * Reads an extension header's size bytes of data, and the rest of its last
+ * block, into a null-terminated buffer for the caller to free.
+ */
+static char*
+ancientfs_tar_readdata(int fd, off_t size)
+{
+    size_t nbyte = (size_t)((size + TBLOCK - 1) / TBLOCK) * TBLOCK;
+    char* data = malloc(nbyte + 1);
+    if (!data)
+        return NULL;
+
+    if (ancientfs_tar_readfull(fd, data, nbyte) != (ssize_t)nbyte) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+
+    return data;
+}
+
+/*
+ * A format 1.0 sparse file's map leads its data, in blocks of its own: the
+ * number of runs of data, then each run's offset and size, all in decimal
+ * and each on a line of its own.
+ */
+static int
+ancientfs_tar_readmap(struct tar_scan* ts, off_t datasize, off_t* mapsize)
+{
+    char blk[TBLOCK];
+    uint64_t count = 0, nums = 0, v = 0, offset = 0;
+    int digits = 0;
+
+    for (*mapsize = 0; *mapsize < datasize; ) {
+        if (ancientfs_tar_readfull(ts->fd, blk, TBLOCK) != TBLOCK)
+            return EIO;
+        *mapsize += TBLOCK;
+        size_t i;
+        for (i = 0; i < TBLOCK; i++) {
+            if ((blk[i] >= '0') && (blk[i] <= '9') && (digits < 20)) {
+                v = v * 10 + (blk[i] - '0');
+                digits++;
+                continue;
+            }
+            if ((blk[i] != '\n') || !digits)
+                return EINVAL;
+            if (nums == 0)
+                count = v;
+            else if (nums & 1)
+                offset = v;
+            else
+                ancientfs_tar_addextent(ts, offset, v);
+            nums++;
+            v = 0;
+            digits = 0;
+            if (nums == 2 * count + 1)
+                return 0; /* the rest of the block is padding */
+        }
+    }
 
-    return i;
+    return EINVAL;
 }
 
+/* the rest of an old GNU sparse file's map, if it didn't fit its header */
 static int
-ancientfs_tar_readheader(int fd, struct tar_entry* te)
+ancientfs_tar_readgnumap(struct tar_scan* ts, struct gnu_header* hdr)
 {
-    static int cksum_failed = 0;
-    int  nr, ustar;
-    char buf[20];
+    int more = hdr->isextended;
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+        struct gnu_sparse* sp = &hdr->sparse[i];
+        if (!sp->offset[0] && !sp->numbytes[0])
+            break;
+        ancientfs_tar_addextent(ts,
+            (uint64_t)ancientfs_tar_number(sp->offset, 12),
+            (uint64_t)ancientfs_tar_number(sp->numbytes, 12));
+    }
+
+    while (more) {
+        union hblock hb;
+        if (ancientfs_tar_readfull(ts->fd, &hb, TBLOCK) != TBLOCK)
+            return EIO;
+        for (i = 0; i < 21; i++) {
+            struct gnu_sparse* sp = &hb.gnu_ext.sparse[i];
+            if (!sp->offset[0] && !sp->numbytes[0])
+                break;
+            ancientfs_tar_addextent(ts,
+                (uint64_t)ancientfs_tar_number(sp->offset, 12),
+                (uint64_t)ancientfs_tar_number(sp->numbytes, 12));
+        }
+        more = hb.gnu_ext.isextended;
+    }
+
+    return 0;
+}
+
+/*
+ * Drops the runs of a sparse file's map that hold nothing (GNU tar ends a
+ * file that ends in a hole with one), and any that don't make sense, and
+ * works out where each run's data is, relative to the first's: they are
+ * stored one after another.
+ */
+static void
+ancientfs_tar_fixmap(struct tar_scan* ts, off_t size, off_t datasize)
+{
+    uint64_t end = 0, stored = 0;
+    size_t i, n = 0;
+
+    for (i = 0; i < ts->nmap; i++) {
+        struct unixfs_aextent ext = ts->map[i];
+        if (!ext.ae_length)
+            continue;
+        if ((ext.ae_offset < end) || (ext.ae_offset > (uint64_t)size) ||
+            (ext.ae_length > (uint64_t)size - ext.ae_offset) ||
+            (ext.ae_length > (uint64_t)datasize - stored)) {
+            fprintf(stderr, "*** warning: bad sparse map; file is cut "
+                    "short\n");
+            break;
+        }
+        ext.ae_daddr = stored;
+        ts->map[n++] = ext;
+        end = ext.ae_offset + ext.ae_length;
+        stored += ext.ae_length;
+    }
+
+    ts->nmap = n;
+}
+
+static void
+ancientfs_tar_paxapply(struct tar_pax* pax, struct tar_entry* te, off_t* size)
+{
+    if (pax->flags & TAR_PAX_PATH)
+        ancientfs_tar_strcpy(te->name, pax->path, strlen(pax->path));
+    if (pax->flags & TAR_PAX_SPARSENAME)
+        ancientfs_tar_strcpy(te->name, pax->sparsename,
+                             strlen(pax->sparsename));
+    if (pax->flags & TAR_PAX_LINKPATH)
+        ancientfs_tar_strcpy(te->linktargetname, pax->linkpath,
+                             strlen(pax->linkpath));
+    if (pax->flags & TAR_PAX_SIZE)
+        *size = pax->size;
+    if (pax->flags & TAR_PAX_MTIME) {
+        te->stat.st_mtime = pax->mtime;
+        ST_MTIMENSEC(&te->stat) = pax->mtimensec;
+    }
+    if (pax->flags & TAR_PAX_UID)
+        te->stat.st_uid = pax->uid;
+    if (pax->flags & TAR_PAX_GID)
+        te->stat.st_gid = pax->gid;
+}
+
+static int
+ancientfs_tar_readheader(struct tar_scan* ts, struct tar_entry* te)
+{
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    int  fd = ts->fd;
+    int  nr, ustar, sparse = 0;
     char hb[sizeof(union hblock) + 1];
     struct header* hdr;
+    off_t size;
+
+    ts->local.flags = 0;
+    ts->nmap = 0;
 
 retry:
 
@@ -75,48 +455,83 @@ retry:
 
     long chksum = 0;
     TAR_ATOI(hdr->chksum, chksum, sizeof(hdr->chksum), OCTAL);
-    if (chksum != ancientfs_tar_chksum((union hblock*)hb)) {
-        cksum_failed++;
-        if (!(cksum_failed % 10))
+    if (!ancientfs_tar_chksum((union hblock*)hb, chksum)) {
+        fs->s_cksumfailed++;
+        if (!(fs->s_cksumfailed % 10))
             fprintf(stderr,
-                    "*** warning: checksum failed (%d failures so far)\n",
-                    cksum_failed);
+                    "*** warning: checksum failed (%u failures so far)\n",
+                    fs->s_cksumfailed);
         goto retry;
     }
 
-    memset(te, 0, sizeof(*te));
+    size = (off_t)ancientfs_tar_number(hdr->size, sizeof(hdr->size));
 
-    TAR_ATOI(hdr->mode, te->stat.st_mode, sizeof(hdr->mode), OCTAL);
-    TAR_ATOI(hdr->uid, te->stat.st_uid, sizeof(hdr->uid), OCTAL);
+    switch (hdr->typeflag) {
 
-    te->stat.st_mode = ancientfs_tar_mode(te->stat.st_mode, unixfs->s_flags);
+    case TARTYPE_GNULONGNAME:
+    case TARTYPE_GNULONGLINK:
+    case TARTYPE_PAXLOCAL:
+    case TARTYPE_PAXGLOBAL: {
+        if ((size < 0) || (size > TAR_MAXEXTHDR)) {
+            fprintf(stderr, "*** warning: skipping %lld-byte extended "
+                    "header\n", (long long)size);
+            goto skip;
+        }
+        char* data = ancientfs_tar_readdata(fd, size);
+        if (!data)
+            return -1;
+        if (hdr->typeflag == TARTYPE_GNULONGNAME) {
+            ancientfs_tar_strcpy(ts->local.path, data, strlen(data));
+            ts->local.flags |= TAR_PAX_PATH;
+        } else if (hdr->typeflag == TARTYPE_GNULONGLINK) {
+            ancientfs_tar_strcpy(ts->local.linkpath, data, strlen(data));
+            ts->local.flags |= TAR_PAX_LINKPATH;
+        } else if (hdr->typeflag == TARTYPE_PAXLOCAL)
+            ancientfs_tar_paxparse(ts, &ts->local, data, (size_t)size);
+        else
+            ancientfs_tar_paxparse(ts, &ts->global, data, (size_t)size);
+        free(data);
+        goto retry;
+    }
 
-    char tbuf[16];
+    case TARTYPE_GNUVOLHDR:
+    case TARTYPE_GNUMULTIVOL:
+    skip:
+        if (size > 0)
+            (void)lseek(fd, (size + TBLOCK - 1) / TBLOCK * TBLOCK, SEEK_CUR);
+        goto retry;
+    }
 
-    memset(tbuf, 0, 16);
-    memcpy(tbuf, hdr->size, 12);
-    TAR_ATOI(tbuf, te->stat.st_size, 16, OCTAL);
+    memset(te, 0, sizeof(*te));
 
-    memset(tbuf, 0, 16);
-    memcpy(tbuf, hdr->mtime, 12);
-    TAR_ATOI(tbuf, te->stat.st_mtime, 16, OCTAL);
+    TAR_ATOI(hdr->mode, te->stat.st_mode, sizeof(hdr->mode), OCTAL);
+    te->stat.st_uid = (uid_t)ancientfs_tar_number(hdr->uid, sizeof(hdr->uid));
+    te->stat.st_gid = (gid_t)ancientfs_tar_number(hdr->gid, sizeof(hdr->gid));
 
-    te->stat.st_atime = te->stat.st_ctime = te->stat.st_mtime;
+    te->stat.st_mode = ancientfs_tar_mode(te->stat.st_mode, unixfs->s_flags);
+
+    te->stat.st_mtime =
+        (time_t)ancientfs_tar_number(hdr->mtime, sizeof(hdr->mtime));
 
     if ((hdr->typeflag == TARTYPE_SYM) || (hdr->typeflag == TARTYPE_LNK)) {
         /* translate hard link to symbolic link */
         te->stat.st_mode |= S_IFLNK;
         memcpy(te->linktargetname, hdr->linkname, 100);
-        te->stat.st_size = strlen(te->linktargetname);
     } else {
 
         switch (hdr->typeflag) {
 
         case 0:
         case TARTYPE_REG:
+        case TARTYPE_CONT:
             te->stat.st_mode |= S_IFREG;
             break;
 
+        case TARTYPE_GNUSPARSE:
+            te->stat.st_mode |= S_IFREG;
+            sparse = 1;
+            break;
+
         case TARTYPE_SYM:
         case TARTYPE_LNK:
             te->stat.st_mode |= S_IFLNK;
@@ -131,6 +546,7 @@ retry:
             break;
 
         case TARTYPE_DIR:
+        case TARTYPE_GNUDUMPDIR:
             te->stat.st_mode |= S_IFDIR;
             break;
 
@@ -141,35 +557,70 @@ retry:
         }
     }
 
-    if (!ustar) {
-        if (hdr->name[99] == '/') /* full field used */
-            te->stat.st_mode = S_IFDIR | (uint16_t)(te->stat.st_mode & 07777);
-        else {
-            size_t len = strlen(hdr->name);
-            if (hdr->name[len - 1] == '/')
-                te->stat.st_mode =
-                    S_IFDIR | (uint16_t)(te->stat.st_mode & 07777);
-        }
+    /* POSIX ustar only: GNU tar keeps other things where the prefix is */
+    if (ustar && !memcmp(hdr->magic, TMAGIC, TMAGLEN) && hdr->prefix[0]) {
+        const char* nul = memchr(hdr->prefix, '\0', sizeof(hdr->prefix));
+        size_t n = nul ? (size_t)(nul - hdr->prefix) : sizeof(hdr->prefix);
+        memcpy(te->name, hdr->prefix, n);
+        te->name[n] = '/';
+        memcpy(te->name + n + 1, hdr->name, 100);
+        te->name[n + 1 + 100] = '\0';
+    } else {
         memcpy(te->name, hdr->name, 100);
         te->name[100] = '\0';
-    } else { /* ustar */
-        if (hdr->prefix[0]) {
-            memcpy(te->name, hdr->name, 100);
-            te->name[100] = '\0';
-        } else {
-            if (hdr->prefix[154]) {
-                memcpy(te->name, hdr->prefix, 155);
-                memcpy(te->name + 155, hdr->name, 100);
-                te->name[255] = '\0';
-            } else {
-                int n = snprintf(te->name, UNIXFS_MAXPATHLEN, "%s",
-                                 hdr->prefix);
-                memcpy(te->name + n, hdr->name, 100);
-                te->name[n + 99] = '\0';
-            }
+    }
+
+    ancientfs_tar_paxapply(&ts->global, te, &size);
+    ancientfs_tar_paxapply(&ts->local, te, &size);
+
+    if (!ustar || (hdr->typeflag == 0)) {
+        /* old tar has a directory be a file whose name ends in a slash */
+        size_t len = strlen(te->name);
+        if (len && (te->name[len - 1] == '/'))
+            te->stat.st_mode = S_IFDIR | (uint16_t)(te->stat.st_mode & 07777);
+    }
+
+    te->stat.st_atime = te->stat.st_ctime = te->stat.st_mtime;
+
+    if (S_ISLNK(te->stat.st_mode))
+        te->stat.st_size = strlen(te->linktargetname);
+    else if (S_ISREG(te->stat.st_mode))
+        te->stat.st_size = size;
+
+    /* only files have data; what directories have is GNU's, and unused */
+    if (S_ISREG(te->stat.st_mode) || (hdr->typeflag == TARTYPE_GNUDUMPDIR))
+        te->datasize = max(size, 0);
+
+    if (S_ISREG(te->stat.st_mode)) {
+        int err = 0;
+        if (sparse) {
+            union hblock* hbp = (union hblock*)hb;
+            te->stat.st_size = (off_t)
+                ancientfs_tar_number(hbp->gnu.realsize,
+                                     sizeof(hbp->gnu.realsize));
+            err = ancientfs_tar_readgnumap(ts, &hbp->gnu);
+        } else if (ts->local.flags & TAR_PAX_SPARSE1) {
+            off_t mapsize;
+            sparse = 1;
+            if (!(err = ancientfs_tar_readmap(ts, te->datasize, &mapsize)))
+                te->datasize -= mapsize;
+        } else if (ts->local.flags & TAR_PAX_SPARSEMAP)
+            sparse = 1;
+        if (sparse && (ts->local.flags & TAR_PAX_REALSIZE))
+            te->stat.st_size = ts->local.realsize;
+        if (err == EIO)
+            return -1;
+        if (err) {
+            fprintf(stderr, "*** warning: bad sparse map (error %d); file "
+                    "is left empty\n", err);
+            ts->nmap = 0;
         }
+        if (sparse)
+            ancientfs_tar_fixmap(ts, te->stat.st_size, te->datasize);
     }
 
+    te->sparse = sparse;
+
     uint16_t dmajor;
     uint16_t dminor;
     TAR_ATOI(hdr->devmajor, dmajor, sizeof(hdr->devmajor), OCTAL);
@@ -181,6 +632,174 @@ retry:
     return 0;
 }
 
+/* adds or, if it's there already, replaces name in parent */
+static ino_t
+ancientfs_tar_addnode(struct unixfs_scanner* us, struct tar_scan* ts,
+                      ino_t parent, const char* name, struct tar_entry* te,
+                      off_t daddr)
+{
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_atree* at = &fs->s_tree;
+    int err = 0;
+
+    /* as the tree's only writer, we needn't lock to look */
+    ino_t ino = unixfs_atree_lookup(at, parent, name, strlen(name), 0);
+
+    unixfs_scanner_lock(us);
+    if (ino)
+        err = unixfs_atree_update(at, ino, &te->stat, daddr,
+                                  te->linktargetname);
+    else if (!(ino = unixfs_atree_add(at, parent, name, &te->stat, daddr,
+                                      te->linktargetname)))
+        err = ENOMEM;
+    if (!err && te->sparse) {
+        size_t i;
+        for (i = 0; i < ts->nmap; i++)
+            ts->map[i].ae_daddr += daddr;
+        err = unixfs_atree_setmap(at, ino, ts->map, ts->nmap);
+    }
+    if (!err)
+        unixfs_scanner_publish(us);
+    unixfs_scanner_unlock(us);
+
+    if (err == ENOMEM) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+
+    if (err) {
+        fprintf(stderr, "*** warning: cannot add %s (error %d)\n", name,
+                err);
+        return ino;
+    }
+
+    if (S_ISDIR(te->stat.st_mode))
+        fs->s_directories++;
+    else
+        fs->s_files++;
+
+    fs->s_lastino = (uint32_t)ino;
+
+    return ino;
+}
+
+static int
+ancientfs_tar_scan(struct unixfs_scanner* us, void* arg)
+{
+    unixfs_internal_attach(arg);
+
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_atree* at = &fs->s_tree;
+    int fd = unixfs->s_bdev;
+    int err;
+
+    lseek(fd, (off_t)0, SEEK_SET); /* rewind tape */
+
+    struct tar_entry _te, *te = &_te;
+    struct tar_scan _ts, *ts = &_ts;
+
+    memset(ts, 0, sizeof(*ts));
+    ts->fd = fd;
+
+    /* directories that a member's path goes through but were never stored */
+    struct tar_entry _de, *de = &_de;
+    memset(de, 0, sizeof(*de));
+
+    for (;;) {
+
+        unixfs_scanner_lock(us);
+        int cancelled = unixfs_scanner_cancelled(us);
+        unixfs_scanner_unlock(us);
+        if (cancelled) {
+            err = ECANCELED;
+            break;
+        }
+
+        if ((err = ancientfs_tar_readheader(ts, te)) != 0) {
+            if (err == 1)
+                err = 0;
+            else {
+                fprintf(stderr,
+                        "*** warning: cannot read block (error %d); "
+                        "tree is incomplete\n", err);
+                err = EIO;
+            }
+            break;
+        }
+
+        /* the data, if any, is right here; we'll seek past it when done */
+        off_t daddr = lseek(fd, (off_t)0, SEEK_CUR);
+        off_t next = daddr + (te->datasize + TBLOCK - 1) / TBLOCK * TBLOCK;
+
+        char* path = te->name;
+        ino_t parent_ino = ROOTINO;
+        size_t pathlen = strlen(te->name);
+
+        if ((*path == '.') && ((pathlen == 1) ||
+            ((pathlen == 2) && (*(path + 1) == '/')))) {
+            /* root */
+            unixfs_scanner_lock(us);
+            struct unixfs_anode* rootnp = unixfs_atree_node(at, ROOTINO);
+            rootnp->an_mode = te->stat.st_mode;
+            rootnp->an_mtime = te->stat.st_mtime;
+            rootnp->an_mtimensec = (uint32_t)ST_MTIMENSEC(&te->stat);
+            unixfs_scanner_unlock(us);
+            (void)lseek(fd, next, SEEK_SET);
+            continue;
+        }
+                
+        /* we don't deal with many fancy paths here: just '/' and './' */
+        if (*path == '/')
+            path++;
+        else if (*path == '.' && *(path + 1) == '/')
+            path += 2;
+
+        de->stat.st_mode = S_IFDIR | 0755;
+        de->stat.st_nlink = 2;
+        de->stat.st_uid = te->stat.st_uid;
+        de->stat.st_gid = te->stat.st_gid;
+        de->stat.st_mtime = te->stat.st_mtime;
+
+        char *cnp, *nextcnp, *term;
+
+        for (cnp = strtok_r(path, "/", &term); cnp; cnp = nextcnp) {
+
+            nextcnp = strtok_r(NULL, "/", &term);
+
+            if (!nextcnp) { /* the member itself */
+                (void)ancientfs_tar_addnode(us, ts, parent_ino, cnp, te,
+                                            daddr);
+                break;
+            }
+
+            ino_t ino = unixfs_atree_lookup(at, parent_ino, cnp, strlen(cnp),
+                                            0);
+            if (!ino)
+                ino = ancientfs_tar_addnode(us, ts, parent_ino, cnp, de, 0);
+
+            if (!ino || !S_ISDIR(unixfs_atree_node(at, ino)->an_mode)) {
+                fprintf(stderr, "*** warning: %s is not a directory; "
+                        "skipping what's in it\n", cnp);
+                break;
+            }
+
+            parent_ino = ino;
+
+        } /* for each component */
+
+        (void)lseek(fd, next, SEEK_SET);
+
+    } /* for each block */
+
+    free(ts->map);
+
+    unixfs_scanner_lock(us);
+    unixfs->s_statvfs.f_files = fs->s_files + fs->s_directories;
+    unixfs_scanner_unlock(us);
+
+    return err;
+}
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
                      char** fsname, char** volname)
@@ -251,166 +870,24 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_bdev = fd;
 
     /* must initialize the inode layer before sanity checking */
-    if ((err = unixfs_inodelayer_init(sizeof(struct tar_node_info))) != 0)
+    if ((err = unixfs_inodelayer_init(0)) != 0)
         goto out;
 
-    struct inode* rootip = unixfs_inodelayer_iget((ino_t)ROOTINO);
-    if (!rootip) {
-        fprintf(stderr, "*** fatal error: no root inode\n");
-        abort();
+    if ((err = unixfs_atree_init(&fs->s_tree, (ino_t)ROOTINO)) != 0) {
+        unixfs_inodelayer_fini();
+        goto out;
     }
 
-    rootip->I_mode = S_IFDIR | 0755;
-    rootip->I_uid  = getuid();
-    rootip->I_gid  = getgid();
-    rootip->I_size = 2;
-    rootip->I_atime_sec = rootip->I_mtime_sec = rootip->I_ctime_sec =        time(0);
-
-    struct tar_node_info* rootti = (struct tar_node_info*)rootip->I_private;
-    rootti->ti_self = rootip;
-    rootti->ti_parent = NULL;
-    rootti->ti_children = NULL;
-    rootti->ti_next_sibling = NULL;
-
-    unixfs_inodelayer_isucceeded(rootip);
+    struct unixfs_anode* rootnp = unixfs_atree_node(&fs->s_tree, ROOTINO);
+    rootnp->an_uid = getuid();
+    rootnp->an_gid = getgid();
+    rootnp->an_mtime = time(0);
 
     fs->s_fsize = stbuf.st_size / TBLOCK;
     fs->s_files = 0;
     fs->s_directories = 1 + 1 + 1;
-    fs->s_rootip = rootip;
     fs->s_lastino = ROOTINO;
 
-    lseek(fd, (off_t)0, SEEK_SET); /* rewind tape */
-
-    struct tar_entry _te, *te = &_te;
-
-    for (;;) {
-
-        off_t toseek = 0;
-
-        if ((err = ancientfs_tar_readheader(fd, te)) != 0) {
-            if (err == 1)
-                break;
-            else {
-                fprintf(stderr,
-                        "*** fatal error: cannot read block (error %d)\n", err);
-                err = EIO;
-                goto out;
-            }
-        }
-
-        char* path = te->name;
-        ino_t parent_ino = ROOTINO;
-        size_t pathlen = strlen(te->name);
-
-        if ((*path == '.') && ((pathlen == 1) ||
-            ((pathlen == 2) && (*(path + 1) == '/')))) {
-            /* root */
-            rootip->I_mode = te->stat.st_mode;
-            rootip->I_atime_sec = \
-                rootip->I_mtime_sec = \
-                    rootip->I_ctime_sec = te->stat.st_mtime;
-            continue;
-        }
-                
-        /* we don't deal with many fancy paths here: just '/' and './' */
-        if (*path == '/')
-            path++;
-        else if (*path == '.' && *(path + 1) == '/')
-            path += 2;
-
-        char *cnp, *term;
-
-        for (cnp = strtok_r(path, "/", &term); cnp;
-            cnp = strtok_r(NULL, "/", &term)) {
-            /* we have { parent_ino, cnp } */
-            struct stat stbuf;
-            int missing = unixfs_internal_namei(parent_ino, cnp, &stbuf);
-            if (!missing) {
-                parent_ino = stbuf.st_ino;
-                continue;
-            }
-            struct inode* ip =
-                unixfs_inodelayer_iget((ino_t)(fs->s_lastino + 1));
-            if (!ip) {
-                fprintf(stderr, "*** fatal error: no inode for %llu\n",
-                        (ino64_t)(fs->s_lastino + 1));
-                abort();
-            }
-
-            ip->I_mode  = te->stat.st_mode;
-            ip->I_uid   = te->stat.st_uid;
-            ip->I_gid   = te->stat.st_gid;
-            ip->I_size  = te->stat.st_size;
-            ip->I_nlink = te->stat.st_nlink;
-            ip->I_rdev  = te->stat.st_rdev;
-
-            ip->I_atime_sec = ip->I_mtime_sec = ip->I_ctime_sec =
-                te->stat.st_mtime;
-
-            struct tar_node_info* ti = (struct tar_node_info*)ip->I_private;
-
-            size_t namelen = strlen(cnp);
-            ti->ti_name = malloc(namelen + 1);
-            if (!ti->ti_name) {
-                fprintf(stderr, "*** fatal error: cannot allocate memory\n");
-                abort();
-            }
-            memcpy(ti->ti_name, cnp, namelen);
-            ti->ti_name[namelen] = '\0';
-
-            ip->I_daddr[0] = 0;
-
-            if (S_ISLNK(ip->I_mode)) {
-                namelen = strlen(te->linktargetname);
-                ti->ti_linktargetname = malloc(namelen + 1);
-                if (!ti->ti_name) {
-                    fprintf(stderr,
-                            "*** fatal error: cannot allocate memory\n");
-                    abort();
-                }
-                memcpy(ti->ti_linktargetname, te->linktargetname, namelen);
-                ti->ti_linktargetname[namelen] = '\0';
-            } else if (S_ISREG(ip->I_mode)) {
-
-                ip->I_daddr[0] = (uint32_t)lseek(fd, (off_t)0, SEEK_CUR);
-                toseek = ip->I_size;
-
-            }
-             
-            ti->ti_self = ip;
-            ti->ti_children = NULL;
-            struct inode* parent_ip = unixfs_internal_iget(parent_ino);
-            parent_ip->I_size += 1;
-            ti->ti_parent = (struct tar_node_info*)(parent_ip->I_private);
-            ti->ti_next_sibling = ti->ti_parent->ti_children;
-            ti->ti_parent->ti_children = ti;
-
-            if (S_ISDIR(ip->I_mode)) {
-                fs->s_directories++;
-                parent_ino = fs->s_lastino + 1;
-                ip->I_size = 2;
-            } else
-                fs->s_files++;
-
-            fs->s_lastino++;
-
-            unixfs_internal_iput(parent_ip);
-            unixfs_inodelayer_isucceeded(ip);
-            /* no put */
-
-        } /* for each component */
-
-        if (toseek) {
-            toseek = (toseek + TBLOCK - 1)/TBLOCK;
-            toseek *= TBLOCK;
-            (void)lseek(fd, (off_t)toseek, SEEK_CUR);
-        }
-
-    } /* for each block */
-
-    err = 0;
-
     unixfs->s_statvfs.f_bsize = TBLOCK;
     unixfs->s_statvfs.f_frsize = TBLOCK;
     unixfs->s_statvfs.f_ffree = 0;
@@ -421,6 +898,16 @@ unixfs_internal_init(const char* dmg, uint32_t flags, fs_endian_t fse,
     unixfs->s_dentsize = 1;
     unixfs->s_statvfs.f_namemax = UNIXFS_MAXNAMLEN;
 
+    /* the rest of the tree comes in the background */
+    err = unixfs_scanner_start(&fs->s_scanner, ancientfs_tar_scan, sb);
+    if (err) {
+        fprintf(stderr, "*** fatal error: cannot set up the scanner\n");
+        unixfs_atree_fini(&fs->s_tree);
+        unixfs_inodelayer_fini();
+        err = ENOMEM;
+        goto out;
+    }
+
     snprintf(unixfs->s_fsname, UNIXFS_MNAMELEN, "UNIX %star",
              (unixfs->s_flags & ANCIENTFS_V7TAR) ? "V7 " : "us");
 
@@ -450,29 +937,21 @@ unixfs_internal_fini(void* filsys)
 {
     struct super_block* sb = (struct super_block*)filsys;
     struct filsys* fs = (struct filsys*)sb->s_fs_info;
-    ino_t i = fs->s_lastino;
-    for (; i >= ROOTINO; i--) {
-        struct inode* tmp = unixfs_internal_iget(i);
-        if (tmp) {
-            struct tar_node_info* ti = (struct tar_node_info*)tmp->I_private;
-            if (ti) {
-                free(ti->ti_name);
-                if (ti->ti_linktargetname)
-                    free(ti->ti_linktargetname);
-            }
-            unixfs_internal_iput(tmp);
-            unixfs_internal_iput(tmp);
-        }
-    }
+
+    unixfs_scanner_stop(&fs->s_scanner);
 
     unixfs_inodelayer_fini();
+    unixfs_atree_fini(&fs->s_tree);
 
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -506,6 +985,19 @@ unixfs_internal_iget(ino_t ino)
     if (ip->I_initialized)
         return ip;
 
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    int found;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    if ((found = (unixfs_atree_node(&fs->s_tree, ino) != NULL)))
+        unixfs_atree_stat(&fs->s_tree, ino, &ip->I_stat);
+    unixfs_scanner_unlock(&fs->s_scanner);
+
+    if (found) {
+        unixfs_inodelayer_isucceeded(ip);
+        return ip;
+    }
+
     unixfs_inodelayer_ifailed(ip);
 
     return NULL; 
@@ -534,7 +1026,11 @@ unixfs_internal_igetattr(ino_t ino, struct stat* stbuf)
 static void
 unixfs_internal_istat(struct inode* ip, struct stat* stbuf)
 {
-    memcpy(stbuf, &ip->I_stat, sizeof(struct stat));
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner); /* directories grow as we scan */
+    unixfs_atree_stat(&fs->s_tree, ip->I_ino, stbuf);
+    unixfs_scanner_unlock(&fs->s_scanner);
 }
 
 static int
@@ -556,28 +1052,27 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
         goto out;
     }
 
-    struct tar_node_info* child =
-        ((struct tar_node_info*)dp->I_private)->ti_children;;
-
-    if (!child) {
-        ret = ENOENT;
-        goto out;
-    }
-
-    int found = 0;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    ino_t seen = 0;
+    int done = 0;
+    ino_t ino = 0;
 
-    do {
-        size_t target_namelen = strlen((const char*)child->ti_name);
-        if ((namelen == target_namelen) &&
-            (memcmp(name, child->ti_name, target_namelen) == 0)) {
-            found = 1;
+    /* until it's found, or the scanner is past the end of the archive */
+    unixfs_scanner_lock(us);
+    for (;;) {
+        ino_t head = unixfs_atree_node(&fs->s_tree, parentino)->an_children;
+        ino = unixfs_atree_lookup(&fs->s_tree, parentino, name, namelen,
+                                  seen);
+        if (ino || done)
             break;
-        }
-        child = child->ti_next_sibling;
-    } while (child);
+        seen = head;
+        done = unixfs_scanner_wait(us);
+    }
+    unixfs_scanner_unlock(us);
 
-    if (found)
-        ret = unixfs_internal_igetattr((ino_t)child->ti_self->I_ino, stbuf);
+    if (ino)
+        ret = unixfs_internal_igetattr(ino, stbuf);
 
 out:
     unixfs_internal_iput(dp);
@@ -586,59 +1081,73 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    if (*offset >= dp->I_size)
-        return -1;
-
-    if (*offset < 2) {
-        int idx = 0;
-        dent->name[idx++] = '.';
-        dent->ino = ROOTINO;
-        if (*offset == 1) {
-            if (dp->I_ino != ROOTINO) {
-                struct inode* pdp = unixfs_internal_iget(dp->I_ino);
-                if (pdp) {
-                    dent->ino = pdp->I_ino;
-                    unixfs_internal_iput(pdp);
-                }
-            }
-            dent->name[idx++] = '.';
-        }
-        dent->name[idx++] = '\0';
-        goto out;
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_scanner* us = &fs->s_scanner;
+    struct unixfs_anode* dnp;
+    int done = 0, n;
+
+    /* only the end of the listing has to wait for the scanner */
+    unixfs_scanner_lock(us);
+    dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
+    while ((*offset >= dnp->an_size) && !done) {
+        done = unixfs_scanner_wait(us);
+        dnp = unixfs_atree_node(&fs->s_tree, dp->I_ino);
     }
 
-    struct tar_node_info* child =
-        ((struct tar_node_info*)dp->I_private)->ti_children;;
-
-    off_t i;
-
-    for (i = 0; i < (*offset - 2); i++)
-        child = child->ti_next_sibling;
+    n = unixfs_atree_readdir(&fs->s_tree, dp->I_ino, dirbuf, offset, dents,
+                             max);
 
-    dent->ino = (ino_t)child->ti_self->I_ino;
-    size_t dirnamelen = strlen(child->ti_name);
-    dirnamelen = min(dirnamelen, UNIXFS_MAXNAMLEN);
-    memcpy(dent->name, child->ti_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    unixfs_scanner_unlock(us);
 
-out:
-    *offset += 1;
-
-    return 0;
+    return n;
 }
 
 static ssize_t
 unixfs_internal_pbread(struct inode* ip, char* buf, size_t nbyte, off_t offset,
                        int* error)
 {
-    off_t start = (off_t)ip->I_daddr[0];
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+    struct unixfs_aextent ext;
+    size_t done = 0;
 
     /* caller already checked for bounds */
 
-    return pread(unixfs->s_bdev, buf, nbyte, start + offset);
+    while (done < nbyte) {
+        off_t pos = offset + (off_t)done;
+        size_t want = nbyte - done;
+
+        unixfs_scanner_lock(&fs->s_scanner);
+        int found = !unixfs_atree_extent(&fs->s_tree, ip->I_ino, pos, &ext);
+        unixfs_scanner_unlock(&fs->s_scanner);
+
+        if (!found || ((uint64_t)pos < ext.ae_offset)) {
+            /* a hole: there's nothing in the archive to read */
+            if (found)
+                want = (size_t)min((uint64_t)want, ext.ae_offset - pos);
+            memset(buf + done, 0, want);
+            done += want;
+            continue;
+        }
+
+        want = (size_t)min((uint64_t)want,
+                           ext.ae_offset + ext.ae_length - pos);
+        ssize_t ret = pread(unixfs->s_bdev, buf + done, want,
+                            (off_t)(ext.ae_daddr + (pos - ext.ae_offset)));
+        if (ret <= 0) {
+            if ((ret < 0) && (errno == EINTR))
+                continue;
+            *error = (ret < 0) ? errno : EIO; /* the archive is cut short */
+            break;
+        }
+        UNIXFS_STATS_BIO(ret);
+        done += ret;
+    }
+
+    return (done || !*error) ? (ssize_t)done : -1;
 }
 
 static int
@@ -650,15 +1159,20 @@ unixfs_internal_readlink(ino_t ino, char path[UNIXFS_MAXPATHLEN])
 
     int error;
 
-    struct tar_node_info* ti = (struct tar_node_info*)ip->I_private;
-    if (!ti->ti_linktargetname) {
+    if (!S_ISLNK(ip->I_mode)) {
         error = ENOENT;
         goto out;
     } 
 
-    size_t linklen = min(ip->I_size, TBLOCK);
-    memcpy(path, ti->ti_linktargetname, linklen);
+    struct filsys* fs = (struct filsys*)unixfs->s_fs_info;
+
+    unixfs_scanner_lock(&fs->s_scanner);
+    struct unixfs_anode* np = unixfs_atree_node(&fs->s_tree, ino);
+    const char* target = unixfs_atree_string(&fs->s_tree, np->an_un.an_link);
+    size_t linklen = min(strlen(target), UNIXFS_MAXPATHLEN - 1);
+    memcpy(path, target, linklen);
     path[linklen] = '\0';
+    unixfs_scanner_unlock(&fs->s_scanner);
 
     error = 0;
 
@@ -22,7 +22,9 @@ struct filsys
     uint32_t s_directories;
     uint32_t s_lastino;
     uint32_t s_dataoffset;
-    struct inode* s_rootip;
+    uint32_t s_cksumfailed; /* headers skipped; the scanner's alone */
+    struct unixfs_atree s_tree;
+    struct unixfs_scanner s_scanner; /* builds s_tree after init */
 };
 
 #define TMAGIC   "ustar" /* space terminated (pre POSIX) or null terminated */
@@ -51,6 +53,37 @@ union hblock {
         char devminor[8];      /* device minor number */
         char prefix[155];      /* prefix for file name */
    } dbuf;
+    struct gnu_header {        /* old GNU tar: the same up to devminor */
+        char name[NAMSIZ];
+        char mode[8];
+        char uid[8];
+        char gid[8];
+        char size[12];         /* of the data in the archive */
+        char mtime[12];
+        char chksum[8];
+        char typeflag;
+        char linkname[NAMSIZ];
+        char magic[8];         /* "ustar  ", null terminated */
+        char uname[32];
+        char gname[32];
+        char devmajor[8];
+        char devminor[8];
+        char atime[12];
+        char ctime[12];
+        char offset[12];       /* multivolume */
+        char longnames[4];     /* not used */
+        char unused;
+        struct gnu_sparse {
+            char offset[12];
+            char numbytes[12];
+        } sparse[4];           /* sparse files: the first runs of data */
+        char isextended;       /* more runs in sparse headers after this */
+        char realsize[12];     /* sparse files: size of the file */
+    } gnu;
+    struct gnu_sparse_header { /* follows a sparse file's header */
+        struct gnu_sparse sparse[21];
+        char isextended;
+    } gnu_ext;
 };
 
 /* values of typeflag / linkflag */
@@ -61,15 +94,17 @@ union hblock {
 #define TARTYPE_BLK  '4'       /* USTAR */
 #define TARTYPE_DIR  '5'       /* USTAR */
 #define TARTYPE_FIFO '6'       /* USTAR */
+#define TARTYPE_CONT '7'       /* USTAR: contiguous file */
 
-struct tar_node_info {
-    struct   inode*         ti_self;
-    struct   tar_node_info* ti_parent;
-    struct   tar_node_info* ti_children;
-    struct   tar_node_info* ti_next_sibling;
-    char*                   ti_name;
-    char*                   ti_linktargetname;
-};
+#define TARTYPE_PAXLOCAL  'x'  /* POSIX.1-2001: keywords for the next file */
+#define TARTYPE_PAXGLOBAL 'g'  /* POSIX.1-2001: keywords for all that follow */
+
+#define TARTYPE_GNUDUMPDIR  'D' /* GNU: directory, with a list of names */
+#define TARTYPE_GNULONGLINK 'K' /* GNU: link target of the next file */
+#define TARTYPE_GNULONGNAME 'L' /* GNU: name of the next file */
+#define TARTYPE_GNUMULTIVOL 'M' /* GNU: rest of a file from the last volume */
+#define TARTYPE_GNUSPARSE   'S' /* GNU: sparse file */
+#define TARTYPE_GNUVOLHDR   'V' /* GNU: volume label */
 
 /* modes */
 #define IALLOC  0100000 /* i-node is allocated */
@@ -168,11 +168,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
     struct super_block* sb = (struct super_block*)filsys;
     if (sb) {
-        if (sb->s_bdev >= 0)
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
             close(sb->s_bdev);
+        }
         sb->s_bdev = -1;
         if (sb->s_fs_info)
             free(sb->s_fs_info);
+        free(sb);
     }
 }
 
@@ -300,11 +303,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
         return 0;
     }
 
-    if (pread(unixfs->s_bdev, blkbuf, UNIXFS_IOSIZE(unixfs),
-              blkno * (off_t)BSIZE) != UNIXFS_IOSIZE(unixfs))
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(unixfs->s_bdev, blkbuf,
+                                    UNIXFS_IOSIZE(unixfs),
+                                    blkno * (off_t)BSIZE);
 }
 
 static struct inode*
@@ -454,36 +455,44 @@ out:
 }
 
 static int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
     if ((*offset + unixfs->s_dentsize) > dp->I_size)
-        return -1;
+        return 0;
 
     if (!dirbuf->flags.initialized || ((*offset & 0777) == 0)) {
         int ret;
         off_t blkno = unixfs_internal_bmap(dp, (off_t)(*offset / BSIZE), &ret);
         if (UNIXFS_BADBLOCK(blkno, ret))
-            return ret;
+            return -1;
         ret = unixfs_internal_bread(blkno, dirbuf->data);
         if (ret != 0)
-            return ret;
+            return -1;
         dirbuf->flags.initialized = 1;
     }
 
     struct dent udent;
     size_t dirnamelen = min(DIRSIZ, UNIXFS_MAXNAMLEN);
+    int n = 0;
 
-    memset(&udent, 0, sizeof(udent));
-    memcpy(&udent, dirbuf->data + (*offset & 0777), unixfs->s_dentsize);
-    udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
-    dent->ino = udent.u_ino;
-    memcpy(dent->name, udent.u_name, dirnamelen);
-    dent->name[dirnamelen] = '\0';
+    /* the rest of the block, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[n++];
 
-    *offset += unixfs->s_dentsize;
+        memset(&udent, 0, sizeof(udent));
+        memcpy(&udent, dirbuf->data + (*offset & 0777), unixfs->s_dentsize);
+        udent.u_ino = fs16_to_host(unixfs->s_endian, udent.u_ino);
+        dent->ino = udent.u_ino;
+        memcpy(dent->name, udent.u_name, dirnamelen);
+        dent->name[dirnamelen] = '\0';
 
-    return 0;
+        *offset += unixfs->s_dentsize;
+    } while ((n < max) && ((*offset & 0777) != 0) &&
+             ((*offset + unixfs->s_dentsize) <= dp->I_size));
+
+    return n;
 }
 
 static ssize_t
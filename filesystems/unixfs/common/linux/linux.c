@@ -9,11 +9,9 @@
 int
 sb_bread_intobh(struct super_block* sb, off_t block, struct buffer_head* bh)
 {
-    if (pread(sb->s_bdev, bh->b_data, sb->s_blocksize,
-              block * (off_t)sb->s_blocksize) != sb->s_blocksize)
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(sb->s_bdev, bh->b_data,
+                                    sb->s_blocksize,
+                                    block * (off_t)sb->s_blocksize);
 }
 
 void
@@ -32,7 +30,7 @@ sb_getblk(struct super_block* sb, sector_t block)
         abort();
     }
     bh->b_flags.dynamic = 1;
-    bh->b_size = PAGE_SIZE;
+    bh->b_size = sb->s_blocksize;
     bh->b_blocknr = block;
     return bh;
 }
@@ -17,21 +17,946 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include <fuse/fuse_opt.h>
 #include <fuse/fuse_lowlevel.h>
 
 #define UNIXFS_META_TIMEOUT 60.0 /* timeout for nodes and their attributes */
 
-static struct unixfs* unixfs = (struct unixfs*)0;
+/*
+ * Per-operation counters and latency histograms. Everything is updated with
+ * atomic adds so that the multithreaded session loop needs no locking here.
+ * The numbers can be had by sending the daemon a SIGUSR1 (they go to stderr)
+ * or by reading "stats" in the control directory (see below).
+ */
+
+struct unixfs_stats unixfs_stats;
+
+static const char* unixfs_opnames[UNIXFS_OP_MAX] = {
+    "lookup", "getattr", "readlink", "readdir", "open", "read", "statfs",
+    "init",
+};
+
+static void
+unixfs_stats_begin(struct timeval* start)
+{
+    gettimeofday(start, NULL);
+}
+
+static void
+unixfs_stats_end(int op, struct timeval* start, int error)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    int64_t us = ((int64_t)(now.tv_sec - start->tv_sec) * 1000000) +
+                 (now.tv_usec - start->tv_usec);
+    if (us < 0)
+        us = 0;
+
+    int bucket = 0;
+    uint64_t v = (uint64_t)us >> 1;
+    while (v && (bucket < (UNIXFS_STATS_NBUCKETS - 1))) {
+        v >>= 1;
+        bucket++;
+    }
+
+    struct unixfs_opstats* os = &unixfs_stats.ops[op];
+    unixfs_atomic_add64(&os->count, 1);
+    if (error)
+        unixfs_atomic_add64(&os->errors, 1);
+    unixfs_atomic_add64(&os->total_us, us);
+    unixfs_atomic_add64(&os->hist[bucket], 1);
+}
+
+/* Like snprintf(), returns the length the complete report needs. */
+static size_t
+unixfs_stats_render(char* buf, size_t len)
+{
+    size_t n = 0;
+    int op, i;
+
+#define UNIXFS_STATS_PRINTF(...) \
+    n += snprintf(buf + min(n, len), (n < len) ? (len - n) : 0, __VA_ARGS__)
+
+    UNIXFS_STATS_PRINTF("%-10s %12s %12s %12s\n",
+                        "op", "count", "errors", "avg_us");
+
+    for (op = 0; op < UNIXFS_OP_MAX; op++) {
+        struct unixfs_opstats* os = &unixfs_stats.ops[op];
+        uint64_t count = os->count;
+        UNIXFS_STATS_PRINTF("%-10s %12llu %12llu %12llu\n", unixfs_opnames[op],
+                            (unsigned long long)count,
+                            (unsigned long long)os->errors,
+                            (unsigned long long)(count ? os->total_us / count
+                                                       : 0));
+    }
+
+    UNIXFS_STATS_PRINTF("\nbytes_read %llu\nbio_count %llu\nbio_bytes %llu\n",
+                        (unsigned long long)unixfs_stats.bytes_read,
+                        (unsigned long long)unixfs_stats.bio_count,
+                        (unsigned long long)unixfs_stats.bio_bytes);
+
+    for (op = 0; op < UNIXFS_OP_MAX; op++) {
+        struct unixfs_opstats* os = &unixfs_stats.ops[op];
+        if (!os->count)
+            continue;
+        UNIXFS_STATS_PRINTF("\n%s latency (us)\n", unixfs_opnames[op]);
+        for (i = 0; i < UNIXFS_STATS_NBUCKETS; i++) {
+            if (!os->hist[i])
+                continue;
+            UNIXFS_STATS_PRINTF("  %10llu - %-10llu %12llu\n",
+                                (i == 0) ? 0ULL : (1ULL << i),
+                                (i == (UNIXFS_STATS_NBUCKETS - 1)) ? ~0ULL :
+                                    (1ULL << (i + 1)) - 1,
+                                (unsigned long long)os->hist[i]);
+        }
+    }
+
+#undef UNIXFS_STATS_PRINTF
+
+    return n;
+}
+
+/*
+ * The control directory. UNIXFS_CTL_NAME in the root of the volume is a
+ * directory that readdir doesn't list, so it can only be reached by name. It
+ * holds reports on the caches in the inode and buffer layers, and knobs to
+ * resize or drop them. The knobs can only be written if the volume was
+ * mounted with --control, which mounts it read-write; everything outside of
+ * the control directory still refuses to be written to. Control nodes take
+ * inode numbers from a reserved range at the very top, which no back-end
+ * hands out, and are handled here without involving unixfs->ops at all.
+ */
+
+#define UNIXFS_CTL_NAME       ".unixfs"
+#define UNIXFS_CTL_INO        ((fuse_ino_t)~0UL - 64) /* the directory */
+#define UNIXFS_CTL_ISCTL(ino) ((ino) >= UNIXFS_CTL_INO)
+
+static int unixfs_ctl_writable = 0;
+
+/* snapshot of a control file, taken at open */
+struct unixfs_ctlbuf {
+    size_t size;
+    char   data[];
+};
+
+#define UNIXFS_CTL_PRINTF(...) \
+    n += snprintf(buf + min(n, len), (n < len) ? (len - n) : 0, __VA_ARGS__)
+
+static unsigned int
+unixfs_ctl_ratio(uint64_t part, uint64_t whole)
+{
+    /* in hundredths of a percent */
+    return whole ? (unsigned int)((part * 10000) / whole) : 0;
+}
+
+static size_t
+unixfs_ctl_icache_show(char* buf, size_t len)
+{
+    struct unixfs_icachestats st;
+    size_t n = 0;
+
+    unixfs_inodelayer_cachestats(&st);
+    unsigned int r = unixfs_ctl_ratio(st.hits, st.hits + st.misses);
+
+    UNIXFS_CTL_PRINTF("active %llu\ncached %llu\nmax %llu\nhits %llu\n"
+                      "misses %llu\nhit_ratio %u.%02u%%\n",
+                      (unsigned long long)st.active,
+                      (unsigned long long)st.cached,
+                      (unsigned long long)st.max,
+                      (unsigned long long)st.hits,
+                      (unsigned long long)st.misses, r / 100, r % 100);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_ihash_show(char* buf, size_t len)
+{
+    struct unixfs_ihashstats st;
+    size_t n = 0;
+    int i;
+
+    unixfs_inodelayer_hashstats(&st);
+    /* in hundredths */
+    unsigned int load = st.buckets ?
+        (unsigned int)((st.entries * 100) / st.buckets) : 0;
+
+    UNIXFS_CTL_PRINTF("images %llu\nbuckets %llu\nentries %llu\n"
+                      "load %u.%02u\nsplits %llu\nmax_chain %llu\n",
+                      (unsigned long long)st.images,
+                      (unsigned long long)st.buckets,
+                      (unsigned long long)st.entries, load / 100, load % 100,
+                      (unsigned long long)st.splits,
+                      (unsigned long long)st.maxchain);
+    for (i = 0; i < UNIXFS_IHASH_NCHAINS; i++)
+        UNIXFS_CTL_PRINTF("chain_%d%s %llu\n", i,
+                          (i == UNIXFS_IHASH_NCHAINS - 1) ? "+" : "",
+                          (unsigned long long)st.chains[i]);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_bcache_show(char* buf, size_t len)
+{
+    struct unixfs_bcachestats st;
+    size_t n = 0;
+
+    unixfs_bufferlayer_cachestats(&st);
+    unsigned int r = unixfs_ctl_ratio(st.hits, st.hits + st.misses);
+    unsigned int rr = unixfs_ctl_ratio(st.ra_hits, st.ra_bufs);
+
+    UNIXFS_CTL_PRINTF("bufs %llu\nbytes %llu\nmax %llu\nhits %llu\n"
+                      "misses %llu\nhit_ratio %u.%02u%%\n",
+                      (unsigned long long)st.bufs,
+                      (unsigned long long)st.bytes,
+                      (unsigned long long)st.max,
+                      (unsigned long long)st.hits,
+                      (unsigned long long)st.misses, r / 100, r % 100);
+    UNIXFS_CTL_PRINTF("readahead_max %llu\nreadahead_window %llu\n"
+                      "readahead_reads %llu\nreadahead_bufs %llu\n"
+                      "readahead_hits %llu\nreadahead_hit_ratio %u.%02u%%\n",
+                      (unsigned long long)st.ra_max,
+                      (unsigned long long)st.ra_window,
+                      (unsigned long long)st.ra_reads,
+                      (unsigned long long)st.ra_bufs,
+                      (unsigned long long)st.ra_hits, rr / 100, rr % 100);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_icache_max_show(char* buf, size_t len)
+{
+    struct unixfs_icachestats st;
+    size_t n = 0;
+
+    unixfs_inodelayer_cachestats(&st);
+    UNIXFS_CTL_PRINTF("%llu\n", (unsigned long long)st.max);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_bcache_max_show(char* buf, size_t len)
+{
+    struct unixfs_bcachestats st;
+    size_t n = 0;
+
+    unixfs_bufferlayer_cachestats(&st);
+    UNIXFS_CTL_PRINTF("%llu\n", (unsigned long long)st.max);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_readahead_max_show(char* buf, size_t len)
+{
+    struct unixfs_bcachestats st;
+    size_t n = 0;
+
+    unixfs_bufferlayer_cachestats(&st);
+    UNIXFS_CTL_PRINTF("%llu\n", (unsigned long long)st.ra_max);
+
+    return n;
+}
+
+static size_t
+unixfs_ctl_drop_caches_show(char* buf, size_t len)
+{
+    size_t n = 0;
+
+    UNIXFS_CTL_PRINTF("0\n");
+
+    return n;
+}
+
+#undef UNIXFS_CTL_PRINTF
+
+static int
+unixfs_ctl_icache_max_store(unsigned long long val)
+{
+    unixfs_inodelayer_setcachesize((size_t)val);
+    return 0;
+}
+
+static int
+unixfs_ctl_bcache_max_store(unsigned long long val)
+{
+    unixfs_bufferlayer_setcachesize((size_t)val);
+    return 0;
+}
+
+static int
+unixfs_ctl_readahead_max_store(unsigned long long val)
+{
+    if (val == 0)
+        return EINVAL;
+    unixfs_bufferlayer_setreadahead((size_t)val);
+    return 0;
+}
+
+static int
+unixfs_ctl_drop_caches_store(unsigned long long val)
+{
+    /* as on Linux: 1 for inodes, 2 for buffers, 3 for both */
+    if ((val == 0) || (val > 3))
+        return EINVAL;
+    if (val & 1)
+        unixfs_inodelayer_dropcache();
+    if (val & 2)
+        unixfs_bufferlayer_dropcache();
+    return 0;
+}
+
+static struct unixfs_ctlfile {
+    const char* name;
+    size_t    (*show)(char* buf, size_t len);      /* snprintf() semantics */
+    int       (*store)(unsigned long long val);    /* NULL if read-only */
+} unixfs_ctlfiles[] = {
+    { "stats",         unixfs_stats_render,            NULL },
+    { "icache",        unixfs_ctl_icache_show,         NULL },
+    { "ihash",         unixfs_ctl_ihash_show,          NULL },
+    { "bcache",        unixfs_ctl_bcache_show,         NULL },
+    { "icache_max",    unixfs_ctl_icache_max_show,
+                       unixfs_ctl_icache_max_store },
+    { "bcache_max",    unixfs_ctl_bcache_max_show,
+                       unixfs_ctl_bcache_max_store },
+    { "readahead_max", unixfs_ctl_readahead_max_show,
+                       unixfs_ctl_readahead_max_store },
+    { "drop_caches",   unixfs_ctl_drop_caches_show,
+                       unixfs_ctl_drop_caches_store },
+};
+
+#define UNIXFS_CTL_NFILES (sizeof(unixfs_ctlfiles) / sizeof(unixfs_ctlfiles[0]))
+
+static struct unixfs_ctlfile*
+unixfs_ctl_file(fuse_ino_t ino)
+{
+    if ((ino <= UNIXFS_CTL_INO) || (ino > UNIXFS_CTL_INO + UNIXFS_CTL_NFILES))
+        return NULL;
+
+    return &unixfs_ctlfiles[ino - UNIXFS_CTL_INO - 1];
+}
+
+static struct unixfs_ctlbuf*
+unixfs_ctl_snapshot(size_t (*show)(char*, size_t))
+{
+    size_t size = show(NULL, 0);
+
+    for (;;) {
+        struct unixfs_ctlbuf* cb = malloc(sizeof(struct unixfs_ctlbuf) +
+                                          size + 1);
+        if (!cb)
+            return NULL;
+        cb->size = show(cb->data, size + 1);
+        if (cb->size <= size) /* counters may have moved in between */
+            return cb;
+        size = cb->size;
+        free(cb);
+    }
+}
+
+static int
+unixfs_ctl_stat(fuse_ino_t ino, struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+
+    if (ino == UNIXFS_CTL_INO) {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+        stbuf->st_size = UNIXFS_CTL_NFILES + 2;
+    } else {
+        struct unixfs_ctlfile* cf = unixfs_ctl_file(ino);
+        if (!cf)
+            return ENOENT;
+        stbuf->st_mode = S_IFREG | 0444;
+        if (cf->store && unixfs_ctl_writable)
+            stbuf->st_mode |= 0200;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = cf->show(NULL, 0);
+    }
+
+    stbuf->st_ino = ino;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(0);
+
+    return 0;
+}
+
+static void
+unixfs_ctl_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+    struct fuse_entry_param e;
+    fuse_ino_t ino = 0;
+    size_t i;
+
+    memset(&e, 0, sizeof(e));
+
+    if (parent == FUSE_ROOT_ID) {
+        ino = UNIXFS_CTL_INO;
+    } else {
+        for (i = 0; i < UNIXFS_CTL_NFILES; i++) {
+            if (strcmp(name, unixfs_ctlfiles[i].name) == 0) {
+                ino = UNIXFS_CTL_INO + 1 + i;
+                break;
+            }
+        }
+    }
+
+    if (!ino || (unixfs_ctl_stat(ino, &(e.attr)) != 0)) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    e.ino = ino;
+    fuse_reply_entry(req, &e);
+}
+
+static void
+unixfs_ctl_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off)
+{
+    struct stat stbuf;
+    char* p = NULL;
+    size_t bsize = 0, i;
+
+    for (i = 0; i < UNIXFS_CTL_NFILES + 2; i++) {
+        const char* name;
+        memset(&stbuf, 0, sizeof(stbuf));
+        if (i == 0) {
+            name = ".";
+            (void)unixfs_ctl_stat(UNIXFS_CTL_INO, &stbuf);
+        } else if (i == 1) {
+            name = "..";
+            stbuf.st_ino = FUSE_ROOT_ID;
+            stbuf.st_mode = S_IFDIR;
+        } else {
+            name = unixfs_ctlfiles[i - 2].name;
+            (void)unixfs_ctl_stat(UNIXFS_CTL_INO + i - 1, &stbuf);
+        }
+        size_t oldsize = bsize;
+        bsize += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+        char* newp = (char *)realloc(p, bsize);
+        if (!newp) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            abort();
+        }
+        p = newp;
+        fuse_add_direntry(req, p + oldsize, bsize - oldsize, name, &stbuf,
+                          bsize);
+    }
+
+    if (off < bsize)
+        fuse_reply_buf(req, p + off, min(bsize - off, size));
+    else
+        fuse_reply_buf(req, NULL, 0);
+
+    free(p);
+}
+
+static void
+unixfs_ctl_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+    struct unixfs_ctlfile* cf = unixfs_ctl_file(ino);
+    if (!cf) {
+        fuse_reply_err(req, (ino == UNIXFS_CTL_INO) ? EISDIR : ENOENT);
+        return;
+    }
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        if (!unixfs_ctl_writable) {
+            fuse_reply_err(req, EROFS);
+            return;
+        }
+        if (!cf->store) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+    }
+
+    struct unixfs_ctlbuf* cb = unixfs_ctl_snapshot(cf->show);
+    if (!cb) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    fi->fh = (uint64_t)(long)cb;
+    fi->direct_io = 1; /* the size changes under us */
+    fuse_reply_open(req, fi);
+}
+
+static void
+unixfs_ctl_read(fuse_req_t req, size_t count, off_t offset,
+                struct fuse_file_info* fi)
+{
+    struct unixfs_ctlbuf* cb = (struct unixfs_ctlbuf*)(long)fi->fh;
+
+    if (offset < cb->size)
+        fuse_reply_buf(req, cb->data + offset, min(cb->size - offset, count));
+    else
+        fuse_reply_buf(req, NULL, 0);
+}
+
+static void
+unixfs_ctl_write(fuse_req_t req, fuse_ino_t ino, const char* buf,
+                 size_t size)
+{
+    struct unixfs_ctlfile* cf = unixfs_ctl_file(ino);
+    char val[32];
+    char* end;
+
+    if (!cf || !cf->store) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    if (size >= sizeof(val)) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    memcpy(val, buf, size);
+    val[size] = '\0';
+
+    errno = 0;
+    unsigned long long v = strtoull(val, &end, 0);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (errno || (end == val) || *end) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    int error = cf->store(v);
+    if (error)
+        fuse_reply_err(req, error);
+    else
+        fuse_reply_write(req, size);
+}
+
+/*
+ * Images. Ordinarily there is just the one, which is the whole volume, and
+ * node numbers are the back-end's own. If --dmg names a directory, every
+ * file in it is an image of its own, shown as a subdirectory of the root by
+ * the name of the file. Such an image is opened on first access and closed
+ * again once nothing has used it for --idle seconds. Node numbers are made
+ * from the image's slot and the back-end's own node number, so they stay
+ * valid across a close and reopen. Each open image has its own back-end
+ * super block and inode layer instance, which unixfs_image_get() makes the
+ * calling thread's before anything calls into the back-end.
+ */
+
+#define UNIXFS_IMG_INOBITS        32
+#define UNIXFS_IMG_INOMASK        ((1ULL << UNIXFS_IMG_INOBITS) - 1)
+#define UNIXFS_IMG_INO(slot, ino) \
+    (((uint64_t)(slot) << UNIXFS_IMG_INOBITS) | (uint64_t)(ino))
+#define UNIXFS_IMG_NBUCKETS       1024 /* per image when aggregating */
+#define UNIXFS_IMG_IDLE           60   /* default for --idle */
+
+struct unixfs_image {
+    char*                     name;    /* in the root, when aggregating */
+    char*                     path;
+    struct unixfs             fs;      /* fs.filsys is NULL while closed */
+    struct unixfs_inodelayer* il;
+    pthread_mutex_t           lock;
+    uint32_t                  refs;    /* requests in flight and open files */
+    time_t                    lastuse;
+    int                       error;   /* if it could not be opened */
+};
+
+static struct unixfs_image* unixfs_images = NULL;
+static size_t               unixfs_nimages = 0;
+static int                  unixfs_aggregate = 0;
+static time_t               unixfs_idle = UNIXFS_IMG_IDLE; /* 0: never */
+static struct stat          unixfs_rootstat;
+
+/* what the command line says about every image */
+static char*                unixfs_type = NULL;
+static uint32_t             unixfs_flags = 0;
+static fs_endian_t          unixfs_fsendian = UNIXFS_FS_INVALID;
+
+/* unixfs_preflight() hands out the back-end's one struct unixfs */
+static pthread_mutex_t      unixfs_preflight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+unixfs_image_attach(struct unixfs_image* img)
+{
+    img->fs.ops->attach(img->fs.filsys);
+    unixfs_inodelayer_attach(img->il);
+}
+
+/* Returns EINVAL if the type can't be had, EIO if the back-end fails. */
+static int
+unixfs_image_open(struct unixfs_image* img)
+{
+    struct unixfs* fs;
+    char* type = unixfs_type;
+
+    pthread_mutex_lock(&unixfs_preflight_lock);
+    if ((fs = unixfs_preflight(img->path, &type, &fs)) != NULL)
+        img->fs = *fs;
+    pthread_mutex_unlock(&unixfs_preflight_lock);
+
+    if (!fs)
+        return EINVAL;
+
+    img->fs.filsys = NULL;
+    img->fs.flags |= unixfs_flags;
+    img->fs.fsname = type; /* XXX quick fix */
+    img->fs.fsendian = unixfs_fsendian;
+
+    img->il = unixfs_inodelayer_create(unixfs_aggregate ?
+                                       UNIXFS_IMG_NBUCKETS : 0);
+    if (!img->il)
+        return ENOMEM;
+
+    unixfs_image_attach(img);
+
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    img->fs.filsys = img->fs.ops->init(img->path, img->fs.flags,
+                                       img->fs.fsendian, &img->fs.fsname,
+                                       &img->fs.volname);
+    if (img->fs.filsys == NULL) {
+        unixfs_stats_end(UNIXFS_OP_INIT, &start, EIO);
+        unixfs_inodelayer_destroy(img->il);
+        img->il = NULL;
+        return EIO;
+    }
+
+    unixfs_stats_end(UNIXFS_OP_INIT, &start, 0);
+
+    return 0;
+}
+
+static void
+unixfs_image_close(struct unixfs_image* img)
+{
+    unixfs_image_attach(img);
+    img->fs.ops->fini(img->fs.filsys);
+    img->fs.ops->attach(NULL);
+    img->fs.filsys = NULL;
+    unixfs_inodelayer_destroy(img->il);
+    img->il = NULL;
+}
+
+/*
+ * Finds the image that node ino belongs to, opening it if need be, and the
+ * back-end's number for the node. The image is attached to the calling
+ * thread and stays open until the matching unixfs_image_put().
+ */
+static int
+unixfs_image_get(fuse_ino_t ino, struct unixfs_image** imgp, ino_t* inop)
+{
+    struct unixfs_image* img;
+
+    if (!unixfs_aggregate) {
+        img = &unixfs_images[0];
+        *inop = (ino_t)ino;
+        goto out;
+    }
+
+    uint64_t slot = (uint64_t)ino >> UNIXFS_IMG_INOBITS;
+    if ((slot == 0) || (slot > unixfs_nimages))
+        return ENOENT;
+
+    img = &unixfs_images[slot - 1];
+    *inop = (ino_t)((uint64_t)ino & UNIXFS_IMG_INOMASK);
+
+    pthread_mutex_lock(&img->lock);
+    if (!img->fs.filsys && !img->error) {
+        /* a failure sticks; no point in trying on every request */
+        if ((img->error = unixfs_image_open(img)) != 0)
+            fprintf(stderr, "*** warning: failed to open image %s\n",
+                    img->path);
+    }
+    if (!img->fs.filsys) {
+        pthread_mutex_unlock(&img->lock);
+        return EIO;
+    }
+    img->refs++;
+    img->lastuse = time(0);
+    pthread_mutex_unlock(&img->lock);
+
+out:
+    unixfs_image_attach(img);
+    *imgp = img;
+
+    return 0;
+}
+
+static void
+unixfs_image_put(struct unixfs_image* img)
+{
+    if (!unixfs_aggregate)
+        return;
+
+    pthread_mutex_lock(&img->lock);
+    img->refs--;
+    img->lastuse = time(0);
+    pthread_mutex_unlock(&img->lock);
+}
+
+/* Turns the back-end's node number in stbuf into ours. */
+static int
+unixfs_image_mapino(struct unixfs_image* img, struct stat* stbuf)
+{
+    if (!unixfs_aggregate)
+        return 0;
+
+    if ((uint64_t)stbuf->st_ino > UNIXFS_IMG_INOMASK)
+        return EOVERFLOW;
+
+    stbuf->st_ino = (ino_t)UNIXFS_IMG_INO(img - unixfs_images + 1,
+                                          stbuf->st_ino);
+
+    return 0;
+}
+
+static void*
+unixfs_image_reaper(void* arg)
+{
+    size_t i;
+
+    for (;;) {
+        sleep((unsigned int)max(unixfs_idle / 2, 1));
+        time_t now = time(0);
+        for (i = 0; i < unixfs_nimages; i++) {
+            struct unixfs_image* img = &unixfs_images[i];
+            if (pthread_mutex_trylock(&img->lock) != 0)
+                continue;
+            if (img->fs.filsys && (img->refs == 0) &&
+                ((now - img->lastuse) >= unixfs_idle))
+                unixfs_image_close(img);
+            pthread_mutex_unlock(&img->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static int
+unixfs_image_compare(const void* a, const void* b)
+{
+    return strcmp(((const struct unixfs_image*)a)->name,
+                  ((const struct unixfs_image*)b)->name);
+}
+
+/* Makes an image of every regular file in dir. */
+static int
+unixfs_image_scan(const char* dir)
+{
+    DIR* dp;
+    struct dirent* de;
+    size_t nalloc = 0, i;
+
+    if (stat(dir, &unixfs_rootstat) != 0) {
+        perror("stat");
+        return -1;
+    }
+
+    if ((dp = opendir(dir)) == NULL) {
+        perror("opendir");
+        return -1;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        char path[UNIXFS_MAXPATHLEN];
+        struct stat stbuf;
+        if ((de->d_name[0] == '.') ||
+            (strlen(de->d_name) > UNIXFS_MAXNAMLEN))
+            continue;
+        if ((snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >=
+             sizeof(path)) || (stat(path, &stbuf) != 0) ||
+            !S_ISREG(stbuf.st_mode))
+            continue;
+        if (unixfs_nimages == nalloc) {
+            nalloc = nalloc ? (nalloc * 2) : 64;
+            void* newp = realloc(unixfs_images,
+                                 nalloc * sizeof(struct unixfs_image));
+            if (!newp) {
+                fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+                abort();
+            }
+            unixfs_images = newp;
+        }
+        struct unixfs_image* img = &unixfs_images[unixfs_nimages];
+        memset(img, 0, sizeof(*img));
+        img->name = strdup(de->d_name);
+        img->path = strdup(path);
+        if (!img->name || !img->path) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            abort();
+        }
+        unixfs_nimages++;
+    }
+
+    closedir(dp);
+
+    if (unixfs_nimages == 0) {
+        fprintf(stderr, "no images in %s\n", dir);
+        return -1;
+    }
+
+    qsort(unixfs_images, unixfs_nimages, sizeof(struct unixfs_image),
+          unixfs_image_compare);
+
+    /* only now that they are done moving around */
+    for (i = 0; i < unixfs_nimages; i++)
+        (void)pthread_mutex_init(&unixfs_images[i].lock,
+                                 (const pthread_mutexattr_t*)0);
+
+    return 0;
+}
+
+/* The root of an aggregate, which lists the images. */
+
+static void
+unixfs_root_stat(struct stat* stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = FUSE_ROOT_ID;
+    stbuf->st_mode = S_IFDIR | (unixfs_rootstat.st_mode & 0555);
+    stbuf->st_nlink = 2;
+    stbuf->st_uid = unixfs_rootstat.st_uid;
+    stbuf->st_gid = unixfs_rootstat.st_gid;
+    stbuf->st_atime = unixfs_rootstat.st_atime;
+    stbuf->st_mtime = unixfs_rootstat.st_mtime;
+    stbuf->st_ctime = unixfs_rootstat.st_ctime;
+}
+
+static void
+unixfs_root_lookup(fuse_req_t req, const char* name)
+{
+    struct fuse_entry_param e;
+    struct unixfs_image key, *img;
+    ino_t ino;
+
+    memset(&e, 0, sizeof(e));
+
+    key.name = (char*)name;
+    img = bsearch(&key, unixfs_images, unixfs_nimages,
+                  sizeof(struct unixfs_image), unixfs_image_compare);
+    if (!img) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int error = unixfs_image_get(UNIXFS_IMG_INO(img - unixfs_images + 1,
+                                                FUSE_ROOT_ID), &img, &ino);
+    if (error) {
+        fuse_reply_err(req, error);
+        return;
+    }
+
+    error = img->fs.ops->igetattr(ino, &(e.attr));
+    if (!error)
+        error = unixfs_image_mapino(img, &(e.attr));
+
+    unixfs_image_put(img);
+
+    if (error) {
+        fuse_reply_err(req, error);
+        return;
+    }
+
+    e.ino = e.attr.st_ino;
+    e.attr_timeout = e.entry_timeout = UNIXFS_META_TIMEOUT;
+
+    fuse_reply_entry(req, &e);
+}
+
+static void
+unixfs_root_readdir(fuse_req_t req, size_t size, off_t off)
+{
+    char* buf = malloc(size);
+    size_t used = 0;
+    off_t i;
+
+    if (!buf) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    /* offsets are indices: ".", "..", and then the images in order */
+    for (i = off; i < (off_t)unixfs_nimages + 2; i++) {
+        struct stat stbuf;
+        const char* name;
+        memset(&stbuf, 0, sizeof(stbuf));
+        stbuf.st_mode = S_IFDIR;
+        if (i < 2) {
+            name = (i == 0) ? "." : "..";
+            stbuf.st_ino = FUSE_ROOT_ID;
+        } else {
+            name = unixfs_images[i - 2].name;
+            stbuf.st_ino = (ino_t)UNIXFS_IMG_INO(i - 1, FUSE_ROOT_ID);
+        }
+        size_t len = fuse_add_direntry(req, buf + used, size - used, name,
+                                       &stbuf, i + 1);
+        if (len > (size - used))
+            break;
+        used += len;
+    }
+
+    fuse_reply_buf(req, buf, used);
+
+    free(buf);
+}
+
+static void*
+unixfs_stats_sigthread(void* arg)
+{
+    sigset_t* set = (sigset_t*)arg;
+    int sig;
+
+    for (;;) {
+        if (sigwait(set, &sig) != 0)
+            continue;
+        struct unixfs_ctlbuf* cb = unixfs_ctl_snapshot(unixfs_stats_render);
+        if (cb) {
+            fwrite(cb->data, 1, cb->size, stderr);
+            fflush(stderr);
+            free(cb);
+        }
+    }
+
+    return NULL;
+}
 
 static void
 unixfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
 {
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
     struct statvfs sv;
-    unixfs->ops->statvfs(&sv);
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if (unixfs_image_get(ino, &img, &iino) == 0) {
+        img->fs.ops->statvfs(&sv);
+        unixfs_image_put(img);
+    } else { /* the root of an aggregate */
+        memset(&sv, 0, sizeof(sv));
+        sv.f_bsize = sv.f_frsize = 512;
+        sv.f_namemax = UNIXFS_MAXNAMLEN;
+    }
+
     fuse_reply_statfs(req, &sv);
+
+    unixfs_stats_end(UNIXFS_OP_STATFS, &start, 0);
 }
 
 /* no unixfs_ll_init() since we do initialization before mounting */
@@ -39,7 +964,15 @@ unixfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
 static void
 unixfs_ll_destroy(void* data)
 {
-    unixfs->ops->fini(unixfs->filsys);
+    size_t i;
+
+    for (i = 0; i < unixfs_nimages; i++) {
+        struct unixfs_image* img = &unixfs_images[i];
+        pthread_mutex_lock(&img->lock);
+        if (img->fs.filsys)
+            unixfs_image_close(img);
+        pthread_mutex_unlock(&img->lock);
+    }
 }
 
 static void
@@ -48,9 +981,35 @@ unixfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
     struct fuse_entry_param e;
     memset(&e, 0, sizeof(e));
 
-    int error = unixfs->ops->namei(parent, name, &(e.attr));
+    if (((parent == FUSE_ROOT_ID) && (strcmp(name, UNIXFS_CTL_NAME) == 0)) ||
+        UNIXFS_CTL_ISCTL(parent)) {
+        unixfs_ctl_lookup(req, parent, name);
+        return;
+    }
+
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    int error;
+    struct unixfs_image* img;
+    ino_t iparent;
+
+    if (unixfs_aggregate && (parent == FUSE_ROOT_ID)) {
+        unixfs_root_lookup(req, name);
+        unixfs_stats_end(UNIXFS_OP_LOOKUP, &start, 0);
+        return;
+    }
+
+    if ((error = unixfs_image_get(parent, &img, &iparent)) == 0) {
+        error = img->fs.ops->namei(iparent, name, &(e.attr));
+        if (!error)
+            error = unixfs_image_mapino(img, &(e.attr));
+        unixfs_image_put(img);
+    }
+
     if (error) {
         fuse_reply_err(req, error);
+        unixfs_stats_end(UNIXFS_OP_LOOKUP, &start, error);
         return;
     }
 
@@ -58,6 +1017,8 @@ unixfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
     e.attr_timeout = e.entry_timeout = UNIXFS_META_TIMEOUT;
 
     fuse_reply_entry(req, &e);
+
+    unixfs_stats_end(UNIXFS_OP_LOOKUP, &start, 0);
 }
 
 static
@@ -65,11 +1026,41 @@ void unixfs_ll_getattr(fuse_req_t req, fuse_ino_t ino,
                        struct fuse_file_info* fi)
 {
     struct stat stbuf;
-    int error = unixfs->ops->igetattr(ino, &stbuf);
+
+    if (UNIXFS_CTL_ISCTL(ino)) {
+        if (unixfs_ctl_stat(ino, &stbuf) == 0)
+            fuse_reply_attr(req, &stbuf, 0);
+        else
+            fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    if (unixfs_aggregate && (ino == FUSE_ROOT_ID)) {
+        unixfs_root_stat(&stbuf);
+        fuse_reply_attr(req, &stbuf, UNIXFS_META_TIMEOUT);
+        return;
+    }
+
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    int error;
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if ((error = unixfs_image_get(ino, &img, &iino)) == 0) {
+        error = img->fs.ops->igetattr(iino, &stbuf);
+        if (!error)
+            error = unixfs_image_mapino(img, &stbuf);
+        unixfs_image_put(img);
+    }
+
     if (!error)
         fuse_reply_attr(req, &stbuf, UNIXFS_META_TIMEOUT);
     else
         fuse_reply_err(req, error);
+
+    unixfs_stats_end(UNIXFS_OP_GETATTR, &start, error);
 }
 
 static void
@@ -79,10 +1070,165 @@ unixfs_ll_readlink(fuse_req_t req, fuse_ino_t ino)
 
     char path[UNIXFS_MAXPATHLEN];
 
-    if ((ret = unixfs->ops->readlink(ino, path)) != 0)
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if (unixfs_aggregate && (ino == FUSE_ROOT_ID)) {
+        ret = EINVAL;
+    } else if ((ret = unixfs_image_get(ino, &img, &iino)) == 0) {
+        ret = img->fs.ops->readlink(iino, path);
+        unixfs_image_put(img);
+    }
+
+    if (ret != 0)
         fuse_reply_err(req, ret);
+    else
+        fuse_reply_readlink(req, path);
+
+    unixfs_stats_end(UNIXFS_OP_READLINK, &start, ret);
+}
+
+/*
+ * A directory's entries, gathered before any of their attributes are looked
+ * up so that the lookups can go in inode order. Every back-end numbers its
+ * inodes in the order they sit in its inode table (or tables: a UFS
+ * cylinder group's inodes follow the previous group's), so inode order is
+ * the table's block order, and the buffer cache serves every inode of a
+ * table block after the first: a directory of N files reads at most
+ * ceil(N / inodes-per-block) table blocks, in ascending order, instead of
+ * bouncing around the table in directory order.
+ */
+
+struct unixfs_dirlist_ent {
+    ino_t    de_ino;    /* the back-end's */
+    ino_t    de_stino;  /* ours, once looked up */
+    mode_t   de_mode;
+    int      de_valid;  /* the lookup succeeded */
+    uint32_t de_name;   /* offset in dl_names */
+};
+
+struct unixfs_dirlist {
+    struct unixfs_dirlist_ent* dl_ents;
+    size_t                     dl_count;
+    size_t                     dl_size;
+    char*                      dl_names;
+    size_t                     dl_namesused;
+    size_t                     dl_namessize;
+};
+
+struct unixfs_dirlist_key {
+    ino_t  dk_ino;
+    size_t dk_index;
+};
+
+static void*
+unixfs_dirlist_grow(void* p, size_t* size, size_t need, size_t elemsize)
+{
+    if (need <= *size)
+        return p;
+
+    size_t n = *size ? *size : 64;
+    while (n < need)
+        n <<= 1;
+
+    p = realloc(p, n * elemsize);
+    if (!p) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+    *size = n;
+
+    return p;
+}
+
+static void
+unixfs_dirlist_add(struct unixfs_dirlist* dl, struct unixfs_direntry* dent)
+{
+    size_t nl = strlen(dent->name) + 1;
+
+    dl->dl_ents = unixfs_dirlist_grow(dl->dl_ents, &dl->dl_size,
+                                      dl->dl_count + 1,
+                                      sizeof(struct unixfs_dirlist_ent));
+    dl->dl_names = unixfs_dirlist_grow(dl->dl_names, &dl->dl_namessize,
+                                       dl->dl_namesused + nl, 1);
+
+    struct unixfs_dirlist_ent* de = &dl->dl_ents[dl->dl_count++];
+    de->de_ino = dent->ino;
+    de->de_valid = 0;
+    de->de_name = (uint32_t)dl->dl_namesused;
+    memcpy(dl->dl_names + dl->dl_namesused, dent->name, nl);
+    dl->dl_namesused += nl;
+}
+
+static int
+unixfs_dirlist_cmp(const void* a, const void* b)
+{
+    ino_t ia = ((const struct unixfs_dirlist_key*)a)->dk_ino;
+    ino_t ib = ((const struct unixfs_dirlist_key*)b)->dk_ino;
 
-    fuse_reply_readlink(req, path);
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+static void
+unixfs_dirlist_getattrs(struct unixfs_dirlist* dl, struct unixfs_image* img)
+{
+    struct unixfs_ops* ops = img->fs.ops;
+    struct stat stbuf;
+    size_t i;
+
+    if (dl->dl_count == 0)
+        return;
+
+    struct unixfs_dirlist_key* keys =
+        malloc(dl->dl_count * sizeof(struct unixfs_dirlist_key));
+    if (!keys) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        abort();
+    }
+
+    for (i = 0; i < dl->dl_count; i++) {
+        keys[i].dk_ino = dl->dl_ents[i].de_ino;
+        keys[i].dk_index = i;
+    }
+
+    qsort(keys, dl->dl_count, sizeof(struct unixfs_dirlist_key),
+          unixfs_dirlist_cmp);
+
+    for (i = 0; i < dl->dl_count; i++) {
+        struct unixfs_dirlist_ent* de = &dl->dl_ents[keys[i].dk_index];
+
+        if ((i > 0) && (keys[i].dk_ino == keys[i - 1].dk_ino)) {
+            /* another link to the inode just looked up */
+            struct unixfs_dirlist_ent* prev =
+                &dl->dl_ents[keys[i - 1].dk_index];
+            de->de_stino = prev->de_stino;
+            de->de_mode = prev->de_mode;
+            de->de_valid = prev->de_valid;
+            continue;
+        }
+
+        if (ops->igetattr(de->de_ino, &stbuf) != 0)
+            continue;
+
+        if (unixfs_image_mapino(img, &stbuf) != 0)
+            continue;
+
+        de->de_stino = stbuf.st_ino;
+        de->de_mode = stbuf.st_mode;
+        de->de_valid = 1;
+    }
+
+    free(keys);
+}
+
+static void
+unixfs_dirlist_free(struct unixfs_dirlist* dl)
+{
+    free(dl->dl_ents);
+    free(dl->dl_names);
 }
 
 static void
@@ -91,23 +1237,54 @@ unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 {
     (void)fi;
 
-    struct inode* dp = unixfs->ops->iget(ino);
+    if (UNIXFS_CTL_ISCTL(ino)) {
+        unixfs_ctl_readdir(req, ino, size, off);
+        return;
+    }
+
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    if (unixfs_aggregate && (ino == FUSE_ROOT_ID)) {
+        unixfs_root_readdir(req, size, off);
+        unixfs_stats_end(UNIXFS_OP_READDIR, &start, 0);
+        return;
+    }
+
+    struct unixfs_image* img;
+    ino_t iino;
+
+    int error = unixfs_image_get(ino, &img, &iino);
+    if (error) {
+        fuse_reply_err(req, error);
+        unixfs_stats_end(UNIXFS_OP_READDIR, &start, error);
+        return;
+    }
+
+    struct unixfs_ops* ops = img->fs.ops;
+
+    struct inode* dp = ops->iget(iino);
     if (!dp) {
+        unixfs_image_put(img);
         fuse_reply_err(req, ENOENT);
+        unixfs_stats_end(UNIXFS_OP_READDIR, &start, ENOENT);
         return;
     }
 
     struct stat stbuf;
-    unixfs->ops->istat(dp, &stbuf);
+    ops->istat(dp, &stbuf);
 
     if (!S_ISDIR(stbuf.st_mode)) {
-        unixfs->ops->iput(dp);
+        ops->iput(dp);
+        unixfs_image_put(img);
         fuse_reply_err(req, ENOTDIR);
+        unixfs_stats_end(UNIXFS_OP_READDIR, &start, ENOTDIR);
         return;
     }
 
     off_t offset = 0;
-    struct unixfs_direntry dent;
+    struct unixfs_direntry dents[UNIXFS_DIRBATCH];
+    int i, n;
 
     struct replybuf {
         char*  p;
@@ -118,27 +1295,54 @@ unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 
     struct unixfs_dirbuf dirbuf;
 
-    while (unixfs->ops->nextdirentry(dp, &dirbuf, &offset, &dent) == 0) {
+    memset(&dirbuf.flags, 0, sizeof(dirbuf.flags));
 
-        if (dent.ino == 0)
-            continue;
+    struct unixfs_dirlist dl;
+
+    memset(&dl, 0, sizeof(dl));
+
+    while ((n = ops->readdir_batch(dp, &dirbuf, &offset, dents,
+                                   UNIXFS_DIRBATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (dents[i].ino != 0)
+                unixfs_dirlist_add(&dl, &dents[i]);
+        }
+    }
+
+    ops->iput(dp);
+
+    unixfs_dirlist_getattrs(&dl, img);
 
-        if (unixfs->ops->igetattr(dent.ino, &stbuf) != 0)
+    unixfs_image_put(img);
+
+    size_t j;
+
+    /* fuse_add_direntry() wants only the inode number and the type */
+    memset(&stbuf, 0, sizeof(stbuf));
+
+    for (j = 0; j < dl.dl_count; j++) {
+        struct unixfs_dirlist_ent* de = &dl.dl_ents[j];
+        const char* name = dl.dl_names + de->de_name;
+
+        if (!de->de_valid)
             continue;
 
+        stbuf.st_ino = de->de_stino;
+        stbuf.st_mode = de->de_mode;
+
         size_t oldsize = b.size;
-        b.size += fuse_add_direntry(req, NULL, 0, dent.name, NULL, 0);
+        b.size += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
         char* newp = (char *)realloc(b.p, b.size);
         if (!newp) {
             fprintf(stderr, "*** fatal error: cannot allocate memory\n");
             abort();
         }
         b.p = newp;
-        fuse_add_direntry(req, b.p + oldsize, b.size - oldsize, dent.name,
-                          &stbuf, b.size);
+        fuse_add_direntry(req, b.p + oldsize, b.size - oldsize,
+                          name, &stbuf, b.size);
     }
 
-    unixfs->ops->iput(dp);
+    unixfs_dirlist_free(&dl);
 
     if (off < b.size)
         fuse_reply_buf(req, b.p + off, min(b.size - off, size));
@@ -146,37 +1350,81 @@ unixfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         fuse_reply_buf(req, NULL, 0);
 
     free(b.p);
+
+    unixfs_stats_end(UNIXFS_OP_READDIR, &start, 0);
 }
 
 static void
 unixfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 {
-    struct inode* ip = unixfs->ops->iget(ino);
-    if (!ip)
+    if (UNIXFS_CTL_ISCTL(ino)) {
+        unixfs_ctl_open(req, ino, fi);
+        return;
+    }
+
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
+    int error = 0;
+
+    if (unixfs_aggregate && (ino == FUSE_ROOT_ID)) {
+        fuse_reply_err(req, EISDIR);
+        unixfs_stats_end(UNIXFS_OP_OPEN, &start, EISDIR);
+        return;
+    }
+
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if ((error = unixfs_image_get(ino, &img, &iino)) != 0) {
+        fuse_reply_err(req, error);
+        unixfs_stats_end(UNIXFS_OP_OPEN, &start, error);
+        return;
+    }
+
+    struct inode* ip = img->fs.ops->iget(iino);
+    if (!ip) {
+        unixfs_image_put(img);
         fuse_reply_err(req, ENOENT);
+        unixfs_stats_end(UNIXFS_OP_OPEN, &start, ENOENT);
+        return;
+    }
 
     struct stat stbuf;
-    unixfs->ops->istat(ip, &stbuf);
+    img->fs.ops->istat(ip, &stbuf);
 
     if (!S_ISREG(stbuf.st_mode)) {
         if (S_ISDIR(stbuf.st_mode))
-            fuse_reply_err(req, EISDIR);
+            error = EISDIR;
         else if (S_ISBLK(stbuf.st_mode) || S_ISCHR(stbuf.st_mode))
-            fuse_reply_err(req, ENXIO);
+            error = ENXIO;
         else
-            fuse_reply_err(req, EACCES);
-        unixfs->ops->iput(ip);
+            error = EACCES;
+        fuse_reply_err(req, error);
+        img->fs.ops->iput(ip);
+        unixfs_image_put(img);
     } else {
+        /* the image stays open as long as the file does */
         fi->fh = (uint64_t)(long)ip;
         fuse_reply_open(req, fi);
     }
+
+    unixfs_stats_end(UNIXFS_OP_OPEN, &start, error);
 }
 
 static void
 unixfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 {
-    if (fi->fh)
-        unixfs->ops->iput((struct inode *)(long)(fi->fh));
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if (UNIXFS_CTL_ISCTL(ino)) {
+        free((void*)(long)(fi->fh));
+    } else if (fi->fh && (unixfs_image_get(ino, &img, &iino) == 0)) {
+        img->fs.ops->iput((struct inode *)(long)(fi->fh));
+        unixfs_image_put(img);
+        unixfs_image_put(img); /* the reference from open */
+    }
 
     fi->fh = 0;
 
@@ -187,18 +1435,31 @@ static void
 unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
                struct fuse_file_info* fi)
 {
+    if (UNIXFS_CTL_ISCTL(ino)) {
+        unixfs_ctl_read(req, count, offset, fi);
+        return;
+    }
+
     struct inode* ip = (struct inode*)(long)(fi->fh);
-    if (!ip) {
+    struct unixfs_image* img;
+    ino_t iino;
+
+    if (!ip || (unixfs_image_get(ino, &img, &iino) != 0)) {
         fuse_reply_err(req, EBADF);
         return;
     }
 
+    struct timeval start;
+    unixfs_stats_begin(&start);
+
     struct stat stbuf;
-    unixfs->ops->istat(ip, &stbuf);
+    img->fs.ops->istat(ip, &stbuf);
     off_t size = stbuf.st_size;
 
     if ((count == 0) || (offset > size)) {
+        unixfs_image_put(img);
         fuse_reply_buf(req, NULL, 0);
+        unixfs_stats_end(UNIXFS_OP_READ, &start, 0);
         return;
     }
 
@@ -207,7 +1468,9 @@ unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
 
     char *buf = calloc(count, 1);
     if (!buf) {
+        unixfs_image_put(img);
         fuse_reply_err(req, ENOMEM);
+        unixfs_stats_end(UNIXFS_OP_READ, &start, ENOMEM);
         return;
     }
 
@@ -216,7 +1479,7 @@ unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
     size_t nbytes = 0;
 
     do {
-        ssize_t ret = unixfs->ops->pbread(ip, bp, count, offset, &error);
+        ssize_t ret = img->fs.ops->pbread(ip, bp, count, offset, &error);
         if (ret < 0)
             goto out; 
         count -= ret;
@@ -226,9 +1489,48 @@ unixfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t count, off_t offset,
     } while (!error && count);
 
 out:
+    unixfs_image_put(img);
+
     fuse_reply_buf(req, buf, nbytes);
 
     free(buf);
+
+    unixfs_atomic_add64(&unixfs_stats.bytes_read, nbytes);
+    unixfs_stats_end(UNIXFS_OP_READ, &start, error);
+}
+
+/* only reachable when mounted with --control */
+
+static void
+unixfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                  int to_set, struct fuse_file_info* fi)
+{
+    struct stat stbuf;
+
+    /* let open(O_TRUNC) of a knob through; there's nothing to truncate */
+    if (!UNIXFS_CTL_ISCTL(ino) ||
+        (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID |
+                   FUSE_SET_ATTR_GID))) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    if (unixfs_ctl_stat(ino, &stbuf) == 0)
+        fuse_reply_attr(req, &stbuf, 0);
+    else
+        fuse_reply_err(req, ENOENT);
+}
+
+static void
+unixfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size,
+                off_t off, struct fuse_file_info* fi)
+{
+    if (!UNIXFS_CTL_ISCTL(ino)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    unixfs_ctl_write(req, ino, buf, size);
 }
 
 static struct fuse_lowlevel_ops unixfs_ll_oper = {
@@ -241,12 +1543,16 @@ static struct fuse_lowlevel_ops unixfs_ll_oper = {
     .open       = unixfs_ll_open,
     .release    = unixfs_ll_release,
     .read       = unixfs_ll_read,
+    .setattr    = unixfs_ll_setattr,
+    .write      = unixfs_ll_write,
 };
 
 struct options {
     char* dmg;
+    int   control;
     int   force;
     char* fsendian;
+    int   idle;
     char* type;
 } options;
 
@@ -254,9 +1560,11 @@ struct options {
 
 static struct fuse_opt unixfs_opts[] = {
 
+    UNIXFS_OPT_KEY("--control", control, 1),
     UNIXFS_OPT_KEY("--dmg %s", dmg, 0),
     UNIXFS_OPT_KEY("--force", force, 1),
     UNIXFS_OPT_KEY("--fsendian %s", fsendian, 0),
+    UNIXFS_OPT_KEY("--idle %d", idle, 0),
     UNIXFS_OPT_KEY("--type %s", type, 0),
 
     FUSE_OPT_END
@@ -268,6 +1576,7 @@ main(int argc, char* argv[])
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
     memset(&options, 0, sizeof(struct options));
+    options.idle = UNIXFS_IMG_IDLE;
 
     if ((fuse_opt_parse(&args, &options, unixfs_opts, NULL) == -1) ||
         !options.dmg) {
@@ -285,45 +1594,85 @@ main(int argc, char* argv[])
        return -1;
     }
 
-    if (!(unixfs = unixfs_preflight(options.dmg, &(options.type), &unixfs))) {
-        if (options.type)
-            fprintf(stderr, "invalid file system type %s\n", options.type);
-        else
-            fprintf(stderr, "missing file system type\n");
-        return -1;
-    }
-
     if (options.force)
-        unixfs->flags |= UNIXFS_FORCE;
+        unixfs_flags |= UNIXFS_FORCE;
 
-    unixfs->fsname = options.type; /* XXX quick fix */
-
-    unixfs->fsendian = UNIXFS_FS_INVALID;
+    unixfs_type = options.type;
 
     if (options.fsendian) {
         if (strcasecmp(options.fsendian, "pdp") == 0) {
-            unixfs->fsendian = UNIXFS_FS_PDP;
+            unixfs_fsendian = UNIXFS_FS_PDP;
         } else if (strcasecmp(options.fsendian, "big") == 0) {
-            unixfs->fsendian = UNIXFS_FS_BIG;
+            unixfs_fsendian = UNIXFS_FS_BIG;
         } else if (strcasecmp(options.fsendian, "little") == 0) {
-            unixfs->fsendian = UNIXFS_FS_LITTLE;
+            unixfs_fsendian = UNIXFS_FS_LITTLE;
         } else {
             fprintf(stderr, "invalid endian type %s\n", options.fsendian);
             return -1;
         }
     }
 
-    if ((unixfs->filsys =
-        unixfs->ops->init(options.dmg, unixfs->flags, unixfs->fsendian,
-                          &unixfs->fsname, &unixfs->volname)) == NULL) {
-        fprintf(stderr, "failed to initialize file system\n");
+    if (options.idle < 0) {
+        fprintf(stderr, "invalid idle time %d\n", options.idle);
         return -1;
     }
 
+    unixfs_idle = options.idle;
+
+    struct stat stbuf;
+    char* fsname;
+    char* volname;
+
+    if ((stat(options.dmg, &stbuf) == 0) && S_ISDIR(stbuf.st_mode)) {
+        if (sizeof(fuse_ino_t) < sizeof(uint64_t)) {
+            fprintf(stderr, "*** fatal error: mounting a directory of images "
+                    "needs 64-bit inode numbers\n");
+            return -1;
+        }
+        unixfs_aggregate = 1;
+        if (unixfs_image_scan(options.dmg) != 0)
+            return -1;
+        fsname = "UnixFS";
+        volname = basename(options.dmg);
+    } else {
+        unixfs_images = calloc(1, sizeof(struct unixfs_image));
+        if (!unixfs_images) {
+            fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+            return -1;
+        }
+        unixfs_nimages = 1;
+        unixfs_images[0].path = options.dmg;
+        (void)pthread_mutex_init(&unixfs_images[0].lock,
+                                 (const pthread_mutexattr_t*)0);
+        int error = unixfs_image_open(&unixfs_images[0]);
+        if (error == EINVAL) {
+            if (unixfs_type)
+                fprintf(stderr, "invalid file system type %s\n", unixfs_type);
+            else
+                fprintf(stderr, "missing file system type\n");
+            return -1;
+        } else if (error) {
+            fprintf(stderr, "failed to initialize file system\n");
+            return -1;
+        }
+        fsname = unixfs_images[0].fs.fsname;
+        volname = unixfs_images[0].fs.volname;
+    }
+
     char extra_args[UNIXFS_ARGLEN] = { 0 };
-    unixfs_postflight(unixfs->fsname, unixfs->volname, extra_args);
+    unixfs_postflight(fsname, volname, extra_args);
+
+    if (options.control) {
+        /* the knobs need a writable mount; see unixfs_ll_write() */
+        if (strncmp(extra_args, "-oro,", 5) == 0)
+            memmove(extra_args + 2, extra_args + 5, strlen(extra_args + 5) + 1);
+        else if (strcmp(extra_args, "-oro") == 0)
+            extra_args[0] = '\0';
+        unixfs_ctl_writable = 1;
+    }
 
-    fuse_opt_add_arg(&args, extra_args);
+    if (extra_args[0])
+        fuse_opt_add_arg(&args, extra_args);
 
     int err = -1;
     struct fuse_chan *ch;
@@ -333,10 +1682,36 @@ main(int argc, char* argv[])
         struct fuse_session* se;
 
         se = fuse_lowlevel_new(&args, &unixfs_ll_oper, sizeof(unixfs_ll_oper),
-                               (void*)&unixfs);
+                               (void*)unixfs_images);
         if (se != NULL) {
             if ((err = fuse_daemonize(foregrounded)) == -1)
                 goto bailout;
+            /*
+             * SIGUSR1 is fielded by a thread of its own rather than by a
+             * handler, so the dump can use stdio. It must be blocked before
+             * the session loop creates any worker threads.
+             */
+            static sigset_t statsigs;
+            pthread_t statsthread;
+            sigemptyset(&statsigs);
+            sigaddset(&statsigs, SIGUSR1);
+            if ((pthread_sigmask(SIG_BLOCK, &statsigs, NULL) != 0) ||
+                (pthread_create(&statsthread, NULL, unixfs_stats_sigthread,
+                                &statsigs) != 0))
+                fprintf(stderr, "*** warning: cannot set up SIGUSR1 "
+                        "statistics dump\n");
+            else
+                pthread_detach(statsthread);
+            unixfs_scanner_enable();
+            pthread_t reaperthread;
+            if (unixfs_aggregate && (unixfs_idle > 0)) {
+                if (pthread_create(&reaperthread, NULL, unixfs_image_reaper,
+                                   NULL) != 0)
+                    fprintf(stderr, "*** warning: cannot start closing idle "
+                            "images\n");
+                else
+                    pthread_detach(reaperthread);
+            }
             if (fuse_set_signal_handlers(se) != -1) {
                 fuse_session_add_chan(se, ch);
                 if (multithreaded)
@@ -53,14 +53,27 @@ struct unixfs_direntry {
 };
 
 #define UNIXFS_DIRBUFSIZ 8192
+#define UNIXFS_DIRBATCH  64 /* entries per readdir_batch call, at most */
 
 struct unixfs_dirbuf {
     struct flags {
        uint32_t initialized;
     } flags;
-    char data[UNIXFS_DIRBUFSIZ];
+    char data[UNIXFS_DIRBUFSIZ] __attribute__((aligned(8)));
 };
 
+/*
+ * readdir_batch fills in up to max entries of directory ip from *offset on,
+ * and moves *offset past them. It returns how many it filled in, 0 at the
+ * end of the directory, or -1 if the directory can't be read. A call may
+ * return fewer than max entries without being at the end: the disk-based
+ * back-ends stop at the end of the block or page that *offset is in, so
+ * that no call reads more than one. Between the calls of a listing, the
+ * back-end keeps that block, or where it left off, in dirbuf, which the
+ * caller zeroes before the first call. An entry whose ino is 0 is an empty
+ * slot, and is to be skipped.
+ */
+
 /* Interface to Ancient Unix file system internals. */
 
 struct inode;
@@ -70,6 +83,7 @@ struct unixfs_ops {
     void*         (*init)(const char* dmg, uint32_t flags, fs_endian_t fse,
                           char** fsname, char** volname);
     void          (*fini)(void*);
+    void          (*attach)(void*);
     off_t         (*alloc)(void);
     off_t         (*bmap)(struct inode* ip, off_t lblkno, int* error);
     int           (*bread)(off_t blkno, char* blkbuf);
@@ -79,10 +93,11 @@ struct unixfs_ops {
     void          (*istat)(struct inode* ip, struct stat* stbuf);
     int           (*namei)(ino_t parentino, const char* name,
                            struct stat* stbuf);
-    int           (*nextdirentry)(struct inode* ip,
-                                  struct unixfs_dirbuf* dirbuf,
-                                  off_t* offset,
-                                  struct unixfs_direntry* dent);
+    int           (*readdir_batch)(struct inode* ip,
+                                   struct unixfs_dirbuf* dirbuf,
+                                   off_t* offset,
+                                   struct unixfs_direntry* dents,
+                                   int max);
     ssize_t       (*pbread)(struct inode*ip, char* buf, size_t nbyte,
                             off_t offset, int* error);
     int           (*readlink)(ino_t, char path[UNIXFS_MAXPATHLEN]);
@@ -90,6 +105,148 @@ struct unixfs_ops {
     int           (*statvfs)(struct statvfs* svb);
 };
 
+/* Instrumentation. */
+
+#if __APPLE__
+#include <libkern/OSAtomic.h>
+#define unixfs_atomic_add64(p, v) \
+    OSAtomicAdd64((int64_t)(v), (volatile int64_t*)(p))
+#else
+#define unixfs_atomic_add64(p, v) __sync_fetch_and_add((p), (uint64_t)(v))
+#endif
+
+/*
+ * Words that threads share without a lock, such as the hints a lookup
+ * leaves for the next one. Each load or store is whole, never torn.
+ */
+
+static inline uint32_t
+unixfs_atomic_load32(volatile uint32_t* p)
+{
+#if __APPLE__
+    return (uint32_t)OSAtomicAdd32Barrier(0, (volatile int32_t*)p);
+#else
+    return __sync_fetch_and_add(p, 0);
+#endif
+}
+
+static inline void
+unixfs_atomic_store32(volatile uint32_t* p, uint32_t v)
+{
+#if __APPLE__
+    int32_t old;
+    do {
+        old = *(volatile int32_t*)p;
+    } while (!OSAtomicCompareAndSwap32Barrier(old, (int32_t)v,
+                                              (volatile int32_t*)p));
+#else
+    (void)__sync_lock_test_and_set(p, v);
+#endif
+}
+
+enum {
+    UNIXFS_OP_LOOKUP,
+    UNIXFS_OP_GETATTR,
+    UNIXFS_OP_READLINK,
+    UNIXFS_OP_READDIR,
+    UNIXFS_OP_OPEN,
+    UNIXFS_OP_READ,
+    UNIXFS_OP_STATFS,
+    UNIXFS_OP_INIT,     /* a back-end's init, i.e. the mount of an image */
+    UNIXFS_OP_MAX,
+};
+
+/* bucket i counts latencies in [2^i, 2^(i+1)) microseconds; 0 is < 2us */
+#define UNIXFS_STATS_NBUCKETS 24
+
+struct unixfs_opstats {
+    volatile uint64_t count;
+    volatile uint64_t errors;
+    volatile uint64_t total_us;
+    volatile uint64_t hist[UNIXFS_STATS_NBUCKETS];
+};
+
+struct unixfs_stats {
+    struct unixfs_opstats ops[UNIXFS_OP_MAX];
+    volatile uint64_t     bytes_read;  /* returned to callers of read */
+    volatile uint64_t     bio_count;   /* reads issued to the image */
+    volatile uint64_t     bio_bytes;
+};
+
+extern struct unixfs_stats unixfs_stats;
+
+/* To be called by back-ends for every read they issue against the image. */
+#define UNIXFS_STATS_BIO(nbytes)                                     \
+    do {                                                             \
+        unixfs_atomic_add64(&unixfs_stats.bio_count, 1);             \
+        unixfs_atomic_add64(&unixfs_stats.bio_bytes, (nbytes));      \
+    } while (0)
+
+/* Cache statistics and control; implemented by the inode/buffer layers. */
+
+struct unixfs_icachestats {
+    uint64_t active;    /* inodes with references */
+    uint64_t cached;    /* unreferenced inodes kept around */
+    uint64_t max;       /* limit on cached */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct unixfs_bcachestats {
+    uint64_t bufs;
+    uint64_t bytes;
+    uint64_t max;       /* limit on bytes */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t ra_max;    /* limit on the read-ahead window, in buffers */
+    uint64_t ra_window; /* current read-ahead window, in buffers */
+    uint64_t ra_reads;  /* reads that brought in more than one buffer */
+    uint64_t ra_bufs;   /* buffers brought in ahead of demand */
+    uint64_t ra_hits;   /* ... that were later asked for */
+};
+
+/* Shape of the inode hash tables, over all images. */
+
+#define UNIXFS_IHASH_NCHAINS 9
+
+struct unixfs_ihashstats {
+    uint64_t images;
+    uint64_t buckets;
+    uint64_t entries;
+    uint64_t splits;    /* buckets added since the tables were made */
+    uint64_t maxchain;
+    uint64_t chains[UNIXFS_IHASH_NCHAINS]; /* buckets by length; last is 8+ */
+};
+
+extern void unixfs_inodelayer_cachestats(struct unixfs_icachestats*);
+extern void unixfs_inodelayer_hashstats(struct unixfs_ihashstats*);
+extern void unixfs_inodelayer_setcachesize(size_t ninodes);
+extern void unixfs_inodelayer_dropcache(void);
+extern void unixfs_bufferlayer_cachestats(struct unixfs_bcachestats*);
+extern void unixfs_bufferlayer_setcachesize(size_t nbytes);
+extern void unixfs_bufferlayer_setreadahead(size_t nbufs);
+extern void unixfs_bufferlayer_dropcache(void);
+
+/*
+ * Per-image state. A back-end's notion of "the" file system, and the inode
+ * layer's, are per thread, and must be pointed at an image (the opaque
+ * pointer returned by the back-end's init) with the attach functions before
+ * calling into the back-end. This lets one process serve many images.
+ */
+#define UNIXFS_TLS __thread
+
+struct unixfs_inodelayer;
+
+extern struct unixfs_inodelayer* unixfs_inodelayer_create(size_t nbuckets);
+extern void unixfs_inodelayer_destroy(struct unixfs_inodelayer*);
+extern void unixfs_inodelayer_attach(struct unixfs_inodelayer*);
+
+/*
+ * Back-ends may index an image on a thread of their own. Such threads are
+ * not started until this is called, after the process has daemonized.
+ */
+extern void unixfs_scanner_enable(void);
+
 #define min(x, y) ((x) < (y) ? (x) : (y))
 #define max(x, y) ((x) > (y) ? (x) : (y))
 
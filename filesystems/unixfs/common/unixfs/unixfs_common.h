@@ -17,6 +17,7 @@ static void*         unixfs_internal_init(const char* dmg, uint32_t flags,
                                           fs_endian_t fse, char** fsname,
                                           char** volname);
 static void          unixfs_internal_fini(void*);
+static void          unixfs_internal_attach(void*);
 static off_t         unixfs_internal_alloc(void);
 static off_t         unixfs_internal_bmap(struct inode* ip, off_t lblkno,
                                          int* error);
@@ -28,10 +29,11 @@ static void          unixfs_internal_istat(struct inode* ip,
                                            struct stat* stbuf);
 static int           unixfs_internal_namei(ino_t parentino, const char *name,
                                            struct stat* stbuf);
-static int           unixfs_internal_nextdirentry(struct inode* ip,
+static int           unixfs_internal_readdir_batch(struct inode* ip,
                                                   struct unixfs_dirbuf* dirbuf,
                                                   off_t* offset,
-                                                  struct unixfs_direntry* dent);
+                                                  struct unixfs_direntry* dents,
+                                                  int max);
 static ssize_t       unixfs_internal_pbread(struct inode* ip, char* buf,
                                             size_t nbyte, off_t offset,
                                             int* error);
@@ -40,30 +42,39 @@ static int           unixfs_internal_readlink(ino_t ino,
                                               char path[UNIXFS_MAXPATHLEN]);
 static int           unixfs_internal_statvfs(struct statvfs* svb);
 
-/* To be used in file-system-specific code. */
+/*
+ * To be used in file-system-specific code. The unixfs super block is per
+ * thread; see unixfs_internal_attach().
+ */
 
-#define DECL_UNIXFS(fsname, sufx)                     \
-    static struct unixfs_ops ops_##sufx = {           \
-        .init         = unixfs_internal_init,         \
-        .fini         = unixfs_internal_fini,         \
-        .alloc        = unixfs_internal_alloc,        \
-        .bmap         = unixfs_internal_bmap,         \
-        .bread        = unixfs_internal_bread,        \
-        .iget         = unixfs_internal_iget,         \
-        .iput         = unixfs_internal_iput,         \
-        .igetattr     = unixfs_internal_igetattr,     \
-        .istat        = unixfs_internal_istat,        \
-        .namei        = unixfs_internal_namei,        \
-        .nextdirentry = unixfs_internal_nextdirentry, \
-        .pbread       = unixfs_internal_pbread,       \
-        .readlink     = unixfs_internal_readlink,     \
-        .sanitycheck  = unixfs_internal_sanitycheck,  \
-        .statvfs      = unixfs_internal_statvfs,      \
-    };                                                \
-    struct unixfs unixfs_##sufx = {                   \
-        &ops_##sufx, NULL, -1, 0                      \
-    };                                                \
-    static struct super_block* unixfs = NULL;         \
+#define DECL_UNIXFS(fsname, sufx)                       \
+    static UNIXFS_TLS struct super_block* unixfs;       \
+    static void                                         \
+    unixfs_internal_attach(void* filsys)                \
+    {                                                   \
+        unixfs = (struct super_block*)filsys;           \
+    }                                                   \
+    static struct unixfs_ops ops_##sufx = {             \
+        .init          = unixfs_internal_init,          \
+        .fini          = unixfs_internal_fini,          \
+        .attach        = unixfs_internal_attach,        \
+        .alloc         = unixfs_internal_alloc,         \
+        .bmap          = unixfs_internal_bmap,          \
+        .bread         = unixfs_internal_bread,         \
+        .iget          = unixfs_internal_iget,          \
+        .iput          = unixfs_internal_iput,          \
+        .igetattr      = unixfs_internal_igetattr,      \
+        .istat         = unixfs_internal_istat,         \
+        .namei         = unixfs_internal_namei,         \
+        .readdir_batch = unixfs_internal_readdir_batch, \
+        .pbread        = unixfs_internal_pbread,        \
+        .readlink      = unixfs_internal_readlink,      \
+        .sanitycheck   = unixfs_internal_sanitycheck,   \
+        .statvfs       = unixfs_internal_statvfs,       \
+    };                                                  \
+    struct unixfs unixfs_##sufx = {                     \
+        &ops_##sufx, NULL, -1, 0                        \
+    };                                                  \
     static const char* unixfs_fstype = fsname;
 
 #endif /* _UNIXFS_COMMON_H_ */
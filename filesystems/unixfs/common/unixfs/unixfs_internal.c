@@ -16,57 +16,311 @@
 #include "unixfs_internal.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
+#if defined(__SSE2__) && defined(__LITTLE_ENDIAN__)
+#define UNIXFS_FS32V_SSE2 1
+#include <emmintrin.h>
+#endif
+
 static int desirednodes = 65536;
-static pthread_mutex_t ihash_lock;
-static LIST_HEAD(ihash_head, inode) *ihash_table = NULL;
+static size_t icache_max = 1024;
+
+/*
+ * Everything the inode layer knows about an image lives in its own
+ * unixfs_inodelayer, so that any number of images can be open at once. The
+ * one a thread works on is whatever it last attached to; the unixfs layer
+ * attaches before every call it makes into a back-end, so back-ends never
+ * have to say which one they mean. All instances are also on a registry so
+ * that the cache statistics and knobs can cover every open image.
+ *
+ * Inodes whose last reference goes away are not freed right away but kept,
+ * still hashed, on an LRU list of up to icache_max entries per image, so
+ * that the next iget() of a recently used inode doesn't have to go to the
+ * disk. An inode is on the list if and only if its I_count is 0.
+ *
+ * The hash starts out with il_desirednodes buckets and grows by linear
+ * hashing: whenever there are more than UNIXFS_IHASH_LOAD inodes to a
+ * bucket, the bucket at il_split is split in two, by one more bit of the
+ * inode number, and il_split moves on; once all il_maxp buckets of a round
+ * have been split, il_maxp doubles and il_split starts over. Growing thus
+ * costs one short chain's worth of work per insertion, never a rehash of
+ * the whole table, which matters for the archive back-ends that keep every
+ * member hashed. Buckets live in segments of UNIXFS_IHASH_SEGSIZE that are
+ * never moved once allocated (LIST_REMOVE needs the heads to stay put); only
+ * the directory of segments is reallocated.
+ */
+
 typedef struct ihash_head ihash_head;
-static size_t ihash_count = 0;
-static size_t iprivsize = 0;
+LIST_HEAD(ihash_head, inode);
+TAILQ_HEAD(icache_head, inode);
+
+#define UNIXFS_IHASH_SEGSHIFT 10
+#define UNIXFS_IHASH_SEGSIZE  (1UL << UNIXFS_IHASH_SEGSHIFT)
+#define UNIXFS_IHASH_LOAD     2 /* inodes per bucket before a split */
+
+struct unixfs_inodelayer {
+    LIST_ENTRY(unixfs_inodelayer) il_link;
+    pthread_mutex_t    il_lock;
+    size_t             il_desirednodes;
+    ihash_head**       il_segs;     /* NULL until init */
+    u_long             il_nsegs;    /* slots in il_segs */
+    u_long             il_maxp;     /* buckets at the start of this round */
+    u_long             il_split;    /* next bucket to split */
+    uint64_t           il_splits;
+    size_t             il_count;
+    size_t             il_privsize;
+    struct icache_head il_lru;
+    size_t             il_cached;
+    uint64_t           il_hits;
+    uint64_t           il_misses;
+};
+
+static pthread_mutex_t il_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, unixfs_inodelayer) il_registry =
+    LIST_HEAD_INITIALIZER(il_registry);
+static UNIXFS_TLS struct unixfs_inodelayer* il_current = NULL;
+
+struct unixfs_inodelayer*
+unixfs_inodelayer_create(size_t nbuckets)
+{
+    struct unixfs_inodelayer* il = calloc(1, sizeof(*il));
+    if (!il)
+        return NULL;
+
+    if (pthread_mutex_init(&il->il_lock, (const pthread_mutexattr_t*)0)) {
+        fprintf(stderr, "failed to initialize the inode layer lock\n");
+        free(il);
+        return NULL;
+    }
+
+    il->il_desirednodes = nbuckets ? nbuckets : desirednodes;
+    TAILQ_INIT(&il->il_lru);
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_INSERT_HEAD(&il_registry, il, il_link);
+    pthread_mutex_unlock(&il_registry_lock);
+
+    return il;
+}
+
+void
+unixfs_inodelayer_destroy(struct unixfs_inodelayer* il)
+{
+    if (!il)
+        return;
+
+    if (il->il_segs) { /* the back-end failed before it could clean up */
+        struct unixfs_inodelayer* saved = il_current;
+        il_current = il;
+        unixfs_inodelayer_fini();
+        il_current = saved;
+    }
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_REMOVE(il, il_link);
+    pthread_mutex_unlock(&il_registry_lock);
+
+    if (il_current == il)
+        il_current = NULL;
+
+    (void)pthread_mutex_destroy(&il->il_lock);
+    free(il);
+}
+
+void
+unixfs_inodelayer_attach(struct unixfs_inodelayer* il)
+{
+    il_current = il;
+}
+
+/* il_lock must be held */
+static void
+unixfs_inodelayer_trimcache(struct unixfs_inodelayer* il, size_t limit,
+                            struct icache_head* victims)
+{
+    while (il->il_cached > limit) {
+        struct inode* ip = TAILQ_FIRST(&il->il_lru);
+        TAILQ_REMOVE(&il->il_lru, ip, I_lrulink);
+        il->il_cached--;
+        LIST_REMOVE(ip, I_hashlink);
+        il->il_count--;
+        TAILQ_INSERT_TAIL(victims, ip, I_lrulink);
+    }
+}
+
+static void
+unixfs_inodelayer_freelist(struct icache_head* victims)
+{
+    struct inode* ip;
+
+    while ((ip = TAILQ_FIRST(victims)) != NULL) {
+        TAILQ_REMOVE(victims, ip, I_lrulink);
+        (void)pthread_cond_destroy(&ip->I_state_cond);
+        free(ip);
+    }
+}
+
+static void
+unixfs_inodelayer_trim(struct unixfs_inodelayer* il, size_t limit)
+{
+    struct icache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+
+    pthread_mutex_lock(&il->il_lock);
+    if (il->il_segs)
+        unixfs_inodelayer_trimcache(il, limit, &victims);
+    pthread_mutex_unlock(&il->il_lock);
 
-static u_long ihash_mask;
+    unixfs_inodelayer_freelist(&victims);
+}
+
+static u_long
+unixfs_inodelayer_nbuckets(struct unixfs_inodelayer* il)
+{
+    return il->il_maxp + il->il_split;
+}
+
+static ihash_head*
+unixfs_inodelayer_bucket(struct unixfs_inodelayer* il, u_long b)
+{
+    return &il->il_segs[b >> UNIXFS_IHASH_SEGSHIFT]
+                       [b & (UNIXFS_IHASH_SEGSIZE - 1)];
+}
+
+static u_long
+unixfs_inodelayer_hash(struct unixfs_inodelayer* il, ino_t ino)
+{
+    u_long b = (u_long)ino & (il->il_maxp - 1);
+
+    if (b < il->il_split) /* already split this round */
+        b = (u_long)ino & ((il->il_maxp << 1) - 1);
+
+    return b;
+}
 
 static ihash_head*
-unixfs_inodelayer_firstfromhash(ino_t ino)
+unixfs_inodelayer_firstfromhash(struct unixfs_inodelayer* il, ino_t ino)
+{
+    return unixfs_inodelayer_bucket(il, unixfs_inodelayer_hash(il, ino));
+}
+
+/* Makes sure buckets [0, nbuckets) exist. */
+static int
+unixfs_inodelayer_addsegs(struct unixfs_inodelayer* il, u_long nbuckets)
 {
-    return (ihash_head*)&ihash_table[ino & ihash_mask];
+    u_long nsegs = (nbuckets + UNIXFS_IHASH_SEGSIZE - 1) >>
+                   UNIXFS_IHASH_SEGSHIFT;
+    u_long i, j;
+
+    if (nsegs > il->il_nsegs) {
+        u_long n = il->il_nsegs ? il->il_nsegs : 1;
+        while (n < nsegs)
+            n <<= 1;
+        ihash_head** segs = realloc(il->il_segs, n * sizeof(ihash_head*));
+        if (segs == NULL)
+            return -1;
+        memset(segs + il->il_nsegs, 0,
+               (n - il->il_nsegs) * sizeof(ihash_head*));
+        il->il_segs = segs;
+        il->il_nsegs = n;
+    }
+
+    for (i = 0; i < nsegs; i++) {
+        if (il->il_segs[i] != NULL)
+            continue;
+        il->il_segs[i] = malloc(UNIXFS_IHASH_SEGSIZE * sizeof(ihash_head));
+        if (il->il_segs[i] == NULL)
+            return -1;
+        for (j = 0; j < UNIXFS_IHASH_SEGSIZE; j++)
+            LIST_INIT(&il->il_segs[i][j]);
+    }
+
+    return 0;
+}
+
+/*
+ * il_lock must be held. Splits one bucket if the table is too full; if the
+ * memory for the new bucket can't be had, the chains just get longer.
+ */
+static void
+unixfs_inodelayer_grow(struct unixfs_inodelayer* il)
+{
+    u_long nbuckets = unixfs_inodelayer_nbuckets(il);
+
+    if (il->il_count <= nbuckets * UNIXFS_IHASH_LOAD)
+        return;
+
+    if (unixfs_inodelayer_addsegs(il, nbuckets + 1) != 0)
+        return;
+
+    ihash_head* from = unixfs_inodelayer_bucket(il, il->il_split);
+    ihash_head* to = unixfs_inodelayer_bucket(il, nbuckets);
+    u_long mask = (il->il_maxp << 1) - 1;
+    struct inode* ip = LIST_FIRST(from);
+
+    while (ip != NULL) {
+        struct inode* next = LIST_NEXT(ip, I_hashlink);
+        if (((u_long)ip->I_number & mask) != il->il_split) {
+            LIST_REMOVE(ip, I_hashlink);
+            LIST_INSERT_HEAD(to, ip, I_hashlink);
+        }
+        ip = next;
+    }
+
+    il->il_splits++;
+    if (++il->il_split == il->il_maxp) {
+        il->il_maxp <<= 1;
+        il->il_split = 0;
+    }
+}
+
+static void
+unixfs_inodelayer_freesegs(struct unixfs_inodelayer* il)
+{
+    u_long i;
+
+    for (i = 0; i < il->il_nsegs; i++)
+        free(il->il_segs[i]);
+    free(il->il_segs);
+    il->il_segs = NULL;
+    il->il_nsegs = 0;
 }
 
 int
 unixfs_inodelayer_init(size_t privsize)
 {
-    if (!UNIXFS_ENABLE_INODEHASH)
-        return 0;
+    struct unixfs_inodelayer* il = il_current;
 
-    if (pthread_mutex_init(&ihash_lock, (const pthread_mutexattr_t*)0)) {    
-        fprintf(stderr, "failed to initialize the inode layer lock\n");
+    if (il == NULL) {
+        fprintf(stderr, "*** fatal error: no inode layer attached\n");
         return -1;
     }
 
-    iprivsize = privsize;
+    il->il_privsize = privsize;
+
+    if (!UNIXFS_ENABLE_INODEHASH)
+        return 0;
 
-    int i;
     u_long hashsize;
-    LIST_HEAD(generic, generic) *hashtbl;
 
-    for (hashsize = 1; hashsize <= desirednodes; hashsize <<= 1)
+    for (hashsize = 1; hashsize <= il->il_desirednodes; hashsize <<= 1)
             continue;
 
     hashsize >>= 1;
 
-    hashtbl = (struct generic *)malloc(hashsize * sizeof(*hashtbl));
-    if (hashtbl != NULL) {
-        for (i = 0; i < hashsize; i++)
-            LIST_INIT(&hashtbl[i]);
-         ihash_mask = hashsize - 1;
-         ihash_table = (struct ihash_head *)hashtbl;
-    }
+    pthread_mutex_lock(&il->il_lock);
+    if (unixfs_inodelayer_addsegs(il, hashsize) == 0) {
+        il->il_maxp = hashsize;
+        il->il_split = 0;
+        il->il_splits = 0;
+    } else
+        unixfs_inodelayer_freesegs(il);
+    pthread_mutex_unlock(&il->il_lock);
 
-    if (ihash_table == NULL) {
-        (void)pthread_mutex_destroy(&ihash_lock);
+    if (il->il_segs == NULL)
         return -1;
-    }
     
     return 0;
 }
@@ -74,50 +328,49 @@ unixfs_inodelayer_init(size_t privsize)
 void
 unixfs_inodelayer_fini(void)
 {
-    if (!UNIXFS_ENABLE_INODEHASH)
+    struct unixfs_inodelayer* il = il_current;
+
+    if (!UNIXFS_ENABLE_INODEHASH || (il == NULL))
         return;
 
-    if (ihash_table != NULL) {
-        if (ihash_count != 0) {
+    if (il->il_segs != NULL) {
+        unixfs_inodelayer_trim(il, 0);
+        if (il->il_count != 0) {
             fprintf(stderr,
                     "*** warning: ihash terminated when not empty (%lu)\n",
-                    (unsigned long)ihash_count);
+                    (unsigned long)il->il_count);
 
-            int node_index = 0;
             u_long ihash_index = 0;
-            for (; ihash_index < ihash_mask; ihash_index++) {
+            for (; ihash_index < unixfs_inodelayer_nbuckets(il);
+                 ihash_index++) {
                 struct inode* ip;
-                LIST_FOREACH(ip, &ihash_table[ihash_index], I_hashlink) {
+                LIST_FOREACH(ip, unixfs_inodelayer_bucket(il, ihash_index),
+                             I_hashlink) {
                     fprintf(stderr, "*** warning: inode %llu still present\n",
                             (ino64_t)ip->I_number);
-                    node_index++;
                 }
             }
         }
 
-        u_long i;
-        for (i = 0; i < (ihash_mask + 1); i++) {
-            if (ihash_table[i].lh_first != NULL)
-                fprintf(stderr,
-                        "*** warning: found ihash_table[%lu].lh_first = %p\n",
-                        i, ihash_table[i].lh_first);
-        }
-        free(ihash_table);
-        ihash_table = NULL;
+        pthread_mutex_lock(&il->il_lock);
+        unixfs_inodelayer_freesegs(il);
+        il->il_count = 0;
+        pthread_mutex_unlock(&il->il_lock);
     }
-
-    (void)pthread_mutex_destroy(&ihash_lock);
 }
 
 struct inode *
 unixfs_inodelayer_iget(ino_t ino)
 {
+    struct unixfs_inodelayer* il = il_current;
+
     if (!UNIXFS_ENABLE_INODEHASH) {
-        struct inode* new_node = calloc(1, sizeof(struct inode) + iprivsize);
+        struct inode* new_node = calloc(1,
+                                        sizeof(struct inode) + il->il_privsize);
         if (new_node == NULL)
             return NULL;
         new_node->I_number = ino;
-        if (iprivsize)
+        if (il->il_privsize)
             new_node->I_private = (void*)&((struct inode *)new_node)[1];
         return new_node;
     }
@@ -127,36 +380,46 @@ unixfs_inodelayer_iget(ino_t ino)
     int needs_unlock = 1;
     int err;
 
-    pthread_mutex_lock(&ihash_lock);
+    pthread_mutex_lock(&il->il_lock);
 
     do {
         err = EAGAIN;
-        this_node = LIST_FIRST(unixfs_inodelayer_firstfromhash(ino));
+        this_node = LIST_FIRST(unixfs_inodelayer_firstfromhash(il, ino));
         while (this_node != NULL) {
             if (this_node->I_number == ino)
                 break;
             this_node = LIST_NEXT(this_node, I_hashlink);
         }
 
+        if (this_node != NULL) {
+            il->il_hits++;
+            if (this_node->I_count == 0) { /* revive it from the cache */
+                TAILQ_REMOVE(&il->il_lru, this_node, I_lrulink);
+                il->il_cached--;
+            }
+        }
+
         if (this_node == NULL) {
             if (new_node == NULL) {
-                pthread_mutex_unlock(&ihash_lock);
-                new_node = calloc(1, sizeof(struct inode) + iprivsize);
+                pthread_mutex_unlock(&il->il_lock);
+                new_node = calloc(1, sizeof(struct inode) + il->il_privsize);
                 if (new_node == NULL) {
                     err = ENOMEM;
                 } else {
                     new_node->I_number = ino;
-                    if (iprivsize)
+                    if (il->il_privsize)
                         new_node->I_private =
                             (void*)&((struct inode *)new_node)[1];
                     (void)pthread_cond_init(&new_node->I_state_cond,
                                             (const pthread_condattr_t*)0);
                 }
-                pthread_mutex_lock(&ihash_lock);
+                pthread_mutex_lock(&il->il_lock);
             } else {
-                LIST_INSERT_HEAD(unixfs_inodelayer_firstfromhash(ino),
+                LIST_INSERT_HEAD(unixfs_inodelayer_firstfromhash(il, ino),
                                  new_node, I_hashlink);
-                ihash_count++;
+                il->il_count++;
+                il->il_misses++;
+                unixfs_inodelayer_grow(il);
                 this_node = new_node;
                 new_node = NULL;
             }
@@ -168,14 +431,14 @@ unixfs_inodelayer_iget(ino_t ino)
                 this_node->I_count++; /* XXX See comment below. */
                 while (this_node->I_attachoutstanding) {
                     int ret = pthread_cond_wait(&this_node->I_state_cond,
-                                                 &ihash_lock);
+                                                 &il->il_lock);
                     if (ret) {
                         fprintf(stderr, "lock %p failed for inode %llu\n",
                                 &this_node->I_state_cond, (ino64_t)ino);
                         abort();
                     }
                 }
-                pthread_mutex_unlock(&ihash_lock); /* XXX See comment below. */
+                pthread_mutex_unlock(&il->il_lock); /* XXX See comment below. */
                 err = needs_unlock = 0; /* XXX See comment below. */
                 /*
                  * XXX Yes, this comment. There's a subtlety here. This logic
@@ -186,11 +449,11 @@ unixfs_inodelayer_iget(ino_t ino)
             } else if (this_node->I_initialized == 0) {
                 this_node->I_count++;
                 this_node->I_attachoutstanding = 1;
-                pthread_mutex_unlock(&ihash_lock);
+                pthread_mutex_unlock(&il->il_lock);
                 err = needs_unlock = 0;
             } else {
                 this_node->I_count++;
-                pthread_mutex_unlock(&ihash_lock);
+                pthread_mutex_unlock(&il->il_lock);
                 err = needs_unlock = 0;
             }
         }
@@ -198,7 +461,7 @@ unixfs_inodelayer_iget(ino_t ino)
     } while (err == EAGAIN);
 
     if (needs_unlock)
-        pthread_mutex_unlock(&ihash_lock);
+        pthread_mutex_unlock(&il->il_lock);
 
     if (new_node != NULL)
         free(new_node);
@@ -209,26 +472,30 @@ unixfs_inodelayer_iget(ino_t ino)
 void
 unixfs_inodelayer_isucceeded(struct inode* ip)
 {
+    struct unixfs_inodelayer* il = il_current;
+
     if (!UNIXFS_ENABLE_INODEHASH)
         return;
 
-    pthread_mutex_lock(&ihash_lock);
+    pthread_mutex_lock(&il->il_lock);
     ip->I_initialized = 1;
     ip->I_attachoutstanding = 0;
     if (ip->I_waiting) {
         ip->I_waiting = 0;
         pthread_cond_broadcast(&ip->I_state_cond);
     }
-    pthread_mutex_unlock(&ihash_lock);
+    pthread_mutex_unlock(&il->il_lock);
 }
 
 void
 unixfs_inodelayer_ifailed(struct inode* ip)
 {
+    struct unixfs_inodelayer* il = il_current;
+
     if (!UNIXFS_ENABLE_INODEHASH)
         return;
 
-    pthread_mutex_lock(&ihash_lock);
+    pthread_mutex_lock(&il->il_lock);
     LIST_REMOVE(ip, I_hashlink);
     ip->I_initialized = 0;
     ip->I_attachoutstanding = 0;
@@ -236,8 +503,8 @@ unixfs_inodelayer_ifailed(struct inode* ip)
         ip->I_waiting = 0;
         pthread_cond_broadcast(&ip->I_state_cond);
     }
-    ihash_count--;
-    pthread_mutex_unlock(&ihash_lock);
+    il->il_count--;
+    pthread_mutex_unlock(&il->il_lock);
     (void)pthread_cond_destroy(&ip->I_state_cond);
     free(ip);
 }
@@ -245,40 +512,1185 @@ unixfs_inodelayer_ifailed(struct inode* ip)
 void
 unixfs_inodelayer_iput(struct inode* ip)
 {
+    struct unixfs_inodelayer* il = il_current;
+
     if (!UNIXFS_ENABLE_INODEHASH) {
         free(ip);
         return;
     }
 
-    pthread_mutex_lock(&ihash_lock);
+    struct icache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+
+    pthread_mutex_lock(&il->il_lock);
     ip->I_count--;
     if (ip->I_count == 0) {
-        LIST_REMOVE(ip, I_hashlink);
-        ihash_count--;
-        pthread_mutex_unlock(&ihash_lock);
-        (void)pthread_cond_destroy(&ip->I_state_cond);
-        free(ip);
-    } else
-        pthread_mutex_unlock(&ihash_lock);
+        if (ip->I_initialized && (icache_max > 0)) {
+            TAILQ_INSERT_TAIL(&il->il_lru, ip, I_lrulink);
+            il->il_cached++;
+            unixfs_inodelayer_trimcache(il, icache_max, &victims);
+        } else {
+            LIST_REMOVE(ip, I_hashlink);
+            il->il_count--;
+            TAILQ_INSERT_TAIL(&victims, ip, I_lrulink);
+        }
+    }
+    pthread_mutex_unlock(&il->il_lock);
+
+    unixfs_inodelayer_freelist(&victims);
 }
 
 void
 unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t it)
 {
-    pthread_mutex_lock(&ihash_lock);
+    struct unixfs_inodelayer* il = il_current;
+
+    pthread_mutex_lock(&il->il_lock);
 
-    int node_index = 0;
     u_long ihash_index = 0;
 
-    for (; ihash_index < ihash_mask; ihash_index++) {
+    for (; ihash_index < unixfs_inodelayer_nbuckets(il); ihash_index++) {
         struct inode* ip;
-        LIST_FOREACH(ip, &ihash_table[ihash_index], I_hashlink) {
+        LIST_FOREACH(ip, unixfs_inodelayer_bucket(il, ihash_index),
+                     I_hashlink) {
             if (it(ip, ip->I_private) != 0)
                 goto out;
-            node_index++;
         }
     }
 
 out:
-    pthread_mutex_unlock(&ihash_lock);
+    pthread_mutex_unlock(&il->il_lock);
+}
+
+void
+unixfs_inodelayer_cachestats(struct unixfs_icachestats* st)
+{
+    struct unixfs_inodelayer* il;
+
+    memset(st, 0, sizeof(*st));
+    st->max = icache_max;
+
+    if (!UNIXFS_ENABLE_INODEHASH)
+        return;
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_FOREACH(il, &il_registry, il_link) {
+        pthread_mutex_lock(&il->il_lock);
+        st->active += il->il_count - il->il_cached;
+        st->cached += il->il_cached;
+        st->hits += il->il_hits;
+        st->misses += il->il_misses;
+        pthread_mutex_unlock(&il->il_lock);
+    }
+    pthread_mutex_unlock(&il_registry_lock);
+}
+
+void
+unixfs_inodelayer_hashstats(struct unixfs_ihashstats* st)
+{
+    struct unixfs_inodelayer* il;
+
+    memset(st, 0, sizeof(*st));
+
+    if (!UNIXFS_ENABLE_INODEHASH)
+        return;
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_FOREACH(il, &il_registry, il_link) {
+        pthread_mutex_lock(&il->il_lock);
+        if (il->il_segs != NULL) {
+            u_long b, nbuckets = unixfs_inodelayer_nbuckets(il);
+            for (b = 0; b < nbuckets; b++) {
+                uint64_t len = 0;
+                struct inode* ip;
+                LIST_FOREACH(ip, unixfs_inodelayer_bucket(il, b), I_hashlink)
+                    len++;
+                st->chains[min(len, UNIXFS_IHASH_NCHAINS - 1)]++;
+                st->maxchain = max(st->maxchain, len);
+            }
+            st->images++;
+            st->buckets += nbuckets;
+            st->entries += il->il_count;
+            st->splits += il->il_splits;
+        }
+        pthread_mutex_unlock(&il->il_lock);
+    }
+    pthread_mutex_unlock(&il_registry_lock);
+}
+
+void
+unixfs_inodelayer_setcachesize(size_t ninodes)
+{
+    struct unixfs_inodelayer* il;
+
+    icache_max = ninodes;
+
+    if (!UNIXFS_ENABLE_INODEHASH)
+        return;
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_FOREACH(il, &il_registry, il_link)
+        unixfs_inodelayer_trim(il, ninodes);
+    pthread_mutex_unlock(&il_registry_lock);
+}
+
+void
+unixfs_inodelayer_dropcache(void)
+{
+    struct unixfs_inodelayer* il;
+
+    if (!UNIXFS_ENABLE_INODEHASH)
+        return;
+
+    pthread_mutex_lock(&il_registry_lock);
+    LIST_FOREACH(il, &il_registry, il_link)
+        unixfs_inodelayer_trim(il, 0);
+    pthread_mutex_unlock(&il_registry_lock);
+}
+
+/*
+ * The buffer layer caches fixed-size reads against the image, keyed on
+ * (descriptor, offset), in an LRU of up to bcache_max bytes. On a miss that
+ * starts where the previous request ended, it reads a window of buffers in
+ * one go; the window doubles with every such sequential miss, up to
+ * bcache_ramax buffers, and falls back to one as soon as a miss isn't
+ * sequential.
+ */
+
+struct unixfs_buf {
+    LIST_ENTRY(unixfs_buf)  b_hashlink;
+    TAILQ_ENTRY(unixfs_buf) b_lrulink;
+    int                     b_fd;
+    int                     b_readahead; /* not asked for yet */
+    off_t                   b_offset;
+    size_t                  b_size;
+    char                    b_data[];
+};
+
+#define UNIXFS_BHASHSIZE 4096 /* must be a power of 2 */
+
+static pthread_mutex_t bcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(bhash_head, unixfs_buf) bhash_table[UNIXFS_BHASHSIZE];
+static TAILQ_HEAD(bcache_head, unixfs_buf) bcache_lru =
+    TAILQ_HEAD_INITIALIZER(bcache_lru);
+static size_t   bcache_bufs = 0;
+static size_t   bcache_bytes = 0;
+static size_t   bcache_max = 8 * 1024 * 1024;
+static size_t   bcache_ramax = 32;
+static size_t   bcache_rawindow = 1;
+static int      bcache_lastfd = -1;
+static off_t    bcache_nextoffset = -1;
+static uint64_t bcache_hits = 0;
+static uint64_t bcache_misses = 0;
+static uint64_t bcache_rareads = 0;
+static uint64_t bcache_rabufs = 0;
+static uint64_t bcache_rahits = 0;
+
+static struct bhash_head*
+unixfs_bufferlayer_hash(int fd, off_t offset)
+{
+    uint64_t h = ((uint64_t)offset * 0x9e3779b97f4a7c15ULL) >> 32;
+    return &bhash_table[(h ^ (uint64_t)fd) & (UNIXFS_BHASHSIZE - 1)];
+}
+
+/* bcache_lock must be held */
+static struct unixfs_buf*
+unixfs_bufferlayer_lookup(int fd, off_t offset, size_t size)
+{
+    struct unixfs_buf* bp;
+
+    LIST_FOREACH(bp, unixfs_bufferlayer_hash(fd, offset), b_hashlink) {
+        if ((bp->b_offset == offset) && (bp->b_fd == fd) &&
+            (bp->b_size == size))
+            return bp;
+    }
+
+    return NULL;
+}
+
+/* bcache_lock must be held */
+static void
+unixfs_bufferlayer_trimcache(size_t limit, struct bcache_head* victims)
+{
+    while (bcache_bytes > limit) {
+        struct unixfs_buf* bp = TAILQ_FIRST(&bcache_lru);
+        TAILQ_REMOVE(&bcache_lru, bp, b_lrulink);
+        LIST_REMOVE(bp, b_hashlink);
+        bcache_bufs--;
+        bcache_bytes -= bp->b_size;
+        TAILQ_INSERT_TAIL(victims, bp, b_lrulink);
+    }
+}
+
+static void
+unixfs_bufferlayer_freelist(struct bcache_head* victims)
+{
+    struct unixfs_buf* bp;
+
+    while ((bp = TAILQ_FIRST(victims)) != NULL) {
+        TAILQ_REMOVE(victims, bp, b_lrulink);
+        free(bp);
+    }
+}
+
+/* Returns 0 if all nbyte bytes could be had, EIO otherwise. */
+int
+unixfs_bufferlayer_pread(int fd, void* buf, size_t nbyte, off_t offset)
+{
+    struct bcache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+    struct unixfs_buf* bp;
+    size_t window, i;
+    ssize_t nr;
+
+    pthread_mutex_lock(&bcache_lock);
+
+    if (bcache_max == 0) {
+        pthread_mutex_unlock(&bcache_lock);
+        if (pread(fd, buf, nbyte, offset) != nbyte)
+            return EIO;
+        UNIXFS_STATS_BIO(nbyte);
+        return 0;
+    }
+
+    int sequential = (fd == bcache_lastfd) && (offset == bcache_nextoffset);
+    bcache_lastfd = fd;
+    bcache_nextoffset = offset + nbyte;
+
+    if ((bp = unixfs_bufferlayer_lookup(fd, offset, nbyte)) != NULL) {
+        bcache_hits++;
+        if (bp->b_readahead) {
+            bp->b_readahead = 0;
+            bcache_rahits++;
+        }
+        TAILQ_REMOVE(&bcache_lru, bp, b_lrulink);
+        TAILQ_INSERT_TAIL(&bcache_lru, bp, b_lrulink);
+        memcpy(buf, bp->b_data, nbyte);
+        pthread_mutex_unlock(&bcache_lock);
+        return 0;
+    }
+
+    bcache_misses++;
+    if (sequential)
+        bcache_rawindow = min(bcache_rawindow * 2, bcache_ramax);
+    else
+        bcache_rawindow = 1;
+    window = max(min(bcache_rawindow, bcache_max / nbyte), 1);
+
+    pthread_mutex_unlock(&bcache_lock);
+
+    char* rbuf = (char*)buf;
+    if ((window > 1) && ((rbuf = malloc(window * nbyte)) == NULL)) {
+        rbuf = (char*)buf;
+        window = 1;
+    }
+
+    nr = pread(fd, rbuf, window * nbyte, offset);
+    if ((nr < 0) || ((size_t)nr < nbyte)) {
+        if (rbuf != buf)
+            free(rbuf);
+        return EIO;
+    }
+
+    UNIXFS_STATS_BIO(nr);
+
+    if (rbuf != buf)
+        memcpy(buf, rbuf, nbyte);
+
+    window = (size_t)nr / nbyte;
+
+    pthread_mutex_lock(&bcache_lock);
+
+    if (window > 1)
+        bcache_rareads++;
+
+    for (i = 0; i < window; i++) {
+        off_t boffset = offset + (off_t)(i * nbyte);
+        if (unixfs_bufferlayer_lookup(fd, boffset, nbyte) != NULL)
+            continue; /* someone beat us to it */
+        bp = malloc(sizeof(struct unixfs_buf) + nbyte);
+        if (!bp)
+            break;
+        bp->b_fd = fd;
+        bp->b_offset = boffset;
+        bp->b_size = nbyte;
+        bp->b_readahead = (i > 0);
+        memcpy(bp->b_data, rbuf + (i * nbyte), nbyte);
+        LIST_INSERT_HEAD(unixfs_bufferlayer_hash(fd, boffset), bp,
+                         b_hashlink);
+        TAILQ_INSERT_TAIL(&bcache_lru, bp, b_lrulink);
+        bcache_bufs++;
+        bcache_bytes += nbyte;
+        if (i > 0)
+            bcache_rabufs++;
+    }
+
+    unixfs_bufferlayer_trimcache(bcache_max, &victims);
+
+    pthread_mutex_unlock(&bcache_lock);
+
+    unixfs_bufferlayer_freelist(&victims);
+
+    if (rbuf != buf)
+        free(rbuf);
+
+    return 0;
+}
+
+/* To be called before fd is closed; it may be reused for another image. */
+void
+unixfs_bufferlayer_invalidate(int fd)
+{
+    struct bcache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+    struct unixfs_buf* bp;
+    struct unixfs_buf* next;
+
+    pthread_mutex_lock(&bcache_lock);
+    for (bp = TAILQ_FIRST(&bcache_lru); bp != NULL; bp = next) {
+        next = TAILQ_NEXT(bp, b_lrulink);
+        if (bp->b_fd != fd)
+            continue;
+        TAILQ_REMOVE(&bcache_lru, bp, b_lrulink);
+        LIST_REMOVE(bp, b_hashlink);
+        bcache_bufs--;
+        bcache_bytes -= bp->b_size;
+        TAILQ_INSERT_TAIL(&victims, bp, b_lrulink);
+    }
+    if (bcache_lastfd == fd)
+        bcache_lastfd = -1;
+    pthread_mutex_unlock(&bcache_lock);
+
+    unixfs_bufferlayer_freelist(&victims);
+}
+
+void
+unixfs_bufferlayer_cachestats(struct unixfs_bcachestats* st)
+{
+    pthread_mutex_lock(&bcache_lock);
+    st->bufs = bcache_bufs;
+    st->bytes = bcache_bytes;
+    st->max = bcache_max;
+    st->hits = bcache_hits;
+    st->misses = bcache_misses;
+    st->ra_max = bcache_ramax;
+    st->ra_window = bcache_rawindow;
+    st->ra_reads = bcache_rareads;
+    st->ra_bufs = bcache_rabufs;
+    st->ra_hits = bcache_rahits;
+    pthread_mutex_unlock(&bcache_lock);
+}
+
+void
+unixfs_bufferlayer_setcachesize(size_t nbytes)
+{
+    struct bcache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+
+    pthread_mutex_lock(&bcache_lock);
+    bcache_max = nbytes;
+    unixfs_bufferlayer_trimcache(bcache_max, &victims);
+    pthread_mutex_unlock(&bcache_lock);
+
+    unixfs_bufferlayer_freelist(&victims);
+}
+
+void
+unixfs_bufferlayer_setreadahead(size_t nbufs)
+{
+    pthread_mutex_lock(&bcache_lock);
+    bcache_ramax = max(nbufs, 1);
+    bcache_rawindow = min(bcache_rawindow, bcache_ramax);
+    pthread_mutex_unlock(&bcache_lock);
+}
+
+void
+unixfs_bufferlayer_dropcache(void)
+{
+    struct bcache_head victims = TAILQ_HEAD_INITIALIZER(victims);
+
+    pthread_mutex_lock(&bcache_lock);
+    unixfs_bufferlayer_trimcache(0, &victims);
+    pthread_mutex_unlock(&bcache_lock);
+
+    unixfs_bufferlayer_freelist(&victims);
+}
+
+/*
+ * The scanner layer lets an archive back-end return from init as soon as it
+ * has a root, and build the rest of its tree on a thread of its own. Lookups
+ * that come up empty wait on the scanner for more entries, or for the end of
+ * the archive, before giving up.
+ *
+ * Scanners are held back until unixfs_scanner_enable() is called, since the
+ * process may yet daemonize (and lose every thread but the one forking)
+ * after the back-end's init has run.
+ */
+
+static pthread_mutex_t scanner_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, unixfs_scanner) scanner_pending =
+    LIST_HEAD_INITIALIZER(scanner_pending);
+static int scanner_enabled = 0;
+
+#define UNIXFS_SCANNER_BATCH 64 /* entries per wakeup of waiting lookups */
+
+static void*
+unixfs_scanner_thread(void* arg)
+{
+    struct unixfs_scanner* us = (struct unixfs_scanner*)arg;
+
+    unixfs_inodelayer_attach(us->us_il);
+
+    int error = us->us_scan(us, us->us_arg);
+
+    pthread_mutex_lock(&us->us_lock);
+    us->us_error = error;
+    us->us_done = 1;
+    pthread_cond_broadcast(&us->us_cond);
+    pthread_mutex_unlock(&us->us_lock);
+
+    return NULL;
+}
+
+/* scanner_lock must be held */
+static void
+unixfs_scanner_launch(struct unixfs_scanner* us)
+{
+    if (pthread_create(&us->us_thread, NULL, unixfs_scanner_thread, us) == 0) {
+        us->us_started = 1;
+        return;
+    }
+
+    fprintf(stderr, "*** warning: cannot start scanner; scanning in place\n");
+    (void)unixfs_scanner_thread(us);
+}
+
+int
+unixfs_scanner_start(struct unixfs_scanner* us, unixfs_scanner_func_t scan,
+                     void* arg)
+{
+    if (pthread_mutex_init(&us->us_lock, (const pthread_mutexattr_t*)0))
+        return -1;
+
+    if (pthread_cond_init(&us->us_cond, (const pthread_condattr_t*)0)) {
+        (void)pthread_mutex_destroy(&us->us_lock);
+        return -1;
+    }
+
+    us->us_il = il_current;
+    us->us_scan = scan;
+    us->us_arg = arg;
+    us->us_entries = 0;
+    us->us_waiters = 0;
+    us->us_started = us->us_done = us->us_cancel = us->us_error = 0;
+    us->us_initialized = 1;
+
+    pthread_mutex_lock(&scanner_lock);
+    if (scanner_enabled)
+        unixfs_scanner_launch(us);
+    else {
+        LIST_INSERT_HEAD(&scanner_pending, us, us_link);
+        us->us_pending = 1;
+    }
+    pthread_mutex_unlock(&scanner_lock);
+
+    return 0;
+}
+
+void
+unixfs_scanner_enable(void)
+{
+    struct unixfs_scanner* us;
+
+    pthread_mutex_lock(&scanner_lock);
+    scanner_enabled = 1;
+    while ((us = LIST_FIRST(&scanner_pending)) != NULL) {
+        LIST_REMOVE(us, us_link);
+        us->us_pending = 0;
+        unixfs_scanner_launch(us);
+    }
+    pthread_mutex_unlock(&scanner_lock);
+}
+
+void
+unixfs_scanner_stop(struct unixfs_scanner* us)
+{
+    if (!us->us_initialized)
+        return;
+
+    pthread_mutex_lock(&scanner_lock);
+    if (us->us_pending) {
+        LIST_REMOVE(us, us_link);
+        us->us_pending = 0;
+    }
+    pthread_mutex_unlock(&scanner_lock);
+
+    if (us->us_started) {
+        pthread_mutex_lock(&us->us_lock);
+        us->us_cancel = 1;
+        pthread_mutex_unlock(&us->us_lock);
+        (void)pthread_join(us->us_thread, NULL);
+        us->us_started = 0;
+    }
+
+    (void)pthread_cond_destroy(&us->us_cond);
+    (void)pthread_mutex_destroy(&us->us_lock);
+    us->us_initialized = 0;
+}
+
+void
+unixfs_scanner_lock(struct unixfs_scanner* us)
+{
+    pthread_mutex_lock(&us->us_lock);
+}
+
+void
+unixfs_scanner_unlock(struct unixfs_scanner* us)
+{
+    pthread_mutex_unlock(&us->us_lock);
+}
+
+/*
+ * us_lock must be held. Waiters are woken in batches; a lookup in a busy
+ * archive would otherwise cost the scanner a context switch per entry.
+ */
+void
+unixfs_scanner_publish(struct unixfs_scanner* us)
+{
+    us->us_entries++;
+    if (us->us_waiters && !(us->us_entries % UNIXFS_SCANNER_BATCH))
+        pthread_cond_broadcast(&us->us_cond);
+}
+
+/*
+ * us_lock must be held. Returns 0 once the scanner has published something
+ * new, or 1 without waiting if it has finished (or never started: without
+ * an enabled scanner there is nothing to wait for).
+ */
+int
+unixfs_scanner_wait(struct unixfs_scanner* us)
+{
+    if (us->us_done || !us->us_started)
+        return 1;
+
+    uint64_t entries = us->us_entries;
+    us->us_waiters++;
+    while (!us->us_done && (us->us_entries == entries))
+        pthread_cond_wait(&us->us_cond, &us->us_lock);
+    us->us_waiters--;
+
+    return (us->us_entries == entries) ? 1 : 0;
+}
+
+/* us_lock must be held */
+int
+unixfs_scanner_cancelled(struct unixfs_scanner* us)
+{
+    return us->us_cancel;
+}
+
+/*
+ * The archive tree layer. A node is the least an archive says about a
+ * member, so that even an archive with tens of millions of them can be
+ * held in memory: 56 bytes in an arena chunk, plus its name, which is
+ * shared with every other member of the same name (think of all those
+ * Makefiles). Full-blown struct stats and inodes are only made for the
+ * members that are being looked at.
+ */
+
+#define UNIXFS_ATREE_CHUNKSHIFT 10
+#define UNIXFS_ATREE_CHUNKSIZE  (1UL << UNIXFS_ATREE_CHUNKSHIFT)
+
+static uint32_t
+unixfs_strpool_hash(const char* s, size_t len)
+{
+    uint32_t h = 2166136261U; /* FNV-1a */
+
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * 16777619U;
+
+    return h;
+}
+
+static int
+unixfs_strpool_rehash(struct unixfs_strpool* sp, size_t tablesize)
+{
+    uint32_t* table = calloc(tablesize, sizeof(uint32_t));
+    size_t i;
+
+    if (!table)
+        return ENOMEM;
+
+    for (i = 0; i < sp->sp_tablesize; i++) {
+        uint32_t off = sp->sp_table[i];
+        if (off == 0)
+            continue;
+        const char* s = sp->sp_data + off;
+        size_t slot = unixfs_strpool_hash(s, strlen(s)) & (tablesize - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (tablesize - 1);
+        table[slot] = off;
+    }
+
+    free(sp->sp_table);
+    sp->sp_table = table;
+    sp->sp_tablesize = tablesize;
+
+    return 0;
+}
+
+/* Offset 0 is always the empty string. */
+static int
+unixfs_strpool_intern(struct unixfs_strpool* sp, const char* s, size_t len,
+                      uint32_t* offp)
+{
+    if (len == 0) {
+        *offp = 0;
+        return 0;
+    }
+
+    if (((sp->sp_count + 1) * 2 > sp->sp_tablesize) &&
+        unixfs_strpool_rehash(sp, max(sp->sp_tablesize * 2, 1024)) != 0)
+        return ENOMEM;
+
+    size_t mask = sp->sp_tablesize - 1;
+    size_t slot = unixfs_strpool_hash(s, len) & mask;
+
+    for (; sp->sp_table[slot] != 0; slot = (slot + 1) & mask) {
+        const char* t = sp->sp_data + sp->sp_table[slot];
+        if ((memcmp(t, s, len) == 0) && (t[len] == '\0')) {
+            *offp = sp->sp_table[slot];
+            return 0;
+        }
+    }
+
+    if (sp->sp_size + len + 1 > UINT32_MAX)
+        return ENOMEM;
+
+    if (sp->sp_size + len + 1 > sp->sp_capacity) {
+        size_t capacity = max(sp->sp_capacity * 2, sp->sp_size + len + 1);
+        char* data = realloc(sp->sp_data, capacity);
+        if (!data)
+            return ENOMEM;
+        sp->sp_data = data;
+        sp->sp_capacity = capacity;
+    }
+
+    *offp = (uint32_t)sp->sp_size;
+    memcpy(sp->sp_data + sp->sp_size, s, len);
+    sp->sp_data[sp->sp_size + len] = '\0';
+    sp->sp_size += len + 1;
+    sp->sp_table[slot] = *offp;
+    sp->sp_count++;
+
+    return 0;
+}
+
+int
+unixfs_atree_init(struct unixfs_atree* at, ino_t rootino)
+{
+    memset(at, 0, sizeof(*at));
+    at->at_rootino = rootino;
+
+    at->at_names.sp_data = malloc(4096);
+    if (!at->at_names.sp_data)
+        return ENOMEM;
+    at->at_names.sp_data[0] = '\0';
+    at->at_names.sp_size = 1;
+    at->at_names.sp_capacity = 4096;
+
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(stbuf));
+    stbuf.st_mode = S_IFDIR | 0755;
+    stbuf.st_nlink = 2;
+
+    /* the root is its own parent, which it isn't linked into */
+    if (unixfs_atree_add(at, 0, "", &stbuf, (off_t)0, NULL) != rootino) {
+        unixfs_atree_fini(at);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+void
+unixfs_atree_fini(struct unixfs_atree* at)
+{
+    size_t i;
+
+    for (i = 0; i < at->at_nchunks; i++)
+        free(at->at_chunks[i]);
+    free(at->at_chunks);
+    free(at->at_names.sp_data);
+    free(at->at_names.sp_table);
+    free(at->at_extents);
+    free(at->at_maps);
+    memset(at, 0, sizeof(*at));
+}
+
+struct unixfs_anode*
+unixfs_atree_node(struct unixfs_atree* at, ino_t ino)
+{
+    if ((ino < at->at_rootino) || (ino - at->at_rootino >= at->at_count))
+        return NULL;
+
+    size_t i = (size_t)(ino - at->at_rootino);
+
+    return &at->at_chunks[i >> UNIXFS_ATREE_CHUNKSHIFT]
+                         [i & (UNIXFS_ATREE_CHUNKSIZE - 1)];
+}
+
+const char*
+unixfs_atree_string(struct unixfs_atree* at, uint32_t off)
+{
+    return at->at_names.sp_data + off;
+}
+
+/* a hard link stands for the node it's a link to */
+static ino_t
+unixfs_atree_resolve(struct unixfs_atree* at, ino_t ino)
+{
+    struct unixfs_anode* np = unixfs_atree_node(at, ino);
+
+    if (!np || np->an_mode || !(np->an_un.an_daddr & UNIXFS_ANODE_LINK))
+        return ino;
+
+    ino_t target = (ino_t)(np->an_un.an_daddr & ~UNIXFS_ANODE_LINK);
+    struct unixfs_anode* tp = unixfs_atree_node(at, target);
+
+    return (tp && tp->an_mode) ? target : ino;
+}
+
+/*
+ * Looks for name among parent's children, from the most recently added one
+ * up to (not including) stop. Children are added at the head of the list,
+ * so a lookup that has to wait need only look at what is new.
+ */
+ino_t
+unixfs_atree_lookup(struct unixfs_atree* at, ino_t parent, const char* name,
+                    size_t namelen, ino_t stop)
+{
+    struct unixfs_anode* dp = unixfs_atree_node(at, parent);
+
+    if (!dp || !S_ISDIR(dp->an_mode))
+        return 0;
+
+    ino_t ino = dp->an_children;
+
+    while (ino && (ino != stop)) {
+        struct unixfs_anode* np = unixfs_atree_node(at, ino);
+        const char* s = unixfs_atree_string(at, np->an_name);
+        if ((memcmp(s, name, namelen) == 0) && (s[namelen] == '\0'))
+            return unixfs_atree_resolve(at, ino);
+        ino = np->an_next_sibling;
+    }
+
+    return 0;
+}
+
+static void
+unixfs_atree_fill(struct unixfs_anode* np, const struct stat* st, off_t daddr,
+                  uint32_t linkoff)
+{
+    np->an_mode = (uint16_t)st->st_mode;
+    np->an_nlink = (uint16_t)min(st->st_nlink, UINT16_MAX);
+    np->an_uid = (uint32_t)st->st_uid;
+    np->an_gid = (uint32_t)st->st_gid;
+    np->an_mtime = (int64_t)st->st_mtime;
+    np->an_mtimensec = (uint32_t)ST_MTIMENSEC(st);
+    np->an_size = (uint64_t)st->st_size;
+    np->an_un.an_daddr = 0;
+
+    if (S_ISDIR(st->st_mode))
+        np->an_size = 2;
+    else if (S_ISREG(st->st_mode))
+        np->an_un.an_daddr = (uint64_t)daddr;
+    else if (S_ISLNK(st->st_mode))
+        np->an_un.an_link = linkoff;
+    else if (S_ISCHR(st->st_mode) || S_ISBLK(st->st_mode))
+        np->an_un.an_rdev = (uint64_t)st->st_rdev;
+}
+
+/*
+ * Returns the new node's inode number, or 0 if there's no memory for it.
+ * Of st, only the mode, owners, link count, size, modification time and
+ * device number are kept; a directory's size is made 2, and goes up by one
+ * for every child. daddr only counts for regular files, and linktarget for
+ * symbolic links.
+ */
+ino_t
+unixfs_atree_add(struct unixfs_atree* at, ino_t parent, const char* name,
+                 const struct stat* st, off_t daddr, const char* linktarget)
+{
+    struct unixfs_anode* dp = NULL;
+    uint32_t nameoff, linkoff = 0;
+
+    if (parent && ((dp = unixfs_atree_node(at, parent)) == NULL))
+        return 0;
+
+    if ((at->at_count >= UINT32_MAX - at->at_rootino) ||
+        unixfs_strpool_intern(&at->at_names, name, strlen(name), &nameoff))
+        return 0;
+
+    if (S_ISLNK(st->st_mode) && linktarget &&
+        unixfs_strpool_intern(&at->at_names, linktarget, strlen(linktarget),
+                              &linkoff))
+        return 0;
+
+    size_t i = at->at_count;
+    size_t chunk = i >> UNIXFS_ATREE_CHUNKSHIFT;
+
+    if (chunk >= at->at_nchunks) {
+        size_t nchunks = max(at->at_nchunks * 2, 16);
+        struct unixfs_anode** chunks =
+            realloc(at->at_chunks, nchunks * sizeof(struct unixfs_anode*));
+        if (!chunks)
+            return 0;
+        memset(chunks + at->at_nchunks, 0,
+               (nchunks - at->at_nchunks) * sizeof(struct unixfs_anode*));
+        at->at_chunks = chunks;
+        at->at_nchunks = nchunks;
+    }
+
+    if (!at->at_chunks[chunk]) {
+        at->at_chunks[chunk] =
+            malloc(UNIXFS_ATREE_CHUNKSIZE * sizeof(struct unixfs_anode));
+        if (!at->at_chunks[chunk])
+            return 0;
+    }
+
+    struct unixfs_anode* np =
+        &at->at_chunks[chunk][i & (UNIXFS_ATREE_CHUNKSIZE - 1)];
+    ino_t ino = at->at_rootino + (ino_t)i;
+
+    memset(np, 0, sizeof(*np));
+    np->an_name = nameoff;
+    unixfs_atree_fill(np, st, daddr, linkoff);
+
+    at->at_count++;
+
+    if (dp) {
+        np->an_parent = (uint32_t)parent;
+        np->an_next_sibling = dp->an_children;
+        dp->an_children = (uint32_t)ino;
+        dp->an_size++;
+    }
+
+    return ino;
+}
+
+/*
+ * Children are added at the head of their directory's list, but listed from
+ * the tail, so that an offset keeps naming the same entry while the
+ * directory grows. A walk down the list can only find them backwards, so a
+ * listing goes a window at a time: one walk finds the inode numbers of as
+ * many entries from an offset on as a struct unixfs_dirbuf can hold, and
+ * the calls that follow take theirs from there.
+ */
+
+struct unixfs_atree_window {
+    off_t    aw_first;            /* offset of aw_ino[0] */
+    uint32_t aw_count;
+    uint32_t aw_ino[(UNIXFS_DIRBUFSIZ - 16) / sizeof(uint32_t)];
+};
+
+#define UNIXFS_ATREE_WINDOW \
+    (sizeof(((struct unixfs_atree_window*)0)->aw_ino) / sizeof(uint32_t))
+
+static void
+unixfs_atree_window_fill(struct unixfs_atree* at, struct unixfs_anode* dp,
+                         off_t offset, struct unixfs_atree_window* aw)
+{
+    uint64_t count = min(dp->an_size - (uint64_t)offset, UNIXFS_ATREE_WINDOW);
+    uint64_t i, skip = dp->an_size - (uint64_t)offset - count;
+    ino_t ino = dp->an_children;
+
+    for (i = 0; i < skip; i++)
+        ino = unixfs_atree_node(at, ino)->an_next_sibling;
+
+    for (i = count; i > 0; i--) {
+        aw->aw_ino[i - 1] = (uint32_t)ino;
+        ino = unixfs_atree_node(at, ino)->an_next_sibling;
+    }
+
+    aw->aw_first = offset;
+    aw->aw_count = (uint32_t)count;
+}
+
+int
+unixfs_atree_readdir(struct unixfs_atree* at, ino_t dir,
+                     struct unixfs_dirbuf* dirbuf, off_t* offset,
+                     struct unixfs_direntry* dents, int max)
+{
+    struct unixfs_anode* dp = unixfs_atree_node(at, dir);
+    struct unixfs_atree_window* aw = (struct unixfs_atree_window*)dirbuf->data;
+    int n;
+
+    if (!dp)
+        return -1;
+
+    if (!dirbuf->flags.initialized) {
+        aw->aw_first = 0;
+        aw->aw_count = 0;
+        dirbuf->flags.initialized = 1;
+    }
+
+    for (n = 0; (n < max) && ((uint64_t)*offset < dp->an_size); n++) {
+        struct unixfs_direntry* dent = &dents[n];
+        const char* name;
+
+        if (*offset < 2) {
+            dent->ino = ((*offset == 1) && dp->an_parent) ? dp->an_parent : dir;
+            name = (*offset == 1) ? ".." : ".";
+        } else {
+            if ((*offset < aw->aw_first) ||
+                (*offset >= aw->aw_first + aw->aw_count))
+                unixfs_atree_window_fill(at, dp, *offset, aw);
+            dent->ino = aw->aw_ino[*offset - aw->aw_first];
+            name = unixfs_atree_string(at,
+                       unixfs_atree_node(at, dent->ino)->an_name);
+            dent->ino = unixfs_atree_resolve(at, dent->ino);
+        }
+
+        size_t namelen = min(strlen(name), UNIXFS_MAXNAMLEN);
+        memcpy(dent->name, name, namelen);
+        dent->name[namelen] = '\0';
+
+        *offset += 1;
+    }
+
+    return n;
+}
+
+/*
+ * Adds name to parent as a hard link to target, which counts it among its
+ * links. Returns the link's node, or 0 if there's no memory for it (or if
+ * target is a directory, which can't have links).
+ */
+ino_t
+unixfs_atree_link(struct unixfs_atree* at, ino_t parent, const char* name,
+                  ino_t target)
+{
+    struct unixfs_anode* tp = unixfs_atree_node(at, target);
+    struct stat stbuf;
+
+    if (!tp || S_ISDIR(tp->an_mode))
+        return 0;
+
+    memset(&stbuf, 0, sizeof(stbuf)); /* no mode: a link */
+
+    ino_t ino = unixfs_atree_add(at, parent, name, &stbuf, (off_t)0, NULL);
+    if (!ino)
+        return 0;
+
+    unixfs_atree_node(at, ino)->an_un.an_daddr =
+        UNIXFS_ANODE_LINK | (uint64_t)target;
+    if (tp->an_nlink < UINT16_MAX)
+        tp->an_nlink++;
+
+    return ino;
+}
+
+/*
+ * Makes an existing node over as st says, the way unixfs_atree_add() would
+ * have made it, for archives in which a later member replaces an earlier
+ * one of the same name. A directory stays a directory, and keeps its
+ * children; it can't be replaced with anything else (EISDIR).
+ */
+int
+unixfs_atree_update(struct unixfs_atree* at, ino_t ino, const struct stat* st,
+                    off_t daddr, const char* linktarget)
+{
+    struct unixfs_anode* np = unixfs_atree_node(at, ino);
+    uint32_t linkoff = 0;
+
+    if (!np)
+        return ENOENT;
+
+    if (S_ISDIR(np->an_mode)) {
+        if (!S_ISDIR(st->st_mode))
+            return EISDIR;
+        uint64_t size = np->an_size;
+        unixfs_atree_fill(np, st, daddr, linkoff);
+        np->an_size = size;
+        return 0;
+    }
+
+    if (S_ISLNK(st->st_mode) && linktarget &&
+        unixfs_strpool_intern(&at->at_names, linktarget, strlen(linktarget),
+                              &linkoff))
+        return ENOMEM;
+
+    unixfs_atree_fill(np, st, daddr, linkoff);
+
+    return 0;
+}
+
+/*
+ * Gives a regular file an extent map in place of its one run of data.
+ * Extents must be in file order, and must not overlap; the file's size must
+ * already cover them.
+ */
+int
+unixfs_atree_setmap(struct unixfs_atree* at, ino_t ino,
+                    const struct unixfs_aextent* extents, size_t count)
+{
+    struct unixfs_anode* np = unixfs_atree_node(at, ino);
+    uint64_t end = 0, bytes = 0;
+    size_t i;
+
+    if (!np || !S_ISREG(np->an_mode))
+        return EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if ((extents[i].ae_offset < end) ||
+            (extents[i].ae_offset > np->an_size) ||
+            (extents[i].ae_length > np->an_size - extents[i].ae_offset))
+            return EINVAL;
+        end = extents[i].ae_offset + extents[i].ae_length;
+        bytes += extents[i].ae_length;
+    }
+
+    if (at->at_nextents + count > at->at_extcapacity) {
+        size_t capacity = max(at->at_extcapacity * 2, 256);
+        while (capacity < at->at_nextents + count)
+            capacity *= 2;
+        struct unixfs_aextent* ext =
+            realloc(at->at_extents, capacity * sizeof(*ext));
+        if (!ext)
+            return ENOMEM;
+        at->at_extents = ext;
+        at->at_extcapacity = capacity;
+    }
+
+    if (at->at_nmaps == at->at_mapcapacity) {
+        size_t capacity = max(at->at_mapcapacity * 2, 16);
+        struct unixfs_amap* maps =
+            realloc(at->at_maps, capacity * sizeof(*maps));
+        if (!maps)
+            return ENOMEM;
+        at->at_maps = maps;
+        at->at_mapcapacity = capacity;
+    }
+
+    struct unixfs_amap* mp = &at->at_maps[at->at_nmaps];
+    mp->am_first = at->at_nextents;
+    mp->am_count = count;
+    mp->am_bytes = bytes;
+    memcpy(at->at_extents + at->at_nextents, extents,
+           count * sizeof(*extents));
+    at->at_nextents += count;
+
+    np->an_un.an_daddr = UNIXFS_ANODE_MAPPED | (uint64_t)at->at_nmaps++;
+
+    return 0;
+}
+
+/*
+ * Finds where a regular file's data at offset is: the extent that holds
+ * offset, or, if offset is in a hole, the first extent after it, which
+ * tells where the hole ends. Returns ENOENT if there's no data at or after
+ * offset. A file that has no extent map has one extent, all of it.
+ */
+int
+unixfs_atree_extent(struct unixfs_atree* at, ino_t ino, off_t offset,
+                    struct unixfs_aextent* ext)
+{
+    struct unixfs_anode* np = unixfs_atree_node(at, ino);
+
+    if (!np || !S_ISREG(np->an_mode))
+        return ENOENT;
+
+    if (!(np->an_un.an_daddr & UNIXFS_ANODE_MAPPED)) {
+        if ((uint64_t)offset >= np->an_size)
+            return ENOENT;
+        ext->ae_offset = 0;
+        ext->ae_length = np->an_size;
+        ext->ae_daddr = np->an_un.an_daddr;
+        return 0;
+    }
+
+    struct unixfs_amap* mp =
+        &at->at_maps[np->an_un.an_daddr & ~UNIXFS_ANODE_MAPPED];
+    struct unixfs_aextent* extents = at->at_extents + mp->am_first;
+    size_t lo = 0, hi = mp->am_count;
+
+    /* the first extent that ends past offset */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (extents[mid].ae_offset + extents[mid].ae_length <=
+            (uint64_t)offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == mp->am_count)
+        return ENOENT;
+
+    *ext = extents[lo];
+
+    return 0;
+}
+
+void
+unixfs_atree_stat(struct unixfs_atree* at, ino_t ino, struct stat* stbuf)
+{
+    struct unixfs_anode* np = unixfs_atree_node(at, ino);
+
+    memset(stbuf, 0, sizeof(*stbuf));
+    if (!np)
+        return;
+
+    stbuf->st_ino = ino;
+    stbuf->st_mode = np->an_mode;
+    stbuf->st_nlink = np->an_nlink;
+    stbuf->st_uid = np->an_uid;
+    stbuf->st_gid = np->an_gid;
+    stbuf->st_size = (off_t)np->an_size;
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime =
+        (time_t)np->an_mtime;
+    ST_ATIMENSEC(stbuf) = ST_MTIMENSEC(stbuf) = ST_CTIMENSEC(stbuf) =
+        np->an_mtimensec;
+    if (S_ISCHR(np->an_mode) || S_ISBLK(np->an_mode))
+        stbuf->st_rdev = (dev_t)np->an_un.an_rdev;
+    else if (S_ISREG(np->an_mode)) {
+        uint64_t bytes = np->an_size;
+        if (np->an_un.an_daddr & UNIXFS_ANODE_MAPPED)
+            bytes = at->at_maps[np->an_un.an_daddr &
+                                ~UNIXFS_ANODE_MAPPED].am_bytes;
+        stbuf->st_blocks = (blkcnt_t)((bytes + 511) / 512);
+    }
+}
+
+/*
+ * Bulk byte order conversion. On a little endian machine, a PDP-11 long is
+ * a swap of its 16-bit halves and a big endian one a full byte swap, both of
+ * which SSE2 does four at a time.
+ */
+
+void
+unixfs_fs32v_to_host(fs_endian_t e, uint32_t* dst, const void* src, size_t n)
+{
+    const uint8_t* s = (const uint8_t*)src;
+    size_t i = 0;
+
+#if UNIXFS_FS32V_SSE2
+    if (e == UNIXFS_FS_PDP) {
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + 4 * i));
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+            _mm_storeu_si128((__m128i*)(dst + i), v);
+        }
+    } else if (e == UNIXFS_FS_BIG) {
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + 4 * i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+            _mm_storeu_si128((__m128i*)(dst + i), v);
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        uint32_t x;
+        memcpy(&x, s + 4 * i, sizeof(x));
+        dst[i] = fs32_to_host(e, x);
+    }
 }
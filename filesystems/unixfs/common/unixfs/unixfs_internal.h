@@ -123,6 +123,7 @@ struct super_block {
  */
 typedef struct inode {
     LIST_ENTRY(inode)   I_hashlink;
+    TAILQ_ENTRY(inode)  I_lrulink;
     pthread_cond_t      I_state_cond;
     uint32_t            I_initialized;
     uint32_t            I_attachoutstanding;
@@ -159,6 +160,15 @@ typedef struct inode {
 #define I_ctime_sec  I_stat.st_ctimespec.tv_sec
 #define I_crtime_sec I_stat.st_birthtimespec.tv_sec
 #endif
+#if __linux__
+#define ST_ATIMENSEC(st) (st)->st_atim.tv_nsec
+#define ST_MTIMENSEC(st) (st)->st_mtim.tv_nsec
+#define ST_CTIMENSEC(st) (st)->st_ctim.tv_nsec
+#else
+#define ST_ATIMENSEC(st) (st)->st_atimespec.tv_nsec
+#define ST_MTIMENSEC(st) (st)->st_mtimespec.tv_nsec
+#define ST_CTIMENSEC(st) (st)->st_ctimespec.tv_nsec
+#endif
 #define I_size       I_stat.st_size
 #define I_blocks     I_stat.st_blocks
 #define I_blksize    I_stat.st_blksize
@@ -183,6 +193,165 @@ void          unixfs_inodelayer_isucceeded(struct inode* ip);
 void          unixfs_inodelayer_ifailed(struct inode* ip);
 void          unixfs_inodelayer_dump(unixfs_inodelayer_iterator_t);
 
+/* Buffer layer interface. */
+
+int           unixfs_bufferlayer_pread(int fd, void* buf, size_t nbyte,
+                                       off_t offset);
+void          unixfs_bufferlayer_invalidate(int fd);
+
+/* Scanner layer interface; for back-ends that index an archive lazily. */
+
+struct unixfs_scanner;
+
+typedef int (*unixfs_scanner_func_t)(struct unixfs_scanner*, void*);
+
+struct unixfs_scanner {
+    LIST_ENTRY(unixfs_scanner) us_link;
+    pthread_mutex_t            us_lock;
+    pthread_cond_t             us_cond;
+    pthread_t                  us_thread;
+    struct unixfs_inodelayer*  us_il;
+    unixfs_scanner_func_t      us_scan;
+    void*                      us_arg;
+    uint64_t                   us_entries;  /* published so far */
+    int                        us_waiters;
+    int                        us_initialized;
+    int                        us_pending;  /* waiting to be enabled */
+    int                        us_started;
+    int                        us_done;
+    int                        us_cancel;
+    int                        us_error;
+};
+
+int           unixfs_scanner_start(struct unixfs_scanner* us,
+                                   unixfs_scanner_func_t scan, void* arg);
+void          unixfs_scanner_stop(struct unixfs_scanner* us);
+void          unixfs_scanner_lock(struct unixfs_scanner* us);
+void          unixfs_scanner_unlock(struct unixfs_scanner* us);
+void          unixfs_scanner_publish(struct unixfs_scanner* us);
+int           unixfs_scanner_wait(struct unixfs_scanner* us);
+int           unixfs_scanner_cancelled(struct unixfs_scanner* us);
+
+/*
+ * Archive tree layer interface; for back-ends that hold an archive's whole
+ * directory tree in memory. Nodes are numbered from the root's inode number
+ * up, in the order they were added, and are kept in chunks of an arena; all
+ * names and link targets are interned in one string pool. struct inodes are
+ * made from nodes on iget, and are cached like any other back-end's.
+ *
+ * A regular file's data is either one run of the archive, at an_daddr, or,
+ * for a sparse file, an extent map: the runs of the file that have data,
+ * each with where in the archive it is, the rest of the file being holes.
+ * Extent maps are kept in one array of the tree's, and are found from an
+ * an_daddr that has UNIXFS_ANODE_MAPPED set.
+ *
+ * A file with more than one name has a node for each name; all but the
+ * first are hard links, which have no mode, and whose an_daddr is the
+ * first's inode number with UNIXFS_ANODE_LINK set. Looking up or listing a
+ * hard link gives that; a member that merely has no mode is not a link.
+ *
+ * Nothing here locks. Whoever adds to a tree (the scanner) may look at it
+ * freely, and must hold the scanner lock while adding; everyone else must
+ * hold the scanner lock to look.
+ */
+
+struct unixfs_anode {             /* 56 bytes */
+    int64_t  an_mtime;
+    uint64_t an_size;             /* directories: 2 + number of children */
+    union {
+        uint64_t an_daddr;        /* regular files: offset in the archive, */
+                                  /* or UNIXFS_ANODE_MAPPED | map number; */
+                                  /* hard links: UNIXFS_ANODE_LINK | target */
+        uint64_t an_rdev;         /* devices */
+        uint32_t an_link;         /* symbolic links: target, in the pool */
+    } an_un;
+    uint32_t an_parent;           /* inode numbers; 0 for none */
+    uint32_t an_children;         /* ... the most recently added one */
+    uint32_t an_next_sibling;
+    uint32_t an_name;             /* in the pool */
+    uint32_t an_uid;
+    uint32_t an_gid;
+    uint16_t an_mode;
+    uint16_t an_nlink;
+    uint32_t an_mtimensec;
+};
+
+#define UNIXFS_ANODE_MAPPED (1ULL << 63)
+#define UNIXFS_ANODE_LINK   (1ULL << 62)
+
+struct unixfs_aextent {
+    uint64_t ae_offset;           /* in the file */
+    uint64_t ae_length;
+    uint64_t ae_daddr;            /* in the archive */
+};
+
+struct unixfs_amap {
+    size_t   am_first;            /* in at_extents */
+    size_t   am_count;
+    uint64_t am_bytes;            /* with data; the rest are holes */
+};
+
+struct unixfs_strpool {
+    char*     sp_data;
+    size_t    sp_size;
+    size_t    sp_capacity;
+    uint32_t* sp_table;           /* offsets; 0 for an empty slot */
+    size_t    sp_tablesize;       /* a power of 2 */
+    size_t    sp_count;
+};
+
+struct unixfs_atree {
+    struct unixfs_anode**  at_chunks;
+    size_t                 at_nchunks;
+    size_t                 at_count;
+    ino_t                  at_rootino;
+    struct unixfs_strpool  at_names;
+    struct unixfs_aextent* at_extents;
+    size_t                 at_nextents;
+    size_t                 at_extcapacity;
+    struct unixfs_amap*    at_maps;
+    size_t                 at_nmaps;
+    size_t                 at_mapcapacity;
+};
+
+int           unixfs_atree_init(struct unixfs_atree* at, ino_t rootino);
+void          unixfs_atree_fini(struct unixfs_atree* at);
+struct unixfs_anode* unixfs_atree_node(struct unixfs_atree* at, ino_t ino);
+ino_t         unixfs_atree_lookup(struct unixfs_atree* at, ino_t parent,
+                                  const char* name, size_t namelen,
+                                  ino_t stop);
+ino_t         unixfs_atree_add(struct unixfs_atree* at, ino_t parent,
+                               const char* name, const struct stat* st,
+                               off_t daddr, const char* linktarget);
+ino_t         unixfs_atree_link(struct unixfs_atree* at, ino_t parent,
+                                const char* name, ino_t target);
+int           unixfs_atree_update(struct unixfs_atree* at, ino_t ino,
+                                  const struct stat* st, off_t daddr,
+                                  const char* linktarget);
+int           unixfs_atree_setmap(struct unixfs_atree* at, ino_t ino,
+                                  const struct unixfs_aextent* extents,
+                                  size_t count);
+int           unixfs_atree_extent(struct unixfs_atree* at, ino_t ino,
+                                  off_t offset, struct unixfs_aextent* ext);
+int           unixfs_atree_readdir(struct unixfs_atree* at, ino_t dir,
+                                   struct unixfs_dirbuf* dirbuf,
+                                   off_t* offset,
+                                   struct unixfs_direntry* dents, int max);
+const char*   unixfs_atree_string(struct unixfs_atree* at, uint32_t off);
+void          unixfs_atree_stat(struct unixfs_atree* at, ino_t ino,
+                                struct stat* stbuf);
+
+/*
+ * Where a listing of a directory that is kept as a list of its children
+ * left off, for back-ends to keep in a struct unixfs_dirbuf between
+ * readdir_batch calls, so that going on from there doesn't mean walking
+ * the list from its head again.
+ */
+struct unixfs_dircursor {
+    off_t dc_offset;              /* of dc_next */
+    void* dc_next;
+};
+
 /* Byte Swappers */
 
 #define cpu_to_le32(x) OSSwapHostToLittleInt32(x)
@@ -231,4 +400,56 @@ fs16_to_host(fs_endian_t e, uint16_t x)
         return OSSwapBigToHostInt16(x);
 }
 
+/*
+ * Every fsXX_to_host() decides what to do from its fs_endian_t, which for
+ * a hot decoder (an inode, a directory entry) means a handful of branches
+ * per field. Such a decoder is better written once, as a static inline
+ * function whose first argument is the fs_endian_t, and instantiated for
+ * each byte order, where the branches fold away:
+ *
+ *     static inline void
+ *     decode(fs_endian_t e, struct inode* ip, const struct dinode* dip)
+ *     { ... fs16_to_host(e, dip->di_mode) ... }
+ *
+ *     UNIXFS_ENDIAN_SPECIALIZE(decode,
+ *         (struct inode* ip, const struct dinode* dip), (ip, dip));
+ *
+ * gives decode_pdp(), decode_little() and decode_big(), and a table,
+ * decode_variants[], of them by fs_endian_t, from which a back-end picks
+ * the one for its file system when it is mounted.
+ */
+
+#define UNIXFS_ARGS(...) __VA_ARGS__
+
+#define UNIXFS_ENDIAN_SPECIALIZE(fn, params, args)                      \
+    static void fn##_pdp params    { fn(UNIXFS_FS_PDP, UNIXFS_ARGS args); } \
+    static void fn##_little params { fn(UNIXFS_FS_LITTLE, UNIXFS_ARGS args); } \
+    static void fn##_big params    { fn(UNIXFS_FS_BIG, UNIXFS_ARGS args); } \
+    static void (* const fn##_variants[]) params = {                    \
+        [UNIXFS_FS_PDP]    = fn##_pdp,                                   \
+        [UNIXFS_FS_LITTLE] = fn##_little,                                \
+        [UNIXFS_FS_BIG]    = fn##_big,                                   \
+    }
+
+/*
+ * Converts n 32-bit quantities, such as an indirect block's addresses, in
+ * byte order e at src (which need not be aligned) to host order at dst.
+ */
+void unixfs_fs32v_to_host(fs_endian_t e, uint32_t* dst, const void* src,
+                          size_t n);
+
+/*
+ * An indirect block's addresses, all converted to host order at once. A
+ * read that walks a file block by block keeps the last one it needed, so
+ * that the blocks under it cost neither another read of it, nor another
+ * conversion, nor a break in the run of sequential reads of the data.
+ */
+
+#define UNIXFS_NINDIR_MAX 1024 /* 4K blocks of 32-bit addresses */
+
+struct unixfs_indirblk {
+    off_t    ib_blkno;                     /* 0 if none */
+    uint32_t ib_addr[UNIXFS_NINDIR_MAX];
+};
+
 #endif /* _UNIXFS_INTERNAL_H_ */
@@ -360,7 +360,7 @@ minixfs_fill_super(int fd, void* data, int silent)
         sbi->s_link_max = MINIX2_LINK_MAX;
         sbi->s_mount_state = MINIX_VALID_FS;
         sb->s_blocksize = m3s->s_blocksize;
-        sb->s_blocksize_bits = m3s->s_blocksize;
+        sb->s_blocksize_bits = blksize_bits(m3s->s_blocksize);
     } else
         goto out_no_fs;
 
@@ -487,8 +487,8 @@ minix_inode_by_name(struct inode* dir, const char* name)
 }
 
 int
-minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
-                      off_t* offset, struct unixfs_direntry* dent)
+minixfs_readdir_batch(struct inode* dir, struct unixfs_dirbuf* dirbuf,
+                      off_t* offset, struct unixfs_direntry* dents, int max)
 {
     struct super_block* sb = dir->I_sb;
     struct minix_sb_info* sbi = minix_sb(sb);
@@ -500,47 +500,51 @@ minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
     *offset = (*offset + chunk_size - 1) & ~(chunk_size - 1);
 
     if (*offset >= dir->I_size)
-        return -1;
+        return 0;
 
     if (npages == 0)
-        return -1;
+        return 0;
 
     start = *offset >> PAGE_CACHE_SHIFT; /* which page from offset */
 
     if (start >= npages)
-        return -1;
+        return 0;
     n = start;
 
     if (!dirbuf->flags.initialized || (*offset & ((PAGE_SIZE - 1))) == 0) {
         int ret = minixfs_get_page(dir, n, dirpagebuf);
         if (ret)
-            return ret;
+            return -1;
         dirbuf->flags.initialized = 1;
     }
 
-    char* name = NULL;
-
-    if (sbi->s_version == MINIX_V3) {
-        minix3_dirent* de3 =
-            (minix3_dirent*)((char*)dirpagebuf + (*offset & (PAGE_SIZE - 1)));
-        dent->ino = de3->inode;
-        name = de3->name;
-    } else {
-        minix_dirent* de =
-            (minix_dirent*)((char*)dirpagebuf + (*offset & (PAGE_SIZE - 1)));
-        dent->ino = de->inode;
-        name = de->name;
-    }
+    int count = 0;
 
-    if (dent->ino) {
-        size_t nl = min(strlen(name), sbi->s_namelen);
-        memcpy(dent->name, name, nl);
-        dent->name[nl] = '\0';
-    }
+    /* the rest of the page, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[count++];
+        char* name = NULL;
+        char* de = dirpagebuf + (*offset & (PAGE_SIZE - 1));
 
-    *offset += chunk_size;
+        if (sbi->s_version == MINIX_V3) {
+            dent->ino = ((minix3_dirent*)de)->inode;
+            name = ((minix3_dirent*)de)->name;
+        } else {
+            dent->ino = ((minix_dirent*)de)->inode;
+            name = ((minix_dirent*)de)->name;
+        }
 
-    return 0;
+        if (dent->ino) {
+            size_t nl = min(strlen(name), sbi->s_namelen);
+            memcpy(dent->name, name, nl);
+            dent->name[nl] = '\0';
+        }
+
+        *offset += chunk_size;
+    } while ((count < max) && ((*offset & (PAGE_SIZE - 1)) != 0) &&
+             (*offset < dir->I_size));
+
+    return count;
 }
 
 int
@@ -92,8 +92,9 @@ struct super_block*
 int   minixfs_statvfs(struct super_block* sb, struct statvfs* buf);
 int   minixfs_iget(struct super_block* sb, struct inode* ip);
 ino_t minixfs_inode_by_name(struct inode* dir, const char* name);
-int   minixfs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
-                          off_t* offset, struct unixfs_direntry* dent);
+int   minixfs_readdir_batch(struct inode* dir, struct unixfs_dirbuf* dirbuf,
+                            off_t* offset, struct unixfs_direntry* dents,
+                            int max);
 int   minixfs_get_block(struct inode* ip, sector_t fragment, off_t* result);
 int   minixfs_get_page(struct inode* ip, sector_t index, char* pagebuf);
 
@@ -35,10 +35,15 @@ unixfs_usage(void)
     "%s (version %s): Minix File System for MacFUSE\n"
     "Amit Singh <http://osxbook.com>\n"
     "usage:\n"
-    "      %s [--force] --dmg DMG MOUNTPOINT [MacFUSE args...]\n"
+    "      %s [--control] [--force] [--idle SECONDS] --dmg DMG MOUNTPOINT [MacFUSE args...]\n"
     "where:\n"
     "     . DMG must point to a Minix disk image\n"
-    "     . --force attempts mounting even if there are warnings or errors\n",
+    "       (or to a directory of them, each of which then shows up as a\n"
+    "       subdirectory of the volume)\n"
+    "     . --control mounts read-write so that the knobs in /.unixfs can be set\n"
+    "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --idle closes images in a directory after SECONDS unused (default\n"
+    "       60; 0 keeps them open)\n",
     PROGNAME, PROGVERS, PROGNAME);
 }
 
@@ -95,8 +95,19 @@ unixfs_internal_fini(void* filsys)
     struct super_block* sb = (struct super_block*)filsys;
     if (sb) {
         struct minix_sb_info* sbi = minix_sb(sb);
-        if (sbi)
+        if (sbi) {
+            unsigned long i;
+            for (i = 0; i < sbi->s_imap_blocks; i++)
+                brelse(sbi->s_imap[i]);
+            for (i = 0; i < sbi->s_zmap_blocks; i++)
+                brelse(sbi->s_zmap[i]);
+            kfree(sbi->s_imap);
             free(sbi);
+        }
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
+            close(sb->s_bdev);
+        }
         free(sb);
     }
 }
@@ -120,11 +131,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
     struct super_block* sb = unixfs;
 
-    if (pread(sb->s_bdev, blkbuf, sb->s_blocksize,
-              blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(sb->s_bdev, blkbuf,
+                                    sb->s_blocksize,
+                                    blkno * (off_t)(sb->s_blocksize));
 }
 
 struct inode*
@@ -279,10 +288,11 @@ found:
 }
 
 int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    return minixfs_next_direntry(dp, dirbuf, offset, dent);
+    return minixfs_readdir_batch(dp, dirbuf, offset, dents, max);
 
 }
 
@@ -0,0 +1,754 @@
+/*
+ * Synthetic Image Generator for the UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#include "mkimage.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char* PROGNAME = "unixfs_mkimage";
+static const char* PROGVERS = "1.0";
+
+static const struct mkimg_format* formats[] = {
+    &mkimg_format_minix1,
+    &mkimg_format_minix2,
+    &mkimg_format_minix3,
+    &mkimg_format_sysv,
+    &mkimg_format_v7,
+    &mkimg_format_tar,
+    &mkimg_format_cpio_newc,
+    &mkimg_format_ar,
+    NULL,
+};
+
+static inline uint64_t
+mkimg_mix(uint64_t z)
+{
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t
+mkimg_hash(uint64_t seed, uint64_t a, uint64_t b)
+{
+    return mkimg_mix(seed + mkimg_mix(a + mkimg_mix(b)));
+}
+
+#define MKIMG_KEY_SIZE 0x53495a45ULL
+#define MKIMG_KEY_DIST 0x44495354ULL
+#define MKIMG_KEY_HOLE 0x484f4c45ULL
+#define MKIMG_KEY_DATA 0x44415441ULL
+
+uint64_t
+mkimg_file_size(const struct mkimg_spec* spec, uint64_t fileno)
+{
+    uint64_t h = mkimg_hash(spec->seed ^ MKIMG_KEY_DIST, fileno, 0);
+    uint64_t r = mkimg_hash(spec->seed ^ MKIMG_KEY_SIZE, fileno, 0);
+    uint32_t w = (uint32_t)(h % spec->distweight);
+    const struct mkimg_sizedist* d = &spec->dist[0];
+    int i;
+
+    for (i = 0; i < spec->ndist; i++) {
+        d = &spec->dist[i];
+        if (w < d->weight)
+            break;
+        w -= d->weight;
+    }
+
+    uint64_t size;
+
+    switch (d->kind) {
+
+    case MKIMG_DIST_UNIFORM:
+        size = d->a + ((d->b > d->a) ? (r % (d->b - d->a + 1)) : 0);
+        break;
+
+    case MKIMG_DIST_EXP: {
+        double u = ((double)(r >> 11) + 0.5) / 9007199254740992.0;
+        size = (uint64_t)(-(double)d->a * log(u));
+        break;
+    }
+
+    case MKIMG_DIST_FIXED:
+    default:
+        size = d->a;
+        break;
+    }
+
+    if (spec->maxsize && (size > spec->maxsize))
+        size = spec->maxsize;
+
+    return size;
+}
+
+int
+mkimg_chunk_is_hole(const struct mkimg_spec* spec, uint64_t fileno,
+                    uint64_t size, uint64_t chunk)
+{
+    if (spec->hole_threshold == 0)
+        return 0;
+
+    /* the last chunk always has data so that the file ends where it says */
+    if (chunk >= ((size + MKIMG_CHUNK - 1) / MKIMG_CHUNK) - 1)
+        return 0;
+
+    return mkimg_hash(spec->seed ^ MKIMG_KEY_HOLE, fileno, chunk) <
+               spec->hole_threshold;
+}
+
+void
+mkimg_file_data(const struct mkimg_spec* spec, uint64_t fileno, uint64_t size,
+                uint64_t offset, char* buf, size_t len)
+{
+    while (len > 0) {
+        uint64_t chunk = offset / MKIMG_CHUNK;
+        size_t coff = (size_t)(offset % MKIMG_CHUNK);
+        size_t n = MKIMG_CHUNK - coff;
+        if (n > len)
+            n = len;
+
+        if ((offset >= size) ||
+            mkimg_chunk_is_hole(spec, fileno, size, chunk)) {
+            memset(buf, 0, n);
+        } else {
+            uint64_t key = mkimg_hash(spec->seed ^ MKIMG_KEY_DATA, fileno,
+                                      chunk);
+            size_t i = 0;
+            while (i < n) {
+                size_t o = coff + i;
+                uint64_t word = mkimg_mix(key + (o >> 3));
+                if (((o & 7) == 0) && ((n - i) >= 8)) {
+                    int b;
+                    for (b = 0; b < 8; b++)
+                        buf[i + b] = (char)(word >> (8 * b));
+                    i += 8;
+                } else {
+                    buf[i] = (char)(word >> (8 * (o & 7)));
+                    i++;
+                }
+            }
+            if (offset + n > size) /* zero the tail of the last block */
+                memset(buf + (size - offset), 0, (size_t)(offset + n - size));
+        }
+
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+uint64_t
+mkimg_dir_nsubdirs(const struct mkimg_spec* spec, uint64_t dirno)
+{
+    return (dirno < spec->ninterior) ? spec->fanout : 0;
+}
+
+uint64_t
+mkimg_dir_firstsubdir(const struct mkimg_spec* spec, uint64_t dirno)
+{
+    return (dirno * spec->fanout) + 1;
+}
+
+uint64_t
+mkimg_dir_parent(const struct mkimg_spec* spec, uint64_t dirno)
+{
+    return (dirno == 0) ? 0 : (dirno - 1) / spec->fanout;
+}
+
+int
+mkimg_dir_name(const struct mkimg_spec* spec, uint64_t dirno, char* buf,
+               size_t len)
+{
+    if (dirno == 0)
+        return snprintf(buf, len, ".");
+
+    return snprintf(buf, len, "d%llu",
+                    (unsigned long long)((dirno - 1) % spec->fanout));
+}
+
+int
+mkimg_dir_path(const struct mkimg_spec* spec, uint64_t dirno, char* buf,
+               size_t len)
+{
+    if (dirno == 0) {
+        if (len)
+            buf[0] = '\0';
+        return 0;
+    }
+
+    int n = mkimg_dir_path(spec, mkimg_dir_parent(spec, dirno), buf, len);
+    if ((n < 0) || ((size_t)n >= len))
+        return -1;
+
+    if (n) {
+        if ((size_t)(n + 1) >= len)
+            return -1;
+        buf[n++] = '/';
+    }
+
+    int m = mkimg_dir_name(spec, dirno, buf + n, len - n);
+    if ((m < 0) || ((size_t)(n + m) >= len))
+        return -1;
+
+    return n + m;
+}
+
+int
+mkimg_file_name(const struct mkimg_spec* spec, uint64_t fileno, char* buf,
+                size_t len)
+{
+    return snprintf(buf, len, "f%llu",
+                    (unsigned long long)(fileno % spec->files));
+}
+
+int
+mkimg_flat_name(const struct mkimg_spec* spec, uint64_t fileno, char* buf,
+                size_t len)
+{
+    int n = mkimg_dir_path(spec, fileno / spec->files, buf, len);
+    if (n < 0)
+        return -1;
+
+    int i;
+    for (i = 0; i < n; i++)
+        if (buf[i] == '/')
+            buf[i] = '_';
+
+    if (n) {
+        if ((size_t)(n + 1) >= len)
+            return -1;
+        buf[n++] = '_';
+    }
+
+    int m = mkimg_file_name(spec, fileno, buf + n, len - n);
+    if ((m < 0) || ((size_t)(n + m) >= len))
+        return -1;
+
+    return n + m;
+}
+
+/* verification against a mounted image */
+
+static uint64_t verify_errors = 0;
+
+static void
+mkimg_mismatch(const char* path, const char* fmt, ...)
+{
+    va_list ap;
+
+    verify_errors++;
+    fprintf(stderr, "*** mismatch: %s: ", path);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+static void
+mkimg_verify_range(const struct mkimg_spec* spec, uint64_t fileno,
+                   uint64_t size, int fd, const char* path, uint64_t offset,
+                   uint64_t len, char* expected, char* actual)
+{
+    while (len > 0) {
+        size_t n = (len > MKIMG_IOSIZE) ? MKIMG_IOSIZE : (size_t)len;
+        ssize_t nr = pread(fd, actual, n, (off_t)offset);
+        if (nr != (ssize_t)n) {
+            mkimg_mismatch(path, "short read at offset %llu (%ld bytes)",
+                           (unsigned long long)offset, (long)nr);
+            return;
+        }
+        mkimg_file_data(spec, fileno, size, offset, expected, n);
+        if (memcmp(expected, actual, n) != 0) {
+            size_t i;
+            for (i = 0; i < n && expected[i] == actual[i]; i++)
+                ;
+            mkimg_mismatch(path, "data differs at offset %llu",
+                           (unsigned long long)(offset + i));
+            return;
+        }
+        offset += n;
+        len -= n;
+    }
+}
+
+static void
+mkimg_verify_file(const struct mkimg_spec* spec, uint64_t fileno,
+                  const char* path, uint64_t limit, char* expected,
+                  char* actual)
+{
+    struct stat stbuf;
+
+    if (lstat(path, &stbuf) != 0) {
+        mkimg_mismatch(path, "missing (%s)", strerror(errno));
+        return;
+    }
+
+    if (!S_ISREG(stbuf.st_mode)) {
+        mkimg_mismatch(path, "mode %o is not a regular file",
+                       (unsigned int)stbuf.st_mode);
+        return;
+    }
+
+    uint64_t size = mkimg_file_size(spec, fileno);
+    if ((uint64_t)stbuf.st_size != size) {
+        mkimg_mismatch(path, "size %llu, expected %llu",
+                       (unsigned long long)stbuf.st_size,
+                       (unsigned long long)size);
+        return;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        mkimg_mismatch(path, "cannot open (%s)", strerror(errno));
+        return;
+    }
+
+    uint64_t head = (limit && (size > limit)) ? limit : size;
+    mkimg_verify_range(spec, fileno, size, fd, path, 0, head, expected,
+                       actual);
+
+    if (head < size) { /* also check the last chunk */
+        uint64_t tail = ((size - 1) / MKIMG_CHUNK) * MKIMG_CHUNK;
+        if (tail < head)
+            tail = head;
+        mkimg_verify_range(spec, fileno, size, fd, path, tail, size - tail,
+                           expected, actual);
+    }
+
+    close(fd);
+}
+
+static uint64_t
+mkimg_count_entries(const char* path)
+{
+    uint64_t count = 0;
+    DIR* dirp = opendir(path);
+    if (!dirp)
+        return (uint64_t)-1;
+
+    struct dirent* dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        count++;
+    }
+
+    closedir(dirp);
+
+    return count;
+}
+
+static int
+mkimg_verify(const struct mkimg_spec* spec, const struct mkimg_format* fmt,
+             const char* root, uint64_t limit)
+{
+    char path[2 * MKIMG_MAXPATH];
+    char dirpath[MKIMG_MAXPATH];
+    char name[MKIMG_MAXPATH];
+    char leaf[64];
+    char* expected = malloc(MKIMG_IOSIZE);
+    char* actual = malloc(MKIMG_IOSIZE);
+    uint64_t dirno, fileno, count;
+    int err = 0;
+
+    if (!expected || !actual) {
+        fprintf(stderr, "*** fatal error: cannot allocate memory\n");
+        err = ENOMEM;
+        goto out;
+    }
+
+    if (fmt->flat) {
+        count = mkimg_count_entries(root);
+        if (count != spec->nfiles)
+            mkimg_mismatch(root, "%lld entries, expected %llu",
+                           (long long)count, (unsigned long long)spec->nfiles);
+        for (fileno = 0; fileno < spec->nfiles; fileno++) {
+            if (mkimg_flat_name(spec, fileno, name, sizeof(name)) < 0) {
+                err = ENAMETOOLONG;
+                goto out;
+            }
+            snprintf(path, sizeof(path), "%s/%s", root, name);
+            mkimg_verify_file(spec, fileno, path, limit, expected, actual);
+        }
+        goto out;
+    }
+
+    for (dirno = 0; dirno < spec->ndirs; dirno++) {
+        int n = mkimg_dir_path(spec, dirno, name, sizeof(name));
+        if ((n < 0) || (snprintf(dirpath, sizeof(dirpath), "%s%s%s", root,
+                                 n ? "/" : "", name) >= (int)sizeof(dirpath))) {
+            err = ENAMETOOLONG;
+            goto out;
+        }
+
+        uint64_t nsubdirs = mkimg_dir_nsubdirs(spec, dirno);
+        uint64_t first = mkimg_dir_firstsubdir(spec, dirno);
+        uint64_t i;
+
+        count = mkimg_count_entries(dirpath);
+        if (count != nsubdirs + spec->files)
+            mkimg_mismatch(dirpath, "%lld entries, expected %llu",
+                           (long long)count,
+                           (unsigned long long)(nsubdirs + spec->files));
+
+        for (i = 0; i < nsubdirs; i++) {
+            struct stat stbuf;
+            mkimg_dir_name(spec, first + i, leaf, sizeof(leaf));
+            snprintf(path, sizeof(path), "%s/%s", dirpath, leaf);
+            if (lstat(path, &stbuf) != 0)
+                mkimg_mismatch(path, "missing (%s)", strerror(errno));
+            else if (!S_ISDIR(stbuf.st_mode))
+                mkimg_mismatch(path, "mode %o is not a directory",
+                               (unsigned int)stbuf.st_mode);
+        }
+
+        for (i = 0; i < spec->files; i++) {
+            fileno = (dirno * spec->files) + i;
+            mkimg_file_name(spec, fileno, leaf, sizeof(leaf));
+            snprintf(path, sizeof(path), "%s/%s", dirpath, leaf);
+            mkimg_verify_file(spec, fileno, path, limit, expected, actual);
+        }
+    }
+
+out:
+    free(expected);
+    free(actual);
+
+    if (!err && verify_errors)
+        err = EIO;
+
+    return err;
+}
+
+/* spec parsing */
+
+static int
+mkimg_parse_size(const char* s, uint64_t* result)
+{
+    char* end;
+    unsigned long long v = strtoull(s, &end, 0);
+
+    if (end == s)
+        return -1;
+
+    switch (*end) {
+    case 't': case 'T': v <<= 10; /* FALLTHROUGH */
+    case 'g': case 'G': v <<= 10; /* FALLTHROUGH */
+    case 'm': case 'M': v <<= 10; /* FALLTHROUGH */
+    case 'k': case 'K': v <<= 10; end++; break;
+    case '\0': break;
+    default: return -1;
+    }
+
+    if (*end != '\0')
+        return -1;
+
+    *result = v;
+
+    return 0;
+}
+
+/*
+ * A size distribution is a comma separated list of terms, each optionally
+ * weighted: fixed:SIZE, uniform:MIN:MAX, or exp:MEAN, followed by @WEIGHT.
+ * For example, "exp:8k@999,fixed:2g@1" yields mostly small files with the
+ * occasional 2 GB one.
+ */
+static int
+mkimg_parse_dist(struct mkimg_spec* spec, const char* arg)
+{
+    char buf[256];
+    char *term, *last;
+
+    if (strlen(arg) >= sizeof(buf))
+        return -1;
+
+    strcpy(buf, arg);
+    spec->ndist = 0;
+    spec->distweight = 0;
+
+    for (term = strtok_r(buf, ",", &last); term;
+         term = strtok_r(NULL, ",", &last)) {
+
+        if (spec->ndist == MKIMG_MAXDIST)
+            return -1;
+
+        struct mkimg_sizedist* d = &spec->dist[spec->ndist];
+        char* at = strchr(term, '@');
+        d->weight = 1;
+        if (at) {
+            *at++ = '\0';
+            d->weight = (uint32_t)strtoul(at, NULL, 10);
+            if (d->weight == 0)
+                return -1;
+        }
+
+        char* p1 = strchr(term, ':');
+        if (!p1)
+            return -1;
+        *p1++ = '\0';
+        char* p2 = strchr(p1, ':');
+        if (p2)
+            *p2++ = '\0';
+
+        if (!strcmp(term, "fixed") && !p2) {
+            d->kind = MKIMG_DIST_FIXED;
+            if (mkimg_parse_size(p1, &d->a) != 0)
+                return -1;
+        } else if (!strcmp(term, "uniform") && p2) {
+            d->kind = MKIMG_DIST_UNIFORM;
+            if ((mkimg_parse_size(p1, &d->a) != 0) ||
+                (mkimg_parse_size(p2, &d->b) != 0) || (d->b < d->a))
+                return -1;
+        } else if (!strcmp(term, "exp") && !p2) {
+            d->kind = MKIMG_DIST_EXP;
+            if (mkimg_parse_size(p1, &d->a) != 0)
+                return -1;
+        } else
+            return -1;
+
+        spec->distweight += d->weight;
+        spec->ndist++;
+    }
+
+    return (spec->ndist) ? 0 : -1;
+}
+
+static int
+mkimg_derive(struct mkimg_spec* spec)
+{
+    uint64_t level = 1, total = 1, interior = 0;
+    uint32_t i;
+
+    for (i = 0; i < spec->depth; i++) {
+        interior = total;
+        if (spec->fanout && (level > (UINT64_C(1) << 40) / spec->fanout))
+            return -1;
+        level *= spec->fanout;
+        total += level;
+        if (level == 0)
+            break;
+    }
+
+    spec->ndirs = total;
+    spec->ninterior = (spec->fanout) ? interior : 0;
+
+    if (spec->files && (spec->ndirs > (UINT64_C(1) << 48) / spec->files))
+        return -1;
+
+    spec->nfiles = spec->ndirs * spec->files;
+
+    if (spec->holes <= 0.0)
+        spec->hole_threshold = 0;
+    else if (spec->holes >= 1.0)
+        spec->hole_threshold = UINT64_MAX;
+    else
+        spec->hole_threshold = (uint64_t)(spec->holes * 18446744073709551615.0);
+
+    return 0;
+}
+
+static void
+unixfs_mkimage_usage(void)
+{
+    int i;
+
+    fprintf(stderr,
+"%s (version %s): synthetic images for the UNIX file systems for MacFUSE\n"
+"Amit Singh <http://osxbook.com>\n"
+"usage:\n"
+"    %s [options] --type=TYPE IMAGE\n"
+"    %s [options] --type=TYPE --verify=MOUNTPOINT\n"
+"options:\n"
+"    --seed=N         seed for sizes, holes, and contents (default 1)\n"
+"    --fanout=N       subdirectories per directory (default 4)\n"
+"    --depth=N        directory levels below the root (default 2)\n"
+"    --files=N        regular files per directory (default 16)\n"
+"    --sizes=DIST     file size distribution (default exp:4k); DIST is a\n"
+"                     comma separated list of fixed:SIZE, uniform:MIN:MAX,\n"
+"                     or exp:MEAN terms, each optionally followed by @WEIGHT\n"
+"    --maxsize=SIZE   clamp file sizes to SIZE\n"
+"    --holes=RATIO    fraction of %d-byte chunks left as holes (default 0)\n"
+"    --mtime=SECONDS  timestamp for every node (default 1200000000)\n"
+"    --verify-bytes=N bytes of each file compared by --verify (default 1m;\n"
+"                     0 compares everything)\n"
+"    --quiet          don't print the summary line\n"
+"supported types:\n",
+    PROGNAME, PROGVERS, PROGNAME, PROGNAME, MKIMG_CHUNK);
+
+    for (i = 0; formats[i]; i++)
+        fprintf(stderr, "    %-16s %s\n", formats[i]->name,
+                formats[i]->description);
+}
+
+int
+main(int argc, char** argv)
+{
+    struct mkimg_spec spec;
+    struct mkimg_stats stats;
+    const struct mkimg_format* fmt = NULL;
+    const char* type = NULL;
+    const char* verify = NULL;
+    uint64_t verify_bytes = 1024 * 1024;
+    int quiet = 0, ch, i;
+
+    memset(&spec, 0, sizeof(spec));
+    memset(&stats, 0, sizeof(stats));
+
+    spec.seed = 1;
+    spec.fanout = 4;
+    spec.depth = 2;
+    spec.files = 16;
+    spec.mtime = 1200000000;
+    mkimg_parse_dist(&spec, "exp:4k");
+
+    static struct option longopts[] = {
+        { "type",         required_argument, NULL, 't' },
+        { "seed",         required_argument, NULL, 's' },
+        { "fanout",       required_argument, NULL, 'f' },
+        { "depth",        required_argument, NULL, 'd' },
+        { "files",        required_argument, NULL, 'n' },
+        { "sizes",        required_argument, NULL, 'S' },
+        { "maxsize",      required_argument, NULL, 'M' },
+        { "holes",        required_argument, NULL, 'H' },
+        { "mtime",        required_argument, NULL, 'T' },
+        { "verify",       required_argument, NULL, 'V' },
+        { "verify-bytes", required_argument, NULL, 'B' },
+        { "quiet",        no_argument,       NULL, 'q' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL,           0,                 NULL, 0   },
+    };
+
+    while ((ch = getopt_long(argc, argv, "t:s:f:d:n:S:M:H:T:V:B:qh",
+                             longopts, NULL)) != -1) {
+        switch (ch) {
+        case 't':
+            type = optarg;
+            break;
+        case 's':
+            spec.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            spec.fanout = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            spec.depth = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            spec.files = strtoull(optarg, NULL, 0);
+            break;
+        case 'S':
+            if (mkimg_parse_dist(&spec, optarg) != 0) {
+                fprintf(stderr, "invalid size distribution: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'M':
+            if (mkimg_parse_size(optarg, &spec.maxsize) != 0) {
+                fprintf(stderr, "invalid size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            spec.holes = strtod(optarg, NULL);
+            break;
+        case 'T':
+            spec.mtime = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'V':
+            verify = optarg;
+            break;
+        case 'B':
+            if (mkimg_parse_size(optarg, &verify_bytes) != 0) {
+                fprintf(stderr, "invalid size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'h':
+        default:
+            unixfs_mkimage_usage();
+            return 1;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (!type || (!verify && (argc != 1)) || (verify && argc)) {
+        unixfs_mkimage_usage();
+        return 1;
+    }
+
+    for (i = 0; formats[i]; i++) {
+        if (!strcmp(formats[i]->name, type)) {
+            fmt = formats[i];
+            break;
+        }
+    }
+
+    if (!fmt) {
+        fprintf(stderr, "unknown image type %s\n", type);
+        return 1;
+    }
+
+    if (mkimg_derive(&spec) != 0) {
+        fprintf(stderr, "the requested tree is too large\n");
+        return 1;
+    }
+
+    if (verify) {
+        int err = mkimg_verify(&spec, fmt, verify, verify_bytes);
+        if (!quiet)
+            printf("%s: verified %llu directories and %llu files, "
+                   "%llu mismatches\n", verify,
+                   (unsigned long long)(fmt->flat ? 1 : spec.ndirs),
+                   (unsigned long long)spec.nfiles,
+                   (unsigned long long)verify_errors);
+        return (err) ? 1 : 0;
+    }
+
+    int fd = open(argv[0], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    int err = fmt->write(&spec, fmt, fd, &stats);
+
+    if (close(fd) != 0 && !err)
+        err = errno;
+
+    if (err) {
+        fprintf(stderr, "failed to create %s image %s (%s)\n", fmt->name,
+                argv[0], strerror(err));
+        (void)unlink(argv[0]);
+        return 1;
+    }
+
+    if (!quiet)
+        printf("%s: type=%s dirs=%llu files=%llu bytes=%llu holebytes=%llu "
+               "inodes=%llu blocks=%llu bsize=%u\n", argv[0], fmt->name,
+               (unsigned long long)stats.dirs,
+               (unsigned long long)stats.files,
+               (unsigned long long)stats.bytes,
+               (unsigned long long)stats.holebytes,
+               (unsigned long long)stats.inodes,
+               (unsigned long long)stats.blocks, stats.bsize);
+
+    return 0;
+}
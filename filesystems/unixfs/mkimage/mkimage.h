@@ -0,0 +1,150 @@
+/*
+ * Synthetic Image Generator for the UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ */
+
+#ifndef _MKIMAGE_H_
+#define _MKIMAGE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define MKIMG_CHUNK     4096 /* hole granularity; multiple of every bsize */
+#define MKIMG_MAXBSIZE  4096
+#define MKIMG_MAXDIST   8
+#define MKIMG_MAXPATH   1024
+#define MKIMG_IOSIZE    (1024 * 1024)
+
+enum {
+    MKIMG_DIST_FIXED = 1,
+    MKIMG_DIST_UNIFORM,
+    MKIMG_DIST_EXP,
+};
+
+struct mkimg_sizedist {
+    int      kind;
+    uint64_t a;      /* fixed size, minimum, or mean */
+    uint64_t b;      /* maximum */
+    uint32_t weight;
+};
+
+/*
+ * The spec describes a complete tree: the root has `fanout' subdirectories,
+ * each of those has `fanout' subdirectories, and so on down to `depth'
+ * levels below the root. Every directory holds `files' regular files.
+ * Directories are numbered breadth-first (the root is 0), so the children
+ * of directory k are k * fanout + 1 ... k * fanout + fanout. File j of
+ * directory k has the global file number k * files + j. Everything about
+ * a file (its size, which chunks are holes, and its contents) is a pure
+ * function of the seed and the file number, which is what lets --verify
+ * regenerate the expected tree without keeping any state around.
+ */
+struct mkimg_spec {
+    uint64_t seed;
+    uint32_t fanout;
+    uint32_t depth;
+    uint64_t files;            /* regular files per directory */
+    double   holes;            /* probability that a chunk is a hole */
+    uint64_t hole_threshold;
+    uint64_t maxsize;          /* clamp for the size distribution */
+    uint32_t mtime;
+    uint32_t uid;
+    uint32_t gid;
+    struct mkimg_sizedist dist[MKIMG_MAXDIST];
+    int      ndist;
+    uint32_t distweight;
+
+    /* derived */
+    uint64_t ndirs;
+    uint64_t ninterior;        /* directories that have subdirectories */
+    uint64_t nfiles;
+};
+
+struct mkimg_stats {
+    uint64_t dirs;
+    uint64_t files;
+    uint64_t bytes;            /* logical bytes in regular files */
+    uint64_t holebytes;        /* ... of which are holes */
+    uint64_t blocks;           /* image size in format blocks */
+    uint32_t bsize;
+    uint64_t inodes;
+};
+
+struct mkimg_format {
+    const char* name;
+    const char* description;
+    int         flat;          /* no directories; files are named by path */
+    int       (*write)(const struct mkimg_spec*, const struct mkimg_format*,
+                       int fd, struct mkimg_stats*);
+    const void* private;
+};
+
+/* mkimage.c */
+
+uint64_t mkimg_hash(uint64_t seed, uint64_t a, uint64_t b);
+uint64_t mkimg_file_size(const struct mkimg_spec* spec, uint64_t fileno);
+int      mkimg_chunk_is_hole(const struct mkimg_spec* spec, uint64_t fileno,
+                             uint64_t size, uint64_t chunk);
+void     mkimg_file_data(const struct mkimg_spec* spec, uint64_t fileno,
+                         uint64_t size, uint64_t offset, char* buf,
+                         size_t len);
+uint64_t mkimg_dir_nsubdirs(const struct mkimg_spec* spec, uint64_t dirno);
+uint64_t mkimg_dir_firstsubdir(const struct mkimg_spec* spec, uint64_t dirno);
+uint64_t mkimg_dir_parent(const struct mkimg_spec* spec, uint64_t dirno);
+int      mkimg_dir_path(const struct mkimg_spec* spec, uint64_t dirno,
+                        char* buf, size_t len);
+int      mkimg_dir_name(const struct mkimg_spec* spec, uint64_t dirno,
+                        char* buf, size_t len);
+int      mkimg_file_name(const struct mkimg_spec* spec, uint64_t fileno,
+                         char* buf, size_t len);
+int      mkimg_flat_name(const struct mkimg_spec* spec, uint64_t fileno,
+                         char* buf, size_t len);
+
+/* mkimage_disk.c */
+
+extern const struct mkimg_format mkimg_format_minix1;
+extern const struct mkimg_format mkimg_format_minix2;
+extern const struct mkimg_format mkimg_format_minix3;
+extern const struct mkimg_format mkimg_format_sysv;
+extern const struct mkimg_format mkimg_format_v7;
+
+/* mkimage_archive.c */
+
+extern const struct mkimg_format mkimg_format_tar;
+extern const struct mkimg_format mkimg_format_cpio_newc;
+extern const struct mkimg_format mkimg_format_ar;
+
+/* little-endian and PDP-11 middle-endian encoders */
+
+static inline void
+mkimg_le16(void* p, uint32_t v)
+{
+    unsigned char* c = (unsigned char*)p;
+    c[0] = v & 0xff;
+    c[1] = (v >> 8) & 0xff;
+}
+
+static inline void
+mkimg_le32(void* p, uint32_t v)
+{
+    unsigned char* c = (unsigned char*)p;
+    c[0] = v & 0xff;
+    c[1] = (v >> 8) & 0xff;
+    c[2] = (v >> 16) & 0xff;
+    c[3] = (v >> 24) & 0xff;
+}
+
+static inline void
+mkimg_pdp32(void* p, uint32_t v)
+{
+    unsigned char* c = (unsigned char*)p;
+    c[0] = (v >> 16) & 0xff;
+    c[1] = (v >> 24) & 0xff;
+    c[2] = v & 0xff;
+    c[3] = (v >> 8) & 0xff;
+}
+
+#endif /* _MKIMAGE_H_ */
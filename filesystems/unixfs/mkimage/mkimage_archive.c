@@ -0,0 +1,459 @@
+/*
+ * Synthetic Image Generator for the UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ *
+ * Archive formats: POSIX ustar, newc cpio, and BSD ar. Archives have no
+ * notion of holes, but runs of zeros that correspond to hole chunks are
+ * skipped over rather than written, so the image file itself stays sparse
+ * and multi-gigabyte members don't cost their size in disk space.
+ */
+
+#include "mkimage.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct mkimg_out {
+    int      fd;
+    int      error;
+    off_t    offset;   /* logical end of the archive */
+    off_t    wstart;
+    size_t   wlen;
+    char*    wbuf;
+};
+
+static int
+mkimg_out_flush(struct mkimg_out* out)
+{
+    const char* p = out->wbuf;
+    off_t offset = out->wstart;
+    size_t len = out->wlen;
+
+    while ((len > 0) && !out->error) {
+        ssize_t nw = pwrite(out->fd, p, len, offset);
+        if (nw <= 0) {
+            out->error = (nw < 0) ? errno : EIO;
+            break;
+        }
+        p += nw;
+        offset += nw;
+        len -= nw;
+    }
+
+    out->wlen = 0;
+    out->wstart = out->offset;
+
+    return out->error;
+}
+
+static int
+mkimg_out_write(struct mkimg_out* out, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+
+    while ((len > 0) && !out->error) {
+        if (out->wlen == MKIMG_IOSIZE)
+            mkimg_out_flush(out);
+        size_t n = MKIMG_IOSIZE - out->wlen;
+        if (n > len)
+            n = len;
+        memcpy(out->wbuf + out->wlen, p, n);
+        out->wlen += n;
+        out->offset += n;
+        p += n;
+        len -= n;
+    }
+
+    return out->error;
+}
+
+static int
+mkimg_out_skip(struct mkimg_out* out, size_t len)
+{
+    mkimg_out_flush(out);
+    out->offset += len;
+    out->wstart = out->offset;
+
+    return out->error;
+}
+
+static int
+mkimg_out_pad(struct mkimg_out* out, uint32_t align, char c)
+{
+    char pad[512];
+    size_t n = (size_t)((align - (out->offset % align)) % align);
+
+    memset(pad, c, sizeof(pad));
+
+    while ((n > 0) && !out->error) {
+        size_t len = (n > sizeof(pad)) ? sizeof(pad) : n;
+        mkimg_out_write(out, pad, len);
+        n -= len;
+    }
+
+    return out->error;
+}
+
+static int
+mkimg_out_data(struct mkimg_out* out, const struct mkimg_spec* spec,
+               uint64_t fileno, uint64_t size, struct mkimg_stats* stats)
+{
+    char buf[MKIMG_CHUNK];
+    uint64_t offset;
+
+    for (offset = 0; (offset < size) && !out->error; offset += MKIMG_CHUNK) {
+        size_t n = ((size - offset) > MKIMG_CHUNK) ? MKIMG_CHUNK
+                                                   : (size_t)(size - offset);
+        if (mkimg_chunk_is_hole(spec, fileno, size, offset / MKIMG_CHUNK)) {
+            stats->holebytes += n;
+            mkimg_out_skip(out, n);
+        } else {
+            mkimg_file_data(spec, fileno, size, offset, buf, n);
+            mkimg_out_write(out, buf, n);
+        }
+    }
+
+    stats->files++;
+    stats->bytes += size;
+
+    return out->error;
+}
+
+static int
+mkimg_out_finish(struct mkimg_out* out, struct mkimg_stats* stats,
+                 uint32_t bsize)
+{
+    mkimg_out_flush(out);
+
+    if (!out->error && (ftruncate(out->fd, out->offset) != 0))
+        out->error = errno;
+
+    stats->bsize = bsize;
+    stats->blocks = (out->offset + bsize - 1) / bsize;
+
+    return out->error;
+}
+
+/*
+ * The archive writers walk directories in number order, which is also
+ * breadth-first order, so every directory is emitted before anything in it.
+ */
+typedef int (*mkimg_emit_t)(struct mkimg_out* out,
+                            const struct mkimg_spec* spec, const char* path,
+                            int isdir, uint64_t ino, uint64_t nsubdirs,
+                            uint64_t fileno, struct mkimg_stats* stats);
+
+static int
+mkimg_archive_walk(struct mkimg_out* out, const struct mkimg_spec* spec,
+                   mkimg_emit_t emit, struct mkimg_stats* stats)
+{
+    char dirpath[MKIMG_MAXPATH];
+    char path[MKIMG_MAXPATH];
+    char name[64];
+    uint64_t dirno, i, ino = 1;
+
+    for (dirno = 0; (dirno < spec->ndirs) && !out->error; dirno++) {
+        int n = mkimg_dir_path(spec, dirno, dirpath, sizeof(dirpath));
+        if (n < 0)
+            return (out->error = ENAMETOOLONG);
+
+        if (dirno != 0)
+            emit(out, spec, dirpath, 1, ino++,
+                 mkimg_dir_nsubdirs(spec, dirno), 0, stats);
+        stats->dirs++;
+
+        for (i = 0; (i < spec->files) && !out->error; i++) {
+            uint64_t fileno = (dirno * spec->files) + i;
+            mkimg_file_name(spec, fileno, name, sizeof(name));
+            if (snprintf(path, sizeof(path), "%s%s%s", dirpath,
+                         (n) ? "/" : "", name) >= (int)sizeof(path))
+                return (out->error = ENAMETOOLONG);
+            emit(out, spec, path, 0, ino++, 0, fileno, stats);
+        }
+    }
+
+    stats->inodes = ino;
+
+    return out->error;
+}
+
+static int
+mkimg_archive_write(const struct mkimg_spec* spec, int fd,
+                    struct mkimg_stats* stats, const char* magic,
+                    mkimg_emit_t emit,
+                    int (*trailer)(struct mkimg_out*, const struct mkimg_spec*),
+                    uint32_t bsize)
+{
+    struct mkimg_out out;
+
+    memset(&out, 0, sizeof(out));
+    out.fd = fd;
+    out.wbuf = malloc(MKIMG_IOSIZE);
+    if (!out.wbuf)
+        return ENOMEM;
+
+    if (magic)
+        mkimg_out_write(&out, magic, strlen(magic));
+
+    if ((mkimg_archive_walk(&out, spec, emit, stats) == 0) && trailer)
+        trailer(&out, spec);
+
+    mkimg_out_finish(&out, stats, bsize);
+
+    free(out.wbuf);
+
+    return out.error;
+}
+
+/* ustar */
+
+#define TBLOCK   512
+#define TRECORD  (20 * TBLOCK)
+
+struct mkimg_tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static int
+mkimg_tar_emit(struct mkimg_out* out, const struct mkimg_spec* spec,
+               const char* path, int isdir, uint64_t ino, uint64_t nsubdirs,
+               uint64_t fileno, struct mkimg_stats* stats)
+{
+    union {
+        struct mkimg_tar_header hdr;
+        unsigned char block[TBLOCK];
+    } u;
+    uint64_t size = (isdir) ? 0 : mkimg_file_size(spec, fileno);
+    char tmp[16];
+    unsigned int sum = 0;
+    int i;
+
+    if (strlen(path) + (isdir ? 1 : 0) >= sizeof(u.hdr.name)) {
+        fprintf(stderr, "*** error: %s is too long for a ustar name\n", path);
+        return (out->error = ENAMETOOLONG);
+    }
+
+    if (size > 077777777777ULL) {
+        fprintf(stderr, "*** error: %s is too large for a ustar header\n",
+                path);
+        return (out->error = EFBIG);
+    }
+
+    memset(&u, 0, sizeof(u));
+    snprintf(u.hdr.name, sizeof(u.hdr.name), "%s%s", path, isdir ? "/" : "");
+    snprintf(u.hdr.mode, sizeof(u.hdr.mode), "%07o", isdir ? 0755 : 0644);
+    snprintf(u.hdr.uid, sizeof(u.hdr.uid), "%07o", spec->uid);
+    snprintf(u.hdr.gid, sizeof(u.hdr.gid), "%07o", spec->gid);
+    snprintf(tmp, sizeof(tmp), "%011llo", (unsigned long long)size);
+    memcpy(u.hdr.size, tmp, 12);
+    snprintf(tmp, sizeof(tmp), "%011o", spec->mtime);
+    memcpy(u.hdr.mtime, tmp, 12);
+    u.hdr.typeflag = (isdir) ? '5' : '0';
+    memcpy(u.hdr.magic, "ustar", 6);
+    memcpy(u.hdr.version, "00", 2);
+    snprintf(u.hdr.devmajor, sizeof(u.hdr.devmajor), "%07o", 0);
+    snprintf(u.hdr.devminor, sizeof(u.hdr.devminor), "%07o", 0);
+
+    memset(u.hdr.chksum, ' ', sizeof(u.hdr.chksum));
+    for (i = 0; i < TBLOCK; i++)
+        sum += u.block[i];
+    snprintf(u.hdr.chksum, sizeof(u.hdr.chksum), "%06o", sum);
+    u.hdr.chksum[7] = ' ';
+
+    if (mkimg_out_write(out, &u, TBLOCK) != 0)
+        return out->error;
+
+    if (isdir)
+        return 0;
+
+    mkimg_out_data(out, spec, fileno, size, stats);
+
+    return mkimg_out_pad(out, TBLOCK, 0);
+}
+
+static int
+mkimg_tar_trailer(struct mkimg_out* out, const struct mkimg_spec* spec)
+{
+    char zero[TBLOCK];
+
+    memset(zero, 0, sizeof(zero));
+    mkimg_out_write(out, zero, TBLOCK);
+    mkimg_out_write(out, zero, TBLOCK);
+
+    return mkimg_out_pad(out, TRECORD, 0);
+}
+
+static int
+mkimg_tar_write(const struct mkimg_spec* spec,
+                const struct mkimg_format* format, int fd,
+                struct mkimg_stats* stats)
+{
+    return mkimg_archive_write(spec, fd, stats, NULL, mkimg_tar_emit,
+                               mkimg_tar_trailer, TBLOCK);
+}
+
+const struct mkimg_format mkimg_format_tar = {
+    "tar", "POSIX ustar archive (members up to 8 GB)",
+    0, mkimg_tar_write, NULL,
+};
+
+/* newc cpio */
+
+static int
+mkimg_cpio_header(struct mkimg_out* out, const char* name, uint64_t ino,
+                  uint32_t mode, uint32_t uid, uint32_t gid, uint32_t nlink,
+                  uint32_t mtime, uint64_t size)
+{
+    char hdr[111];
+    size_t namesize = strlen(name) + 1;
+
+    snprintf(hdr, sizeof(hdr),
+             "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+             (uint32_t)ino, mode, uid, gid, nlink, mtime, (uint32_t)size,
+             0, 0, 0, 0, (uint32_t)namesize, 0);
+
+    mkimg_out_write(out, hdr, 110);
+    mkimg_out_write(out, name, namesize);
+
+    return mkimg_out_pad(out, 4, 0);
+}
+
+static int
+mkimg_cpio_emit(struct mkimg_out* out, const struct mkimg_spec* spec,
+                const char* path, int isdir, uint64_t ino, uint64_t nsubdirs,
+                uint64_t fileno, struct mkimg_stats* stats)
+{
+    if (isdir)
+        return mkimg_cpio_header(out, path, ino, S_IFDIR | 0755, spec->uid,
+                                 spec->gid, 2 + (uint32_t)nsubdirs,
+                                 spec->mtime, 0);
+
+    uint64_t size = mkimg_file_size(spec, fileno);
+
+    if (size > 0xffffffffULL) {
+        fprintf(stderr, "*** error: %s is too large for a newc header\n",
+                path);
+        return (out->error = EFBIG);
+    }
+
+    if (ino > 0xffffffffULL) {
+        fprintf(stderr, "*** error: too many members for a newc archive\n");
+        return (out->error = EFBIG);
+    }
+
+    mkimg_cpio_header(out, path, ino, S_IFREG | 0644, spec->uid, spec->gid, 1,
+                      spec->mtime, size);
+    mkimg_out_data(out, spec, fileno, size, stats);
+
+    return mkimg_out_pad(out, 4, 0);
+}
+
+static int
+mkimg_cpio_trailer(struct mkimg_out* out, const struct mkimg_spec* spec)
+{
+    mkimg_cpio_header(out, "TRAILER!!!", 0, 0, 0, 0, 1, 0, 0);
+
+    return mkimg_out_pad(out, 512, 0);
+}
+
+static int
+mkimg_cpio_write(const struct mkimg_spec* spec,
+                 const struct mkimg_format* format, int fd,
+                 struct mkimg_stats* stats)
+{
+    return mkimg_archive_write(spec, fd, stats, NULL, mkimg_cpio_emit,
+                               mkimg_cpio_trailer, 512);
+}
+
+const struct mkimg_format mkimg_format_cpio_newc = {
+    "cpio_newc", "New ASCII (newc) cpio archive (members up to 4 GB)",
+    0, mkimg_cpio_write, NULL,
+};
+
+/* BSD ar */
+
+#define ARMAG    "!<arch>\n"
+#define AR_EFMT1 "#1/"
+
+/*
+ * ar archives are flat, so members are named after their path with the
+ * slashes turned into underscores. Names that don't fit the 16-byte field
+ * use the BSD "#1/<length>" convention, with the name prepended to the data.
+ */
+static int
+mkimg_ar_emit(struct mkimg_out* out, const struct mkimg_spec* spec,
+              const char* path, int isdir, uint64_t ino, uint64_t nsubdirs,
+              uint64_t fileno, struct mkimg_stats* stats)
+{
+    char name[MKIMG_MAXPATH];
+    char hdr[61];
+    char field[17];
+
+    if (isdir)
+        return 0;
+
+    uint64_t size = mkimg_file_size(spec, fileno);
+    int namelen = mkimg_flat_name(spec, fileno, name, sizeof(name));
+    if ((namelen < 0) || (namelen > 255))
+        return (out->error = ENAMETOOLONG);
+
+    int extended = (namelen > 16);
+    uint64_t arsize = size + ((extended) ? namelen : 0);
+
+    if (arsize > 9999999999ULL) {
+        fprintf(stderr, "*** error: %s is too large for an ar header\n",
+                path);
+        return (out->error = EFBIG);
+    }
+
+    if (extended)
+        snprintf(field, sizeof(field), "%s%d", AR_EFMT1, namelen);
+    else {
+        memcpy(field, name, namelen);
+        field[namelen] = '\0';
+    }
+
+    snprintf(hdr, sizeof(hdr), "%-16s%-12u%-6u%-6u%-8o%-10llu`\n",
+             field, spec->mtime, spec->uid, spec->gid, S_IFREG | 0644,
+             (unsigned long long)arsize);
+
+    mkimg_out_write(out, hdr, 60);
+    if (extended)
+        mkimg_out_write(out, name, namelen);
+    mkimg_out_data(out, spec, fileno, size, stats);
+
+    return mkimg_out_pad(out, 2, '\n');
+}
+
+static int
+mkimg_ar_write(const struct mkimg_spec* spec,
+               const struct mkimg_format* format, int fd,
+               struct mkimg_stats* stats)
+{
+    return mkimg_archive_write(spec, fd, stats, ARMAG, mkimg_ar_emit, NULL,
+                               1);
+}
+
+const struct mkimg_format mkimg_format_ar = {
+    "ar", "BSD archive (flat; members named after their path)",
+    1, mkimg_ar_write, NULL,
+};
@@ -0,0 +1,725 @@
+/*
+ * Synthetic Image Generator for the UNIX File Systems for MacFUSE
+ * Amit Singh
+ * http://osxbook.com
+ *
+ * Block-mapped disk file systems: Minix V1/V2/V3, System V Release 4,
+ * and Seventh Edition UNIX. All three families share the same shape (boot
+ * block, super block, an inode table at a fixed place, then data blocks
+ * addressed through direct and one to three levels of indirect pointers),
+ * so a single writer handles them and each flavor only supplies its
+ * geometry plus routines to encode an inode and the super block.
+ *
+ * Blocks are allocated strictly sequentially and written through a large
+ * coalescing buffer; the inode table is built in memory and written once
+ * at the end, together with the super block and (for Minix) the bitmaps.
+ * Holes are simply left unallocated.
+ */
+
+#include "mkimage.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct mkimg_disk;
+
+struct mkimg_diskfmt {
+    uint32_t bsize;
+    uint32_t ndirect;    /* direct addresses in the inode */
+    uint32_t nlevels;    /* indirect addresses that follow them */
+    uint32_t ptrsize;    /* bytes per address in an indirect block */
+    uint32_t isize;      /* bytes per on-disk inode */
+    uint32_t dentsize;
+    uint32_t namelen;
+    uint32_t inowidth;   /* bytes of inode number in a directory entry */
+    uint32_t linkmax;
+    uint32_t version;    /* flavor-specific */
+    uint64_t rootino;
+    uint64_t maxino;
+    uint64_t maxblock;
+    uint64_t maxsize;
+    void   (*put_ptr)(unsigned char* p, uint32_t v);
+    void   (*put_inode)(struct mkimg_disk* d, unsigned char* raw, uint32_t mode,
+                        uint32_t nlink, uint64_t size, const uint32_t* addrs);
+    int    (*layout)(struct mkimg_disk* d);
+    int    (*finish)(struct mkimg_disk* d);
+};
+
+struct mkimg_disk {
+    const struct mkimg_spec*    spec;
+    const struct mkimg_diskfmt* fmt;
+    struct mkimg_stats*         stats;
+    int            fd;
+    int            error;
+    uint32_t       bsize;
+    uint32_t       nptrs;          /* addresses per indirect block */
+    uint64_t       ninodes;        /* highest inode number in use */
+    uint64_t       bound;          /* upper bound on data blocks */
+    uint64_t       imap_blocks;
+    uint64_t       zmap_blocks;
+    uint64_t       itable_block;
+    uint64_t       itable_blocks;
+    unsigned char* itable;
+    uint64_t       firstdata;
+    uint64_t       nextblock;
+    char*          wbuf;
+    uint64_t       wstart;
+    size_t         wlen;
+};
+
+typedef int (*mkimg_fill_t)(struct mkimg_disk* d, void* arg, uint64_t lblkno,
+                            unsigned char* buf);
+
+static int
+mkimg_disk_pwrite(struct mkimg_disk* d, const void* buf, size_t len,
+                  uint64_t blkno)
+{
+    const char* p = (const char*)buf;
+    off_t offset = (off_t)(blkno * d->bsize);
+
+    while (len > 0) {
+        ssize_t nw = pwrite(d->fd, p, len, offset);
+        if (nw <= 0) {
+            d->error = (nw < 0) ? errno : EIO;
+            return d->error;
+        }
+        p += nw;
+        offset += nw;
+        len -= nw;
+    }
+
+    return 0;
+}
+
+static int
+mkimg_disk_flush(struct mkimg_disk* d)
+{
+    if (d->wlen && !d->error)
+        mkimg_disk_pwrite(d, d->wbuf, d->wlen, d->wstart);
+
+    d->wlen = 0;
+
+    return d->error;
+}
+
+static uint32_t
+mkimg_disk_alloc(struct mkimg_disk* d, const unsigned char* data)
+{
+    if (d->error)
+        return 0;
+
+    if (d->nextblock > d->fmt->maxblock) {
+        fprintf(stderr, "*** error: image needs more than %llu blocks\n",
+                (unsigned long long)d->fmt->maxblock);
+        d->error = EFBIG;
+        return 0;
+    }
+
+    if ((d->wlen + d->bsize) > MKIMG_IOSIZE)
+        if (mkimg_disk_flush(d))
+            return 0;
+
+    if (d->wlen == 0)
+        d->wstart = d->nextblock;
+
+    memcpy(d->wbuf + d->wlen, data, d->bsize);
+    d->wlen += d->bsize;
+
+    return (uint32_t)d->nextblock++;
+}
+
+/*
+ * Builds the subtree of a file's block map rooted at the given level (0 is
+ * a data block) and returns its block number, or 0 if the whole subtree is
+ * a hole. Children are allocated before their parent.
+ */
+static uint32_t
+mkimg_disk_tree(struct mkimg_disk* d, uint32_t level, uint64_t base,
+                uint64_t nblocks, mkimg_fill_t fill, void* arg)
+{
+    unsigned char buf[MKIMG_MAXBSIZE];
+
+    if (base >= nblocks)
+        return 0;
+
+    memset(buf, 0, d->bsize);
+
+    if (level == 0) {
+        if (!fill(d, arg, base, buf))
+            return 0;
+        return mkimg_disk_alloc(d, buf);
+    }
+
+    uint64_t span = 1;
+    uint32_t i, l;
+    int any = 0;
+
+    for (l = 1; l < level; l++)
+        span *= d->nptrs;
+
+    for (i = 0; (i < d->nptrs) && (base < nblocks); i++, base += span) {
+        uint32_t blkno = mkimg_disk_tree(d, level - 1, base, nblocks, fill,
+                                         arg);
+        if (blkno) {
+            d->fmt->put_ptr(buf + (i * d->fmt->ptrsize), blkno);
+            any = 1;
+        }
+    }
+
+    return (any) ? mkimg_disk_alloc(d, buf) : 0;
+}
+
+static int
+mkimg_disk_node(struct mkimg_disk* d, uint64_t ino, uint32_t mode,
+                uint32_t nlink, uint64_t size, mkimg_fill_t fill, void* arg)
+{
+    const struct mkimg_diskfmt* fmt = d->fmt;
+    uint32_t addrs[16];
+    uint64_t nblocks = (size + d->bsize - 1) / d->bsize;
+    uint64_t capacity = fmt->ndirect, span = 1, base;
+    uint32_t i;
+
+    if (size > fmt->maxsize) {
+        fprintf(stderr, "*** error: a size of %llu bytes is too large for "
+                "this file system (maximum is %llu)\n",
+                (unsigned long long)size, (unsigned long long)fmt->maxsize);
+        return (d->error = EFBIG);
+    }
+
+    for (i = 0; i < fmt->nlevels; i++) {
+        span *= d->nptrs;
+        capacity += span;
+    }
+
+    if (nblocks > capacity) {
+        fprintf(stderr, "*** error: %llu blocks do not fit in a block map\n",
+                (unsigned long long)nblocks);
+        return (d->error = EFBIG);
+    }
+
+    memset(addrs, 0, sizeof(addrs));
+
+    for (i = 0; i < fmt->ndirect; i++)
+        addrs[i] = mkimg_disk_tree(d, 0, i, nblocks, fill, arg);
+
+    for (i = 0, base = fmt->ndirect, span = d->nptrs; i < fmt->nlevels;
+         i++, base += span, span *= d->nptrs)
+        addrs[fmt->ndirect + i] = mkimg_disk_tree(d, i + 1, base, nblocks,
+                                                  fill, arg);
+
+    if (nlink > fmt->linkmax)
+        nlink = fmt->linkmax;
+
+    fmt->put_inode(d, d->itable + ((ino - 1) * fmt->isize), mode, nlink, size,
+                   addrs);
+
+    return d->error;
+}
+
+struct mkimg_dirarg {
+    uint64_t dirno;
+    uint64_t nsubdirs;
+    uint64_t nentries;
+};
+
+static int
+mkimg_disk_dirfill(struct mkimg_disk* d, void* arg, uint64_t lblkno,
+                   unsigned char* buf)
+{
+    const struct mkimg_spec* spec = d->spec;
+    const struct mkimg_diskfmt* fmt = d->fmt;
+    struct mkimg_dirarg* da = (struct mkimg_dirarg*)arg;
+    uint32_t epb = d->bsize / fmt->dentsize;
+    uint64_t e = lblkno * epb, last = e + epb;
+    unsigned char* p = buf;
+    char name[64];
+
+    if (last > da->nentries)
+        last = da->nentries;
+
+    for (; e < last; e++, p += fmt->dentsize) {
+        uint64_t ino;
+        if (e == 0) {
+            ino = fmt->rootino + da->dirno;
+            strcpy(name, ".");
+        } else if (e == 1) {
+            ino = fmt->rootino + mkimg_dir_parent(spec, da->dirno);
+            strcpy(name, "..");
+        } else if ((e - 2) < da->nsubdirs) {
+            uint64_t dirno = mkimg_dir_firstsubdir(spec, da->dirno) + (e - 2);
+            ino = fmt->rootino + dirno;
+            mkimg_dir_name(spec, dirno, name, sizeof(name));
+        } else {
+            uint64_t fileno = (da->dirno * spec->files) +
+                              (e - 2 - da->nsubdirs);
+            ino = fmt->rootino + spec->ndirs + fileno;
+            mkimg_file_name(spec, fileno, name, sizeof(name));
+        }
+
+        if (fmt->inowidth == 2)
+            mkimg_le16(p, (uint32_t)ino);
+        else
+            mkimg_le32(p, (uint32_t)ino);
+
+        strncpy((char*)p + fmt->inowidth, name, fmt->namelen);
+    }
+
+    return 1;
+}
+
+struct mkimg_filearg {
+    uint64_t fileno;
+    uint64_t size;
+};
+
+static int
+mkimg_disk_filefill(struct mkimg_disk* d, void* arg, uint64_t lblkno,
+                    unsigned char* buf)
+{
+    struct mkimg_filearg* fa = (struct mkimg_filearg*)arg;
+    uint64_t offset = lblkno * d->bsize;
+
+    if (mkimg_chunk_is_hole(d->spec, fa->fileno, fa->size,
+                            offset / MKIMG_CHUNK)) {
+        d->stats->holebytes += d->bsize;
+        return 0;
+    }
+
+    mkimg_file_data(d->spec, fa->fileno, fa->size, offset, (char*)buf,
+                    d->bsize);
+
+    return 1;
+}
+
+/*
+ * An upper bound on the indirect blocks needed to map nblocks blocks.
+ */
+static uint64_t
+mkimg_disk_indblocks(const struct mkimg_disk* d, uint64_t nblocks)
+{
+    uint64_t total = 0, n = nblocks;
+    uint32_t i;
+
+    for (i = 0; i < d->fmt->nlevels; i++) {
+        n = (n + d->nptrs - 1) / d->nptrs;
+        total += n + 1;
+    }
+
+    return total;
+}
+
+/*
+ * The number of data blocks a file really occupies, i.e., not counting
+ * the ones that fall in holes.
+ */
+static uint64_t
+mkimg_disk_datablocks(const struct mkimg_disk* d, uint64_t fileno,
+                      uint64_t size)
+{
+    uint64_t offset, nblocks = 0;
+
+    for (offset = 0; offset < size; offset += MKIMG_CHUNK) {
+        uint64_t n = ((size - offset) > MKIMG_CHUNK) ? MKIMG_CHUNK
+                                                     : (size - offset);
+        if (!mkimg_chunk_is_hole(d->spec, fileno, size, offset / MKIMG_CHUNK))
+            nblocks += (n + d->bsize - 1) / d->bsize;
+    }
+
+    return nblocks;
+}
+
+static int
+mkimg_disk_write(const struct mkimg_spec* spec,
+                 const struct mkimg_format* format, int fd,
+                 struct mkimg_stats* stats)
+{
+    const struct mkimg_diskfmt* fmt =
+        (const struct mkimg_diskfmt*)format->private;
+    struct mkimg_disk _d, *d = &_d;
+    uint64_t dirno, fileno, i;
+
+    memset(d, 0, sizeof(*d));
+    d->spec = spec;
+    d->fmt = fmt;
+    d->stats = stats;
+    d->fd = fd;
+    d->bsize = fmt->bsize;
+    d->nptrs = fmt->bsize / fmt->ptrsize;
+    d->ninodes = fmt->rootino + spec->ndirs + spec->nfiles - 1;
+
+    if (d->ninodes > fmt->maxino) {
+        fprintf(stderr, "*** error: %llu inodes needed but %s supports %llu\n",
+                (unsigned long long)d->ninodes, format->name,
+                (unsigned long long)fmt->maxino);
+        return EFBIG;
+    }
+
+    for (dirno = 0; dirno < spec->ndirs; dirno++) {
+        uint64_t nentries = 2 + mkimg_dir_nsubdirs(spec, dirno) + spec->files;
+        uint64_t nblocks =
+            ((nentries * fmt->dentsize) + d->bsize - 1) / d->bsize;
+        d->bound += nblocks + mkimg_disk_indblocks(d, nblocks);
+    }
+
+    for (fileno = 0; fileno < spec->nfiles; fileno++) {
+        uint64_t size = mkimg_file_size(spec, fileno);
+        d->bound += mkimg_disk_datablocks(d, fileno, size) +
+            mkimg_disk_indblocks(d, (size + d->bsize - 1) / d->bsize);
+    }
+
+    if (fmt->layout(d) != 0)
+        return d->error;
+
+    d->itable = calloc(1, d->itable_blocks * d->bsize);
+    d->wbuf = malloc(MKIMG_IOSIZE);
+    if (!d->itable || !d->wbuf) {
+        d->error = ENOMEM;
+        goto out;
+    }
+
+    d->nextblock = d->firstdata;
+
+    for (dirno = 0; (dirno < spec->ndirs) && !d->error; dirno++) {
+        struct mkimg_dirarg da;
+        da.dirno = dirno;
+        da.nsubdirs = mkimg_dir_nsubdirs(spec, dirno);
+        da.nentries = 2 + da.nsubdirs + spec->files;
+        mkimg_disk_node(d, fmt->rootino + dirno, S_IFDIR | 0755,
+                        2 + (uint32_t)da.nsubdirs, da.nentries * fmt->dentsize,
+                        mkimg_disk_dirfill, &da);
+        stats->dirs++;
+
+        for (i = 0; (i < spec->files) && !d->error; i++) {
+            struct mkimg_filearg fa;
+            fa.fileno = (dirno * spec->files) + i;
+            fa.size = mkimg_file_size(spec, fa.fileno);
+            mkimg_disk_node(d, fmt->rootino + spec->ndirs + fa.fileno,
+                            S_IFREG | 0644, 1, fa.size, mkimg_disk_filefill,
+                            &fa);
+            stats->files++;
+            stats->bytes += fa.size;
+        }
+    }
+
+    if (mkimg_disk_flush(d))
+        goto out;
+
+    if (fmt->finish(d) != 0)
+        goto out;
+
+    mkimg_disk_pwrite(d, d->itable, d->itable_blocks * d->bsize,
+                      d->itable_block);
+
+    if (!d->error && (ftruncate(fd, (off_t)(d->nextblock * d->bsize)) != 0))
+        d->error = errno;
+
+    stats->blocks = d->nextblock;
+    stats->bsize = d->bsize;
+    stats->inodes = d->ninodes;
+
+out:
+    free(d->itable);
+    free(d->wbuf);
+
+    return d->error;
+}
+
+/* Minix */
+
+#define MINIX_V1_MAGIC 0x137f /* 14-character names */
+#define MINIX_V2_MAGIC 0x2468 /* 14-character names */
+#define MINIX_V3_MAGIC 0x4d5a
+#define MINIX_VALID_FS 0x0001
+
+static void
+mkimg_minix_ptr16(unsigned char* p, uint32_t v)
+{
+    mkimg_le16(p, v);
+}
+
+static void
+mkimg_minix_ptr32(unsigned char* p, uint32_t v)
+{
+    mkimg_le32(p, v);
+}
+
+static void
+mkimg_minix_inode(struct mkimg_disk* d, unsigned char* raw, uint32_t mode,
+                  uint32_t nlink, uint64_t size, const uint32_t* addrs)
+{
+    const struct mkimg_spec* spec = d->spec;
+    int i;
+
+    if (d->fmt->version == 1) {
+        mkimg_le16(raw + 0, mode);
+        mkimg_le16(raw + 2, spec->uid);
+        mkimg_le32(raw + 4, (uint32_t)size);
+        mkimg_le32(raw + 8, spec->mtime);
+        raw[12] = (unsigned char)spec->gid;
+        raw[13] = (unsigned char)nlink;
+        for (i = 0; i < 9; i++)
+            mkimg_le16(raw + 14 + (2 * i), addrs[i]);
+    } else {
+        mkimg_le16(raw + 0, mode);
+        mkimg_le16(raw + 2, nlink);
+        mkimg_le16(raw + 4, spec->uid);
+        mkimg_le16(raw + 6, spec->gid);
+        mkimg_le32(raw + 8, (uint32_t)size);
+        mkimg_le32(raw + 12, spec->mtime);
+        mkimg_le32(raw + 16, spec->mtime);
+        mkimg_le32(raw + 20, spec->mtime);
+        for (i = 0; i < 10; i++)
+            mkimg_le32(raw + 24 + (4 * i), addrs[i]);
+    }
+}
+
+static int
+mkimg_minix_layout(struct mkimg_disk* d)
+{
+    uint64_t bits = (uint64_t)d->bsize * 8;
+    uint64_t ipb = d->bsize / d->fmt->isize;
+
+    d->itable_blocks = (d->ninodes + ipb - 1) / ipb;
+    d->imap_blocks = (d->ninodes + 1 + bits - 1) / bits;
+    d->zmap_blocks = (d->bound + 1 + bits - 1) / bits;
+    d->itable_block = 2 + d->imap_blocks + d->zmap_blocks;
+    d->firstdata = d->itable_block + d->itable_blocks;
+
+    if (d->firstdata > 0xffff) {
+        fprintf(stderr, "*** error: the inode table does not fit in front "
+                "of the first data zone\n");
+        return (d->error = EFBIG);
+    }
+
+    return 0;
+}
+
+static int
+mkimg_minix_finish(struct mkimg_disk* d)
+{
+    unsigned char sb[1024];
+    uint64_t bits = (uint64_t)d->bsize * 8;
+    uint64_t nzones;
+    size_t maplen = (size_t)((d->imap_blocks + d->zmap_blocks) * d->bsize);
+    unsigned char* maps;
+
+    /*
+     * The zone map was sized from an upper bound before any data went out.
+     * The driver expects the last map block to be the one holding the last
+     * zone's bit, so stretch the (sparse) volume if we came in under.
+     */
+    if (d->nextblock < d->firstdata + ((d->zmap_blocks - 1) * bits))
+        d->nextblock = d->firstdata + ((d->zmap_blocks - 1) * bits);
+    nzones = d->nextblock;
+
+    if ((d->fmt->version == 1) && (nzones > 0xffff)) {
+        fprintf(stderr, "*** error: %llu zones is too many for Minix V1\n",
+                (unsigned long long)nzones);
+        return (d->error = EFBIG);
+    }
+
+    /*
+     * Every inode and every zone is in use, so both bitmaps are all ones;
+     * the bits past the end are set too, as mkfs does, to mark them as
+     * unusable.
+     */
+    maps = malloc(maplen);
+    if (!maps)
+        return (d->error = ENOMEM);
+    memset(maps, 0xff, maplen);
+    mkimg_disk_pwrite(d, maps, maplen, 2);
+    free(maps);
+
+    memset(sb, 0, sizeof(sb));
+
+    if (d->fmt->version == 3) {
+        mkimg_le32(sb + 0, (uint32_t)d->ninodes);
+        mkimg_le16(sb + 6, (uint32_t)d->imap_blocks);
+        mkimg_le16(sb + 8, (uint32_t)d->zmap_blocks);
+        mkimg_le16(sb + 10, (uint32_t)d->firstdata);
+        mkimg_le16(sb + 12, 0);
+        mkimg_le32(sb + 16, (uint32_t)d->fmt->maxsize);
+        mkimg_le32(sb + 20, (uint32_t)nzones);
+        mkimg_le16(sb + 24, MINIX_V3_MAGIC);
+        mkimg_le16(sb + 28, d->bsize);
+        sb[30] = 0;
+    } else {
+        mkimg_le16(sb + 0, (uint32_t)d->ninodes);
+        mkimg_le16(sb + 2, (nzones > 0xffff) ? 0 : (uint32_t)nzones);
+        mkimg_le16(sb + 4, (uint32_t)d->imap_blocks);
+        mkimg_le16(sb + 6, (uint32_t)d->zmap_blocks);
+        mkimg_le16(sb + 8, (uint32_t)d->firstdata);
+        mkimg_le16(sb + 10, 0);
+        mkimg_le32(sb + 12, (uint32_t)d->fmt->maxsize);
+        mkimg_le16(sb + 16, (d->fmt->version == 1) ? MINIX_V1_MAGIC
+                                                   : MINIX_V2_MAGIC);
+        mkimg_le16(sb + 18, MINIX_VALID_FS);
+        if (d->fmt->version == 2)
+            mkimg_le32(sb + 20, (uint32_t)nzones);
+    }
+
+    return mkimg_disk_pwrite(d, sb, sizeof(sb), 1);
+}
+
+static const struct mkimg_diskfmt minix1_diskfmt = {
+    1024, 7, 2, 2, 32, 16, 14, 2, 250, 1,
+    1, 0xffff, 0xffff, (7 + 512 + (512 * 512)) * 1024ULL,
+    mkimg_minix_ptr16, mkimg_minix_inode, mkimg_minix_layout,
+    mkimg_minix_finish,
+};
+
+static const struct mkimg_diskfmt minix2_diskfmt = {
+    1024, 7, 3, 4, 64, 16, 14, 2, 65530, 2,
+    1, 0xffff, 0xffffffffULL, 0x7fffffffULL,
+    mkimg_minix_ptr32, mkimg_minix_inode, mkimg_minix_layout,
+    mkimg_minix_finish,
+};
+
+static const struct mkimg_diskfmt minix3_diskfmt = {
+    1024, 7, 3, 4, 64, 64, 60, 4, 65530, 3,
+    1, 0xffffffffULL, 0xffffffffULL, 0x7fffffffULL,
+    mkimg_minix_ptr32, mkimg_minix_inode, mkimg_minix_layout,
+    mkimg_minix_finish,
+};
+
+const struct mkimg_format mkimg_format_minix1 = {
+    "minix1", "Minix V1 file system (1 KB blocks, 14-character names)",
+    0, mkimg_disk_write, &minix1_diskfmt,
+};
+
+const struct mkimg_format mkimg_format_minix2 = {
+    "minix2", "Minix V2 file system (1 KB blocks, 14-character names)",
+    0, mkimg_disk_write, &minix2_diskfmt,
+};
+
+const struct mkimg_format mkimg_format_minix3 = {
+    "minix3", "Minix V3 file system (1 KB blocks, 60-character names)",
+    0, mkimg_disk_write, &minix3_diskfmt,
+};
+
+/* System V Release 4 and Seventh Edition UNIX */
+
+#define SYSV_MAGIC      0xfd187e20
+#define SYSV_STATE_BASE 0x7c269d38
+
+static void
+mkimg_sysv_ptr(unsigned char* p, uint32_t v)
+{
+    mkimg_le32(p, v);
+}
+
+static void
+mkimg_v7_ptr(unsigned char* p, uint32_t v)
+{
+    mkimg_pdp32(p, v);
+}
+
+/*
+ * Both put 13 three-byte addresses in the inode; System V stores them as
+ * the low three bytes of a little-endian long, V7 as a PDP-11 long with
+ * the (always zero) high byte dropped.
+ */
+static void
+mkimg_sysv_inode(struct mkimg_disk* d, unsigned char* raw, uint32_t mode,
+                 uint32_t nlink, uint64_t size, const uint32_t* addrs)
+{
+    const struct mkimg_spec* spec = d->spec;
+    void (*put32)(void*, uint32_t) =
+        (d->fmt->version == 7) ? mkimg_pdp32 : mkimg_le32;
+    int i;
+
+    mkimg_le16(raw + 0, mode);
+    mkimg_le16(raw + 2, nlink);
+    mkimg_le16(raw + 4, spec->uid);
+    mkimg_le16(raw + 6, spec->gid);
+    put32(raw + 8, (uint32_t)size);
+
+    for (i = 0; i < 13; i++) {
+        unsigned char* a = raw + 12 + (3 * i);
+        if (d->fmt->version == 7) {
+            a[0] = (addrs[i] >> 16) & 0xff;
+            a[1] = addrs[i] & 0xff;
+            a[2] = (addrs[i] >> 8) & 0xff;
+        } else {
+            a[0] = addrs[i] & 0xff;
+            a[1] = (addrs[i] >> 8) & 0xff;
+            a[2] = (addrs[i] >> 16) & 0xff;
+        }
+    }
+
+    put32(raw + 52, spec->mtime);
+    put32(raw + 56, spec->mtime);
+    put32(raw + 60, spec->mtime);
+}
+
+static int
+mkimg_sysv_layout(struct mkimg_disk* d)
+{
+    uint64_t ipb = d->bsize / d->fmt->isize;
+
+    /* the i-list starts at block 2 in both */
+    d->itable_block = 2;
+    d->itable_blocks = (d->ninodes + ipb - 1) / ipb;
+    d->firstdata = d->itable_block + d->itable_blocks;
+
+    return 0;
+}
+
+static int
+mkimg_sysv_finish(struct mkimg_disk* d)
+{
+    uint32_t ninodes =
+        (uint32_t)(d->itable_blocks * (d->bsize / d->fmt->isize));
+
+    if (d->fmt->version == 7) {
+        unsigned char sb[512];
+        memset(sb, 0, sizeof(sb));
+        mkimg_le16(sb + 0, (uint32_t)d->firstdata);   /* s_isize */
+        mkimg_pdp32(sb + 2, (uint32_t)d->nextblock);  /* s_fsize */
+        mkimg_pdp32(sb + 414, d->spec->mtime);        /* s_time */
+        memcpy(sb + 428, "synth", 5);                 /* s_fname */
+        memcpy(sb + 434, "mkimg", 5);                 /* s_fpack */
+        return mkimg_disk_pwrite(d, sb, sizeof(sb), 1);
+    }
+
+    /* SVR4 with 1 KB blocks: the super block is the second half of block 0 */
+    unsigned char block0[1024];
+    unsigned char* ssb = block0 + 512;
+
+    memset(block0, 0, sizeof(block0));
+    mkimg_le16(ssb + 0, (uint32_t)d->firstdata);      /* s_isize */
+    mkimg_le32(ssb + 4, (uint32_t)d->nextblock);      /* s_fsize */
+    mkimg_le32(ssb + 420, d->spec->mtime);            /* s_time */
+    mkimg_le16(ssb + 436, ninodes - (uint32_t)d->ninodes); /* s_tinode */
+    memcpy(ssb + 440, "synth", 5);                    /* s_fname */
+    memcpy(ssb + 446, "mkimg", 5);                    /* s_fpack */
+    mkimg_le32(ssb + 500, SYSV_STATE_BASE - d->spec->mtime); /* s_state */
+    mkimg_le32(ssb + 504, SYSV_MAGIC);                /* s_magic */
+    mkimg_le32(ssb + 508, 2);                         /* s_type */
+
+    return mkimg_disk_pwrite(d, block0, sizeof(block0), 0);
+}
+
+static const struct mkimg_diskfmt sysv_diskfmt = {
+    1024, 10, 3, 4, 64, 16, 14, 2, 126, 4,
+    2, 65520, 0xffffff, 0x7fffffffULL,
+    mkimg_sysv_ptr, mkimg_sysv_inode, mkimg_sysv_layout, mkimg_sysv_finish,
+};
+
+static const struct mkimg_diskfmt v7_diskfmt = {
+    512, 10, 3, 4, 64, 16, 14, 2, 32767, 7,
+    2, 0xffff, 0xffffff, 0x7fffffffULL,
+    mkimg_v7_ptr, mkimg_sysv_inode, mkimg_sysv_layout, mkimg_sysv_finish,
+};
+
+const struct mkimg_format mkimg_format_sysv = {
+    "sysv", "System V Release 4 file system (1 KB blocks, little endian)",
+    0, mkimg_disk_write, &sysv_diskfmt,
+};
+
+const struct mkimg_format mkimg_format_v7 = {
+    "v7", "Seventh Edition UNIX file system (512-byte blocks, PDP-11)",
+    0, mkimg_disk_write, &v7_diskfmt,
+};
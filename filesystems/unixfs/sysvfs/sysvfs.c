@@ -772,8 +772,8 @@ sysv_get_page(struct inode* inode, sector_t index, char* pagebuf)
 }
 
 int
-sysv_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
-                   off_t* offset, struct unixfs_direntry* dent)
+sysv_readdir_batch(struct inode* dir, struct unixfs_dirbuf* dirbuf,
+                   off_t* offset, struct unixfs_direntry* dents, int max)
 {
     struct super_block* sb = dir->I_sb;
     struct sysv_sb_info* sbi = SYSV_SB(sb);
@@ -785,34 +785,42 @@ sysv_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
     *offset = (*offset + SYSV_DIRSIZE-1) & ~(SYSV_DIRSIZE-1);
 
     if (*offset >= dir->I_size)
-        return -1;
+        return 0;
 
     if (npages == 0)
-        return -1;
+        return 0;
 
     start = *offset >> PAGE_CACHE_SHIFT; /* which page from offset */
 
     if (start >= npages)
-        return -1;
+        return 0;
     n = start;
 
     if (!dirbuf->flags.initialized || (*offset & ((PAGE_SIZE - 1))) == 0) {
         int ret = sysv_get_page(dir, n, dirpagebuf);
         if (ret)
-            return ret;
+            return -1;
         dirbuf->flags.initialized = 1;
     }
 
-    de = (struct sysv_dir_entry*)
-             ((char*)dirpagebuf + (*offset & (PAGE_SIZE - 1)));
+    int count = 0;
 
-    dent->ino = fs16_to_host(sbi->s_bytesex, de->inode);
-    size_t nl = strlen(de->name);
-    nl = min(nl, SYSV_NAMELEN);
-    memcpy(dent->name, de->name, nl);
-    dent->name[nl] = '\0';
+    /* the rest of the page, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[count++];
 
-    *offset += SYSV_DIRSIZE;
+        de = (struct sysv_dir_entry*)
+                 ((char*)dirpagebuf + (*offset & (PAGE_SIZE - 1)));
 
-    return 0;
+        dent->ino = fs16_to_host(sbi->s_bytesex, de->inode);
+        size_t nl = strlen(de->name);
+        nl = min(nl, SYSV_NAMELEN);
+        memcpy(dent->name, de->name, nl);
+        dent->name[nl] = '\0';
+
+        *offset += SYSV_DIRSIZE;
+    } while ((count < max) && ((*offset & (PAGE_SIZE - 1)) != 0) &&
+             (*offset < dir->I_size));
+
+    return count;
 }
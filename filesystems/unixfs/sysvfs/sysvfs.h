@@ -137,14 +137,14 @@ SYSV_SB(struct super_block* sb)
 }
 
 static inline void
-sysv_read3byte(struct sysv_sb_info* sbi, unsigned char* from, unsigned char* to)
+__sysv_read3byte(fs_endian_t e, unsigned char* from, unsigned char* to)
 {
-    if (sbi->s_bytesex == UNIXFS_FS_PDP) {
+    if (e == UNIXFS_FS_PDP) {
         to[0] = from[0];
         to[1] = 0;
         to[2] = from[1];
         to[3] = from[2];
-    } else if (sbi->s_bytesex == UNIXFS_FS_LITTLE) {
+    } else if (e == UNIXFS_FS_LITTLE) {
         to[0] = from[0];
         to[1] = from[1];
         to[2] = from[2];
@@ -157,6 +157,12 @@ sysv_read3byte(struct sysv_sb_info* sbi, unsigned char* from, unsigned char* to)
     }
 }
 
+static inline void
+sysv_read3byte(struct sysv_sb_info* sbi, unsigned char* from, unsigned char* to)
+{
+    __sysv_read3byte(sbi->s_bytesex, from, to);
+}
+
 /* in-memory file system type identifiers */
 enum {
     FSTYPE_NONE = 0,
@@ -319,8 +325,8 @@ u_long sysv_count_free_inodes(struct super_block* sb);
 
 struct sysv_dinode* sysv_raw_inode(struct super_block* sb, ino_t ino,
                                    struct buffer_head* bh);
-int sysv_next_direntry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                       off_t* offset, struct unixfs_direntry* dent);
+int sysv_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                       off_t* offset, struct unixfs_direntry* dents, int max);
 
 int sysv_get_block(struct inode* ip, sector_t block, off_t* result);
 int sysv_get_page(struct inode* ip, sector_t index, char* pagebuf);
@@ -18,6 +18,37 @@
 
 DECL_UNIXFS("UNIX System V", sysv);
 
+static inline void
+__unixfs_internal_idecode(fs_endian_t e, struct inode* inode,
+                          struct sysv_dinode* raw_inode)
+{
+    struct sysv_inode_info *si = SYSV_I(inode);
+
+    inode->I_mode = fs16_to_host(e, raw_inode->di_mode);
+
+    inode->I_uid   = (uid_t)fs16_to_host(e, raw_inode->di_uid);
+    inode->I_gid   = (gid_t)fs16_to_host(e, raw_inode->di_gid);
+    inode->I_nlink = fs16_to_host(e, raw_inode->di_nlink);
+    inode->I_size  = fs32_to_host(e, raw_inode->di_size);
+
+    inode->I_atime.tv_sec = fs32_to_host(e, raw_inode->di_atime);
+    inode->I_mtime.tv_sec = fs32_to_host(e, raw_inode->di_mtime);
+    inode->I_ctime.tv_sec = fs32_to_host(e, raw_inode->di_ctime);
+
+    unsigned int block;
+    for (block = 0; block < (10 + 1 + 1 + 1); block++)
+        __sysv_read3byte(e, &raw_inode->di_data[3 * block],
+                         (u8*)&si->i_data[block]);
+}
+
+UNIXFS_ENDIAN_SPECIALIZE(__unixfs_internal_idecode,
+                         (struct inode* inode, struct sysv_dinode* raw_inode),
+                         (inode, raw_inode));
+
+/* for the byte order of the file system this thread is attached to */
+#define unixfs_internal_idecode(inode, raw_inode) \
+    __unixfs_internal_idecode_variants[unixfs->s_endian](inode, raw_inode)
+
 static void*
 unixfs_internal_init(const char* dmg, uint32_t flags, __unused fs_endian_t fse,
                      char** fsname, char** volname)
@@ -121,6 +152,10 @@ unixfs_internal_fini(void* filsys)
                 brelse(bh2);
             free(sbi);
         }
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
+            close(sb->s_bdev);
+        }
         free(sb);
     }
 }
@@ -144,11 +179,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
     struct super_block* sb = unixfs;
 
-    if (pread(sb->s_bdev, blkbuf, sb->s_blocksize,
-              blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(sb->s_bdev, blkbuf,
+                                    sb->s_blocksize,
+                                    blkno * (off_t)(sb->s_blocksize));
 }
 
 struct inode*
@@ -188,16 +221,8 @@ unixfs_internal_iget(ino_t ino)
 
     /* SystemV FS: kludge permissions if ino==SYSV_ROOT_INO ?? */
 
-    inode->I_mode = fs16_to_host(unixfs->s_endian, raw_inode->di_mode);
+    unixfs_internal_idecode(inode, raw_inode);
 
-    inode->I_uid   = (uid_t)fs16_to_host(unixfs->s_endian, raw_inode->di_uid);
-    inode->I_gid   = (gid_t)fs16_to_host(unixfs->s_endian, raw_inode->di_gid);
-    inode->I_nlink = fs16_to_host(unixfs->s_endian, raw_inode->di_nlink);
-    inode->I_size  = fs32_to_host(unixfs->s_endian, raw_inode->di_size);
-
-    inode->I_atime.tv_sec = fs32_to_host(unixfs->s_endian, raw_inode->di_atime);
-    inode->I_mtime.tv_sec = fs32_to_host(unixfs->s_endian, raw_inode->di_mtime);
-    inode->I_ctime.tv_sec = fs32_to_host(unixfs->s_endian, raw_inode->di_ctime);
     inode->I_ctime.tv_nsec = 0;
     inode->I_atime.tv_nsec = 0;
     inode->I_mtime.tv_nsec = 0;
@@ -205,11 +230,6 @@ unixfs_internal_iget(ino_t ino)
     inode->I_sb = unixfs;
     inode->I_blkbits = sb->s_blocksize_bits;
 
-    unsigned int block;
-    for (block = 0; block < (10 + 1 + 1 + 1); block++)
-        sysv_read3byte(sbi, &raw_inode->di_data[3 * block],
-                       (u8*)&si->i_data[block]);
-
     if (S_ISCHR(inode->I_mode) || S_ISBLK(inode->I_mode)) {
         uint32_t rdev = fs32_to_host(unixfs->s_endian, si->i_data[0]);
         inode->I_rdev = makedev((rdev >> 8) & 255, rdev & 255);
@@ -320,10 +340,11 @@ found:
 }
 
 int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    return sysv_next_direntry(dp, dirbuf, offset, dent);
+    return sysv_readdir_batch(dp, dirbuf, offset, dents, max);
 
 }
 
@@ -433,14 +433,18 @@ ufs_read_cylinder_structures(struct super_block* sb)
 
 failed:
     kfree(base);
+    sbi->s_csp = NULL;
 
     if (sbi->s_ucg) {
         for (i = 0; i < uspi->s_ncg; i++)
             if (sbi->s_ucg[i])
                 brelse (sbi->s_ucg[i]);
         kfree (sbi->s_ucg);
-        for (i = 0; i < UFS_MAX_GROUP_LOADED; i++)
+        sbi->s_ucg = NULL;
+        for (i = 0; i < UFS_MAX_GROUP_LOADED; i++) {
             kfree (sbi->s_ucpi[i]);
+            sbi->s_ucpi[i] = NULL;
+        }
     }
 
     UFSD("EXIT (FAILED)\n");
@@ -920,7 +924,8 @@ ufs_find_entry_s(struct inode* dir, const char* name)
     if (npages == 0 || namelen > UFS_MAXNAMLEN)
         goto out;
 
-    start = ui->i_dir_start_lookup;
+    /* a hint shared by every lookup in the directory, whatever thread */
+    start = unixfs_atomic_load32(&ui->i_dir_start_lookup);
 
     if (start >= npages)
         start = 0;
@@ -956,7 +961,7 @@ out:
     return result;
 
 found:
-    ui->i_dir_start_lookup = n;
+    unixfs_atomic_store32(&ui->i_dir_start_lookup, (uint32_t)n);
 
     return result;
 }
@@ -1468,6 +1473,38 @@ failed_nomem:
     return NULL;
 }
 
+/*
+ * Releases the cylinder group buffers and the cg private info, and frees the
+ * csum area, if ufs_read_cylinder_structures() got as far as keeping them.
+ */
+void
+U_ufs_put_super(struct super_block* sb)
+{
+    struct ufs_sb_info* sbi = UFS_SB(sb);
+
+    if (!sbi)
+        return;
+
+    if (sbi->s_ucg) {
+        unsigned i;
+        for (i = 0; i < sbi->s_uspi->s_ncg; i++)
+            if (sbi->s_ucg[i])
+                brelse(sbi->s_ucg[i]);
+        kfree(sbi->s_ucg);
+        for (i = 0; i < UFS_MAX_GROUP_LOADED; i++)
+            kfree(sbi->s_ucpi[i]);
+    }
+    kfree(sbi->s_csp);
+
+    if (sbi->s_uspi) {
+        ubh_brelse_uspi(sbi->s_uspi);
+        kfree(sbi->s_uspi);
+    }
+
+    kfree(sbi);
+    sb->s_fs_info = NULL;
+}
+
 int
 U_ufs_statvfs(struct super_block* sb, struct statvfs* buf)
 {
@@ -1579,50 +1616,59 @@ U_ufs_inode_by_name(struct inode* dir, const char* name)
     return ufs_find_entry_s(dir, name);
 }
 
+/*
+ * The page comes from the offset, and not from the inode's lookup hint, which
+ * is shared with every other listing and lookup in the directory.
+ */
 int
-U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirpagebuf,
-                    off_t* offset, struct unixfs_direntry* dent)
+U_ufs_readdir_batch(struct inode* dir, struct unixfs_dirbuf* dirpagebuf,
+                    off_t* offset, struct unixfs_direntry* dents, int max)
 {
     struct super_block* sb = dir->I_sb;
-    struct ufs_inode_info* ui = dir->I_private;
 
     unsigned long npages = ufs_dir_pages(dir);
-    unsigned long start, n;
+    unsigned long n;
     struct ufs_dir_entry* de;
 
     UFSD("ENTER, dir_ino %llu\n", dir->I_ino);
 
     if (*offset > (dir->I_size - UFS_DIR_REC_LEN(1)))
-        return -1;
+        return 0;
 
     if (npages == 0)
-        return -1;
+        return 0;
 
-    start = ui->i_dir_start_lookup;
-    n = start;
+    n = *offset >> PAGE_CACHE_SHIFT; /* which page from offset */
 
-    if (start > npages)
-        return -1;
+    if (n >= npages)
+        return 0;
 
-    if ((ui->i_unused1 == 0) || (*offset & ((PAGE_SIZE - 1))) == 0) {
+    if (!dirpagebuf->flags.initialized || (*offset & (PAGE_SIZE - 1)) == 0) {
         int ret = ufs_get_dirpage(dir, n, dirpagebuf->data);
         if (ret != 0)
-            return ret;
-        ui->i_dir_start_lookup++;
-        ui->i_unused1 = ui->i_dir_start_lookup;
+            return -1;
+        dirpagebuf->flags.initialized = 1;
     }
 
-    de = (struct ufs_dir_entry*)((char*)dirpagebuf->data +
-                                 (*offset & (PAGE_SIZE - 1)));
+    int count = 0;
 
-    dent->ino = fs32_to_cpu(sb, de->d_ino);
-    size_t nl = ufs_get_de_namlen(sb, de);;
-    memcpy(dent->name, de->d_name, nl);
-    dent->name[nl] = '\0';
+    /* the rest of the page, or as much of it as there is room for */
+    do {
+        struct unixfs_direntry* dent = &dents[count++];
 
-    *offset += fs16_to_cpu(sb, de->d_reclen);
+        de = (struct ufs_dir_entry*)((char*)dirpagebuf->data +
+                                     (*offset & (PAGE_SIZE - 1)));
 
-    return 0;
+        dent->ino = fs32_to_cpu(sb, de->d_ino);
+        size_t nl = ufs_get_de_namlen(sb, de);;
+        memcpy(dent->name, de->d_name, nl);
+        dent->name[nl] = '\0';
+
+        *offset += fs16_to_cpu(sb, de->d_reclen);
+    } while ((count < max) && ((*offset & (PAGE_SIZE - 1)) != 0) &&
+             (*offset <= (dir->I_size - UFS_DIR_REC_LEN(1))));
+
+    return count;
 }
 
 /* Interface between UFS and read/write page. */
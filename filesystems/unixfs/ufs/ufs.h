@@ -19,11 +19,13 @@
 
 struct super_block*
       U_ufs_fill_super(int fd, void* args, int silent);
+void  U_ufs_put_super(struct super_block* sb);
 int   U_ufs_statvfs(struct super_block* sb, struct statvfs* buf);
 int   U_ufs_iget(struct super_block* sb, struct inode* ip);
 ino_t U_ufs_inode_by_name(struct inode* dir, const char* name);
-int   U_ufs_next_direntry(struct inode* dir, struct unixfs_dirbuf* dirbuf,
-                          off_t* offset, struct unixfs_direntry* dent);
+int   U_ufs_readdir_batch(struct inode* dir, struct unixfs_dirbuf* dirbuf,
+                          off_t* offset, struct unixfs_direntry* dents,
+                          int max);
 int   U_ufs_get_block(struct inode* ip, sector_t fragment, off_t* result);
 int   U_ufs_get_page(struct inode* ip, sector_t index, char* pagebuf);
 
@@ -45,9 +45,11 @@ unixfs_usage(void)
     "%s (version %s): UFS family of file systems for MacFUSE\n"
     "Amit Singh <http://osxbook.com>\n"
     "usage:\n"
-    "      %s [--force] --dmg DMG --type TYPE MOUNTPOINT [MacFUSE args...]\n"
+    "      %s [--control] [--force] [--idle SECONDS] --dmg DMG --type TYPE MOUNTPOINT [MacFUSE args...]\n"
     "where:\n"
     "     . DMG must point to an ancient Unix disk image of a valid type\n"
+    "       (or to a directory of them, each of which then shows up as a\n"
+    "       subdirectory of the volume)\n"
     "     . TYPE is one of:",
     PROGNAME, PROGVERS, PROGNAME);
 
@@ -59,7 +61,10 @@ unixfs_usage(void)
     fprintf(stderr, "\n");
 
     fprintf(stderr, "%s",
+    "     . --control mounts read-write so that the knobs in /.unixfs can be set\n"
     "     . --force attempts mounting even if there are warnings or errors\n"
+    "     . --idle closes images in a directory after SECONDS unused (default\n"
+    "       60; 0 keeps them open)\n"
     );
 }
 
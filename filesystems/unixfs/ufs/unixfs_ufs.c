@@ -92,8 +92,14 @@ unixfs_internal_fini(void* filsys)
     unixfs_inodelayer_fini();
 
     struct super_block* sb = (struct super_block*)filsys;
-    if (sb)
+    if (sb) {
+        U_ufs_put_super(sb);
+        if (sb->s_bdev >= 0) {
+            unixfs_bufferlayer_invalidate(sb->s_bdev);
+            close(sb->s_bdev);
+        }
         free(sb);
+    }
 }
 
 static off_t
@@ -115,11 +121,9 @@ unixfs_internal_bread(off_t blkno, char* blkbuf)
 {
     struct super_block* sb = unixfs;
 
-    if (pread(sb->s_bdev, blkbuf, sb->s_blocksize,
-              blkno * (off_t)(sb->s_blocksize)) != sb->s_blocksize)
-        return EIO;
-
-    return 0;
+    return unixfs_bufferlayer_pread(sb->s_bdev, blkbuf,
+                                    sb->s_blocksize,
+                                    blkno * (off_t)(sb->s_blocksize));
 }
 
 struct inode*
@@ -216,10 +220,11 @@ unixfs_internal_namei(ino_t parentino, const char* name, struct stat* stbuf)
 }
 
 int
-unixfs_internal_nextdirentry(struct inode* dp, struct unixfs_dirbuf* dirbuf,
-                             off_t* offset, struct unixfs_direntry* dent)
+unixfs_internal_readdir_batch(struct inode* dp, struct unixfs_dirbuf* dirbuf,
+                              off_t* offset, struct unixfs_direntry* dents,
+                              int max)
 {
-    return U_ufs_next_direntry(dp, dirbuf, offset, dent);
+    return U_ufs_readdir_batch(dp, dirbuf, offset, dents, max);
 
 }
 
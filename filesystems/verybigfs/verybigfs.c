@@ -9,14 +9,82 @@
  * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
  */
 
+/*
+ * The contents are generated as they're read (see verybigfs_pattern.h),
+ * which makes this a way of measuring how fast FUSE reads can go, with
+ * verybigfs_bench as the reader. Options:
+ *
+ *   -o files=N      N files instead of the one (copyme0.txt ...)
+ *   -o size=BYTES   of each file; K, M, G and T suffixes are understood
+ *   -o latency=US   microseconds every read takes, as if there were a disk
+ */
+
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/statvfs.h>
 #include <fuse.h>
 
+#include "verybigfs_pattern.h"
+
 char *bigfile_path = "/copyme.txt";
 
+static struct verybigfs_config {
+    unsigned  files;
+    char     *size;
+    unsigned  latency;
+} config = { 1, NULL, 0 };
+
+static off_t bigfile_size = 128ULL * 1024ULL * 0xFFFFFFFFULL;
+
+#define VERYBIGFS_OPT(t, p) { t, offsetof(struct verybigfs_config, p), 1 }
+
+static const struct fuse_opt verybigfs_opts[] = {
+    VERYBIGFS_OPT("files=%u",   files),
+    VERYBIGFS_OPT("size=%s",    size),
+    VERYBIGFS_OPT("latency=%u", latency),
+    FUSE_OPT_END
+};
+
+static void
+verybigfs_name(unsigned index, char *name, size_t size)
+{
+    if (config.files == 1) {
+        snprintf(name, size, "%s", bigfile_path + 1);
+    } else {
+        snprintf(name, size, "copyme%u.txt", index);
+    }
+}
+
+/* Returns the file's index, or -1. */
+static int
+verybigfs_lookup(const char *path)
+{
+    char name[32];
+    unsigned index;
+
+    if (config.files == 1) {
+        return (strcmp(path, bigfile_path) == 0) ? 0 : -1;
+    }
+
+    if ((sscanf(path, "/copyme%u.txt", &index) != 1) ||
+        (index >= config.files)) {
+        return -1;
+    }
+
+    /* No leading zeroes, nothing trailing. */
+    verybigfs_name(index, name, sizeof(name));
+    if (strcmp(path + 1, name) != 0) {
+        return -1;
+    }
+
+    return (int)index;
+}
+
 static int
 verybigfs_statfs(const char *path, struct statvfs *stbuf)
 {
@@ -24,7 +92,7 @@ verybigfs_statfs(const char *path, struct statvfs *stbuf)
     stbuf->f_frsize = 128  * 1024;  /* MAXPHYS */
     stbuf->f_blocks = 0xFFFFFFFFUL; /* aim for a lot; this is 32-bit though  */
     stbuf->f_bfree  = stbuf->f_bavail = stbuf->f_ffree = stbuf->f_favail = 0;
-    stbuf->f_files  = 3;
+    stbuf->f_files  = config.files + 2;
     return 0;
 }
 
@@ -37,10 +105,10 @@ verybigfs_getattr(const char *path, struct stat *stbuf)
     if (strcmp(path, "/") == 0) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (strcmp(path, bigfile_path) == 0) {
+    } else if (verybigfs_lookup(path) != -1) {
         stbuf->st_mode = S_IFREG | 0444;
         stbuf->st_nlink = 1;
-        stbuf->st_size = 128ULL * 1024ULL * 0xFFFFFFFFULL;
+        stbuf->st_size = bigfile_size;
     } else
         return -ENOENT;
     return 0;
@@ -50,9 +118,34 @@ static int
 verybigfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                   off_t offset, struct fuse_file_info *fi)
 {
+    char name[32];
+    unsigned i;
+
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, bigfile_path + 1, NULL, 0);
+    for (i = 0; i < config.files; i++) {
+        verybigfs_name(i, name, sizeof(name));
+        if (filler(buf, name, NULL, 0)) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static int
+verybigfs_open(const char *path, struct fuse_file_info *fi)
+{
+    if (verybigfs_lookup(path) == -1) {
+        return -ENOENT;
+    }
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    /* The pattern's key, so that reads needn't look at the path. */
+    fi->fh = verybigfs_key(path + 1);
+
     return 0;
 }
 
@@ -60,18 +153,76 @@ static int
 verybigfs_read(const char *path, char *buf, size_t size, off_t offset,
                struct fuse_file_info *fi)
 {
-    return 0;
+    if (offset >= bigfile_size) {
+        return 0;
+    }
+
+    if (size > (size_t)(bigfile_size - offset)) {
+        size = bigfile_size - offset;
+    }
+
+    if (config.latency) {
+        usleep(config.latency);
+    }
+
+    verybigfs_fill(buf, size, offset, fi->fh);
+
+    return size;
 }
 
 static struct fuse_operations verybigfs_oper = {
     .getattr = verybigfs_getattr,
+    .open    = verybigfs_open,
     .read    = verybigfs_read,
     .readdir = verybigfs_readdir,
     .statfs  = verybigfs_statfs,
 };
 
+static int
+verybigfs_parse_size(const char *s, off_t *sizep)
+{
+    char *end;
+    unsigned long long size = strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'T': case 't': size <<= 10; /* FALLTHROUGH */
+    case 'G': case 'g': size <<= 10; /* FALLTHROUGH */
+    case 'M': case 'm': size <<= 10; /* FALLTHROUGH */
+    case 'K': case 'k': size <<= 10; end++; break;
+    }
+
+    if ((end == s) || (*end != '\0')) {
+        return -1;
+    }
+
+    *sizep = (off_t)size;
+
+    return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
-    return fuse_main(argc, argv, &verybigfs_oper, NULL);
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    int res;
+
+    if (fuse_opt_parse(&args, &config, verybigfs_opts, NULL) == -1) {
+        return 1;
+    }
+
+    if (config.files == 0) {
+        fprintf(stderr, "verybigfs: files must be at least 1\n");
+        return 1;
+    }
+
+    if (config.size && (verybigfs_parse_size(config.size, &bigfile_size))) {
+        fprintf(stderr, "verybigfs: size=%s: not a size\n", config.size);
+        return 1;
+    }
+
+    res = fuse_main(args.argc, args.argv, &verybigfs_oper, NULL);
+
+    fuse_opt_free_args(&args);
+
+    return res;
 }
@@ -0,0 +1,307 @@
+/*
+ * A "very big" file system with a "very big" file. All that you can read.
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+/*
+ * Reads verybigfs's files, sequentially or at random, from some number of
+ * threads for some number of seconds, and reports the throughput and the
+ * spread of the latencies of the reads. With -v, it also checks every byte
+ * it reads against what verybigfs should have generated.
+ *
+ *   verybigfs_bench [-m seq|rand] [-t threads] [-b blocksize] [-d seconds]
+ *                   [-v] file ...
+ *
+ * Thread i reads file i modulo the number of files; sequential readers of
+ * the same file start at different places in it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "verybigfs_pattern.h"
+
+struct bench_thread {
+    pthread_t      thread;
+    unsigned       index;
+    const char    *path;
+    uint64_t       key;
+    off_t          size;
+    uint64_t       bytes;
+    uint32_t      *latencies;   /* microseconds */
+    size_t         count;
+    size_t         capacity;
+    int            failed;
+};
+
+static int      random_mode;
+static unsigned nthreads = 1;
+static size_t   blocksize = 128 * 1024;
+static unsigned duration = 10;
+static int      verify;
+static uint64_t deadline;
+
+static uint64_t
+bench_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Cheap, and good enough for picking offsets; one per thread. */
+static uint64_t
+bench_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return (*state = x);
+}
+
+static int
+bench_record(struct bench_thread *t, uint64_t usec)
+{
+    if (t->count == t->capacity) {
+        size_t capacity = t->capacity ? (2 * t->capacity) : 65536;
+        uint32_t *latencies = realloc(t->latencies,
+                                      capacity * sizeof(uint32_t));
+        if (latencies == NULL) {
+            return -1;
+        }
+        t->latencies = latencies;
+        t->capacity = capacity;
+    }
+
+    t->latencies[t->count++] = (usec > UINT32_MAX) ? UINT32_MAX : usec;
+
+    return 0;
+}
+
+static void *
+bench_reader(void *arg)
+{
+    struct bench_thread *t = arg;
+    off_t blocks = t->size / blocksize;
+    uint64_t state = 0x9E3779B97F4A7C15ULL * (t->index + 1);
+    off_t offset = 0;
+    char *buf;
+    int fd;
+
+    if ((buf = malloc(blocksize)) == NULL) {
+        perror("malloc");
+        t->failed = 1;
+        return NULL;
+    }
+
+    if ((fd = open(t->path, O_RDONLY)) == -1) {
+        perror(t->path);
+        t->failed = 1;
+        free(buf);
+        return NULL;
+    }
+
+    if (!random_mode && (blocks > 0)) {
+        offset = (blocks * t->index / nthreads) * blocksize;
+    }
+
+    while (bench_now() < deadline) {
+        uint64_t start;
+        ssize_t n;
+
+        if (random_mode) {
+            offset = blocks ? (bench_random(&state) % blocks) * blocksize : 0;
+        } else if (offset >= t->size) {
+            offset = 0;
+        }
+
+        start = bench_now();
+        n = pread(fd, buf, blocksize, offset);
+        if (n < 0) {
+            fprintf(stderr, "%s: offset %lld: %s\n", t->path,
+                    (long long)offset, strerror(errno));
+            t->failed = 1;
+            break;
+        }
+        if (bench_record(t, bench_now() - start) == -1) {
+            perror("realloc");
+            t->failed = 1;
+            break;
+        }
+
+        if (verify) {
+            off_t bad = verybigfs_check(buf, n, offset, t->key);
+            if (bad != -1) {
+                fprintf(stderr, "%s: wrong data at offset %lld\n", t->path,
+                        (long long)bad);
+                t->failed = 1;
+                break;
+            }
+        }
+
+        t->bytes += n;
+        offset += n;
+        if (n == 0) {
+            offset = t->size; /* wrap */
+        }
+    }
+
+    close(fd);
+    free(buf);
+
+    return NULL;
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: verybigfs_bench [-m seq|rand] [-t threads] "
+            "[-b blocksize] [-d seconds]\n"
+            "                       [-v] file ...\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_thread *threads;
+    uint32_t *all;
+    uint64_t bytes = 0, start, elapsed;
+    size_t count = 0;
+    unsigned i;
+    int ch, failed = 0;
+
+    while ((ch = getopt(argc, argv, "m:t:b:d:v")) != -1) {
+        switch (ch) {
+        case 'm':
+            if (strcmp(optarg, "seq") == 0) {
+                random_mode = 0;
+            } else if (strcmp(optarg, "rand") == 0) {
+                random_mode = 1;
+            } else {
+                usage();
+            }
+            break;
+        case 't':
+            nthreads = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            blocksize = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verify = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ((argc == 0) || (nthreads == 0) || (blocksize == 0)) {
+        usage();
+    }
+
+    threads = calloc(nthreads, sizeof(struct bench_thread));
+    if (threads == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        struct bench_thread *t = &threads[i];
+        const char *name;
+        struct stat st;
+
+        t->index = i;
+        t->path = argv[i % argc];
+        if (stat(t->path, &st) == -1) {
+            perror(t->path);
+            return 1;
+        }
+        t->size = st.st_size;
+        name = strrchr(t->path, '/');
+        t->key = verybigfs_key(name ? (name + 1) : t->path);
+    }
+
+    start = bench_now();
+    deadline = start + (uint64_t)duration * 1000000;
+
+    for (i = 0; i < nthreads; i++) {
+        errno = pthread_create(&threads[i].thread, NULL, bench_reader,
+                               &threads[i]);
+        if (errno) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        bytes += threads[i].bytes;
+        count += threads[i].count;
+        failed |= threads[i].failed;
+    }
+    elapsed = bench_now() - start;
+
+    if ((all = malloc((count + 1) * sizeof(uint32_t))) == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (count = 0, i = 0; i < nthreads; i++) {
+        memcpy(all + count, threads[i].latencies,
+               threads[i].count * sizeof(uint32_t));
+        count += threads[i].count;
+        free(threads[i].latencies);
+    }
+    qsort(all, count, sizeof(uint32_t), bench_compare);
+
+    printf("%s, %u thread%s, %zu-byte reads: %llu bytes in %.2f s, "
+           "%.1f MB/s\n", random_mode ? "random" : "sequential", nthreads,
+           (nthreads == 1) ? "" : "s", blocksize, (unsigned long long)bytes,
+           elapsed / 1e6, elapsed ? (bytes / (double)elapsed) : 0.0);
+    if (count) {
+        printf("%zu reads; latency (us) p50 %u, p90 %u, p99 %u, max %u\n",
+               count, all[count / 2], all[count * 9 / 10],
+               all[count * 99 / 100], all[count - 1]);
+    }
+    if (verify && !failed) {
+        printf("all data verified\n");
+    }
+
+    free(all);
+    free(threads);
+
+    return failed;
+}
@@ -0,0 +1,112 @@
+/*
+ * A "very big" file system with a "very big" file. All that you can read.
+ *
+ * Copyright Amit Singh. All Rights Reserved.
+ * http://osxbook.com
+ *
+ * http://code.google.com/p/macfuse/
+ *
+ * Source License: GNU GENERAL PUBLIC LICENSE (GPL)
+ */
+
+#ifndef _VERYBIGFS_PATTERN_H
+#define _VERYBIGFS_PATTERN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * The contents of verybigfs's files, shared with the benchmark so that it
+ * can check what it reads.
+ *
+ * A file is a run of little-endian 64-bit words: the word at byte offset
+ * 8 * n is n, exclusive-or'ed with a key made from the file's name. Any
+ * range of any file can thus be generated, or checked, on its own, and
+ * filling a buffer is a loop of adds and stores that runs at memory speed.
+ */
+
+static inline uint64_t
+verybigfs_key(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static inline uint64_t
+verybigfs_le64(uint64_t v)
+{
+#if defined(__BIG_ENDIAN__) || \
+    (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+    v = ((v & 0x00000000ffffffffULL) << 32) | (v >> 32);
+    v = ((v & 0x0000ffff0000ffffULL) << 16) |
+        ((v >> 16) & 0x0000ffff0000ffffULL);
+    v = ((v & 0x00ff00ff00ff00ffULL) << 8) |
+        ((v >> 8) & 0x00ff00ff00ff00ffULL);
+#endif
+    return v;
+}
+
+static inline unsigned char
+verybigfs_byte(uint64_t key, off_t offset)
+{
+    uint64_t word = ((uint64_t)offset >> 3) ^ key;
+
+    return (unsigned char)(word >> (8 * (offset & 7)));
+}
+
+static inline void
+verybigfs_fill(char *buf, size_t size, off_t offset, uint64_t key)
+{
+    uint64_t n;
+
+    while (size && (offset & 7)) {
+        *buf++ = verybigfs_byte(key, offset++);
+        size--;
+    }
+
+    for (n = (uint64_t)offset >> 3; size >= 8; n++, size -= 8, buf += 8) {
+        uint64_t v = verybigfs_le64(n ^ key);
+        memcpy(buf, &v, 8);
+    }
+    offset = (off_t)(n << 3);
+
+    while (size--) {
+        *buf++ = verybigfs_byte(key, offset++);
+    }
+}
+
+/* Returns the offset of the first byte that's wrong, or -1. */
+static inline off_t
+verybigfs_check(const char *buf, size_t size, off_t offset, uint64_t key)
+{
+    size_t i;
+
+    for (i = 0; (i < size) && ((offset + i) & 7); i++) {
+        if ((unsigned char)buf[i] != verybigfs_byte(key, offset + i)) {
+            return offset + i;
+        }
+    }
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v = verybigfs_le64((((uint64_t)offset + i) >> 3) ^ key);
+        if (memcmp(buf + i, &v, 8) != 0) {
+            break; /* find the byte below */
+        }
+    }
+
+    for (; i < size; i++) {
+        if ((unsigned char)buf[i] != verybigfs_byte(key, offset + i)) {
+            return offset + i;
+        }
+    }
+
+    return -1;
+}
+
+#endif /* _VERYBIGFS_PATTERN_H */
@@ -0,0 +1,187 @@
+// Tests ancientfs's checksum kernels and header field parser, every
+// implementation that can run on this machine, against the scalar code they
+// replaced, on random input.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+
+extern "C" {
+#include "ancientfs_cksum.h"
+}
+
+using std::cout;
+using std::endl;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+
+static const char *kImpls[] = { "scalar", "sse2", "avx2", "neon" };
+
+// What ancientfs_tar_chksum() did, after blanking the checksum field.
+static long old_tar_sum(const char *p, size_t n) {
+  long i = 0;
+  for (const char *cp = p; cp < p + n; cp++)
+    i += *cp;
+  return i;
+}
+
+// What ancientfs_dump_cksum() and ancientfs_tp_cksum() did: the words are
+// taken in the data's byte order, whatever the host's.
+static uint16_t old_word_sum(const uint8_t *p, size_t n, int bigendian) {
+  uint16_t sum = 0;
+  for (size_t i = 0; i < n; i++, p += 2)
+    sum += bigendian ? (uint16_t)((p[0] << 8) | p[1]) :
+                       (uint16_t)((p[1] << 8) | p[0]);
+  return sum;
+}
+
+static int host_is_bigendian() {
+  uint16_t probe = 1;
+  return *(uint8_t *)&probe == 0;
+}
+
+// What TAR_ATOI() and friends did.
+static long old_atoi(const char *from, size_t len, int base) {
+  char buf[20];
+  memmove(buf, from, len);
+  buf[len] = '\0';
+  return strtol(buf, (char **)NULL, base);
+}
+
+static void fill_random(uint8_t *p, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    p[i] = random();
+}
+
+void testBytesumMatchesCharLoop(const char *impl) {
+  cout << "testBytesumMatchesCharLoop(" << impl << ")... " << std::flush;
+  static uint8_t buf[4096 + 64];
+
+  for (int round = 0; round < 20000; round++) {
+    size_t off = random() % 64;
+    size_t n = (round % 10 == 0) ? 512 : random() % 4096;
+    fill_random(buf + off, n);
+
+    long want_signed = 0, want_unsigned = 0;
+    for (size_t i = 0; i < n; i++) {
+      want_signed += (int8_t)buf[off + i];
+      want_unsigned += buf[off + i];
+    }
+    ASSERT_EQ(ancientfs_bytesum(buf + off, n, 1), want_signed);
+    ASSERT_EQ(ancientfs_bytesum(buf + off, n, 0), want_unsigned);
+    ASSERT_EQ(ancientfs_bytesum(buf + off, n, (char)-1 < 0),
+              old_tar_sum((const char *)buf + off, n));
+  }
+
+  // all high bits, where signed and unsigned differ the most
+  memset(buf, 0xff, 512);
+  ASSERT_EQ(ancientfs_bytesum(buf, 512, 1), -512L);
+  ASSERT_EQ(ancientfs_bytesum(buf, 512, 0), 512L * 255);
+  ASSERT_EQ(ancientfs_bytesum(buf, 0, 1), 0L);
+  cout << "OK" << endl;
+}
+
+void testWordsumMatchesWordLoop(const char *impl) {
+  cout << "testWordsumMatchesWordLoop(" << impl << ")... " << std::flush;
+  static uint8_t buf[2 * 2048 + 64];
+
+  for (int round = 0; round < 20000; round++) {
+    size_t off = random() % 64;  // odd offsets too
+    size_t n = (round % 10 == 0) ? 256 : random() % 2048;
+    int bigendian = random() & 1;
+    int swap = (bigendian != host_is_bigendian());
+    fill_random(buf + off, 2 * n);
+    ASSERT_EQ(ancientfs_wordsum(buf + off, n, swap),
+              old_word_sum(buf + off, n, bigendian));
+  }
+
+  // a tape directory entry whose checksum word zeroes the sum
+  uint8_t ent[64];
+  fill_random(ent, sizeof(ent));
+  for (int bigendian = 0; bigendian <= 1; bigendian++) {
+    memset(ent + 62, 0, 2);
+    uint16_t need = -old_word_sum(ent, 32, bigendian);
+    ent[62] = bigendian ? need >> 8 : need & 0xff;
+    ent[63] = bigendian ? need & 0xff : need >> 8;
+    ASSERT_EQ(ancientfs_wordsum(ent, 32, bigendian != host_is_bigendian()),
+              (uint16_t)0);
+  }
+  cout << "OK" << endl;
+}
+
+// The parser is the same whatever the kernels.
+void testAtoiMatchesStrtol() {
+  cout << "testAtoiMatchesStrtol... " << std::flush;
+  static const char kAlphabet[] = "0123456789abcdefABCDEFxXgz +-\t\n\v\f\r\0";
+  static const int kBases[] = { 8, 10, 16 };
+  char field[20];
+
+  for (int round = 0; round < 300000; round++) {
+    size_t len = 1 + random() % (sizeof(field) - 1);
+    int base = kBases[random() % 3];
+    int style = random() % 4;
+    for (size_t i = 0; i < len; i++) {
+      switch (style) {
+      case 0:  // anything
+        field[i] = kAlphabet[random() % (sizeof(kAlphabet) - 1)];
+        break;
+      case 1:  // digits, the way archives write them
+        field[i] = "0123456789abcdef"[random() % base];
+        break;
+      case 2:  // padded on the left, terminated on the right
+        field[i] = (i < len / 3) ? ' ' :
+                   (i + 1 == len) ? "\0 "[random() % 2] :
+                   "0123456789abcdef"[random() % base];
+        break;
+      default:  // raw bytes
+        field[i] = random();
+        break;
+      }
+    }
+    ASSERT_EQ(ancientfs_atoi(field, len, base), old_atoi(field, len, base));
+  }
+
+  // fields too big for a long come out as LONG_MAX either way
+  const char *big[] = { "9999999999999999999", "ffffffffffffffffff",
+                        "7777777777777777777", "777777777777",
+                        "-123", "0x1f", " 0X1F", "+17" };
+  for (size_t i = 0; i < sizeof(big) / sizeof(big[0]); i++)
+    for (size_t b = 0; b < 3; b++)
+      ASSERT_EQ(ancientfs_atoi(big[i], strlen(big[i]), kBases[b]),
+                old_atoi(big[i], strlen(big[i]), kBases[b]));
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  cout << "kernels picked: " << ancientfs_cksum_impl() << endl;
+
+  for (size_t i = 0; i < sizeof(kImpls) / sizeof(kImpls[0]); i++) {
+    if (ancientfs_cksum_use(kImpls[i]) != 0) {
+      cout << kImpls[i] << ": can't run here, skipped" << endl;
+      continue;
+    }
+    srandom(i + 1);
+    testBytesumMatchesCharLoop(kImpls[i]);
+    testWordsumMatchesWordLoop(kImpls[i]);
+  }
+  testAtoiMatchesStrtol();
+
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Tests that ancientfs's cpio back-ends make one file of a hard-linked
+// file's names: one inode number, a link count that is the number of its
+// names, and its data whichever name came with it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+
+extern "C" {
+#include "unixfs.h"
+
+extern struct unixfs unixfs_cpio_newc;
+extern struct unixfs unixfs_cpio_odc;
+
+// The daemon's counters live in unixfs.c, which isn't linked here.
+struct unixfs_stats unixfs_stats;
+}
+
+using std::cout;
+using std::endl;
+using std::string;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+
+static const ino_t kRootIno = 1;  // MACFUSE_ROOTINO
+
+// The members of every archive: "a" and "d/b" (and, in newc, "d/c", whose
+// data it carries) are one file; so are "x" and "y", in different
+// directories of the archive's, on different devices than "a"; "lone" is
+// on its own.
+struct member {
+  const char *name;
+  unsigned dev, ino, mode, nlink;
+  const char *data;
+};
+
+static const char kData[] = "hard-linked data\n";
+
+static const member kMembers[] = {
+  { "d", 1, 10, 040755, 2, "" },
+  { "a", 1, 11, 0100644, 3, kData },
+  { "d/b", 1, 11, 0100644, 3, kData },
+  { "x", 2, 11, 0100600, 2, "x\n" },
+  { "d/c", 1, 11, 0100644, 3, kData },
+  { "lone", 1, 12, 0100644, 1, "lone\n" },
+  { "d/y", 2, 11, 0100600, 2, "x\n" },
+};
+
+static const size_t kNMembers = sizeof(kMembers) / sizeof(kMembers[0]);
+
+static void pad4(string *out) {
+  out->append((4 - out->size() % 4) % 4, '\0');
+}
+
+// newc: a hard-linked file's data comes with its last name only.
+static void newc_member(string *out, const member &m, const string &data) {
+  char h[111];
+  snprintf(h, sizeof(h),
+           "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+           m.ino, m.mode, 3, 4, m.nlink, 1000000, (unsigned)data.size(), 0,
+           m.dev, 0, 0, (unsigned)strlen(m.name) + 1, 0);
+  out->append(h, 110);
+  out->append(m.name, strlen(m.name) + 1);
+  pad4(out);
+  out->append(data);
+  pad4(out);
+}
+
+static string make_newc() {
+  string cpio;
+  for (size_t i = 0; i < kNMembers; i++) {
+    const member &m = kMembers[i];
+    bool last = true;
+    for (size_t j = i + 1; j < kNMembers; j++)
+      if (kMembers[j].dev == m.dev && kMembers[j].ino == m.ino)
+        last = false;
+    newc_member(&cpio, m, last ? m.data : "");
+  }
+  member trailer = { "TRAILER!!!", 0, 0, 0, 1, "" };
+  newc_member(&cpio, trailer, "");
+  return cpio;
+}
+
+// odc: every name comes with the data.
+static void odc_member(string *out, const member &m) {
+  char h[77];
+  snprintf(h, sizeof(h), "070707%06o%06o%06o%06o%06o%06o%06o%011o%06o%011o",
+           m.dev, m.ino, m.mode, 3, 4, m.nlink, 0, 1000000,
+           (unsigned)strlen(m.name) + 1, (unsigned)strlen(m.data));
+  out->append(h, 76);
+  out->append(m.name, strlen(m.name) + 1);
+  out->append(m.data);
+}
+
+static string make_odc() {
+  string cpio;
+  for (size_t i = 0; i < kNMembers; i++)
+    odc_member(&cpio, kMembers[i]);
+  member trailer = { "TRAILER!!!", 0, 0, 0, 1, "" };
+  odc_member(&cpio, trailer);
+  return cpio;
+}
+
+struct archive {
+  struct unixfs fs;
+  struct unixfs_inodelayer *il;
+};
+
+static void archive_open(archive *a, struct unixfs *fs, const string &data) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ancientfs_cpio_test.XXXXXX");
+  int fd = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+  close(fd);
+
+  a->fs = *fs;
+  a->il = unixfs_inodelayer_create(0);
+  ASSERT_NE(a->il, (struct unixfs_inodelayer *)NULL);
+  unixfs_inodelayer_attach(a->il);
+  a->fs.filsys = a->fs.ops->init(path, 0, UNIXFS_FS_INVALID, &a->fs.fsname,
+                                 &a->fs.volname);
+  ASSERT_NE(a->fs.filsys, (void *)NULL);
+  unlink(path);  // the back-end has it open
+}
+
+static void archive_close(archive *a) {
+  a->fs.ops->fini(a->fs.filsys);
+  unixfs_inodelayer_destroy(a->il);
+}
+
+static ino_t lookup(archive *a, const string &path, struct stat *st) {
+  ino_t ino = kRootIno;
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == string::npos)
+      end = path.size();
+    if (a->fs.ops->namei(ino, path.substr(start, end - start).c_str(), st))
+      return 0;
+    ino = st->st_ino;
+    start = end + 1;
+  }
+  return ino;
+}
+
+static string contents(archive *a, ino_t ino, size_t size) {
+  struct inode *ip = a->fs.ops->iget(ino);
+  ASSERT_NE(ip, (struct inode *)NULL);
+  string buf(size, '\0');
+  int error = 0;
+  ASSERT_EQ(a->fs.ops->pbread(ip, &buf[0], size, 0, &error), (ssize_t)size);
+  a->fs.ops->iput(ip);
+  return buf;
+}
+
+// What readdir gives for name in dir.
+static ino_t listed(archive *a, ino_t dir, const string &name) {
+  struct inode *dp = a->fs.ops->iget(dir);
+  ASSERT_NE(dp, (struct inode *)NULL);
+  struct unixfs_dirbuf dirbuf;
+  struct unixfs_direntry dents[UNIXFS_DIRBATCH];
+  off_t offset = 0;
+  ino_t found = 0;
+  int n;
+  memset(&dirbuf.flags, 0, sizeof(dirbuf.flags));
+  while ((n = a->fs.ops->readdir_batch(dp, &dirbuf, &offset, dents,
+                                       UNIXFS_DIRBATCH)) > 0)
+    for (int i = 0; i < n; i++)
+      if (name == dents[i].name)
+        found = dents[i].ino;
+  a->fs.ops->iput(dp);
+  return found;
+}
+
+static void check_links(const char *what, struct unixfs *fs,
+                        const string &cpio) {
+  cout << "testHardLinksShareOneInode(" << what << ")... " << std::flush;
+  archive a;
+  archive_open(&a, fs, cpio);
+
+  struct stat st, first;
+  ino_t d = lookup(&a, "d", &st);
+  ASSERT_NE(d, (ino_t)0);
+
+  ASSERT_NE(lookup(&a, "a", &first), (ino_t)0);
+  ASSERT_EQ(first.st_nlink, (nlink_t)3);
+  ASSERT_EQ(first.st_size, (off_t)strlen(kData));
+  ASSERT_EQ(contents(&a, first.st_ino, first.st_size), string(kData));
+  const char *names[] = { "d/b", "d/c" };
+  for (size_t i = 0; i < 2; i++) {
+    ASSERT_EQ(lookup(&a, names[i], &st), first.st_ino);
+    ASSERT_EQ(st.st_nlink, (nlink_t)3);
+  }
+  ASSERT_EQ(listed(&a, d, "b"), first.st_ino);
+  ASSERT_EQ(listed(&a, kRootIno, "a"), first.st_ino);
+
+  // the same inode number on another device is another file
+  ASSERT_NE(lookup(&a, "x", &st), (ino_t)0);
+  ASSERT_NE(st.st_ino, first.st_ino);
+  ASSERT_EQ(st.st_nlink, (nlink_t)2);
+  ASSERT_EQ(lookup(&a, "d/y", &first), st.st_ino);
+  ASSERT_EQ(contents(&a, st.st_ino, st.st_size), string("x\n"));
+
+  ASSERT_NE(lookup(&a, "lone", &st), (ino_t)0);
+  ASSERT_EQ(st.st_nlink, (nlink_t)1);
+  ASSERT_EQ(contents(&a, st.st_ino, st.st_size), string("lone\n"));
+
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  unixfs_scanner_enable();
+  check_links("newc", &unixfs_cpio_newc, make_newc());
+  check_links("odc", &unixfs_cpio_odc, make_odc());
+  return 0;
+}
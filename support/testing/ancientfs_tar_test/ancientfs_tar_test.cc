@@ -0,0 +1,489 @@
+// Tests ancientfs's tar back-end on archives in the formats that came after
+// ustar: GNU long names, POSIX.1-2001 extended headers, and sparse files in
+// old GNU and every pax form GNU tar writes, checking what's listed, what
+// the files' attributes are, and what reading them, holes and all, returns.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "unixfs.h"
+
+extern struct unixfs unixfs_tar;
+
+// The daemon's counters live in unixfs.c, which isn't linked here.
+struct unixfs_stats unixfs_stats;
+}
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+
+static const ino_t kRootIno = 1;  // MACFUSE_ROOTINO
+static const uint64_t kGiB = 1024ULL * 1024 * 1024;
+
+static long mtime_nsec(const struct stat &st) {
+#if __linux__
+  return st.st_mtim.tv_nsec;
+#else
+  return st.st_mtimespec.tv_nsec;
+#endif
+}
+
+// Archives.
+
+enum magic { kV7, kPosix, kGnu };
+
+struct member {
+  string name;
+  char type;
+  uint64_t size;           // in the header; 0 if only pax has it
+  string linkname;
+  string prefix;           // POSIX ustar only
+  uint64_t realsize;       // old GNU sparse files
+  bool base256;            // size and realsize in GNU's base-256
+  member(const string &n, char t, uint64_t s)
+      : name(n), type(t), size(s), realsize(0), base256(false) {}
+};
+
+static void put_octal(char *field, size_t len, uint64_t v) {
+  snprintf(field, len, "%0*llo", (int)len - 1, (unsigned long long)v);
+}
+
+static void put_base256(char *field, size_t len, uint64_t v) {
+  memset(field, 0, len);
+  for (size_t i = len - 1; i > 0; i--, v >>= 8)
+    field[i] = v & 0xff;
+  field[0] = (char)0x80;
+}
+
+static void checksum(char *h) {
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (size_t i = 0; i < 512; i++)
+    sum += (unsigned char)h[i];
+  snprintf(h + 148, 8, "%06o", sum);
+}
+
+typedef vector<std::pair<uint64_t, uint64_t> > sparse_map;
+
+static void header(string *out, magic m, const member &mb,
+                   const sparse_map &gnumap = sparse_map()) {
+  char h[512];
+  memset(h, 0, sizeof(h));
+  memcpy(h, mb.name.data(), min(mb.name.size(), (size_t)100));
+  put_octal(h + 100, 8, mb.type == '5' ? 0755 : 0644);
+  put_octal(h + 108, 8, 3);
+  put_octal(h + 116, 8, 4);
+  if (mb.base256)
+    put_base256(h + 124, 12, mb.size);
+  else
+    put_octal(h + 124, 12, mb.size);
+  put_octal(h + 136, 12, 1000000);
+  h[156] = mb.type;
+  memcpy(h + 157, mb.linkname.data(),
+         min(mb.linkname.size(), (size_t)100));
+  if (m == kPosix) {
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memcpy(h + 345, mb.prefix.data(), mb.prefix.size());
+  } else if (m == kGnu) {
+    memcpy(h + 257, "ustar  ", 8);
+  }
+
+  // old GNU sparse files: four runs here, 21 in each block after
+  size_t n = 0;
+  for (; n < gnumap.size() && n < 4; n++) {
+    put_octal(h + 386 + n * 24, 12, gnumap[n].first);
+    put_octal(h + 386 + n * 24 + 12, 12, gnumap[n].second);
+  }
+  if (mb.type == 'S') {
+    h[482] = n < gnumap.size();
+    if (mb.base256)
+      put_base256(h + 483, 12, mb.realsize);
+    else
+      put_octal(h + 483, 12, mb.realsize);
+  }
+  checksum(h);
+  out->append(h, sizeof(h));
+
+  while (n < gnumap.size()) {
+    char x[512];
+    memset(x, 0, sizeof(x));
+    for (size_t i = 0; i < 21 && n < gnumap.size(); i++, n++) {
+      put_octal(x + i * 24, 12, gnumap[n].first);
+      put_octal(x + i * 24 + 12, 12, gnumap[n].second);
+    }
+    x[504] = n < gnumap.size();
+    out->append(x, sizeof(x));
+  }
+}
+
+static void data(string *out, const string &d) {
+  out->append(d);
+  out->append((512 - d.size() % 512) % 512, '\0');
+}
+
+static void file(string *out, magic m, const string &name, const string &d) {
+  header(out, m, member(name, '0', d.size()));
+  data(out, d);
+}
+
+// "length key=value\n", the length counting itself
+static string pax_record(const string &key, const string &value) {
+  size_t len = key.size() + value.size() + 3;
+  for (;;) {
+    char n[32];
+    snprintf(n, sizeof(n), "%zu", len);
+    if (strlen(n) + key.size() + value.size() + 3 == len)
+      return string(n) + " " + key + "=" + value + "\n";
+    len = strlen(n) + key.size() + value.size() + 3;
+  }
+}
+
+static void extension(string *out, char type, const string &d) {
+  header(out, kPosix, member("././@PaxHeader", type, d.size()));
+  data(out, d);
+}
+
+static string decimal(uint64_t v) {
+  char n[32];
+  snprintf(n, sizeof(n), "%llu", (unsigned long long)v);
+  return n;
+}
+
+// Sparse files: what's at each byte, and what of it is stored.
+
+static char sparse_byte(uint64_t pos) {
+  return (char)(1 + pos % 251);  // never 0, so holes can't pass for data
+}
+
+static string sparse_stored(const sparse_map &map) {
+  string s;
+  for (size_t i = 0; i < map.size(); i++)
+    for (uint64_t p = map[i].first; p < map[i].first + map[i].second; p++)
+      s += sparse_byte(p);
+  return s;
+}
+
+static char sparse_want(const sparse_map &map, uint64_t pos) {
+  for (size_t i = 0; i < map.size(); i++)
+    if (pos >= map[i].first && pos < map[i].first + map[i].second)
+      return sparse_byte(pos);
+  return 0;
+}
+
+// An archive opened the way unixfs.c opens one, scanned all the way.
+
+struct archive {
+  string path;
+  struct unixfs fs;
+  struct unixfs_inodelayer *il;
+};
+
+static void archive_open(archive *a, const string &tar) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ancientfs_tar_test.XXXXXX");
+  int fd = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(write(fd, tar.data(), tar.size()), (ssize_t)tar.size());
+  close(fd);
+
+  a->path = path;
+  a->fs = unixfs_tar;
+  a->il = unixfs_inodelayer_create(0);
+  ASSERT_NE(a->il, (struct unixfs_inodelayer *)NULL);
+  unixfs_inodelayer_attach(a->il);
+  a->fs.filsys = a->fs.ops->init(a->path.c_str(), 0, UNIXFS_FS_INVALID,
+                                 &a->fs.fsname, &a->fs.volname);
+  ASSERT_NE(a->fs.filsys, (void *)NULL);
+  unlink(a->path.c_str());  // the back-end has it open
+}
+
+static void archive_close(archive *a) {
+  a->fs.ops->fini(a->fs.filsys);
+  unixfs_inodelayer_destroy(a->il);
+}
+
+// Looks a path up from the root; returns 0 if it isn't there.
+static ino_t lookup(archive *a, const string &path, struct stat *st) {
+  ino_t ino = kRootIno;
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == string::npos)
+      end = path.size();
+    if (a->fs.ops->namei(ino, path.substr(start, end - start).c_str(), st))
+      return 0;
+    ino = st->st_ino;
+    start = end + 1;
+  }
+  return ino;
+}
+
+static string read_file(archive *a, ino_t ino, uint64_t off, size_t count) {
+  struct inode *ip = a->fs.ops->iget(ino);
+  ASSERT_NE(ip, (struct inode *)NULL);
+  string buf(count, 'X');
+  int error = 0;
+  ssize_t nr = a->fs.ops->pbread(ip, &buf[0], count, off, &error);
+  a->fs.ops->iput(ip);
+  ASSERT_EQ(nr, (ssize_t)count);
+  ASSERT_EQ(error, 0);
+  return buf;
+}
+
+static string contents(archive *a, const string &path) {
+  struct stat st;
+  ino_t ino = lookup(a, path, &st);
+  ASSERT_NE(ino, (ino_t)0);
+  ASSERT_EQ(S_ISREG(st.st_mode), true);
+  return st.st_size ? read_file(a, ino, 0, st.st_size) : string();
+}
+
+static string long_name(const string &dir, char c, size_t n) {
+  return dir + string(n, c);
+}
+
+void testGnuLongNames() {
+  cout << "testGnuLongNames... " << std::flush;
+  string dir = long_name("", 'd', 90) + "/" + long_name("", 'e', 90);
+  string name = dir + "/" + long_name("", 'n', 120);
+  string target = long_name("../", 't', 150);
+
+  string tar;
+  header(&tar, kGnu, member("././@LongLink", 'L', name.size() + 1));
+  data(&tar, name + '\0');
+  file(&tar, kGnu, name.substr(0, 100), "long\n");
+  header(&tar, kGnu, member("././@LongLink", 'L', dir.size() + 6));
+  data(&tar, dir + "/link" + '\0');
+  header(&tar, kGnu, member("././@LongLink", 'K', target.size() + 1));
+  data(&tar, target + '\0');
+  member link(dir.substr(0, 100), '2', 0);
+  link.linkname = target.substr(0, 100);
+  header(&tar, kGnu, link);
+  file(&tar, kGnu, "after", "after\n");
+  tar.append(1024, '\0');
+
+  archive a;
+  archive_open(&a, tar);
+  struct stat st;
+  ASSERT_EQ(contents(&a, name), string("long\n"));
+  ino_t ino = lookup(&a, dir + "/link", &st);
+  ASSERT_NE(ino, (ino_t)0);
+  ASSERT_EQ(S_ISLNK(st.st_mode), true);
+  char path[UNIXFS_MAXPATHLEN];
+  ASSERT_EQ(a.fs.ops->readlink(ino, path), 0);
+  ASSERT_EQ(string(path), target);
+  ASSERT_EQ(contents(&a, "after"), string("after\n"));
+  // the extension headers' data wasn't taken for members
+  ASSERT_EQ(lookup(&a, "././@LongLink", &st), (ino_t)0);
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+void testPaxHeaders() {
+  cout << "testPaxHeaders... " << std::flush;
+  string name = long_name("p/", 'x', 200);
+
+  string tar;
+  extension(&tar, 'g', pax_record("uid", "77") + pax_record("gid", "88"));
+  extension(&tar, 'x', pax_record("path", name) +
+                       pax_record("mtime", "1234567890.123456789") +
+                       pax_record("size", "6") +
+                       pax_record("uid", "1001"));
+  header(&tar, kPosix, member("short", '0', 0));  // pax has the size
+  data(&tar, "paxed\n");
+  extension(&tar, 'x', pax_record("mtime", "-1.25"));
+  file(&tar, kPosix, "old", "old\n");
+  tar.append(1024, '\0');
+
+  archive a;
+  archive_open(&a, tar);
+  struct stat st;
+  ASSERT_NE(lookup(&a, name, &st), (ino_t)0);
+  ASSERT_EQ(st.st_size, (off_t)6);
+  ASSERT_EQ(st.st_mtime, (time_t)1234567890);
+  ASSERT_EQ(mtime_nsec(st), 123456789L);
+  ASSERT_EQ(st.st_uid, (uid_t)1001);   // this file's, over the global one
+  ASSERT_EQ(st.st_gid, (gid_t)88);
+  ASSERT_EQ(contents(&a, name), string("paxed\n"));
+  ASSERT_NE(lookup(&a, "old", &st), (ino_t)0);
+  ASSERT_EQ(st.st_mtime, (time_t)-2);
+  ASSERT_EQ(mtime_nsec(st), 750000000L);
+  ASSERT_EQ(st.st_uid, (uid_t)77);
+  ASSERT_EQ(lookup(&a, "short", &st), (ino_t)0);
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+void testUstarPrefixAndImplicitDirectories() {
+  cout << "testUstarPrefixAndImplicitDirectories... " << std::flush;
+  string tar;
+  member m("c", '0', 3);
+  m.prefix = "a/b";
+  header(&tar, kPosix, m);
+  data(&tar, "abc");
+  tar.append(1024, '\0');
+
+  archive a;
+  archive_open(&a, tar);
+  struct stat st;
+  ASSERT_NE(lookup(&a, "a", &st), (ino_t)0);
+  ASSERT_EQ(S_ISDIR(st.st_mode), true);
+  ASSERT_NE(lookup(&a, "a/b", &st), (ino_t)0);
+  ASSERT_EQ(S_ISDIR(st.st_mode), true);
+  ASSERT_EQ(contents(&a, "a/b/c"), string("abc"));
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+void testLaterMemberReplacesEarlier() {
+  cout << "testLaterMemberReplacesEarlier... " << std::flush;
+  string tar;
+  file(&tar, kPosix, "f", "first version\n");
+  header(&tar, kPosix, member("d/", '5', 0));
+  file(&tar, kPosix, "f", string(1000, 'z'));  // its data isn't headers
+  file(&tar, kPosix, "g", "g\n");
+  tar.append(1024, '\0');
+
+  archive a;
+  archive_open(&a, tar);
+  ASSERT_EQ(contents(&a, "f"), string(1000, 'z'));
+  ASSERT_EQ(contents(&a, "g"), string("g\n"));
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+// A map with holes everywhere: first, between runs, and last, past 8 GiB.
+static sparse_map big_map(size_t runs) {
+  sparse_map map;
+  for (size_t i = 0; i < runs; i++)
+    map.push_back(std::make_pair(4096 + i * 3 * kGiB / runs,
+                                 (uint64_t)(1000 + i * 517)));
+  return map;
+}
+
+static void check_sparse(archive *a, const string &name, uint64_t size,
+                         const sparse_map &map) {
+  struct stat st;
+  ino_t ino = lookup(a, name, &st);
+  ASSERT_NE(ino, (ino_t)0);
+  ASSERT_EQ((uint64_t)st.st_size, size);
+  uint64_t stored = sparse_stored(map).size();
+  ASSERT_EQ((uint64_t)st.st_blocks, (stored + 511) / 512);
+
+  // around the start and the end of every run, and far out in the holes
+  vector<uint64_t> offs;
+  offs.push_back(0);
+  offs.push_back(size - 700);
+  for (size_t i = 0; i < map.size(); i++) {
+    offs.push_back(map[i].first - 300);
+    offs.push_back(map[i].first + map[i].second - 300);
+    offs.push_back(map[i].first + map[i].second + kGiB / 3);
+  }
+  for (size_t i = 0; i < offs.size(); i++) {
+    uint64_t off = min(offs[i], size - 700);
+    string got = read_file(a, ino, off, 700);
+    for (size_t j = 0; j < got.size(); j++)
+      ASSERT_EQ((int)got[j], (int)sparse_want(map, off + j));
+  }
+}
+
+void testSparseFiles() {
+  cout << "testSparseFiles... " << std::flush;
+  const uint64_t size = 9 * kGiB;  // too big for octal
+  sparse_map map = big_map(30);    // too many for an old GNU header
+  string stored = sparse_stored(map);
+
+  string tar;
+
+  // old GNU, its map running on into extension blocks
+  member gnu("gnu", 'S', stored.size());
+  gnu.realsize = size;
+  gnu.base256 = true;
+  sparse_map gnumap = map;
+  gnumap.push_back(std::make_pair(size, (uint64_t)0));  // ends in a hole
+  header(&tar, kGnu, gnu, gnumap);
+  data(&tar, stored);
+
+  // pax 0.0: pairs of keywords
+  string rec = pax_record("GNU.sparse.size", decimal(size)) +
+               pax_record("GNU.sparse.numblocks", decimal(map.size()));
+  for (size_t i = 0; i < map.size(); i++)
+    rec += pax_record("GNU.sparse.offset", decimal(map[i].first)) +
+           pax_record("GNU.sparse.numbytes", decimal(map[i].second));
+  extension(&tar, 'x', rec);
+  file(&tar, kPosix, "pax00", stored);
+
+  // pax 0.1: one keyword
+  string list;
+  for (size_t i = 0; i < map.size(); i++)
+    list += (i ? "," : "") + decimal(map[i].first) + "," +
+            decimal(map[i].second);
+  extension(&tar, 'x', pax_record("GNU.sparse.size", decimal(size)) +
+                       pax_record("GNU.sparse.map", list));
+  file(&tar, kPosix, "pax01", stored);
+
+  // pax 1.0: the map leads the data, in blocks of its own
+  string lead = decimal(map.size()) + "\n";
+  for (size_t i = 0; i < map.size(); i++)
+    lead += decimal(map[i].first) + "\n" + decimal(map[i].second) + "\n";
+  lead.append((512 - lead.size() % 512) % 512, '\0');
+  extension(&tar, 'x', pax_record("GNU.sparse.major", "1") +
+                       pax_record("GNU.sparse.minor", "0") +
+                       pax_record("GNU.sparse.name", "pax10") +
+                       pax_record("GNU.sparse.realsize", decimal(size)));
+  file(&tar, kPosix, "GNUSparseFile.0/pax10", lead + stored);
+
+  file(&tar, kPosix, "after", "after\n");
+  tar.append(1024, '\0');
+
+  archive a;
+  archive_open(&a, tar);
+  check_sparse(&a, "gnu", size, map);
+  check_sparse(&a, "pax00", size, map);
+  check_sparse(&a, "pax01", size, map);
+  check_sparse(&a, "pax10", size, map);
+  ASSERT_EQ(contents(&a, "after"), string("after\n"));
+  struct stat st;
+  ASSERT_EQ(lookup(&a, "GNUSparseFile.0", &st), (ino_t)0);
+  archive_close(&a);
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  unixfs_scanner_enable();
+  testGnuLongNames();
+  testPaxHeaders();
+  testUstarPrefixAndImplicitDirectories();
+  testLaterMemberReplacesEarlier();
+  testSparseFiles();
+  return 0;
+}
@@ -0,0 +1,206 @@
+// Tests for the loopback file systems' write-back cache, against real files
+// in a temporary directory, and against a model of what they should hold.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+
+extern "C" {
+#include "loopback_wb.h"
+}
+
+using std::cout;
+using std::endl;
+using std::string;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+
+static string dir;
+
+static string path_of(const char *name) {
+  return dir + "/" + name;
+}
+
+static int open_registered(const string &path, int flags) {
+  int fd = open(path.c_str(), flags, 0644);
+  ASSERT_EQ(fd >= 0, true);
+  ASSERT_EQ(loopback_wb_open(fd), 0);
+  return fd;
+}
+
+static void release(int fd) {
+  ASSERT_EQ(loopback_wb_release(fd), 0);
+  close(fd);
+}
+
+// What the host itself says, bypassing the cache.
+static off_t host_size(const string &path) {
+  struct stat st;
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  return st.st_size;
+}
+
+void testSmallWritesStayInMemory() {
+  cout << "testSmallWritesStayInMemory... " << std::flush;
+  string path = path_of("log");
+  int fd = open_registered(path, O_RDWR | O_CREAT | O_TRUNC);
+
+  string expected;
+  for (int i = 0; i < 1000; i++) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "line %04d\n", i);
+    ASSERT_EQ(loopback_wb_pwrite(fd, line, n, expected.size()), (ssize_t)n);
+    expected += line;
+  }
+  ASSERT_EQ(host_size(path), (off_t)0);
+
+  // A stat of the file brings it up to date.
+  struct stat st;
+  ASSERT_EQ(fstat(fd, &st), 0);
+  ASSERT_EQ(loopback_wb_sync(st.st_dev, st.st_ino), 1);
+  ASSERT_EQ(host_size(path), (off_t)expected.size());
+  ASSERT_EQ(loopback_wb_sync(st.st_dev, st.st_ino), 0);
+
+  // So does a read; through a descriptor the cache doesn't know about, too.
+  ASSERT_EQ(loopback_wb_pwrite(fd, "LINE", 4, 0), (ssize_t)4);
+  int rd = open(path.c_str(), O_RDONLY);
+  ASSERT_EQ(loopback_wb_open(rd), 0);
+  char buf[8];
+  ASSERT_EQ(loopback_wb_pread(rd, buf, 8, 0), (ssize_t)8);
+  ASSERT_EQ(string(buf, 8), string("LINE 000"));
+  release(rd);
+
+  // And so do releases.
+  ASSERT_EQ(loopback_wb_pwrite(fd, "!", 1, expected.size()), (ssize_t)1);
+  release(fd);
+  ASSERT_EQ(host_size(path), (off_t)expected.size() + 1);
+  unlink(path.c_str());
+  cout << "OK" << endl;
+}
+
+void testHoleBeforePendingData() {
+  cout << "testHoleBeforePendingData... " << std::flush;
+  string path = path_of("sparse");
+  int fd = open_registered(path, O_RDWR | O_CREAT | O_TRUNC);
+
+  // Reading the hole must not find the end of the file instead.
+  ASSERT_EQ(loopback_wb_pwrite(fd, "x", 1, 10000), (ssize_t)1);
+  char buf[16];
+  memset(buf, 'y', sizeof(buf));
+  ASSERT_EQ(loopback_wb_pread(fd, buf, sizeof(buf), 100),
+            (ssize_t)sizeof(buf));
+  ASSERT_EQ(buf[0], '\0');
+  release(fd);
+  unlink(path.c_str());
+  cout << "OK" << endl;
+}
+
+void testAppendsAreWrittenThrough() {
+  cout << "testAppendsAreWrittenThrough... " << std::flush;
+  string path = path_of("append");
+  int fd = open_registered(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+  ASSERT_EQ(loopback_wb_pwrite(fd, "abc", 3, 0), (ssize_t)3);
+  ASSERT_EQ(host_size(path), (off_t)3);
+  release(fd);
+  unlink(path.c_str());
+  cout << "OK" << endl;
+}
+
+// Random writes through two descriptors, and reads, stats and truncations
+// through those and a third, checked against a model of the file.
+void testRandomAgainstModel() {
+  cout << "testRandomAgainstModel... " << std::flush;
+  const size_t kMax = 400000;
+  string path = path_of("random");
+
+  for (unsigned seed = 1; seed <= 4; seed++) {
+    srandom(seed);
+    string model;
+    int a = open_registered(path, O_RDWR | O_CREAT | O_TRUNC);
+    int b = open_registered(path, O_RDWR);
+    int r = open(path.c_str(), O_RDONLY);
+    char buf[10000];
+
+    for (int step = 0; step < 20000; step++) {
+      int fd = (random() & 1) ? a : b;
+      int what = random() % 100;
+      if (what < 60) {
+        off_t off = random() % 300000;
+        size_t n = 1 + random() % 5000;
+        for (size_t i = 0; i < n; i++)
+          buf[i] = random();
+        ASSERT_EQ(loopback_wb_pwrite(fd, buf, n, off), (ssize_t)n);
+        if (model.size() < off + n)
+          model.resize(off + n, '\0');
+        model.replace(off, n, buf, n);
+      } else if (what < 85) {
+        int fds[3] = { a, b, r };
+        off_t off = random() % (kMax - sizeof(buf));
+        size_t n = 1 + random() % sizeof(buf);
+        ssize_t got = loopback_wb_pread(fds[random() % 3], buf, n, off);
+        string want = ((size_t)off < model.size()) ? model.substr(off, n) : "";
+        ASSERT_EQ(got, (ssize_t)want.size());
+        ASSERT_EQ(memcmp(buf, want.data(), got), 0);
+      } else if (what < 95) {
+        struct stat st;
+        ASSERT_EQ(fstat(fd, &st), 0);
+        if (loopback_wb_sync(st.st_dev, st.st_ino) > 0)
+          ASSERT_EQ(fstat(fd, &st), 0);
+        ASSERT_EQ(st.st_size, (off_t)model.size());
+      } else {
+        size_t n = random() % 300000;
+        ASSERT_EQ(loopback_wb_flush(fd), 0);
+        ASSERT_EQ(ftruncate(fd, n), 0);
+        model.resize(n, '\0');
+      }
+    }
+
+    release(a);
+    release(b);
+    close(r);
+    ASSERT_EQ(host_size(path), (off_t)model.size());
+  }
+
+  unlink(path.c_str());
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  char tmpl[] = "/tmp/loopback_wb_test.XXXXXX";
+  if (mkdtemp(tmpl) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  dir = tmpl;
+
+  loopback_wb_init(1024 * 1024, 60 * 1000);
+
+  testSmallWritesStayInMemory();
+  testHoleBeforePendingData();
+  testAppendsAreWrittenThrough();
+  testRandomAgainstModel();
+
+  rmdir(dir.c_str());
+  return 0;
+}
@@ -0,0 +1,39 @@
+# Pulls the patterns out of procfs's dispatcher tables, so that the router
+# is tested against the same tables that procfs compiles at startup.
+#
+# Each pattern becomes PROCFS_PATTERN(table, flags, "pattern", argc).
+
+/^procfs_(file|directory|link)_table\[\] = \{/ {
+    table = $1
+    sub(/^procfs_/, "", table)
+    sub(/_table\[\]$/, "", table)
+    flags = "0"
+    next
+}
+
+/^};/ {
+    table = ""
+    next
+}
+
+table == "" {
+    next
+}
+
+/^        PROCFS_FLAG_/ {
+    flags = $1
+    sub(/,$/, "", flags)
+    next
+}
+
+/^        "\// {
+    pattern = $1
+    sub(/,$/, "", pattern)
+    getline
+    argc = $1
+    sub(/,$/, "", argc)
+    if (argc !~ /^[0-9]+$/)
+        argc = 0
+    printf("PROCFS_PATTERN(%s, %s, %s, %s)\n", table, flags, pattern, argc)
+    flags = "0"
+}
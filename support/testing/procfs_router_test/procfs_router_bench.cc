@@ -0,0 +1,82 @@
+// Replays a recorded trace of procfs paths against the router procfs used
+// before (a FullMatch per table entry, in table order) and the new one,
+// and reports the time per lookup.
+//
+// Usage: procfs_router_bench [trace [rounds]]
+
+#include <sys/time.h>
+
+#include <iostream>
+
+#include "procfs_router_test.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static double now_us() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+int main(int argc, char *argv[]) {
+  const char *trace = (argc > 1) ? argv[1] : "procfs_paths.trace";
+  int rounds = (argc > 2) ? atoi(argv[2]) : 20;
+  table_set tables;
+  vector<string> paths = load_trace(trace);
+  double t0, t_old, t_new;
+  long old_hits = 0, new_hits = 0, lookups;
+
+  t0 = now_us();
+  old_router reference(tables);
+  double build_old = now_us() - t0;
+
+  t0 = now_us();
+  new_router router(tables);
+  double build_new = now_us() - t0;
+
+  lookups = (long)paths.size() * rounds;
+
+  t0 = now_us();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < paths.size(); i++) {
+      int table, index;
+      string args[PROCFS_ROUTER_MAX_ARGS];
+      if (reference.lookup(paths[i].c_str(), &table, &index, args))
+        old_hits++;
+    }
+  }
+  t_old = now_us() - t0;
+
+  t0 = now_us();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < paths.size(); i++) {
+      int table;
+      procfs_route_match_t m;
+      if (router.lookup(paths[i].c_str(), &table, &m))
+        new_hits++;
+    }
+  }
+  t_new = now_us() - t0;
+
+  if (old_hits != new_hits) {
+    cout << "routers disagree: " << old_hits << " vs " << new_hits
+         << " matches" << endl;
+    return 1;
+  }
+
+  printf("%ld lookups (%zu paths x %d), %ld matched\n", lookups,
+         paths.size(), rounds, new_hits);
+#if HAVE_PCRECPP
+  printf("regex (pcrecpp):  build %8.0f us, %9.1f ns/lookup\n", build_old,
+#else
+  printf("regex (std):      build %8.0f us, %9.1f ns/lookup\n", build_old,
+#endif
+         t_old * 1000.0 / lookups);
+  printf("router:           build %8.0f us, %9.1f ns/lookup\n", build_new,
+         t_new * 1000.0 / lookups);
+  printf("speedup:          %.1fx\n", t_old / t_new);
+  return 0;
+}
@@ -0,0 +1,201 @@
+// Tests for procfs's path router. Checks the pattern subset it accepts, a
+// few routes by hand, and then that it routes every path in a recorded
+// trace the same way as the regular expressions it replaces.
+//
+// Usage: procfs_router_test [trace]
+
+#include <iostream>
+
+#include "procfs_router_test.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+
+static string describe(const route &r) {
+  string s;
+  if (r.table < 0)
+    return "(no match)";
+  s = all_patterns[r.index].pattern;
+  for (size_t i = 0; i < r.argv.size(); i++)
+    s += " [" + r.argv[i] + "]";
+  return s;
+}
+
+// Routes path and checks the pattern that won and what it captured.
+static void check_route(const new_router &router, const char *path,
+                        const char *expected, const char *arg0 = NULL,
+                        const char *arg1 = NULL, const char *arg2 = NULL) {
+  route r = router.resolve(path);
+  const char *args[] = { arg0, arg1, arg2 };
+
+  if (!expected) {
+    ASSERT_EQ(describe(r), string("(no match)"));
+    return;
+  }
+  ASSERT_NE(r.table, -1);
+  ASSERT_EQ(string(all_patterns[r.index].pattern), string(expected));
+  for (int i = 0; i < PROCFS_ROUTER_MAX_ARGS; i++) {
+    if (!args[i]) {
+      ASSERT_EQ(r.argv.size(), (size_t)i);
+      break;
+    }
+    ASSERT_EQ(r.argv[i], string(args[i]));
+  }
+}
+
+void testPatternSubset() {
+  cout << "testPatternSubset... " << std::flush;
+  procfs_router_t *r = procfs_router_create();
+
+  ASSERT_EQ(procfs_router_add(r, "/", 0), 0);
+  ASSERT_EQ(procfs_router_add(r, "/a/(\\d+)/b", 1), 1);
+  ASSERT_EQ(procfs_router_add(r, "/a/x(\\d+)y/(p|q[0-2])", 2), 2);
+  ASSERT_EQ(procfs_router_add(r, "/c/.*\\._.*|/\\d+/.*\\._.*", 3), 0);
+  ASSERT_EQ(procfs_router_add(r, "/d/(.+)", 4), 1);
+
+  // Unsupported: not anchored at /, nested groups, quantified groups,
+  // something after the rest of the path, more than three captures.
+  ASSERT_EQ(procfs_router_add(r, "a/b", 5), -1);
+  ASSERT_EQ(procfs_router_add(r, "/((a))", 5), -1);
+  ASSERT_EQ(procfs_router_add(r, "/(a)+", 5), -1);
+  ASSERT_EQ(procfs_router_add(r, "/(.+)/a", 5), -1);
+  ASSERT_EQ(procfs_router_add(r, "/(\\d+)/(\\d+)/(\\d+)/(\\d+)", 5), -1);
+  ASSERT_EQ(procfs_router_add(r, "/a|/(b)", 5), -1);
+
+  procfs_route_match_t m;
+  ASSERT_EQ(procfs_router_match(r, "/", &m), 1);
+  ASSERT_EQ(m.value, 0);
+  ASSERT_EQ(m.argc, 0);
+  ASSERT_EQ(procfs_router_match(r, "/a/123/b", &m), 1);
+  ASSERT_EQ(m.value, 1);
+  ASSERT_EQ(string(m.argv[0]), string("123"));
+  ASSERT_EQ(procfs_router_match(r, "/a/12x/b", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/a//b", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/a/123/b/", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/a/x7y/q2", &m), 1);
+  ASSERT_EQ(m.value, 2);
+  ASSERT_EQ(string(m.argv[0]), string("7"));
+  ASSERT_EQ(string(m.argv[1]), string("q2"));
+  ASSERT_EQ(procfs_router_match(r, "/a/xy/q2", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/a/x7y/q3", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/c/e/f/._g", &m), 1);
+  ASSERT_EQ(m.value, 3);
+  ASSERT_EQ(procfs_router_match(r, "/42/._g", &m), 1);
+  ASSERT_EQ(procfs_router_match(r, "/42/g", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "/d/e/f", &m), 1);
+  ASSERT_EQ(m.value, 4);
+  ASSERT_EQ(string(m.argv[0]), string("e/f"));
+  ASSERT_EQ(procfs_router_match(r, "/d/", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "", &m), 0);
+  ASSERT_EQ(procfs_router_match(r, "relative", &m), 0);
+
+  // The lowest value wins, whatever the order patterns were added in.
+  procfs_router_t *o = procfs_router_create();
+  ASSERT_EQ(procfs_router_add(o, "/(\\d+)/x", 9), 1);
+  ASSERT_EQ(procfs_router_add(o, "/\\d+/.*", 4), 0);
+  ASSERT_EQ(procfs_router_add(o, "/1/(x)", 6), 1);
+  ASSERT_EQ(procfs_router_match(o, "/1/x", &m), 1);
+  ASSERT_EQ(m.value, 4);
+  ASSERT_EQ(m.argc, 0);
+
+  // Captures longer than the match buffer are refused, not truncated.
+  string longpath = "/d/" + string(PROCFS_ROUTER_BUFSIZE, 'z');
+  ASSERT_EQ(procfs_router_match(r, longpath.c_str(), &m), 0);
+
+  procfs_router_destroy(o);
+  procfs_router_destroy(r);
+  cout << "OK" << endl;
+}
+
+void testProcfsTables(const table_set &tables) {
+  cout << "testProcfsTables... " << std::flush;
+  new_router router(tables);
+
+  check_route(router, "/", "/");
+  check_route(router, "/system/hardware/cpus/3", "/system/hardware/cpus/(\\d+)",
+              "3");
+  check_route(router, "/123", "/\\d+");
+  check_route(router, "/123/ppid",
+              "/(\\d+)/(cmdline|jobc|paddr|pgid|ppid|tdev|tpgid|wchan)",
+              "123", "ppid");
+  check_route(router, "/123/task/threads/1f/states/thread/ebx",
+              "/(\\d+)/task/threads/([a-f\\d]+)/states/thread/"
+              "(e[a-d]x|edi|esi|ebp|esp|ss|eflags|eip|[cdefg]s)",
+              "123", "1f", "ebx");
+  check_route(router, "/123/task/threads/1f/states/thread/eex", NULL);
+  check_route(router, "/123/task/threads/1f",
+              "/(\\d+)/task/threads/([a-f\\d]+)", "123", "1f");
+  check_route(router, "/123/task/ports/a07/qlimit",
+              "/(\\d+)/task/ports/([a-f\\d]+)/"
+              "(msgcount|qlimit|seqno|sorights|task_rights)",
+              "123", "a07", "qlimit");
+  check_route(router, "/9/windows/screenshots/3e8.png",
+              "/(\\d+)/windows/screenshots/([a-f\\d]+).png", "9", "3e8");
+  check_route(router, "/system/hardware/tpm/pcrs/pcr12",
+              "/system/hardware/tpm/pcrs/pcr(\\d+)", "12");
+  check_route(router, "/byname/Finder", "/byname/(.+)", "Finder");
+  check_route(router, "/byname", "/byname");
+
+  // Finder's "._" probes go to the first file entry, ahead of the rest.
+  check_route(router, "/123/task/._basic_info",
+              "/system/.*\\._.*|/\\d+/.*\\._.*");
+  check_route(router, "/system/._hardware", "/system/.*\\._.*|/\\d+/.*\\._.*");
+  check_route(router, "/._x", NULL);
+
+  check_route(router, "/system/hardware/cpus/x", NULL);
+  check_route(router, "/123/task/bogus", NULL);
+  check_route(router, "/123x", NULL);
+  cout << "OK" << endl;
+}
+
+void testTraceAgainstRegex(const table_set &tables, const char *trace) {
+  cout << "testTraceAgainstRegex... " << std::flush;
+  new_router router(tables);
+  old_router reference(tables);
+  vector<string> paths = load_trace(trace);
+  int matched = 0;
+
+  ASSERT_NE(paths.size(), (size_t)0);
+  for (size_t i = 0; i < paths.size(); i++) {
+    route want = reference.resolve(paths[i].c_str());
+    route got = router.resolve(paths[i].c_str());
+    if (!(got == want)) {
+      cout << "FAILED" << endl << paths[i] << ": expected " << describe(want)
+           << ", got " << describe(got) << endl;
+      exit(1);
+    }
+    if (got.table >= 0)
+      matched++;
+  }
+  cout << "OK (" << paths.size() << " paths, " << matched << " matched)"
+       << endl;
+}
+
+int main(int argc, char *argv[]) {
+  const char *trace = (argc > 1) ? argv[1] : "procfs_paths.trace";
+  table_set tables;
+
+  testPatternSubset();
+  testProcfsTables(tables);
+  testTraceAgainstRegex(tables, trace);
+  return 0;
+}
@@ -0,0 +1,208 @@
+// Shared by the procfs router test and benchmark: the procfs dispatcher
+// tables, the router procfs used before (a linear scan of regular
+// expressions, tried in table order), and the new one.
+
+#ifndef _PROCFS_ROUTER_TEST_H
+#define _PROCFS_ROUTER_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if HAVE_PCRECPP
+#include <pcrecpp.h>
+#else
+#include <regex>
+#endif
+
+#include "procfs_router.h"
+
+#define PROCFS_FLAG_ISDOTFILE 0x00000001
+
+enum { TABLE_file, TABLE_directory, TABLE_link, TABLE_MAX };
+
+struct pattern {
+  int table;
+  int flags;
+  const char *pattern;
+  int argc;
+};
+
+#define PROCFS_PATTERN(table, flags, pattern, argc) \
+  { TABLE_##table, flags, pattern, argc },
+
+static const struct pattern all_patterns[] = {
+#include "procfs_patterns.inc"
+};
+
+static const int npatterns = sizeof(all_patterns) / sizeof(all_patterns[0]);
+
+// The result of routing a path: which table, which entry, and the captures.
+struct route {
+  int table;   // -1 if nothing matched
+  int index;
+  std::vector<std::string> argv;
+
+  bool operator==(const route &o) const {
+    return table == o.table && index == o.index && argv == o.argv;
+  }
+};
+
+// The order in which procfs_getattr() consults the tables.
+static const int lookup_order[] = { TABLE_directory, TABLE_file, TABLE_link };
+
+class table_set {
+ public:
+  std::vector<int> entries[TABLE_MAX];  // indices into all_patterns
+
+  table_set() {
+    for (int i = 0; i < npatterns; i++)
+      entries[all_patterns[i].table].push_back(i);
+  }
+};
+
+class new_router {
+ public:
+  procfs_router_t *routers[TABLE_MAX];
+  const table_set &tables;
+
+  new_router(const table_set &t) : tables(t) {
+    for (int k = 0; k < TABLE_MAX; k++) {
+      routers[k] = procfs_router_create();
+      for (size_t i = 0; i < tables.entries[k].size(); i++) {
+        const struct pattern &p = all_patterns[tables.entries[k][i]];
+        if (procfs_router_add(routers[k], p.pattern, i) != p.argc) {
+          fprintf(stderr, "cannot compile %s\n", p.pattern);
+          exit(1);
+        }
+      }
+    }
+  }
+
+  ~new_router() {
+    for (int k = 0; k < TABLE_MAX; k++)
+      procfs_router_destroy(routers[k]);
+  }
+
+  // The part procfs does on every operation; no std::string here.
+  bool lookup(const char *path, int *table, procfs_route_match_t *m) const {
+    for (size_t k = 0; k < sizeof(lookup_order) / sizeof(int); k++) {
+      if (procfs_router_match(routers[lookup_order[k]], path, m)) {
+        *table = lookup_order[k];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  route resolve(const char *path) const {
+    route r;
+    procfs_route_match_t m;
+    r.table = -1;
+    r.index = -1;
+    if (lookup(path, &r.table, &m)) {
+      r.index = tables.entries[r.table][m.value];
+      for (int i = 0; i < m.argc; i++)
+        r.argv.push_back(m.argv[i]);
+    }
+    return r;
+  }
+};
+
+class old_router {
+ public:
+#if HAVE_PCRECPP
+  typedef pcrecpp::RE re_t;
+#else
+  typedef std::regex re_t;
+#endif
+  std::vector<re_t *> compiled[TABLE_MAX];
+  const table_set &tables;
+
+  old_router(const table_set &t) : tables(t) {
+    for (int k = 0; k < TABLE_MAX; k++)
+      for (size_t i = 0; i < tables.entries[k].size(); i++)
+        compiled[k].push_back(
+            new re_t(all_patterns[tables.entries[k][i]].pattern));
+  }
+
+  ~old_router() {
+    for (int k = 0; k < TABLE_MAX; k++)
+      for (size_t i = 0; i < compiled[k].size(); i++)
+        delete compiled[k][i];
+  }
+
+  // What procfs used to do on every operation: a FullMatch per entry.
+  bool lookup(const char *path, int *table, int *index,
+              std::string args[PROCFS_ROUTER_MAX_ARGS]) const {
+    for (size_t k = 0; k < sizeof(lookup_order) / sizeof(int); k++) {
+      int t = lookup_order[k];
+      for (size_t i = 0; i < compiled[t].size(); i++) {
+        int argc = all_patterns[tables.entries[t][i]].argc;
+        if (full_match(*compiled[t][i], path, args, argc)) {
+          *table = t;
+          *index = i;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  route resolve(const char *path) const {
+    route r;
+    std::string args[PROCFS_ROUTER_MAX_ARGS];
+    int i;
+    r.table = -1;
+    r.index = -1;
+    if (lookup(path, &r.table, &i, args)) {
+      r.index = tables.entries[r.table][i];
+      for (int a = 0; a < all_patterns[r.index].argc; a++)
+        r.argv.push_back(args[a]);
+    }
+    return r;
+  }
+
+ private:
+#if HAVE_PCRECPP
+  static bool full_match(const re_t &re, const char *path,
+                         std::string args[], int argc) {
+    switch (argc) {
+    case 0: return re.FullMatch(path);
+    case 1: return re.FullMatch(path, &args[0]);
+    case 2: return re.FullMatch(path, &args[0], &args[1]);
+    default: return re.FullMatch(path, &args[0], &args[1], &args[2]);
+    }
+  }
+#else
+  static bool full_match(const re_t &re, const char *path,
+                         std::string args[], int argc) {
+    std::cmatch m;
+    if (!std::regex_match(path, m, re))
+      return false;
+    for (int a = 0; a < argc && a + 1 < (int)m.size(); a++)
+      args[a] = m[a + 1].str();
+    return true;
+  }
+#endif
+};
+
+static std::vector<std::string> load_trace(const char *file) {
+  std::vector<std::string> paths;
+  std::ifstream in(file);
+  std::string line;
+  if (!in) {
+    fprintf(stderr, "cannot open %s\n", file);
+    exit(1);
+  }
+  while (std::getline(in, line))
+    if (!line.empty())
+      paths.push_back(line);
+  return paths;
+}
+
+#endif  // _PROCFS_ROUTER_TEST_H
@@ -0,0 +1,303 @@
+// Tests for procfs's snapshots of generated files, with mock read handlers
+// that render the way procfs's do: the whole file into a buffer, cut off
+// at the size they were given.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include "procfs_snapshot.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+#define ASSERT_GT(a, b) ASSERT_OP(a, >, b)
+
+// A generated file: its contents change every time it is rendered, like a
+// process's statistics would.
+struct mock_file {
+  size_t length;
+  int error;          // if set, rendering fails with -error
+  volatile int generation;
+};
+
+static char content_byte(int generation, size_t i) {
+  return 'a' + (generation + i) % 26;
+}
+
+static int mock_render(void *arg, char *buf, size_t size) {
+  mock_file *f = (mock_file *)arg;
+  if (f->error)
+    return -f->error;
+  int generation = __sync_add_and_fetch(&f->generation, 1);
+  size_t len = (f->length < size) ? f->length : size;
+  for (size_t i = 0; i < len; i++)
+    buf[i] = content_byte(generation, i);
+  return len;
+}
+
+static struct procfs_snapshot_stats stats_of(procfs_snapshot_cache_t *c) {
+  struct procfs_snapshot_stats s;
+  procfs_snapshot_cache_stats(c, &s);
+  return s;
+}
+
+// Reads a whole snapshot in small pieces, as the kernel would.
+static string read_all(procfs_snapshot_t *snap, size_t chunk) {
+  string out;
+  char buf[4096];
+  off_t offset = 0;
+  int n;
+  while ((n = procfs_snapshot_read(snap, buf, chunk, offset)) > 0) {
+    out.append(buf, n);
+    offset += n;
+  }
+  return out;
+}
+
+void testRenderOncePerOpen() {
+  cout << "testRenderOncePerOpen... " << std::flush;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(0);
+  mock_file f = { 10000, 0, 0 };
+  procfs_snapshot_t *snap;
+
+  ASSERT_EQ(procfs_snapshot_open(c, "/1/task/vmmap", mock_render, &f, &snap),
+            0);
+  ASSERT_EQ(stats_of(c).renders, 1ULL);
+
+  // Many reads, one render, and all of them from the same generation.
+  string all = read_all(snap, 1000);
+  ASSERT_EQ(all.size(), (size_t)10000);
+  ASSERT_EQ(stats_of(c).renders, 1ULL);
+  for (size_t i = 0; i < all.size(); i++)
+    ASSERT_EQ(all[i], content_byte(1, i));
+
+  char buf[16];
+  ASSERT_EQ(procfs_snapshot_read(snap, buf, sizeof(buf), 9995), 5);
+  ASSERT_EQ(procfs_snapshot_read(snap, buf, sizeof(buf), 10000), 0);
+  ASSERT_EQ(procfs_snapshot_read(snap, buf, sizeof(buf), 1 << 30), 0);
+
+  // Without a time to live, each open gets its own.
+  procfs_snapshot_t *snap2;
+  ASSERT_EQ(procfs_snapshot_open(c, "/1/task/vmmap", mock_render, &f, &snap2),
+            0);
+  ASSERT_NE(snap, snap2);
+  ASSERT_EQ(stats_of(c).renders, 2ULL);
+  ASSERT_EQ(stats_of(c).hits, 0ULL);
+  ASSERT_EQ(stats_of(c).live, 2ULL);
+
+  procfs_snapshot_release(snap);
+  procfs_snapshot_release(snap2);
+  ASSERT_EQ(stats_of(c).live, 0ULL);
+  ASSERT_EQ(stats_of(c).bytes, 0ULL);
+  procfs_snapshot_cache_destroy(c);
+  cout << "OK" << endl;
+}
+
+void testLargeAndEmptyFiles() {
+  cout << "testLargeAndEmptyFiles... " << std::flush;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(0);
+  procfs_snapshot_t *snap;
+
+  // Bigger than the first buffer: rendered again into larger ones.
+  mock_file big = { 3 * PROCFS_SNAPSHOT_INITIAL_SIZE + 7, 0, 0 };
+  ASSERT_EQ(procfs_snapshot_open(c, "/big", mock_render, &big, &snap), 0);
+  ASSERT_EQ(stats_of(c).renders, 3ULL);
+  string all = read_all(snap, 4096);
+  ASSERT_EQ(all.size(), big.length);
+  ASSERT_EQ(all[all.size() - 1], content_byte(3, big.length - 1));
+  procfs_snapshot_release(snap);
+
+  // Exactly the size of the first buffer: once more to be sure.
+  mock_file exact = { PROCFS_SNAPSHOT_INITIAL_SIZE, 0, 0 };
+  ASSERT_EQ(procfs_snapshot_open(c, "/exact", mock_render, &exact, &snap), 0);
+  ASSERT_EQ(read_all(snap, 4096).size(), exact.length);
+  procfs_snapshot_release(snap);
+
+  mock_file empty = { 0, 0, 0 };
+  ASSERT_EQ(procfs_snapshot_open(c, "/empty", mock_render, &empty, &snap), 0);
+  ASSERT_EQ(read_all(snap, 4096).size(), (size_t)0);
+  procfs_snapshot_release(snap);
+
+  // Anything past the limit is cut off.
+  mock_file huge = { PROCFS_SNAPSHOT_MAX_SIZE + 1, 0, 0 };
+  ASSERT_EQ(procfs_snapshot_open(c, "/huge", mock_render, &huge, &snap), 0);
+  char buf[16];
+  ASSERT_EQ(procfs_snapshot_read(snap, buf, sizeof(buf),
+                                 PROCFS_SNAPSHOT_MAX_SIZE - 4), 4);
+  procfs_snapshot_release(snap);
+
+  ASSERT_EQ(stats_of(c).live, 0ULL);
+  procfs_snapshot_cache_destroy(c);
+  cout << "OK" << endl;
+}
+
+void testRenderError() {
+  cout << "testRenderError... " << std::flush;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(1000);
+  mock_file f = { 100, EIO, 0 };
+  procfs_snapshot_t *snap = NULL;
+
+  ASSERT_EQ(procfs_snapshot_open(c, "/dead/task/role", mock_render, &f, &snap),
+            -EIO);
+  ASSERT_EQ(snap, (procfs_snapshot_t *)NULL);
+  ASSERT_EQ(stats_of(c).live, 0ULL);
+
+  // Failures aren't cached.
+  f.error = 0;
+  ASSERT_EQ(procfs_snapshot_open(c, "/dead/task/role", mock_render, &f, &snap),
+            0);
+  ASSERT_EQ(stats_of(c).hits, 0ULL);
+  procfs_snapshot_release(snap);
+  procfs_snapshot_cache_destroy(c);
+  cout << "OK" << endl;
+}
+
+void testSharedWithinTTL() {
+  cout << "testSharedWithinTTL... " << std::flush;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(200);
+  mock_file f = { 5000, 0, 0 }, g = { 10, 0, 0 };
+  procfs_snapshot_t *a, *b, *d, *e;
+
+  ASSERT_EQ(procfs_snapshot_open(c, "/1/task/basic_info/user_time",
+                                 mock_render, &f, &a), 0);
+  ASSERT_EQ(procfs_snapshot_open(c, "/1/task/basic_info/user_time",
+                                 mock_render, &f, &b), 0);
+  ASSERT_EQ(a, b);
+  ASSERT_EQ(stats_of(c).renders, 1ULL);
+  ASSERT_EQ(stats_of(c).hits, 1ULL);
+
+  // A different file doesn't get it.
+  ASSERT_EQ(procfs_snapshot_open(c, "/2/task/basic_info/user_time",
+                                 mock_render, &g, &d), 0);
+  ASSERT_NE(a, d);
+  ASSERT_EQ(read_all(d, 100).size(), (size_t)10);
+
+  // The cache's reference outlives the opens...
+  procfs_snapshot_release(a);
+  procfs_snapshot_release(b);
+  procfs_snapshot_release(d);
+  ASSERT_EQ(stats_of(c).live, 2ULL);
+
+  // ... until it expires, and the file is rendered anew.
+  usleep(300 * 1000);
+  ASSERT_EQ(procfs_snapshot_open(c, "/1/task/basic_info/user_time",
+                                 mock_render, &f, &e), 0);
+  ASSERT_EQ(stats_of(c).renders, 3ULL);
+  ASSERT_EQ(read_all(e, 700)[0], content_byte(2, 0));
+  procfs_snapshot_release(e);
+
+  procfs_snapshot_cache_destroy(c);
+  cout << "OK" << endl;
+}
+
+struct thread_args {
+  procfs_snapshot_cache_t *cache;
+  mock_file *files;
+  int nfiles;
+  int failed;
+};
+
+static void *reader_thread(void *arg) {
+  thread_args *t = (thread_args *)arg;
+  for (int i = 0; i < 2000; i++) {
+    int k = i % t->nfiles;
+    char key[32];
+    procfs_snapshot_t *snap;
+    snprintf(key, sizeof(key), "/%d/task/vmmap", k);
+    if (procfs_snapshot_open(t->cache, key, mock_render, &t->files[k],
+                             &snap) != 0) {
+      t->failed = 1;
+      break;
+    }
+    string all = read_all(snap, 512);
+    // One generation throughout, whoever rendered it.
+    if (all.size() != t->files[k].length ||
+        all[all.size() - 1] != content_byte(all[0] - 'a', all.size() - 1))
+      t->failed = 1;
+    procfs_snapshot_release(snap);
+  }
+  return NULL;
+}
+
+void testConcurrentOpens() {
+  cout << "testConcurrentOpens... " << std::flush;
+  const int nthreads = 8;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(5);
+  mock_file files[4] = {
+    { 100, 0, 0 }, { 3000, 0, 0 }, { 70000, 0, 0 }, { 1, 0, 0 },
+  };
+  pthread_t threads[nthreads];
+  thread_args args[nthreads];
+
+  for (int i = 0; i < nthreads; i++) {
+    args[i].cache = c;
+    args[i].files = files;
+    args[i].nfiles = 4;
+    args[i].failed = 0;
+    pthread_create(&threads[i], NULL, reader_thread, &args[i]);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].failed, 0);
+  }
+
+  struct procfs_snapshot_stats s = stats_of(c);
+  ASSERT_GT(s.hits, 0ULL);
+  ASSERT_GT(s.live, 0ULL);         // still cached
+  ASSERT_GT(5ULL, s.live);         // but nothing else
+  procfs_snapshot_cache_destroy(c);
+  cout << "OK" << endl;
+}
+
+// A file still open when the cache goes away can still be read; the cache
+// is freed with the last snapshot (which ASan or valgrind would see).
+void testDestroyWithOpenFiles() {
+  cout << "testDestroyWithOpenFiles... " << std::flush;
+  procfs_snapshot_cache_t *c = procfs_snapshot_cache_create(1000);
+  mock_file f = { 100, 0, 0 };
+  procfs_snapshot_t *a = NULL, *b = NULL;
+
+  ASSERT_EQ(procfs_snapshot_open(c, "/a", mock_render, &f, &a), 0);
+  ASSERT_EQ(procfs_snapshot_open(c, "/b", mock_render, &f, &b), 0);
+  procfs_snapshot_cache_destroy(c);
+
+  ASSERT_EQ(read_all(a, 4096).size(), (size_t)100);
+  procfs_snapshot_release(a);
+  ASSERT_EQ(read_all(b, 4096).size(), (size_t)100);
+  procfs_snapshot_release(b);
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  testRenderOncePerOpen();
+  testLargeAndEmptyFiles();
+  testRenderError();
+  testSharedWithinTTL();
+  testConcurrentOpens();
+  testDestroyWithOpenFiles();
+  return 0;
+}
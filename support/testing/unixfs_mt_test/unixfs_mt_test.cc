@@ -0,0 +1,409 @@
+// Stress test for unixfs back-ends serving many threads at once: threads
+// list directories, look up names and read files, in images of different
+// kinds and byte orders at the same time, the way fuse_session_loop_mt()
+// drives them, and check every answer against what the image holds.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "unixfs.h"
+
+extern struct unixfs unixfs_tar;
+extern struct unixfs unixfs_v7;
+
+// The daemon's counters live in unixfs.c, which isn't linked here.
+struct unixfs_stats unixfs_stats;
+}
+
+using std::cout;
+using std::endl;
+using std::set;
+using std::string;
+using std::vector;
+
+#define ASSERT_OP(a, op, b) \
+  do { \
+    typeof(a) _a = (a); \
+    typeof(b) _b = (b); \
+    if (!(_a op _b)) { \
+      std::cout << __FILE__ << ":" << __LINE__ \
+                << ", Assertion failed: " \
+                << "expected: (" #a ")" #op "(" #b "), " \
+                << "actual: (" << _a << ")" #op "(" << _b << ")" \
+                << std::endl; \
+      exit(1); \
+    } \
+  } while (0);
+
+#define ASSERT_EQ(a, b) ASSERT_OP(a, ==, b)
+#define ASSERT_NE(a, b) ASSERT_OP(a, !=, b)
+
+static const ino_t kRootIno = 1;  // MACFUSE_ROOTINO
+
+// Every image holds "top", a small file, and "d", a directory of files
+// whose contents follow from their number.
+static string file_name(int k) {
+  char name[16];
+  snprintf(name, sizeof(name), "f%04d", k);
+  return name;
+}
+
+static size_t file_size(int k) {
+  return (k * 137) % 3000;
+}
+
+static char file_byte(int k, size_t i) {
+  return (char)((k * 31 + i * 7) & 0xff);
+}
+
+static string file_data(int k) {
+  string s(file_size(k), '\0');
+  for (size_t i = 0; i < s.size(); i++)
+    s[i] = file_byte(k, i);
+  return s;
+}
+
+static string temp_path(const char *what) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/unixfs_mt_test.%s.XXXXXX", what);
+  int fd = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  return path;
+}
+
+static void write_file(const string &path, const string &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  ASSERT_NE(f, (FILE *)NULL);
+  ASSERT_EQ(fwrite(data.data(), 1, data.size(), f), data.size());
+  fclose(f);
+}
+
+// A ustar archive.
+
+static void tar_header(string *out, const string &name, char type,
+                       size_t size) {
+  char h[512];
+  memset(h, 0, sizeof(h));
+  snprintf(h, 100, "%s", name.c_str());
+  snprintf(h + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+  snprintf(h + 108, 8, "%07o", 3);
+  snprintf(h + 116, 8, "%07o", 4);
+  snprintf(h + 124, 12, "%011lo", (unsigned long)size);
+  snprintf(h + 136, 12, "%011o", 1000000);
+  h[156] = type;
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (size_t i = 0; i < sizeof(h); i++)
+    sum += (unsigned char)h[i];
+  snprintf(h + 148, 8, "%06o", sum);
+  out->append(h, sizeof(h));
+}
+
+static void tar_file(string *out, const string &name, const string &data) {
+  tar_header(out, name, '0', data.size());
+  out->append(data);
+  out->append((512 - data.size() % 512) % 512, '\0');
+}
+
+static string make_tar(int nfiles) {
+  string tar;
+  tar_file(&tar, "top", file_data(0));
+  tar_header(&tar, "d/", '5', 0);
+  for (int k = 1; k <= nfiles; k++)
+    tar_file(&tar, "d/" + file_name(k), file_data(k));
+  tar.append(1024, '\0');
+  return tar;
+}
+
+// A V7 file system, in the PDP-11's byte order or in big-endian order.
+// Files and directories fit in their 10 direct blocks.
+
+static void put16(string *img, bool big, size_t off, unsigned v) {
+  (*img)[off + (big ? 1 : 0)] = v & 0xff;
+  (*img)[off + (big ? 0 : 1)] = (v >> 8) & 0xff;
+}
+
+// The high word first in either order: the PDP-11's longs are middle-endian.
+static void put32(string *img, bool big, size_t off, unsigned long v) {
+  put16(img, big, off, v >> 16);
+  put16(img, big, off + 2, v & 0xffff);
+}
+
+// A 3-byte block address: a long with one of its high bytes left out.
+static void put_addr(string *img, bool big, size_t off, unsigned long b) {
+  (*img)[off] = big ? 0 : (b >> 16) & 0xff;
+  (*img)[off + 1] = big ? (b >> 8) & 0xff : b & 0xff;
+  (*img)[off + 2] = big ? b & 0xff : (b >> 8) & 0xff;
+}
+
+static const int kV7Inodes = 512;
+static const int kV7FirstData = 2 + kV7Inodes / 8;
+
+static void v7_inode(string *img, bool big, int ino, unsigned mode,
+                     const string &data, int *nextblock) {
+  size_t off = (2 + (ino - 1) / 8) * 512 + ((ino - 1) % 8) * 64;
+  put16(img, big, off, mode);
+  put16(img, big, off + 2, 1);
+  put16(img, big, off + 4, 3);
+  put16(img, big, off + 6, 4);
+  put32(img, big, off + 8, data.size());
+  for (size_t b = 0; b * 512 < data.size(); b++) {
+    ASSERT_OP(b, <, (size_t)10);
+    int blk = (*nextblock)++;
+    img->resize((blk + 1) * 512);
+    img->replace(blk * 512, min((size_t)512, data.size() - b * 512),
+                 data, b * 512, 512);
+    put_addr(img, big, off + 12 + b * 3, blk);
+  }
+  put32(img, big, off + 52, 1000000);
+  put32(img, big, off + 56, 1000000);
+  put32(img, big, off + 60, 1000000);
+}
+
+typedef vector<std::pair<int, string> > v7_entries;
+
+static string v7_dir(bool big, const v7_entries &ents) {
+  string d(ents.size() * 16, '\0');
+  for (size_t i = 0; i < ents.size(); i++) {
+    put16(&d, big, i * 16, ents[i].first);
+    memcpy(&d[i * 16 + 2], ents[i].second.data(), ents[i].second.size());
+  }
+  return d;
+}
+
+static string make_v7(bool big, int nfiles) {
+  string img(kV7FirstData * 512, '\0');
+  int nextblock = kV7FirstData;
+
+  const int root = 2, top = 3, dir = 4;
+  v7_entries ents;
+  ents.push_back(std::make_pair(dir, string(".")));
+  ents.push_back(std::make_pair(root, string("..")));
+  // inode numbers out of directory order, as on a well-used disk
+  for (int k = 1; k <= nfiles; k++) {
+    int ino = dir + 1 + (k * 7) % nfiles;
+    v7_inode(&img, big, ino, 0100644, file_data(k), &nextblock);
+    ents.push_back(std::make_pair(ino, file_name(k)));
+  }
+  v7_inode(&img, big, dir, 040755, v7_dir(big, ents), &nextblock);
+
+  ents.clear();
+  ents.push_back(std::make_pair(root, string(".")));
+  ents.push_back(std::make_pair(root, string("..")));
+  ents.push_back(std::make_pair(top, string("top")));
+  ents.push_back(std::make_pair(dir, string("d")));
+  v7_inode(&img, big, top, 0100644, file_data(0), &nextblock);
+  v7_inode(&img, big, root, 040755, v7_dir(big, ents), &nextblock);
+
+  img.resize((nextblock + 1) * 512);
+  put16(&img, big, 512 + 0, kV7FirstData);   // s_isize
+  put32(&img, big, 512 + 2, nextblock + 1);  // s_fsize
+  put32(&img, big, 512 + 414, 1000000);      // s_time
+  return img;
+}
+
+// An image opened the way unixfs.c opens one, and the names it holds.
+
+struct image {
+  const char *what;
+  string path;
+  struct unixfs fs;
+  struct unixfs_inodelayer *il;
+  int nfiles;
+  ino_t dir;
+  set<string> dirnames;
+};
+
+static void image_attach(image *img) {
+  img->fs.ops->attach(img->fs.filsys);
+  unixfs_inodelayer_attach(img->il);
+}
+
+static void image_open(image *img, const char *what, struct unixfs *fs,
+                       fs_endian_t e, const string &data, int nfiles) {
+  img->what = what;
+  img->path = temp_path(what);
+  write_file(img->path, data);
+  img->fs = *fs;
+  img->nfiles = nfiles;
+  img->il = unixfs_inodelayer_create(0);
+  ASSERT_NE(img->il, (struct unixfs_inodelayer *)NULL);
+  unixfs_inodelayer_attach(img->il);
+  img->fs.filsys = img->fs.ops->init(img->path.c_str(), 0, e,
+                                     &img->fs.fsname, &img->fs.volname);
+  ASSERT_NE(img->fs.filsys, (void *)NULL);
+  unlink(img->path.c_str());  // the back-end has it open
+
+  struct stat st;
+  ASSERT_EQ(img->fs.ops->namei(kRootIno, "d", &st), 0);
+  img->dir = st.st_ino;
+  img->dirnames.insert(".");
+  img->dirnames.insert("..");
+  for (int k = 1; k <= nfiles; k++)
+    img->dirnames.insert(file_name(k));
+}
+
+static void image_close(image *img) {
+  image_attach(img);
+  img->fs.ops->fini(img->fs.filsys);
+  unixfs_inodelayer_destroy(img->il);
+}
+
+// What each thread does, over and over.
+
+static int check_readdir(image *img, ino_t dir, const set<string> &want) {
+  struct unixfs_ops *ops = img->fs.ops;
+  struct inode *dp = ops->iget(dir);
+  if (!dp)
+    return 1;
+
+  struct unixfs_dirbuf dirbuf;
+  struct unixfs_direntry dents[UNIXFS_DIRBATCH];
+  off_t offset = 0;
+  set<string> got;
+  int n, failed = 0;
+
+  memset(&dirbuf.flags, 0, sizeof(dirbuf.flags));
+  while ((n = ops->readdir_batch(dp, &dirbuf, &offset, dents,
+                                 UNIXFS_DIRBATCH)) > 0) {
+    for (int i = 0; i < n; i++) {
+      if (dents[i].ino == 0)
+        continue;
+      if (!got.insert(dents[i].name).second)
+        failed++;  // listed twice
+    }
+  }
+  ops->iput(dp);
+
+  return failed + (n < 0) + (got != want);
+}
+
+static int check_file(image *img, ino_t parent, int k) {
+  struct unixfs_ops *ops = img->fs.ops;
+  struct stat st;
+  string name = k ? file_name(k) : "top";
+
+  if (ops->namei(parent, name.c_str(), &st) != 0)
+    return 1;
+  if (!S_ISREG(st.st_mode) || ((size_t)st.st_size != file_size(k)))
+    return 1;
+
+  struct inode *ip = ops->iget(st.st_ino);
+  if (!ip)
+    return 1;
+
+  // from a block boundary, as the kernel's page-sized reads are, and clipped
+  // to the file's size, as unixfs_ll_read() does
+  string want = file_data(k);
+  char buf[4096];
+  int error = 0;
+  size_t off = 512 * (random() % ((want.size() + 511) / 512 + 1));
+  off = min(off, want.size());
+  size_t count = min(sizeof(buf), want.size() - off);
+  ssize_t nr = count ? ops->pbread(ip, buf, count, off, &error) : 0;
+  ops->iput(ip);
+
+  if ((nr < 0) || ((size_t)nr != count))
+    return 1;
+  return memcmp(buf, want.data() + off, nr) != 0;
+}
+
+struct thread_args {
+  vector<image *> *images;
+  int seed;
+  int rounds;
+  int failed;
+};
+
+static void *worker(void *arg) {
+  thread_args *a = (thread_args *)arg;
+  srandom(a->seed);
+
+  for (int round = 0; round < a->rounds; round++) {
+    image *img = (*a->images)[random() % a->images->size()];
+    image_attach(img);
+
+    switch (random() % 8) {
+    case 0:
+      a->failed += check_readdir(img, img->dir, img->dirnames);
+      break;
+    case 1: {
+      set<string> root;
+      root.insert(".");
+      root.insert("..");
+      root.insert("top");
+      root.insert("d");
+      a->failed += check_readdir(img, kRootIno, root);
+      break;
+    }
+    case 2:
+      a->failed += check_file(img, kRootIno, 0);
+      break;
+    default:
+      a->failed += check_file(img, img->dir, 1 + random() % img->nfiles);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+void testParallelReaddirLookupRead() {
+  cout << "testParallelReaddirLookupRead... " << std::flush;
+  const int nthreads = 8;
+
+  // the archive is scanned while the threads start on it
+  unixfs_scanner_enable();
+
+  image tar, pdp, big;
+  image_open(&tar, "tar", &unixfs_tar, UNIXFS_FS_INVALID, make_tar(2000),
+             2000);
+  image_open(&pdp, "v7pdp", &unixfs_v7, UNIXFS_FS_PDP, make_v7(false, 300),
+             300);
+  image_open(&big, "v7big", &unixfs_v7, UNIXFS_FS_BIG, make_v7(true, 300),
+             300);
+
+  vector<image *> images;
+  images.push_back(&tar);
+  images.push_back(&pdp);
+  images.push_back(&big);
+
+  pthread_t threads[nthreads];
+  thread_args args[nthreads];
+
+  for (int i = 0; i < nthreads; i++) {
+    args[i].images = &images;
+    args[i].seed = i + 1;
+    args[i].rounds = 3000;
+    args[i].failed = 0;
+    pthread_create(&threads[i], NULL, worker, &args[i]);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    ASSERT_EQ(args[i].failed, 0);
+  }
+
+  image_close(&tar);
+  image_close(&pdp);
+  image_close(&big);
+  cout << "OK" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  testParallelReaddirLookupRead();
+  return 0;
+}